@@ -21,9 +21,10 @@ struct FastPointerLookupStore;
 typedef struct FastPointerLookup_t {
   pthread_mutex_t mutex;  // For mutual exclusion while editing the store.
   void *(*create_func)(void *);  // Creates the result for as yet unmapped keys.
-  // Atomic. Incremented on entry of a lock-free lookup and decremented on exit.
-  _Atomic(size_t) readers;
   _Atomic(struct FastPointerLookupStore *) store;
+  // Non-atomic, only used under mutex. Stores replaced by a resize that may
+  // still be read by lock-free lookups.
+  struct FastPointerLookupStore *retired;
 } FastPointerLookup_t;
 
 /**
@@ -35,7 +36,7 @@ typedef struct FastPointerLookup_t {
  *   for each key.
  */
 #define FAST_POINTER_LOOKUP_INIT(create_func) \
-  { PTHREAD_MUTEX_INITIALIZER, create_func, 0, NULL }
+  { PTHREAD_MUTEX_INITIALIZER, create_func, NULL, NULL }
 
 // Looks up the value for a key.
 void *FastPointerLookup(FastPointerLookup_t *lookup, void *key);
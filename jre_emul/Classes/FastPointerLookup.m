@@ -12,9 +12,13 @@
 
 #include "FastPointerLookup.h"
 
+#include "ThreadRecordList.h"
+
+#include <stdint.h>
 #include <stdlib.h>
 
 #define INITIAL_CAPACITY 64
+#define CACHE_LINE_SIZE 64
 
 // Entry objects are immutable once initialized so their fields don't need to be
 // atomic.
@@ -31,10 +35,59 @@ typedef struct FastPointerLookupStore {
   // Non-atomic. nextEntry and lastEntry are only used under mutex.
   Entry *nextEntry;
   Entry *lastEntry;
+  // Non-atomic. Only used under mutex once the store has been retired.
+  struct FastPointerLookupStore *nextRetired;
+  uint64_t retireEpoch;
   // Atomic. Read by the lock-free lookup and written concurrently by Put().
   _Atomic(Entry *) table[0];
 } Store;
 
+// Lock-free lookups are tracked with epochs so that a resize can tell when a
+// replaced store is no longer read, without the readers sharing any writable
+// memory. Each thread publishes the global epoch in its own record while it
+// reads a store, and a resize advances the global epoch after swapping in the
+// new store. A store retired at epoch E can be freed once every record is
+// either idle or has published E or later, because those readers loaded the
+// store after the swap.
+typedef struct EpochRecord {
+  ThreadRecord record;
+  // Atomic. The epoch that the owning thread's lookup started in, or 0.
+  _Atomic(uint64_t) epoch;
+} __attribute__((aligned(CACHE_LINE_SIZE))) EpochRecord;
+
+static _Atomic(uint64_t) globalEpoch = 1;
+static ThreadRecordList_t epochRecords = THREAD_RECORD_LIST_INIT(EpochRecord, NULL);
+
+// Returns true if no lock-free lookup can still read a store retired at epoch.
+static bool IsQuiescent(uint64_t epoch) {
+  // Synchronize with the fence in FastPointerLookup() so that either the lookup
+  // reads the new store or we read its published epoch.
+  __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ThreadRecord *record = ThreadRecordListFirst(&epochRecords);
+  for (; record; record = record->next) {
+    uint64_t readerEpoch = __c11_atomic_load(&((EpochRecord *)record)->epoch, __ATOMIC_ACQUIRE);
+    if (readerEpoch != 0 && readerEpoch < epoch) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Frees the retired stores that are no longer read. Caller must hold the mutex.
+static void FreeRetiredStores(FastPointerLookup_t *lookup) {
+  // Stores are retired in epoch order, so once the newest one can be freed all
+  // of them can.
+  Store *retired = lookup->retired;
+  if (retired && IsQuiescent(retired->retireEpoch)) {
+    lookup->retired = NULL;
+    while (retired) {
+      Store *next = retired->nextRetired;
+      free(retired);
+      retired = next;
+    }
+  }
+}
+
 // Copied from Collections.secondaryHash() which HashMap uses.
 static uint32_t Hash(void *key) {
   uint32_t h = (uint32_t)(uintptr_t)key;
@@ -84,7 +137,8 @@ static Store *GetInitializedStore(FastPointerLookup_t *lookup) {
 }
 
 // Creates a new store with double the capacity as oldStore, copies all entry
-// data then swaps in the new store and frees oldStore when it is safe to do so.
+// data then swaps in the new store and retires oldStore, to be freed when it is
+// safe to do so.
 static Store *Resize(FastPointerLookup_t *lookup, Store *oldStore) {
   size_t oldSize = oldStore->size;
   size_t newSize = oldSize << 1;
@@ -108,13 +162,12 @@ static Store *Resize(FastPointerLookup_t *lookup, Store *oldStore) {
   // using an atomic store with a barrier.
   __c11_atomic_store(&lookup->store, newStore, __ATOMIC_RELEASE);
 
-  // Synchronize with the fetch-add of "readers" to ensure we read the updated
-  // value here.
-  __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
-  // We need to busy wait until there are no lock-free readers before it is safe
-  // to free the old store.
-  while (__c11_atomic_load(&lookup->readers, __ATOMIC_ACQUIRE) > 0);
-  free(oldStore);
+  // Lookups that start in the new epoch read the new store. The old store is
+  // freed once the lookups from earlier epochs are done.
+  oldStore->retireEpoch = __c11_atomic_fetch_add(&globalEpoch, 1, __ATOMIC_SEQ_CST) + 1;
+  oldStore->nextRetired = lookup->retired;
+  lookup->retired = oldStore;
+  FreeRetiredStores(lookup);
 
   return newStore;
 }
@@ -154,6 +207,7 @@ static Entry *FindEntryRelaxed(Store *store, void *key, uint32_t hash) {
 // Put() to add an entry if the key is not found.
 static void *LockedLookup(FastPointerLookup_t *lookup, void *key, uint32_t hash) {
   pthread_mutex_lock(&lookup->mutex);
+  FreeRetiredStores(lookup);
   Store *store = GetInitializedStore(lookup);
   Entry *entry = FindEntryRelaxed(store, key, hash);
   if (!entry) {
@@ -167,9 +221,12 @@ static void *LockedLookup(FastPointerLookup_t *lookup, void *key, uint32_t hash)
 // Attempts a fast lock-free lookup before grabbing any locks.
 void *FastPointerLookup(FastPointerLookup_t *lookup, void *key) {
   uint32_t hash = Hash(key);
-  __c11_atomic_fetch_add(&lookup->readers, 1, __ATOMIC_RELAXED);
-  // Synchronize with "Resize()" above to ensure it reads the increment of
-  // "readers" and doesn't deallocate the store while we read from it.
+  // Enter the protected read-only section by publishing the current epoch.
+  EpochRecord *record = (EpochRecord *)ThreadRecordListGet(&epochRecords);
+  __c11_atomic_store(
+      &record->epoch, __c11_atomic_load(&globalEpoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+  // Synchronize with IsQuiescent() above to ensure it reads the published epoch
+  // and doesn't deallocate the store while we read from it.
   __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
   // Atomic load with barrier.
   Store *store = __c11_atomic_load(&lookup->store, __ATOMIC_ACQUIRE);
@@ -188,7 +245,7 @@ void *FastPointerLookup(FastPointerLookup_t *lookup, void *key) {
   }
 
   // Exit protected read-only section. (Safe to delete store now)
-  __c11_atomic_fetch_sub(&lookup->readers, 1, __ATOMIC_RELEASE);
+  __c11_atomic_store(&record->epoch, 0, __ATOMIC_RELEASE);
 
   if (result) {
     return result;
@@ -199,6 +256,7 @@ void *FastPointerLookup(FastPointerLookup_t *lookup, void *key) {
 bool FastPointerLookupAddMapping(FastPointerLookup_t *lookup, void *key, void *value) {
   bool result = false;
   pthread_mutex_lock(&lookup->mutex);
+  FreeRetiredStores(lookup);
   Store *store = GetInitializedStore(lookup);
   uint32_t hash = Hash(key);
   Entry *entry = FindEntryRelaxed(store, key, hash);
@@ -58,6 +58,50 @@
 // in practice, due to OS X virtual memory and the infrequent use
 // of large caches in client code. The alternative of throwing an
 // UnsupportedOperationException seems less useful.
+//
+// The reference bookkeeping is sharded by referent address, so that
+// threads that create, clear and release references to unrelated
+// objects don't contend. A shard's mutex is never held while a
+// referent is deallocated, since the referent's dealloc may release
+// the referents of other shards. Instead, the last release of a
+// referent clears and enqueues its references before the referent
+// is deallocated. Phantom references are enqueued after the dealloc,
+// so they are kept in a DyingReferent until then.
+//
+// Enqueuing takes the queue's lock, so it happens after the shard's
+// mutex is released. Until then the references are retained and their
+// referent is ENQUEUE_PENDING, which get() treats as cleared and which
+// makes clear(), and so a reference's finalize method, wait for the
+// enqueue to finish.
+
+// Must be a power of two.
+#define REFERENCE_SHARD_COUNT 64
+
+// A referent that is being deallocated, and its phantom references.
+typedef struct DyingReferent {
+  struct DyingReferent *next;
+  id referent;
+  CFMutableSetRef phantoms;
+  // Set once the referent's dealloc has started, after which another referent
+  // may have the same address.
+  bool claimed;
+} DyingReferent;
+
+// The references of a referent that are to be enqueued, which are retained.
+typedef struct ReferenceBatch {
+  id *references;
+  CFIndex count;
+} ReferenceBatch;
+
+typedef struct ReferenceShard {
+  // Recursive mutex.
+  pthread_mutex_t mutex;
+  // Maps referents to sets of Reference instances that refer to them.
+  CFMutableDictionaryRef weak_refs_map;
+  // The shard's dying referents.
+  DyingReferent *dying;
+} ReferenceShard __attribute__((aligned(64)));
+// aligned to put mutexes on separate cache lines
 
 @interface NSObject (JavaLangRefReferenceSwizzled)
 - (void)JavaLangRefReference_original_dealloc;
@@ -67,74 +111,137 @@
 
 @implementation IOSReference
 
-static void AssociateReferenceWithReferent(id referent, JavaLangRefReference *reference);
+static void AssociateReferenceWithReferent(
+    ReferenceShard *shard, id referent, JavaLangRefReference *reference);
 static void EnsureReferentSubclass(id referent);
-static void RemoveReferenceAssociation(id referent, JavaLangRefReference *reference);
+static bool RemoveReferenceAssociation(
+    ReferenceShard *shard, id referent, JavaLangRefReference *reference);
+static void DetachReferences(ReferenceShard *shard, id referent, ReferenceBatch *batch);
+static void EnqueueBatch(ReferenceBatch *batch);
+static void WaitForEnqueue(JavaLangRefReference *reference);
 static void RealReferentRelease(id referent);
 static void ReferentSubclassDealloc(id self, SEL _cmd);
 static void ReferentSubclassRelease(id self, SEL _cmd);
 static IOSClass *ReferentSubclassGetClass(id self, SEL _cmd);
-static void WhileLocked(void (^block)(void));
-static CFMutableSetRef CreateReferentSet();
 
-// Global recursive mutux.
-static pthread_mutex_t reference_mutex;
+static ReferenceShard reference_shards[REFERENCE_SHARD_COUNT];
+
+// The referent of a reference that is retained in a ReferenceBatch.
+static char enqueue_pending_referent;
+#define ENQUEUE_PENDING ((id)&enqueue_pending_referent)
 
-// Maps referents to sets of Reference instances that refer to them.
-static CFMutableDictionaryRef weak_refs_map;
+// Signals the threads in WaitForEnqueue() when a batch has been enqueued.
+static pthread_mutex_t enqueue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t enqueue_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic(int) enqueue_waiter_count;
+
+// Guards referent_subclass_map.
+static pthread_mutex_t subclass_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Maps referent classes to their referent subclasses.
 static CFMutableDictionaryRef referent_subclass_map;
 
-// Set of all referent subclasses.
-static CFMutableSetRef referent_subclasses;
+// Guards soft_references.
+static pthread_mutex_t soft_references_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Set of all soft ref queue candidates. These are only released when
-// the runtime is notified of a low memory condition.
+// Set of all soft ref queue candidates, which the set retains. These are only
+// released when the runtime is notified of a low memory condition.
 static CFMutableSetRef soft_references;
 
-static jboolean in_low_memory_cleanup;
+// The number of low memory cleanups in progress. Referents aren't saved from
+// deallocation while it is non-zero.
+static _Atomic(int) low_memory_cleanup_count;
+
+// Returns the shard of a referent. The lowest bits of object addresses are
+// always zero.
+static inline ReferenceShard *GetShard(id referent) {
+  return &reference_shards[((uintptr_t)referent >> 4) & (REFERENCE_SHARD_COUNT - 1)];
+}
+
+// Loads a reference's referent without retaining it, to find its shard.
+static inline id PeekReferent(JavaLangRefReference *reference) {
+  return (id)__atomic_load_n(&reference->referent_, __ATOMIC_ACQUIRE);
+}
 
 + (void)initReferent:(JavaLangRefReference *)reference {
-  WhileLocked(^{
-    id referent = JreLoadVolatileId(&reference->referent_);
-    if (referent) {
-      EnsureReferentSubclass(referent);
-      AssociateReferenceWithReferent(referent, reference);
-    }
-  });
+  id referent = JreLoadVolatileId(&reference->referent_);
+  if (referent) {
+    EnsureReferentSubclass(referent);
+    ReferenceShard *shard = GetShard(referent);
+    pthread_mutex_lock(&shard->mutex);
+    AssociateReferenceWithReferent(shard, referent, reference);
+    pthread_mutex_unlock(&shard->mutex);
+  }
 }
 
 + (id)getReferent:(JavaLangRefReference *)reference {
-  // The referent must be loaded under mutex to avoid a race with another
-  // thread that might be releasing the referent. We can't rely only on the
-  // volatile synchronization because it is a @Weak volatile, but WhileLocked
-  // will synchronize with the release implementation in the referent subclass.
-  __block id referent;
-  WhileLocked(^{
-    // The volatile load ensures that the result is retained in this thread.
+  id referent = PeekReferent(reference);
+  if (!referent || referent == ENQUEUE_PENDING) {
+    return nil;
+  }
+  // The referent must be loaded again under the shard's mutex to avoid a race
+  // with another thread that might be releasing the referent. We can't rely
+  // only on the volatile synchronization because it is a @Weak volatile, but
+  // the mutex will synchronize with the release implementation in the referent
+  // subclass. The referent only ever changes to nil, which the load returns if
+  // the referent was released in the meantime.
+  ReferenceShard *shard = GetShard(referent);
+  pthread_mutex_lock(&shard->mutex);
+  // The volatile load ensures that the result is retained in this thread. The
+  // referent only becomes ENQUEUE_PENDING under the mutex.
+  if (PeekReferent(reference) == ENQUEUE_PENDING) {
+    referent = nil;
+  } else {
     referent = JreLoadVolatileId(&reference->referent_);
-  });
+  }
+  pthread_mutex_unlock(&shard->mutex);
   return referent;
 }
 
 + (void)clearReferent:(JavaLangRefReference *)reference {
-  WhileLocked(^{
-    id referent = JreLoadVolatileId(&reference->referent_);
-    if (referent) {
-      RemoveReferenceAssociation(referent, reference);
-    }
+  id referent = PeekReferent(reference);
+  if (!referent) {
+    return;
+  }
+  if (referent == ENQUEUE_PENDING) {
+    WaitForEnqueue(reference);
+    return;
+  }
+  ReferenceShard *shard = GetShard(referent);
+  bool releaseSoftReferent = false;
+  pthread_mutex_lock(&shard->mutex);
+  if (PeekReferent(reference) == referent) {
+    releaseSoftReferent = RemoveReferenceAssociation(shard, referent, reference);
     JreAssignVolatileId(&reference->referent_, nil);
-  });
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  // The reference may have been added to a batch while this thread waited for
+  // the mutex. It mustn't be deallocated before the batch is enqueued.
+  if (PeekReferent(reference) == ENQUEUE_PENDING) {
+    WaitForEnqueue(reference);
+  }
+  // Released without holding a mutex, since it may dealloc the referent.
+  if (releaseSoftReferent) {
+    [referent release];
+  }
 }
 
 + (void)handleMemoryWarning:(NSNotification *)notification {
-  WhileLocked(^{
-    in_low_memory_cleanup = true;
-    CFRelease(soft_references);
-    soft_references = CreateReferentSet();
-    in_low_memory_cleanup = false;
-  });
+  __c11_atomic_fetch_add(&low_memory_cleanup_count, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&soft_references_mutex);
+  CFMutableSetRef oldSoftReferences = soft_references;
+  soft_references = CFSetCreateMutable(NULL, 0, NULL);
+  pthread_mutex_unlock(&soft_references_mutex);
+
+  CFIndex count = CFSetGetCount(oldSoftReferences);
+  const void **referents = malloc(count * sizeof(id));
+  CFSetGetValues(oldSoftReferences, referents);
+  CFRelease(oldSoftReferences);
+  for (CFIndex i = 0; i < count; i++) {
+    [(id)referents[i] release];
+  }
+  free(referents);
+  __c11_atomic_fetch_sub(&low_memory_cleanup_count, 1, __ATOMIC_SEQ_CST);
 }
 
 + (void)initialize {
@@ -142,14 +249,16 @@ static jboolean in_low_memory_cleanup;
     pthread_mutexattr_t mutexattr;
     pthread_mutexattr_init(&mutexattr);
     pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&reference_mutex, &mutexattr);
+    for (int i = 0; i < REFERENCE_SHARD_COUNT; i++) {
+      pthread_mutex_init(&reference_shards[i].mutex, &mutexattr);
+      reference_shards[i].weak_refs_map =
+          CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+    }
     pthread_mutexattr_destroy(&mutexattr);
 
-    weak_refs_map = CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
-    referent_subclasses = CreateReferentSet();
     referent_subclass_map =
         CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
-    soft_references = CreateReferentSet();
+    soft_references = CFSetCreateMutable(NULL, 0, NULL);
 
 #ifdef SUPPORTS_SOFT_REFERENCES
     // Register for iOS low memory notifications, to clear pending soft references.
@@ -162,27 +271,21 @@ static jboolean in_low_memory_cleanup;
   }
 }
 
-static CFMutableSetRef CreateReferentSet() {
-  CFSetCallBacks referenceSetCallBacks = kCFTypeSetCallBacks;
-  // Set equal callback to NULL to use pointer equality.
-  referenceSetCallBacks.equal = NULL;
-  // Set hash callback to NULL to compute hash codes by converting pointers to integers
-  referenceSetCallBacks.hash = NULL;
-  return CFSetCreateMutable(NULL, 0, &referenceSetCallBacks);
-}
-
-static void WhileLocked(void (^block)(void)) {
-  pthread_mutex_lock(&reference_mutex);
-  block();
-  pthread_mutex_unlock(&reference_mutex);
+// Returns true if cls is a referent subclass, which is the class that
+// implements ReferentSubclassDealloc and whose superclass doesn't. Classes
+// can't be removed from the runtime, so no mutex is needed.
+static bool IsReferentSubclass(Class cls) {
+  return class_getMethodImplementation(cls, @selector(dealloc)) == (IMP)ReferentSubclassDealloc
+      && class_getMethodImplementation(class_getSuperclass(cls), @selector(dealloc))
+          != (IMP)ReferentSubclassDealloc;
 }
 
 
 // Returns the referent subclass for a referent, or nil if one hasn't
-// been created for that type. Caller must hold the mutex.
+// been created for that type.
 static Class GetReferentSubclass(id obj) {
   Class cls = object_getClass(obj);
-  while (cls && !CFSetContainsValue(referent_subclasses, cls)) {
+  while (cls && !IsReferentSubclass(cls)) {
     cls = class_getSuperclass(cls);
   }
   return cls;
@@ -225,24 +328,28 @@ static Class CreateReferentSubclass(Class cls) {
 
 // Checks whether a referent subclass exists, and creates one if
 // it doesn't. The exception is for constants, which are never
-// dealloced. Caller must hold the mutex.
+// dealloced.
 static void EnsureReferentSubclass(id referent) {
-  if (!GetReferentSubclass(referent) && !IsConstantObject(referent)) {
+  if (GetReferentSubclass(referent) || IsConstantObject(referent)) {
+    return;
+  }
+  pthread_mutex_lock(&subclass_mutex);
+  if (!GetReferentSubclass(referent)) {
     Class cls = object_getClass(referent);
     Class subclass = (Class)CFDictionaryGetValue(referent_subclass_map, cls);
     if (!subclass) {
       subclass = CreateReferentSubclass(cls);
       CFDictionaryAddValue(referent_subclass_map, cls, subclass);
-      CFSetAddValue(referent_subclasses, subclass);
     }
     if (class_getSuperclass(subclass) == cls) {
       object_setClass(referent, subclass);
     }
   }
+  pthread_mutex_unlock(&subclass_mutex);
 }
 
 
-// Returns the referent's original class. Caller must hold the mutex.
+// Returns the referent's original class.
 static Class GetRealSuperclass(id obj) {
   return class_getSuperclass(GetReferentSubclass(obj));
 }
@@ -250,12 +357,13 @@ static Class GetRealSuperclass(id obj) {
 
 // Add an association between a referent and its reference. Because
 // multiple references can share a referent, a reference set is used.
-// Caller must hold the mutex.
-static void AssociateReferenceWithReferent(id referent, JavaLangRefReference *reference) {
-  CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(weak_refs_map, referent);
+// Caller must hold the shard's mutex.
+static void AssociateReferenceWithReferent(
+    ReferenceShard *shard, id referent, JavaLangRefReference *reference) {
+  CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(shard->weak_refs_map, referent);
   if (!set) {
     set = CFSetCreateMutable(NULL, 0, NULL);
-    CFDictionarySetValue(weak_refs_map, referent, set);
+    CFDictionarySetValue(shard->weak_refs_map, referent, set);
     CFRelease(set);
   }
   CFSetAddValue(set, reference);
@@ -263,7 +371,7 @@ static void AssociateReferenceWithReferent(id referent, JavaLangRefReference *re
 
 
 // Check if there is a SoftReference among a referent's references. Caller must
-// hold the mutex.
+// hold the shard's mutex.
 static bool hasSoftReference(CFMutableSetRef set) {
   // CFSet doesn't have an interruptible iterator function.
   NSSet *setCopy = (ARCBRIDGE NSSet *) set;
@@ -276,16 +384,181 @@ static bool hasSoftReference(CFMutableSetRef set) {
 }
 
 
-// Remove the association between a referent and all of its references. Caller
-// must hold the mutex
-static void RemoveReferenceAssociation(id referent, JavaLangRefReference *reference) {
-  CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(weak_refs_map, referent);
-  if (set) {
+// Adds a softly reachable referent to soft_references, which retains it.
+static void SaveSoftReferent(id referent) {
+  pthread_mutex_lock(&soft_references_mutex);
+  if (!CFSetContainsValue(soft_references, referent)) {
+    CFSetAddValue(soft_references, [referent retain]);
+  }
+  pthread_mutex_unlock(&soft_references_mutex);
+}
+
+
+// Removes a referent from soft_references. Returns true if it was removed, in
+// which case the caller must release it.
+static bool ForgetSoftReferent(id referent) {
+  pthread_mutex_lock(&soft_references_mutex);
+  bool found = CFSetContainsValue(soft_references, referent);
+  if (found) {
+    CFSetRemoveValue(soft_references, referent);
+  }
+  pthread_mutex_unlock(&soft_references_mutex);
+  return found;
+}
+
+
+// Remove the association between a referent and one of its references. Returns
+// true if the referent was removed from soft_references, in which case the
+// caller must release it after releasing the mutex. Caller must hold the
+// shard's mutex.
+static bool RemoveReferenceAssociation(
+    ReferenceShard *shard, id referent, JavaLangRefReference *reference) {
+  CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(shard->weak_refs_map, referent);
+  if (set && CFSetContainsValue(set, reference)) {
     CFSetRemoveValue(set, reference);
     if ([reference isKindOfClass:[JavaLangRefSoftReference class]] && !hasSoftReference(set)) {
-      CFSetRemoveValue(soft_references, referent);
+      return ForgetSoftReferent(referent);
+    }
+    return false;
+  }
+  // A phantom reference of a referent that is being deallocated. Another
+  // referent may already have the same address.
+  for (DyingReferent *dying = shard->dying; dying; dying = dying->next) {
+    if (CFSetContainsValue(dying->phantoms, reference)) {
+      CFSetRemoveValue(dying->phantoms, reference);
+      break;
+    }
+  }
+  return false;
+}
+
+
+// Retains references and sets their referents to ENQUEUE_PENDING, so that
+// they can be enqueued by EnqueueBatch() once the shard's mutex is released.
+// Takes ownership of references, which must be malloc'ed. Caller must hold the
+// shard's mutex.
+static void MakeBatch(ReferenceBatch *batch, id *references, CFIndex count) {
+  for (CFIndex i = 0; i < count; i++) {
+    [references[i] retain];
+    JreAssignVolatileId(&((JavaLangRefReference *)references[i])->referent_, ENQUEUE_PENDING);
+  }
+  batch->references = references;
+  batch->count = count;
+}
+
+
+// Enqueues a batch of references, and then clears and releases them. Must be
+// called without holding any shard's mutex, since enqueuing takes the queue's
+// lock and releasing may dealloc a reference.
+static void EnqueueBatch(ReferenceBatch *batch) {
+  id *references = batch->references;
+  CFIndex count = batch->count;
+  if (!references) {
+    return;
+  }
+  for (CFIndex i = 0; i < count; i++) {
+    [references[i] enqueue];
+  }
+  for (CFIndex i = 0; i < count; i++) {
+    JreAssignVolatileId(&((JavaLangRefReference *)references[i])->referent_, nil);
+  }
+  if (__c11_atomic_load(&enqueue_waiter_count, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&enqueue_mutex);
+    pthread_cond_broadcast(&enqueue_cond);
+    pthread_mutex_unlock(&enqueue_mutex);
+  }
+  for (CFIndex i = 0; i < count; i++) {
+    [references[i] release];
+  }
+  free(references);
+  batch->references = NULL;
+  batch->count = 0;
+}
+
+
+// Waits until a reference whose referent is ENQUEUE_PENDING has been enqueued
+// and cleared.
+static void WaitForEnqueue(JavaLangRefReference *reference) {
+  __c11_atomic_fetch_add(&enqueue_waiter_count, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&enqueue_mutex);
+  while ((id)__atomic_load_n(&reference->referent_, __ATOMIC_SEQ_CST) == ENQUEUE_PENDING) {
+    pthread_cond_wait(&enqueue_cond, &enqueue_mutex);
+  }
+  pthread_mutex_unlock(&enqueue_mutex);
+  __c11_atomic_fetch_sub(&enqueue_waiter_count, 1, __ATOMIC_SEQ_CST);
+}
+
+
+// Adds a referent's references to batch, except for its phantom references,
+// which are moved to a DyingReferent and enqueued by ReferentSubclassDealloc.
+// Caller must hold the shard's mutex, and must pass the batch to EnqueueBatch()
+// after releasing it.
+static void DetachReferences(ReferenceShard *shard, id referent, ReferenceBatch *batch) {
+  CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(shard->weak_refs_map, referent);
+  if (!set) {
+    return;
+  }
+  CFIndex count = CFSetGetCount(set);
+  id *references = malloc(count * sizeof(id));
+  CFSetGetValues(set, (const void **)references);
+  CFDictionaryRemoveValue(shard->weak_refs_map, referent);
+
+  CFMutableSetRef phantoms = NULL;
+  CFIndex numQueued = 0;
+  for (CFIndex i = 0; i < count; i++) {
+    JavaLangRefReference *reference = references[i];
+    if ([reference isKindOfClass:[JavaLangRefPhantomReference class]]) {
+      if (!phantoms) {
+        phantoms = CFSetCreateMutable(NULL, 0, NULL);
+      }
+      CFSetAddValue(phantoms, reference);
+    } else {
+      references[numQueued++] = reference;
     }
   }
+  MakeBatch(batch, references, numQueued);
+  if (phantoms) {
+    DyingReferent *dying = malloc(sizeof(DyingReferent));
+    dying->referent = referent;
+    dying->phantoms = phantoms;
+    dying->claimed = false;
+    dying->next = shard->dying;
+    shard->dying = dying;
+  }
+}
+
+
+// Returns the unclaimed DyingReferent of a referent that is about to be
+// deallocated, or NULL, and claims it. Caller must hold the shard's mutex.
+static DyingReferent *ClaimDyingReferent(ReferenceShard *shard, id referent) {
+  DyingReferent *dying = shard->dying;
+  while (dying && (dying->claimed || dying->referent != referent)) {
+    dying = dying->next;
+  }
+  if (dying) {
+    dying->claimed = true;
+  }
+  return dying;
+}
+
+
+// Adds the phantom references of a deallocated referent to batch, and frees its
+// DyingReferent. Caller must hold the shard's mutex, and must pass the batch to
+// EnqueueBatch() after releasing it.
+static void DetachPhantomReferences(
+    ReferenceShard *shard, DyingReferent *dying, ReferenceBatch *batch) {
+  DyingReferent **link = &shard->dying;
+  while (*link != dying) {
+    link = &(*link)->next;
+  }
+  *link = dying->next;
+
+  CFIndex count = CFSetGetCount(dying->phantoms);
+  id *references = malloc(count * sizeof(id));
+  CFSetGetValues(dying->phantoms, (const void **)references);
+  CFRelease(dying->phantoms);
+  free(dying);
+  MakeBatch(batch, references, count);
 }
 
 
@@ -297,52 +570,29 @@ static void RealReferentDealloc(id referent) {
 }
 
 
-typedef struct PhantomRefsContext {
-  int num;
-  id *refs;
-} PhantomRefsContext;
-
-static void ClearAndMaybeQueueReference(const void *value, void *context) {
-  JavaLangRefReference *reference = (JavaLangRefReference *)value;
-  PhantomRefsContext *ctx = (PhantomRefsContext *)context;
-  // Clear the referent field.
-  JreAssignVolatileId(&reference->referent_, nil);
-  // Queue the reference unless it is a phantom.
-  if ([reference isKindOfClass:[JavaLangRefPhantomReference class]]) {
-    ctx->refs[ctx->num++] = reference;
-  } else {
-    [reference enqueue];
-  }
-}
-
 // Dealloc method for referent subclasses, which directly calls the
 // original class's dealloc method. Normally "[super dealloc]" isn't
 // permissible with ARC, but in this case it's actually invoking a
 // delegate object's dealloc method (which won't invoke super-dealloc).
 static void ReferentSubclassDealloc(id self, SEL _cmd) {
-  WhileLocked(^{
-    CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(weak_refs_map, self);
-    if (set) {
-      int count = (int)CFSetGetCount(set);
-      CFMutableSetRef setCopy = CFSetCreateMutableCopy(NULL, count, set);
-      PhantomRefsContext phantomRefsCtx;
-      phantomRefsCtx.num = 0;
-      id phantomRefs[count];
-      phantomRefsCtx.refs = phantomRefs;
-      CFSetApplyFunction(setCopy, ClearAndMaybeQueueReference, &phantomRefsCtx);
-
-      // Real dealloc.
-      RealReferentDealloc(self);
-      // Remove reference associations.
-      CFDictionaryRemoveValue(weak_refs_map, self);
-
-      // Queue all phantom references.
-      for (int i = 0; i < phantomRefsCtx.num; i++) {
-        [phantomRefsCtx.refs[i] enqueue];
-      }
-      CFRelease(setCopy);
-    }
-  });
+  ReferenceShard *shard = GetShard(self);
+  ReferenceBatch batch = { NULL, 0 };
+  pthread_mutex_lock(&shard->mutex);
+  // The references are normally detached by ReferentSubclassRelease.
+  DetachReferences(shard, self, &batch);
+  DyingReferent *dying = ClaimDyingReferent(shard, self);
+  pthread_mutex_unlock(&shard->mutex);
+  EnqueueBatch(&batch);
+
+  // Real dealloc.
+  RealReferentDealloc(self);
+
+  if (dying) {
+    pthread_mutex_lock(&shard->mutex);
+    DetachPhantomReferences(shard, dying, &batch);
+    pthread_mutex_unlock(&shard->mutex);
+    EnqueueBatch(&batch);
+  }
 }
 
 
@@ -356,29 +606,41 @@ static void RealReferentRelease(id referent) {
 
 // Release method for referent subclasses, which directly calls the
 // original class's release method. If the instance would be
-// deallocated when this function returns, it is added to its
-// associated reference queue, if any.
+// deallocated when this function returns, its references are cleared
+// and added to their associated reference queues, if any. Releases that
+// don't dealloc are serialized by the shard's mutex, so that exactly one
+// of them sees the last retain count.
 static void ReferentSubclassRelease(id self, SEL _cmd) {
-  WhileLocked(^{
-    if ([self retainCount] == 1 && !in_low_memory_cleanup) {
-      CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(weak_refs_map, self);
-      if (set && hasSoftReference(set)) {
-        // referent is softly reachable. Save it from deallocation.
-        CFSetAddValue(soft_references, self);
-      }
+  ReferenceShard *shard = GetShard(self);
+  ReferenceBatch batch = { NULL, 0 };
+  pthread_mutex_lock(&shard->mutex);
+  bool lastRelease = [self retainCount] == 1;
+  if (lastRelease) {
+    CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(shard->weak_refs_map, self);
+    if (set && hasSoftReference(set)
+        && __c11_atomic_load(&low_memory_cleanup_count, __ATOMIC_SEQ_CST) == 0) {
+      // referent is softly reachable. Save it from deallocation.
+      SaveSoftReferent(self);
+      lastRelease = false;
+    } else {
+      DetachReferences(shard, self, &batch);
     }
+  }
+  if (!lastRelease) {
     RealReferentRelease(self);
-  });
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  if (lastRelease) {
+    // No other thread can get the referent from its references anymore.
+    EnqueueBatch(&batch);
+    RealReferentRelease(self);
+  }
 }
 
 // Override getClass in the subclass so that it returns the IOSClass for the
 // original class of the referent.
 static IOSClass *ReferentSubclassGetClass(id self, SEL _cmd) {
-  __block Class realSuperclass;
-  WhileLocked(^{
-    realSuperclass = GetRealSuperclass(self);
-  });
-  return IOSClass_fromClass(realSuperclass);
+  return IOSClass_fromClass(GetRealSuperclass(self));
 }
 
 @end
@@ -21,6 +21,7 @@
 #import "FastPointerLookup.h"
 #import "IOSClass.h"
 #import "JreRetainedWith.h"
+#import "ThreadRecordList.h"
 #import "java/lang/AbstractStringBuilder.h"
 #import "java/lang/ArithmeticException.h"
 #import "java/lang/AssertionError.h"
@@ -32,6 +33,8 @@
 #import "java/util/logging/Logger.h"
 #import "objc/runtime.h"
 
+#import <pthread.h>
+
 id JreThrowNullPointerException() {
   @throw create_JavaLangNullPointerException_init(); // NOLINT
 }
@@ -75,75 +78,190 @@ id JreStrongAssignAndConsume(__strong id *pIvar, NS_RELEASES_ARGUMENT id value)
   return JreAutoreleasedAssign(pIvar, value);
 }
 
-// Declare a pool of spin locks for volatile variable access. The use of spin
-// locks for atomic access is consistent with how Apple implements atomic
-// property accessors, and the hashing used here is inspired by Apple's
-// implementation:
-// NOLINTNEXTLINE
-// http://www.opensource.apple.com/source/objc4/objc4-532.2/runtime/Accessors.subproj/objc-accessors.mm
-// Spin locks are unsafe to use on iOS because of the potential for priority
-// inversion so we use pthread_mutex.
-#define VOLATILE_POWER 7
-#define VOLATILE_NLOCKS (1 << VOLATILE_POWER)
-#define VOLATILE_MASK (VOLATILE_NLOCKS - 1)
-#define VOLATILE_HASH(x) (((long)x >> 5) & VOLATILE_MASK)
-#define VOLATILE_GETLOCK(ptr) &volatile_locks[VOLATILE_HASH(ptr)]
-#define VOLATILE_LOCK(l) pthread_mutex_lock(l)
-#define VOLATILE_UNLOCK(l) pthread_mutex_unlock(l)
-
-typedef pthread_mutex_t *volatile_lock_t;
-static pthread_mutex_t volatile_locks[VOLATILE_NLOCKS] =
-  { [0 ... VOLATILE_MASK] = PTHREAD_MUTEX_INITIALIZER };
+// Volatile object fields are accessed with atomic operations. The difficulty is
+// that a load must retain its result before another thread replaces and
+// releases it, which is solved with hazard pointers: before retaining, a
+// loading thread publishes the object in its own record and checks that the
+// field still holds it. A thread that replaces a strong value scans all records
+// and releases the value right away unless one of them holds it. Such a load
+// retains the value within a few instructions, so the thread instead keeps it
+// in its record's list of retired values, and tries again on its next volatile
+// access or when it exits. Neither loads nor stores ever wait for another
+// thread, and stores cost one read of each thread's record.
+#define VOLATILE_HAZARD_ALIGNMENT 64
+#define VOLATILE_RETIRED_INITIAL_CAPACITY 8
+
+typedef struct VolatileHazard {
+  ThreadRecord record;
+  // Atomic. The object that the owning thread is retaining, or 0.
+  _Atomic(uintptr_t) value;
+  // Non-atomic, only accessed by the owning thread. The strong references
+  // that it replaced while another thread was retaining them, and hasn't
+  // released yet.
+  uintptr_t *retired;
+  uint32_t numRetired;
+  uint32_t retiredCapacity;
+} __attribute__((aligned(VOLATILE_HAZARD_ALIGNMENT))) VolatileHazard;
+
+static void ReclaimRetiredVolatiles(VolatileHazard *hazard);
+
+// Releases the retired values of a thread that exits. A record keeps the ones
+// that are still held for the next owner to release.
+static void ExitVolatileHazard(ThreadRecord *record) {
+  VolatileHazard *hazard = (VolatileHazard *)record;
+  if (hazard->numRetired > 0) {
+    @autoreleasepool {
+      ReclaimRetiredVolatiles(hazard);
+    }
+  }
+}
+
+static ThreadRecordList_t volatile_hazards =
+    THREAD_RECORD_LIST_INIT(VolatileHazard, &ExitVolatileHazard);
+
+static inline VolatileHazard *GetVolatileHazard() {
+  return (VolatileHazard *)ThreadRecordListGet(&volatile_hazards);
+}
+
+// Loads the value of the field and returns it retained.
+static id LoadAndRetainVolatile(volatile_id *pVar) {
+  uintptr_t value = __atomic_load_n(pVar, __ATOMIC_SEQ_CST);
+  if (!value) {
+    return nil;
+  }
+  VolatileHazard *hazard = GetVolatileHazard();
+  while (value) {
+    __c11_atomic_store(&hazard->value, value, __ATOMIC_RELAXED);
+    // Synchronize with IsVolatileHazard() so that either it reads the
+    // published value or we read the value that replaced it.
+    __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uintptr_t current = __atomic_load_n(pVar, __ATOMIC_ACQUIRE);
+    if (current == value) {
+      [(id)value retain];
+      break;
+    }
+    value = current;
+  }
+  __c11_atomic_store(&hazard->value, 0, __ATOMIC_RELEASE);
+  if (__builtin_expect(hazard->numRetired > 0, 0)) {
+    ReclaimRetiredVolatiles(hazard);
+  }
+  return (id)value;
+}
+
+// Returns true if a load on some thread may be about to retain value.
+static bool IsVolatileHazard(uintptr_t value) {
+  __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ThreadRecord *record = ThreadRecordListFirst(&volatile_hazards);
+  for (; record; record = record->next) {
+    if (__c11_atomic_load(&((VolatileHazard *)record)->value, __ATOMIC_ACQUIRE) == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void AddRetiredVolatile(VolatileHazard *hazard, uintptr_t value) {
+  if (hazard->numRetired == hazard->retiredCapacity) {
+    hazard->retiredCapacity =
+        MAX(hazard->retiredCapacity * 2, VOLATILE_RETIRED_INITIAL_CAPACITY);
+    hazard->retired =
+        (uintptr_t *)realloc(hazard->retired, hazard->retiredCapacity * sizeof(uintptr_t));
+  }
+  hazard->retired[hazard->numRetired++] = value;
+}
+
+// Releases the current thread's retired values that no record holds.
+static void ReclaimRetiredVolatiles(VolatileHazard *hazard) {
+  // A release can run a dealloc that retires more values on this thread, so
+  // the list is detached while its values are released.
+  uintptr_t *retired = hazard->retired;
+  uint32_t numRetired = hazard->numRetired;
+  uint32_t retiredCapacity = hazard->retiredCapacity;
+  hazard->retired = NULL;
+  hazard->numRetired = 0;
+  hazard->retiredCapacity = 0;
+  uint32_t numKept = 0;
+  for (uint32_t i = 0; i < numRetired; i++) {
+    uintptr_t value = retired[i];
+    if (IsVolatileHazard(value)) {
+      retired[numKept++] = value;
+    } else {
+      [(id)value release];
+    }
+  }
+
+  // Keep the values that were retired by the releases.
+  uint32_t numAdded = hazard->numRetired;
+  if (numAdded > 0) {
+    if (numKept + numAdded > retiredCapacity) {
+      retiredCapacity = numKept + numAdded;
+      retired = (uintptr_t *)realloc(retired, retiredCapacity * sizeof(uintptr_t));
+    }
+    memcpy(retired + numKept, hazard->retired, numAdded * sizeof(uintptr_t));
+    free(hazard->retired);
+  }
+  hazard->retired = retired;
+  hazard->numRetired = numKept + numAdded;
+  hazard->retiredCapacity = retiredCapacity;
+}
+
+// Takes over a strong reference that was just replaced, and releases it once
+// no other thread can be retaining it.
+static void RetireVolatile(uintptr_t value) {
+  if (!value) {
+    return;
+  }
+  VolatileHazard *hazard = GetVolatileHazard();
+  if (__builtin_expect(hazard->numRetired > 0, 0)) {
+    AddRetiredVolatile(hazard, value);
+    ReclaimRetiredVolatiles(hazard);
+  } else if (IsVolatileHazard(value)) {
+    AddRetiredVolatile(hazard, value);
+  } else {
+    [(id)value release];
+  }
+}
 
 id JreLoadVolatileId(volatile_id *pVar) {
-  volatile_lock_t lock = VOLATILE_GETLOCK(pVar);
-  VOLATILE_LOCK(lock);
-  id value = [*(id *)pVar retain];
-  VOLATILE_UNLOCK(lock);
-  return [value autorelease];
+  return [LoadAndRetainVolatile(pVar) autorelease];
 }
 
 id JreAssignVolatileId(volatile_id *pVar, id value) {
-  volatile_lock_t lock = VOLATILE_GETLOCK(pVar);
-  VOLATILE_LOCK(lock);
-  *(id *)pVar = value;
-  VOLATILE_UNLOCK(lock);
+  __atomic_store_n(pVar, (uintptr_t)value, __ATOMIC_SEQ_CST);
   return value;
 }
 
 id JreVolatileStrongAssign(volatile_id *pIvar, id value) {
-  volatile_lock_t lock = VOLATILE_GETLOCK(pIvar);
   [value retain];
-  VOLATILE_LOCK(lock);
-  id oldValue = *(id *)pIvar;
-  *(id *)pIvar = value;
-  VOLATILE_UNLOCK(lock);
-  [oldValue autorelease];
+  uintptr_t oldValue = __atomic_exchange_n(pIvar, (uintptr_t)value, __ATOMIC_SEQ_CST);
+  RetireVolatile(oldValue);
   return value;
 }
 
 jboolean JreCompareAndSwapVolatileStrongId(volatile_id *pVar, id expected, id newValue) {
-  volatile_lock_t lock = VOLATILE_GETLOCK(pVar);
-  VOLATILE_LOCK(lock);
-  jboolean result = *(id *)pVar == expected;
-  if (result) {
-    *(id *)pVar = [newValue retain];
-  }
-  VOLATILE_UNLOCK(lock);
+  // Retain before the swap, after which another thread may replace and release
+  // newValue.
+  [newValue retain];
+  uintptr_t expectedValue = (uintptr_t)expected;
+  jboolean result = __atomic_compare_exchange_n(
+      pVar, &expectedValue, (uintptr_t)newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
   if (result) {
-    [expected autorelease];
+    RetireVolatile((uintptr_t)expected);
+  } else {
+    [newValue release];
   }
   return result;
 }
 
 id JreExchangeVolatileStrongId(volatile_id *pVar, id newValue) {
   [newValue retain];
-  volatile_lock_t lock = VOLATILE_GETLOCK(pVar);
-  VOLATILE_LOCK(lock);
-  id oldValue = *(id *)pVar;
-  *(id *)pVar = newValue;
-  VOLATILE_UNLOCK(lock);
-  return [oldValue autorelease];
+  uintptr_t oldValue = __atomic_exchange_n(pVar, (uintptr_t)newValue, __ATOMIC_SEQ_CST);
+  // The field's reference may still be needed by a load on another thread, so
+  // the caller gets a reference of its own.
+  [[(id)oldValue retain] autorelease];
+  RetireVolatile(oldValue);
+  return (id)oldValue;
 }
 
 void JreReleaseVolatile(volatile_id *pVar) {
@@ -154,21 +272,13 @@ void JreReleaseVolatile(volatile_id *pVar) {
 }
 
 void JreCloneVolatile(volatile_id *pVar, volatile_id *pOther) {
-  volatile_lock_t lock = VOLATILE_GETLOCK(pOther);
-  VOLATILE_LOCK(lock);
-  *(id *)pVar = *(id *)pOther;
-  VOLATILE_UNLOCK(lock);
+  *pVar = __atomic_load_n(pOther, __ATOMIC_SEQ_CST);
 }
 
 void JreCloneVolatileStrong(volatile_id *pVar, volatile_id *pOther) {
-  // We lock on pOther because it may be visible to other threads. Since we are
-  // still within Object.clone() we know that pVar isn't visible to other
-  // threads yet, so we don't need to use it's lock. However, we do the
-  // assignment within pOther's lock to provide sequencial consistency.
-  volatile_lock_t lock = VOLATILE_GETLOCK(pOther);
-  VOLATILE_LOCK(lock);
-  *(id *)pVar = [*(id *)pOther retain];
-  VOLATILE_UNLOCK(lock);
+  // Since we are still within Object.clone() we know that pVar isn't visible
+  // to other threads yet, so only pOther needs to be accessed atomically.
+  *pVar = (volatile_id)LoadAndRetainVolatile(pOther);
 }
 
 id JreRetainedWithAssign(id parent, __strong id *pIvar, id value) {
@@ -188,14 +298,10 @@ id JreVolatileRetainedWithAssign(id parent, volatile_id *pIvar, id value) {
   // least 2 which is required by JreRetainedWithInitialize.
   [value retain];
   JreRetainedWithInitialize(parent, value);
-  volatile_lock_t lock = VOLATILE_GETLOCK(pIvar);
-  VOLATILE_LOCK(lock);
-  id oldValue = *(id *)pIvar;
-  *(id *)pIvar = value;
-  VOLATILE_UNLOCK(lock);
+  id oldValue = (id)__atomic_exchange_n(pIvar, (uintptr_t)value, __ATOMIC_SEQ_CST);
   if (oldValue) {
     JreRetainedWithHandlePreviousValue(parent, oldValue);
-    [oldValue release];
+    RetireVolatile((uintptr_t)oldValue);
   }
   return value;
 }
@@ -47,9 +47,9 @@ typedef _Atomic(jlong)     volatile_jlong;
 typedef _Atomic(jfloat)    volatile_jfloat;
 typedef _Atomic(jdouble)   volatile_jdouble;
 typedef _Atomic(jboolean)  volatile_jboolean;
-// Volatile object access is guarded by spin locks because of reference counting
-// so we don't use an atomic type. uintptr_t is used for the typedef mainly to
-// prevent accidental usage as a regular id type.
+// Volatile object access has to cooperate with reference counting (see
+// J2ObjC_common.m), so we don't use an atomic type. uintptr_t is used for the
+// typedef mainly to prevent accidental usage as a regular id type.
 typedef uintptr_t          volatile_id;
 
 #endif // _J2OBJC_TYPES_H_
@@ -0,0 +1,80 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ThreadRecordList_H_
+#define ThreadRecordList_H_
+
+#import <pthread.h>
+#import <stdbool.h>
+
+// Lists of per-thread records, through which lock-free code publishes what
+// each thread is reading for writers to scan. A thread claims a record the
+// first time it asks for one, and gives it up when it exits. Records are
+// reused by later threads and are never freed, so they can be scanned without
+// locking.
+
+struct ThreadRecordList_t;
+
+// The start of every record. The owner's state follows it in a larger struct.
+typedef struct ThreadRecord {
+  // Atomic. Whether a thread owns the record.
+  _Atomic(bool) inUse;
+  // Non-atomic. Immutable once the record is published.
+  struct ThreadRecord *next;
+  struct ThreadRecordList_t *list;
+} ThreadRecord;
+
+typedef struct ThreadRecordList_t {
+  size_t recordSize;  // The size of the structs that start with a ThreadRecord.
+  // Runs on a thread that exits, before its record can be claimed by another
+  // thread. May be NULL.
+  void (*exit_func)(ThreadRecord *);
+  _Atomic(ThreadRecord *) head;
+  _Atomic(bool) keyCreated;
+  pthread_mutex_t keyMutex;  // For creating key.
+  pthread_key_t key;
+} ThreadRecordList_t;
+
+/**
+ * Static initializer to use with a ThreadRecordList_t declaration.
+ *
+ * @define THREAD_RECORD_LIST_INIT
+ * @param record_type The type of the records, whose first member is a
+ *   ThreadRecord. New records are zero-filled apart from that member.
+ * @param exit_func A pointer to the function that runs when the owner of a
+ *   record exits, or NULL.
+ */
+#define THREAD_RECORD_LIST_INIT(record_type, exit_func) \
+  { sizeof(record_type), exit_func, NULL, false, PTHREAD_MUTEX_INITIALIZER }
+
+// Claims a free record for the current thread, or adds a new one. Use
+// ThreadRecordListGet() instead.
+ThreadRecord *ThreadRecordListClaim(ThreadRecordList_t *list);
+
+// Returns the current thread's record.
+static inline ThreadRecord *ThreadRecordListGet(ThreadRecordList_t *list) {
+  if (__builtin_expect(__c11_atomic_load(&list->keyCreated, __ATOMIC_ACQUIRE), 1)) {
+    ThreadRecord *record = (ThreadRecord *)pthread_getspecific(list->key);
+    if (__builtin_expect(record != NULL, 1)) {
+      return record;
+    }
+  }
+  return ThreadRecordListClaim(list);
+}
+
+// Returns the most recently added record, from which the others are reached
+// through next. Includes the records that no thread owns.
+static inline ThreadRecord *ThreadRecordListFirst(ThreadRecordList_t *list) {
+  return __c11_atomic_load(&list->head, __ATOMIC_ACQUIRE);
+}
+
+#endif // ThreadRecordList_H_
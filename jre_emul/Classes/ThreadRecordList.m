@@ -0,0 +1,67 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ThreadRecordList.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Records are written by their owner and read by every thread that scans the
+// list, so each gets its own cache lines.
+#define CACHE_LINE_SIZE 64
+
+static void ReleaseThreadRecord(void *value) {
+  ThreadRecord *record = (ThreadRecord *)value;
+  if (record->list->exit_func) {
+    record->list->exit_func(record);
+  }
+  __c11_atomic_store(&record->inUse, false, __ATOMIC_RELEASE);
+}
+
+static void CreateKey(ThreadRecordList_t *list) {
+  pthread_mutex_lock(&list->keyMutex);
+  if (!__c11_atomic_load(&list->keyCreated, __ATOMIC_RELAXED)) {
+    if (pthread_key_create(&list->key, &ReleaseThreadRecord) != 0) {
+      abort();
+    }
+    __c11_atomic_store(&list->keyCreated, true, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&list->keyMutex);
+}
+
+ThreadRecord *ThreadRecordListClaim(ThreadRecordList_t *list) {
+  if (!__c11_atomic_load(&list->keyCreated, __ATOMIC_ACQUIRE)) {
+    CreateKey(list);
+  }
+  ThreadRecord *record = __c11_atomic_load(&list->head, __ATOMIC_ACQUIRE);
+  for (; record; record = record->next) {
+    bool inUse = false;
+    if (!__c11_atomic_load(&record->inUse, __ATOMIC_RELAXED) &&
+        __c11_atomic_compare_exchange_strong(
+            &record->inUse, &inUse, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (!record) {
+    if (posix_memalign((void **)&record, CACHE_LINE_SIZE, list->recordSize) != 0) {
+      abort();
+    }
+    memset(record, 0, list->recordSize);
+    __c11_atomic_init(&record->inUse, true);
+    record->list = list;
+    record->next = __c11_atomic_load(&list->head, __ATOMIC_RELAXED);
+    while (!__c11_atomic_compare_exchange_weak(
+        &list->head, &record->next, record, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+  pthread_setspecific(list->key, record);
+  return record;
+}
@@ -25,6 +25,7 @@
 #define __OBJC_SNYC_H_
 
 #include <objc/objc.h>
+#include <stdio.h>
 
 // Begin synchronizing on 'obj'.  
 // Allocates recursive pthread_mutex associated with 'obj' if needed.
@@ -57,4 +58,22 @@ enum {
 // Returns true if an object has a pthread_mutux allocated for it on this thread.
 BOOL j2objc_sync_holds_lock(id obj);
 
+// Monitor profiling. While enabled, objc_sync_enter(), objc_sync_exit() and
+// objc_sync_wait() record per-class acquisition counts, contended
+// acquisitions, the total and maximum time blocked, the time held and the time
+// spent in wait(). Contended objects also get the contended acquisitions, the
+// time blocked and the call sites of the contended acquisitions recorded per
+// object. Setting the J2OBJC_MONITOR_PROFILE environment variable to a value
+// other than 0 enables profiling at startup and prints the report to stderr at
+// exit. Disabled profiling has no measurable cost.
+void j2objc_sync_set_profiling_enabled(BOOL enabled);
+BOOL j2objc_sync_profiling_enabled(void);
+
+// Discards the statistics recorded so far.
+void j2objc_sync_reset_profile(void);
+
+// Prints the statistics of the profiled classes and contended objects, the
+// ones that threads were blocked on the longest first.
+void j2objc_sync_print_profile(FILE *out);
+
 #endif // __OBJC_SNYC_H_
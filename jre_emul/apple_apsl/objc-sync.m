@@ -21,9 +21,17 @@
  * @APPLE_LICENSE_HEADER_END@
  */
 
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <AssertMacros.h>
 #include <libkern/OSAtomic.h>
+#include <mach/mach_time.h>
+#include <objc/runtime.h>
 #include <os/lock.h>
 
 #include "JreEmulation.h"
@@ -91,11 +99,17 @@ typedef struct SyncData {
     int              threadCount;  // number of THREADS using this block
     pthread_mutex_t  mutex;
     pthread_cond_t   conditionVariable;
+    // Signaled when a thin lock on object is released (see ThinLock). The
+    // mutex is only held while checking the thin lock, so that releasing a
+    // thin lock never waits for another thread's critical section.
+    pthread_mutex_t  thinLockMutex;
+    pthread_cond_t   thinLockReleased;
 } SyncData;
 
 typedef struct {
     SyncData *data;
     unsigned int lockCount;  // number of times THIS THREAD locked this block
+    uint64_t acquiredAt;     // mach_absolute_time() of the first lock, if profiled
 } SyncCacheItem;
 
 typedef struct SyncCache {
@@ -110,18 +124,64 @@ typedef struct {
 } SyncList __attribute__((aligned(64)));
 // aligned to put locks on separate cache lines
 
+//
+// Thin locks. Uncontended locking doesn't need a SyncData: a thread locks an
+// object by setting the object field of the object's ThinLock from 0 to the
+// object with a single CAS, and keeps the recursion count in its own
+// j2objc_pthread_data. Objects that share a ThinLock can't be thin locked at
+// the same time.
+//
+// A thread that finds the object thin locked by another thread, or that needs
+// to wait on the object, falls back to the object's SyncData instead. While any
+// thread uses a SyncData for an object of a ThinLock, slowCount is non-zero and
+// no new thin locks are taken on it, so at most one thin lock is left to be
+// released. Before they acquire the SyncData mutex, threads wait for the thin
+// lock on their object to be released. A thread that waits on an object it has
+// thin locked moves its lock to the SyncData mutex first. The CAS and the
+// slowCount increment are each followed by a sequentially consistent load of
+// the other field, and objc_sync_exit() only decrements slowCount after it has
+// unlocked the mutex, so that a thread can't take a thin lock on an object
+// while another thread holds its SyncData mutex.
+//
+typedef struct {
+    // The object that is thin locked, or 0.
+    _Atomic(uintptr_t) object;
+    // The number of threads that use a SyncData for an object of this ThinLock.
+    _Atomic(unsigned) slowCount;
+} ThinLock __attribute__((aligned(64)));
+
+// The maximum number of thin locks that a thread holds. Further locks use
+// SyncData.
+#define THIN_LOCK_CACHE_SIZE 8
+
+typedef struct {
+    id object;
+    unsigned int lockCount;  // number of times THIS THREAD locked object
+    uint64_t acquiredAt;     // mach_absolute_time() of the first lock, if profiled
+} ThinLockItem;
+
 // Use multiple parallel lists to decrease contention among unrelated objects.
-#define COUNT 16
-#define HASH(obj) ((((uintptr_t)(obj)) >> 5) & (COUNT - 1))
-#define LOCK_FOR_OBJ(obj) sDataLists[HASH(obj)].lock
-#define LIST_FOR_OBJ(obj) sDataLists[HASH(obj)].data
-static SyncList sDataLists[COUNT];
+// The numbers of lists and thin locks scale with the number of cores.
+#define MIN_LIST_COUNT 16
+#define LISTS_PER_CPU 4
+#define MIN_THIN_LOCK_COUNT 256
+#define THIN_LOCKS_PER_CPU 64
+#define HASH(obj, mask) ((((uintptr_t)(obj)) >> 5) & (mask))
+#define LOCK_FOR_OBJ(obj) sDataLists[HASH(obj, sDataListMask)].lock
+#define LIST_FOR_OBJ(obj) sDataLists[HASH(obj, sDataListMask)].data
+#define THIN_LOCK_FOR_OBJ(obj) (&sThinLocks[HASH(obj, sThinLockMask)])
+static SyncList *sDataLists;
+static uintptr_t sDataListMask;
+static ThinLock *sThinLocks;
+static uintptr_t sThinLockMask;
 
 static pthread_key_t j2objc_pthread_key = 0;
 static pthread_once_t oneTimeInit = PTHREAD_ONCE_INIT;
 
 typedef struct {
   struct SyncCache *syncCache;
+  unsigned int thinLockCount;
+  ThinLockItem thinLocks[THIN_LOCK_CACHE_SIZE];
 } j2objc_pthread_data;
 
 enum usage { ACQUIRE, RELEASE, CHECK, TEST };
@@ -137,22 +197,302 @@ static void j2objc_destroy_key(void *thread_data) {
 }
 
 
+//
+// Monitor profiling. While profiling is enabled, every monitor enter and exit
+// records statistics in a fixed-size table that is keyed by the object's class,
+// so that objects that are locked once and then die, such as Vectors and
+// StringBuffers, only cost a class lookup. Objects only get entries of their
+// own, in a second table, when they are contended. An object entry is keyed by
+// the object and its class, so that a dead object's statistics are not merged
+// with those of a new object of another class at the same address. Call sites
+// are only recorded for contended acquisitions, like JFR's monitor enter
+// events, and only the first few distinct call sites of each object are kept.
+// Disabled profiling costs one relaxed load and a predicted branch in
+// objc_sync_enter and objc_sync_exit.
+//
+#define PROFILE_CLASS_TABLE_SIZE 1024  // must be a power of two
+#define PROFILE_OBJECT_TABLE_SIZE 4096  // must be a power of two
+#define PROFILE_MAX_PROBES 64
+#define PROFILE_MAX_CALL_SITES 4
+
+typedef struct {
+    _Atomic(uintptr_t) pc;
+    _Atomic(uint64_t) count;
+} MonitorCallSite;
+
+typedef struct {
+    _Atomic(uint64_t) contendedAcquisitions;
+    // Times are in mach_absolute_time() units.
+    _Atomic(uint64_t) blockedTime;
+    _Atomic(uint64_t) maxBlockedTime;
+    _Atomic(uint64_t) waits;
+    _Atomic(uint64_t) waitTime;
+} ContentionStats;
+
+typedef struct {
+    _Atomic(uintptr_t) cls;
+    _Atomic(uint64_t) acquisitions;
+    _Atomic(uint64_t) heldTime;
+    ContentionStats contention;
+} ClassProfile;
+
+typedef struct {
+    _Atomic(uintptr_t) object;
+    _Atomic(uintptr_t) cls;
+    ContentionStats contention;
+    MonitorCallSite callSites[PROFILE_MAX_CALL_SITES];
+    // Contended acquisitions from call sites that didn't fit in callSites.
+    _Atomic(uint64_t) otherCallSites;
+} ObjectProfile;
+
+static _Atomic(bool) sProfilingEnabled;
+static ClassProfile *_Atomic sClassProfiles;
+static ObjectProfile *_Atomic sObjectProfiles;
+// Acquisitions of objects whose class didn't fit in sClassProfiles.
+static _Atomic(uint64_t) sUnprofiledAcquisitions;
+// Contended acquisitions of objects that didn't fit in sObjectProfiles.
+static _Atomic(uint64_t) sUnprofiledContentions;
+static pthread_mutex_t sProfileMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define PROFILING() \
+    __builtin_expect(__c11_atomic_load(&sProfilingEnabled, __ATOMIC_RELAXED), 0)
+
+// Returns the entry of cls, adding it if needed, or NULL if the table is full.
+static ClassProfile* profile_for_class(uintptr_t cls)
+{
+    ClassProfile *profiles = __c11_atomic_load(&sClassProfiles, __ATOMIC_ACQUIRE);
+    if (!profiles) {
+        return NULL;
+    }
+    uintptr_t index = cls >> 4;
+    for (int i = 0; i < PROFILE_MAX_PROBES; i++, index++) {
+        ClassProfile *profile = &profiles[index & (PROFILE_CLASS_TABLE_SIZE - 1)];
+        uintptr_t expected = __c11_atomic_load(&profile->cls, __ATOMIC_RELAXED);
+        if (expected == 0 &&
+            __c11_atomic_compare_exchange_strong(&profile->cls, &expected, cls,
+                                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return profile;
+        }
+        if (expected == cls) {
+            return profile;
+        }
+    }
+    return NULL;
+}
+
+// Returns the entry of object, adding it if add is set, or NULL if there is no
+// entry or the table is full.
+static ObjectProfile* profile_for_object(id object, uintptr_t cls, BOOL add)
+{
+    ObjectProfile *profiles = __c11_atomic_load(&sObjectProfiles, __ATOMIC_ACQUIRE);
+    if (!profiles) {
+        return NULL;
+    }
+    uintptr_t key = (uintptr_t)object;
+    uintptr_t index = key >> 4;
+    for (int i = 0; i < PROFILE_MAX_PROBES; i++, index++) {
+        ObjectProfile *profile = &profiles[index & (PROFILE_OBJECT_TABLE_SIZE - 1)];
+        uintptr_t expected = __c11_atomic_load(&profile->object, __ATOMIC_ACQUIRE);
+        if (expected == 0) {
+            if (!add) {
+                return NULL;
+            }
+            if (__c11_atomic_compare_exchange_strong(&profile->object, &expected, key,
+                                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __c11_atomic_store(&profile->cls, cls, __ATOMIC_RELEASE);
+                return profile;
+            }
+        }
+        if (expected == key) {
+            // A zero class is an entry that another thread is still adding.
+            uintptr_t profileClass = __c11_atomic_load(&profile->cls, __ATOMIC_ACQUIRE);
+            if (profileClass == cls || profileClass == 0) {
+                return profile;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void add_contention(ContentionStats *stats, uint64_t blockedTime)
+{
+    __c11_atomic_fetch_add(&stats->contendedAcquisitions, 1, __ATOMIC_RELAXED);
+    __c11_atomic_fetch_add(&stats->blockedTime, blockedTime, __ATOMIC_RELAXED);
+    uint64_t max = __c11_atomic_load(&stats->maxBlockedTime, __ATOMIC_RELAXED);
+    while (blockedTime > max &&
+           !__c11_atomic_compare_exchange_weak(&stats->maxBlockedTime, &max, blockedTime,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void add_wait(ContentionStats *stats, uint64_t waitTime)
+{
+    __c11_atomic_fetch_add(&stats->waits, 1, __ATOMIC_RELAXED);
+    __c11_atomic_fetch_add(&stats->waitTime, waitTime, __ATOMIC_RELAXED);
+}
+
+static void profile_add_call_site(ObjectProfile *profile, uintptr_t pc)
+{
+    for (int i = 0; i < PROFILE_MAX_CALL_SITES; i++) {
+        MonitorCallSite *site = &profile->callSites[i];
+        uintptr_t expected = __c11_atomic_load(&site->pc, __ATOMIC_RELAXED);
+        if (expected == 0) {
+            __c11_atomic_compare_exchange_strong(&site->pc, &expected, pc,
+                                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            // On failure, expected is the call site that another thread added.
+            if (expected == 0) {
+                expected = pc;
+            }
+        }
+        if (expected == pc) {
+            __c11_atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __c11_atomic_fetch_add(&profile->otherCallSites, 1, __ATOMIC_RELAXED);
+}
+
+// Records an acquisition of object by objc_sync_enter(). Not inlined, so that
+// the caller of objc_sync_enter() is two frames up.
+static __attribute__((noinline)) void profile_enter(id object, BOOL contended,
+                                                    uint64_t blockedTime)
+{
+    uintptr_t cls = (uintptr_t)object_getClass(object);
+    ClassProfile *classProfile = profile_for_class(cls);
+    if (classProfile) {
+        __c11_atomic_fetch_add(&classProfile->acquisitions, 1, __ATOMIC_RELAXED);
+    } else {
+        __c11_atomic_fetch_add(&sUnprofiledAcquisitions, 1, __ATOMIC_RELAXED);
+    }
+    if (!contended) {
+        return;
+    }
+    if (classProfile) {
+        add_contention(&classProfile->contention, blockedTime);
+    }
+    ObjectProfile *profile = profile_for_object(object, cls, YES);
+    if (!profile) {
+        __c11_atomic_fetch_add(&sUnprofiledContentions, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    add_contention(&profile->contention, blockedTime);
+
+    void *frames[3];
+    if (backtrace(frames, 3) == 3) {
+        profile_add_call_site(profile, (uintptr_t)frames[2]);
+    }
+}
+
+// Records the release of the outermost lock on object, which was acquired at
+// acquiredAt, or at 0 if profiling was disabled then.
+static void profile_exit(id object, uint64_t acquiredAt)
+{
+    if (acquiredAt == 0) {
+        return;
+    }
+    ClassProfile *profile = profile_for_class((uintptr_t)object_getClass(object));
+    if (profile) {
+        __c11_atomic_fetch_add(&profile->heldTime, mach_absolute_time() - acquiredAt,
+                               __ATOMIC_RELAXED);
+    }
+}
+
+// Records a wait on object. Only objects that were already contended get the
+// wait recorded in their own entry.
+static void profile_wait(id object, uint64_t waitTime)
+{
+    uintptr_t cls = (uintptr_t)object_getClass(object);
+    ClassProfile *classProfile = profile_for_class(cls);
+    if (classProfile) {
+        add_wait(&classProfile->contention, waitTime);
+    }
+    ObjectProfile *profile = profile_for_object(object, cls, NO);
+    if (profile) {
+        add_wait(&profile->contention, waitTime);
+    }
+}
+
+// Allocates the tables when profiling is first enabled.
+static void set_profiling_enabled(BOOL enabled)
+{
+    pthread_mutex_lock(&sProfileMutex);
+    if (enabled && !__c11_atomic_load(&sClassProfiles, __ATOMIC_RELAXED)) {
+        __c11_atomic_store(&sObjectProfiles,
+                           calloc(PROFILE_OBJECT_TABLE_SIZE, sizeof(ObjectProfile)),
+                           __ATOMIC_RELEASE);
+        __c11_atomic_store(&sClassProfiles,
+                           calloc(PROFILE_CLASS_TABLE_SIZE, sizeof(ClassProfile)),
+                           __ATOMIC_RELEASE);
+    }
+    __c11_atomic_store(&sProfilingEnabled, enabled, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&sProfileMutex);
+}
+
+static void print_profile_at_exit(void)
+{
+    j2objc_sync_print_profile(stderr);
+}
+
+// Enables profiling if the J2OBJC_MONITOR_PROFILE environment variable is set,
+// and prints the report when the process exits.
+static void init_profiling_from_environment(void)
+{
+    const char *value = getenv("J2OBJC_MONITOR_PROFILE");
+    if (value && *value && strcmp(value, "0") != 0) {
+        set_profiling_enabled(YES);
+        atexit(print_profile_at_exit);
+    }
+}
+
+
+// Allocates a zeroed table with a power of two number of entries, at least
+// minCount and perCpu entries per CPU, and sets *mask to the count minus one.
+static void *alloc_table(size_t entrySize, uintptr_t minCount, uintptr_t perCpu,
+                         uintptr_t *mask)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    uintptr_t count = minCount;
+    while (cpus > 0 && count < (uintptr_t)cpus * perCpu) {
+        count <<= 1;
+    }
+    void *table = NULL;
+    if (posix_memalign(&table, 64, count * entrySize) != 0) {
+        abort();
+    }
+    memset(table, 0, count * entrySize);
+    *mask = count - 1;
+    return table;
+}
+
+
 void init_j2objc_thread_data(void) {
   pthread_key_create(&j2objc_pthread_key, j2objc_destroy_key);
+  sDataLists = (SyncList *)alloc_table(
+      sizeof(SyncList), MIN_LIST_COUNT, LISTS_PER_CPU, &sDataListMask);
+  sThinLocks = (ThinLock *)alloc_table(
+      sizeof(ThinLock), MIN_THIN_LOCK_COUNT, THIN_LOCKS_PER_CPU, &sThinLockMask);
+  init_profiling_from_environment();
 }
 
 
-static SyncCache *fetch_cache(BOOL create)
+static j2objc_pthread_data *fetch_thread_data(BOOL create)
 {
     pthread_once(&oneTimeInit, init_j2objc_thread_data);
     j2objc_pthread_data *data = (j2objc_pthread_data *)pthread_getspecific(j2objc_pthread_key);
-    if (!data && !create) {
-      return NULL;
-    }
-    if (!data) {
+    if (!data && create) {
       data = (j2objc_pthread_data *)calloc(1, sizeof(j2objc_pthread_data));
       pthread_setspecific(j2objc_pthread_key, data);
     }
+    return data;
+}
+
+
+static SyncCache *fetch_cache(BOOL create)
+{
+    j2objc_pthread_data *data = fetch_thread_data(create);
+    if (!data) {
+      return NULL;
+    }
     if (!data->syncCache) {
         if (!create) {
             return NULL;
@@ -178,6 +518,7 @@ static SyncCache *fetch_cache(BOOL create)
 
 static SyncCacheItem* id2SyncCacheItem(id object, enum usage why)
 {
+    pthread_once(&oneTimeInit, init_j2objc_thread_data);
     J2OBJC_FAST_LOCK_TYPE *lockp = &LOCK_FOR_OBJ(object);
     SyncData **listp = &LIST_FOR_OBJ(object);
     SyncData* result = NULL;
@@ -210,6 +551,8 @@ static SyncCacheItem* id2SyncCacheItem(id object, enum usage why)
                     cache->list[i] = cache->list[--cache->used];
                     // atomic because may collide with concurrent ACQUIRE
                     OSAtomicDecrement32Barrier(&result->threadCount);
+                    // The caller decrements the ThinLock's slowCount once it
+                    // has unlocked the mutex.
                 }
                 break;
             case CHECK:
@@ -271,6 +614,10 @@ static SyncCacheItem* id2SyncCacheItem(id object, enum usage why)
     __Require_noErr_String(err, done, "pthread_mutex_init failed");
     err = pthread_cond_init(&result->conditionVariable, NULL);
     __Require_noErr_String(err, done, "pthread_cond_init failed");
+    err = pthread_mutex_init(&result->thinLockMutex, NULL);
+    __Require_noErr_String(err, done, "pthread_mutex_init failed");
+    err = pthread_cond_init(&result->thinLockReleased, NULL);
+    __Require_noErr_String(err, done, "pthread_cond_init failed");
     result->nextData = *listp;
     *listp = result;
 
@@ -290,6 +637,11 @@ static SyncCacheItem* id2SyncCacheItem(id object, enum usage why)
         if (!cache) cache = fetch_cache(YES);
         item = &cache->list[cache->used++];
         *item = (SyncCacheItem){result, 1};
+
+        // Keep other threads from thin locking objects of this ThinLock until
+        // the item is released. The caller waits for a thin lock on object to
+        // be released before it acquires the mutex.
+        __c11_atomic_fetch_add(&THIN_LOCK_FOR_OBJ(object)->slowCount, 1, __ATOMIC_SEQ_CST);
     }
 
  really_done:
@@ -304,6 +656,170 @@ static SyncData* id2data(id object, enum usage why)
 }
 
 
+// Returns the SyncData that is associated with object, or NULL, without
+// registering the current thread.
+static SyncData* find_sync_data(id object)
+{
+    J2OBJC_FAST_LOCK_TYPE *lockp = &LOCK_FOR_OBJ(object);
+    SyncData* result;
+
+    J2OBJC_FAST_LOCK_LOCK(lockp);
+    for (result = LIST_FOR_OBJ(object); result != NULL; result = result->nextData) {
+        if (result->object == object) {
+            break;
+        }
+    }
+    J2OBJC_FAST_LOCK_UNLOCK(lockp);
+    return result;
+}
+
+
+// Returns the current thread's item for a thin lock on object, or NULL.
+static ThinLockItem* find_thin_lock_item(j2objc_pthread_data *data, id object)
+{
+    if (data) {
+        for (unsigned i = 0; i < data->thinLockCount; i++) {
+            if (data->thinLocks[i].object == object) {
+                return &data->thinLocks[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static void remove_thin_lock_item(j2objc_pthread_data *data, ThinLockItem *item)
+{
+    *item = data->thinLocks[--data->thinLockCount];
+}
+
+
+// Releases a thin lock and wakes the threads that wait for it in
+// wait_for_thin_lock().
+static void release_thin_lock(ThinLock *thinLock, id object)
+{
+    __c11_atomic_store(&thinLock->object, 0, __ATOMIC_SEQ_CST);
+    if (__c11_atomic_load(&thinLock->slowCount, __ATOMIC_SEQ_CST) != 0) {
+        SyncData *data = find_sync_data(object);
+        if (data) {
+            pthread_mutex_lock(&data->thinLockMutex);
+            pthread_cond_broadcast(&data->thinLockReleased);
+            pthread_mutex_unlock(&data->thinLockMutex);
+        }
+    }
+}
+
+
+// Locks object with a thin lock if it is already thin locked by this thread or
+// not locked at all, and returns the thread's item for it. Returns NULL if the
+// SyncData has to be used instead.
+static ThinLockItem* thin_lock_enter(id object)
+{
+    j2objc_pthread_data *data = fetch_thread_data(YES);
+    ThinLockItem *item = find_thin_lock_item(data, object);
+    if (item) {
+        item->lockCount++;
+        return item;
+    }
+    if (data->thinLockCount == THIN_LOCK_CACHE_SIZE) {
+        return NULL;
+    }
+    ThinLock *thinLock = THIN_LOCK_FOR_OBJ(object);
+    if (__c11_atomic_load(&thinLock->slowCount, __ATOMIC_RELAXED) != 0) {
+        return NULL;
+    }
+    uintptr_t expected = 0;
+    if (!__c11_atomic_compare_exchange_strong(&thinLock->object, &expected, (uintptr_t)object,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    if (__c11_atomic_load(&thinLock->slowCount, __ATOMIC_SEQ_CST) != 0) {
+        // Another thread started using the SyncData in the meantime.
+        release_thin_lock(thinLock, object);
+        return NULL;
+    }
+    item = &data->thinLocks[data->thinLockCount++];
+    *item = (ThinLockItem){object, 1};
+    return item;
+}
+
+
+// Unlocks object if this thread holds a thin lock on it. Returns false if the
+// SyncData has to be used instead.
+static BOOL thin_lock_exit(id object)
+{
+    j2objc_pthread_data *data = fetch_thread_data(NO);
+    ThinLockItem *item = find_thin_lock_item(data, object);
+    if (!item) {
+        return NO;
+    }
+    if (--item->lockCount == 0) {
+        if (PROFILING()) {
+            profile_exit(object, item->acquiredAt);
+        }
+        remove_thin_lock_item(data, item);
+        release_thin_lock(THIN_LOCK_FOR_OBJ(object), object);
+    }
+    return YES;
+}
+
+
+static BOOL thin_lock_held(id object)
+{
+    return find_thin_lock_item(fetch_thread_data(NO), object) != NULL;
+}
+
+
+// Called before this thread first acquires the SyncData mutex of object. Waits
+// until no other thread holds a thin lock on object, and sets *blocked if it
+// had to.
+static int wait_for_thin_lock(id object, SyncData *data, JavaLangThread *javaThread,
+                              BOOL *blocked)
+{
+    ThinLock *thinLock = THIN_LOCK_FOR_OBJ(object);
+    int result = 0;
+    pthread_mutex_lock(&data->thinLockMutex);
+    while (result == 0 &&
+           __c11_atomic_load(&thinLock->object, __ATOMIC_SEQ_CST) == (uintptr_t)object) {
+        *blocked = YES;
+        if (javaThread != NULL) {
+            JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_BLOCKED);
+        }
+        result = pthread_cond_wait(&data->thinLockReleased, &data->thinLockMutex);
+        if (javaThread != NULL) {
+            JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_RUNNABLE);
+        }
+    }
+    pthread_mutex_unlock(&data->thinLockMutex);
+    return result;
+}
+
+
+// Moves this thread's thin lock on object, if any, to the SyncData mutex, which
+// wait() and notify() need.
+static void inflate_thin_lock(id object)
+{
+    j2objc_pthread_data *data = fetch_thread_data(NO);
+    ThinLockItem *thinItem = find_thin_lock_item(data, object);
+    if (!thinItem) {
+        return;
+    }
+    unsigned int lockCount = thinItem->lockCount;
+    uint64_t acquiredAt = thinItem->acquiredAt;
+    remove_thin_lock_item(data, thinItem);
+
+    // Other threads wait for the thin lock to be released before they acquire
+    // the mutex, so this doesn't block.
+    SyncCacheItem *item = id2SyncCacheItem(object, ACQUIRE);
+    for (unsigned int i = 0; i < lockCount; i++) {
+        pthread_mutex_lock(&item->data->mutex);
+    }
+    item->lockCount = lockCount;
+    item->acquiredAt = acquiredAt;
+    release_thin_lock(THIN_LOCK_FOR_OBJ(object), object);
+}
+
+
 __private_extern__ __attribute__((noinline))
 int objc_sync_nil(void)
 {
@@ -319,22 +835,55 @@ int objc_sync_enter(id obj)
     int result = OBJC_SYNC_SUCCESS;
 
     if (obj) {
-        SyncData* data = id2data(obj, ACQUIRE);
-        __Require_Action_String(data != NULL, done, result = OBJC_SYNC_NOT_INITIALIZED, "id2data failed");
+        ThinLockItem *thinItem = thin_lock_enter(obj);
+        if (thinItem) {
+            if (PROFILING()) {
+                if (thinItem->lockCount == 1) {
+                    thinItem->acquiredAt = mach_absolute_time();
+                }
+                profile_enter(obj, NO, 0);
+            }
+            return OBJC_SYNC_SUCCESS;
+        }
+
+        SyncCacheItem* item = id2SyncCacheItem(obj, ACQUIRE);
+        __Require_Action_String(item != NULL, done, result = OBJC_SYNC_NOT_INITIALIZED, "id2data failed");
+        SyncData* data = item->data;
 
+        BOOL profiling = PROFILING();
+        uint64_t start = profiling ? mach_absolute_time() : 0;
+        BOOL blocked = NO;
         JavaLangThread *javaThread = getCurrentJavaThreadOrNull();
-        if (javaThread != NULL) {
+        if (item->lockCount == 1) {
+            result = wait_for_thin_lock(obj, data, javaThread, &blocked);
+            __Require_noErr_String(result, done, "pthread_cond_wait failed");
+        }
+
+        if (javaThread != NULL || profiling) {
             result = pthread_mutex_trylock(&data->mutex);
             if (result != 0 ) {
-                JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_BLOCKED);
+                blocked = YES;
+                if (javaThread != NULL) {
+                    JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_BLOCKED);
+                }
                 result = pthread_mutex_lock(&data->mutex);
-                JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_RUNNABLE);
+                if (javaThread != NULL) {
+                    JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_RUNNABLE);
+                }
             }
         } else {
             result = pthread_mutex_lock(&data->mutex);
         }
 
         __Require_noErr_String(result, done, "pthread_mutex_lock failed");
+
+        if (profiling) {
+            uint64_t now = mach_absolute_time();
+            if (item->lockCount == 1) {
+                item->acquiredAt = now;
+            }
+            profile_enter(obj, blocked, blocked ? now - start : 0);
+        }
     } else {
         // @synchronized(nil) does nothing
 #ifdef DEBUG_NIL_SYNC
@@ -355,10 +904,24 @@ int objc_sync_exit(id obj)
     int result = OBJC_SYNC_SUCCESS;
 
     if (obj) {
+        if (thin_lock_exit(obj)) {
+            return OBJC_SYNC_SUCCESS;
+        }
+
+        SyncCacheItem* item = id2SyncCacheItem(obj, TEST);
+        BOOL lastRelease = item && item->lockCount == 1;
+        if (lastRelease && PROFILING()) {
+            profile_exit(obj, item->acquiredAt);
+        }
+
         SyncData* data = id2data(obj, RELEASE);
         __Require_Action_String(data != NULL, done, result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR, "id2data failed");
 
         result = pthread_mutex_unlock(&data->mutex);
+        if (lastRelease) {
+            // Only now may objects of this ThinLock be thin locked again.
+            __c11_atomic_fetch_sub(&THIN_LOCK_FOR_OBJ(obj)->slowCount, 1, __ATOMIC_SEQ_CST);
+        }
         __Require_noErr_String(result, done, "pthread_mutex_unlock failed");
     } else {
         // @synchronized(nil) does nothing
@@ -378,6 +941,7 @@ int objc_sync_wait(id obj, long long milliSecondsMaxWait)
 {
     int result = OBJC_SYNC_SUCCESS;
 
+    inflate_thin_lock(obj);
     SyncCacheItem* syncCacheItem = id2SyncCacheItem(obj, CHECK);
 
     if (!syncCacheItem) {
@@ -393,6 +957,7 @@ int objc_sync_wait(id obj, long long milliSecondsMaxWait)
     }
 
     JavaLangThread *javaThread = getCurrentJavaThreadOrNull();
+    uint64_t waitStart = PROFILING() ? mach_absolute_time() : 0;
 
     // XXX need to retry cond_wait under out-of-our-control failures
     if ( milliSecondsMaxWait == 0 ) {
@@ -422,6 +987,16 @@ done:
       JreAssignVolatileInt(&javaThread->state_, JavaLangThread_STATE_RUNNABLE);
     }
 
+    if (waitStart != 0) {
+        uint64_t waitTime = mach_absolute_time() - waitStart;
+        profile_wait(obj, waitTime);
+        // The lock isn't held while waiting.
+        SyncCacheItem* item = id2SyncCacheItem(obj, TEST);
+        if (item && item->acquiredAt != 0) {
+            item->acquiredAt += waitTime;
+        }
+    }
+
     if ( result == EPERM )
         result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
     else if ( result == ETIMEDOUT )
@@ -442,6 +1017,11 @@ int objc_sync_notify(id obj)
 {
     int result = OBJC_SYNC_SUCCESS;
 
+    // No thread can wait on an object that is thin locked.
+    if (thin_lock_held(obj)) {
+      return OBJC_SYNC_SUCCESS;
+    }
+
     SyncData* data = id2data(obj, CHECK);
     if (!data) {
       return OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
@@ -464,6 +1044,11 @@ int objc_sync_notifyAll(id obj)
 {
     int result = OBJC_SYNC_SUCCESS;
 
+    // No thread can wait on an object that is thin locked.
+    if (thin_lock_held(obj)) {
+      return OBJC_SYNC_SUCCESS;
+    }
+
     SyncData* data = id2data(obj, CHECK);
     if (!data) {
       return OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
@@ -483,8 +1068,195 @@ done:
 // Returns true if an object has a pthread_mutux allocated for it on this thread.
 BOOL j2objc_sync_holds_lock(id obj) {
   (void)nil_chk(obj);
+  if (thin_lock_held(obj)) {
+    return YES;
+  }
   SyncData* data = id2data(obj, TEST);
   return data ? YES : NO;
 }
+
+
+void j2objc_sync_set_profiling_enabled(BOOL enabled) {
+  pthread_once(&oneTimeInit, init_j2objc_thread_data);
+  set_profiling_enabled(enabled);
+}
+
+
+BOOL j2objc_sync_profiling_enabled(void) {
+  return __c11_atomic_load(&sProfilingEnabled, __ATOMIC_RELAXED);
+}
+
+
+static void reset_contention(ContentionStats *stats) {
+  __c11_atomic_store(&stats->contendedAcquisitions, 0, __ATOMIC_RELAXED);
+  __c11_atomic_store(&stats->blockedTime, 0, __ATOMIC_RELAXED);
+  __c11_atomic_store(&stats->maxBlockedTime, 0, __ATOMIC_RELAXED);
+  __c11_atomic_store(&stats->waits, 0, __ATOMIC_RELAXED);
+  __c11_atomic_store(&stats->waitTime, 0, __ATOMIC_RELAXED);
+}
+
+
+void j2objc_sync_reset_profile(void) {
+  pthread_mutex_lock(&sProfileMutex);
+  ClassProfile *classProfiles = __c11_atomic_load(&sClassProfiles, __ATOMIC_RELAXED);
+  ObjectProfile *objectProfiles = __c11_atomic_load(&sObjectProfiles, __ATOMIC_RELAXED);
+  if (classProfiles) {
+    // Acquisitions that are recorded concurrently may be partly lost. Class
+    // entries are kept, since the classes are likely to be locked again.
+    for (int i = 0; i < PROFILE_CLASS_TABLE_SIZE; i++) {
+      ClassProfile *profile = &classProfiles[i];
+      __c11_atomic_store(&profile->acquisitions, 0, __ATOMIC_RELAXED);
+      __c11_atomic_store(&profile->heldTime, 0, __ATOMIC_RELAXED);
+      reset_contention(&profile->contention);
+    }
+    for (int i = 0; i < PROFILE_OBJECT_TABLE_SIZE; i++) {
+      ObjectProfile *profile = &objectProfiles[i];
+      reset_contention(&profile->contention);
+      for (int j = 0; j < PROFILE_MAX_CALL_SITES; j++) {
+        __c11_atomic_store(&profile->callSites[j].count, 0, __ATOMIC_RELAXED);
+        __c11_atomic_store(&profile->callSites[j].pc, 0, __ATOMIC_RELAXED);
+      }
+      __c11_atomic_store(&profile->otherCallSites, 0, __ATOMIC_RELAXED);
+      __c11_atomic_store(&profile->cls, 0, __ATOMIC_RELAXED);
+      __c11_atomic_store(&profile->object, 0, __ATOMIC_RELEASE);
+    }
+  }
+  __c11_atomic_store(&sUnprofiledAcquisitions, 0, __ATOMIC_RELAXED);
+  __c11_atomic_store(&sUnprofiledContentions, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&sProfileMutex);
+}
+
+
+// Orders by time blocked, then by contended acquisitions.
+static int compare_contention(const ContentionStats *s1, const ContentionStats *s2) {
+  uint64_t values1[] = {
+    __c11_atomic_load(&s1->blockedTime, __ATOMIC_RELAXED),
+    __c11_atomic_load(&s1->contendedAcquisitions, __ATOMIC_RELAXED) };
+  uint64_t values2[] = {
+    __c11_atomic_load(&s2->blockedTime, __ATOMIC_RELAXED),
+    __c11_atomic_load(&s2->contendedAcquisitions, __ATOMIC_RELAXED) };
+  for (int i = 0; i < 2; i++) {
+    if (values1[i] != values2[i]) {
+      return values1[i] > values2[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+
+static int compare_class_profiles(const void *a, const void *b) {
+  ClassProfile *p1 = *(ClassProfile **)a;
+  ClassProfile *p2 = *(ClassProfile **)b;
+  int result = compare_contention(&p1->contention, &p2->contention);
+  if (result == 0) {
+    uint64_t acquisitions1 = __c11_atomic_load(&p1->acquisitions, __ATOMIC_RELAXED);
+    uint64_t acquisitions2 = __c11_atomic_load(&p2->acquisitions, __ATOMIC_RELAXED);
+    if (acquisitions1 != acquisitions2) {
+      result = acquisitions1 > acquisitions2 ? -1 : 1;
+    }
+  }
+  return result;
+}
+
+
+static int compare_object_profiles(const void *a, const void *b) {
+  return compare_contention(&(*(ObjectProfile **)a)->contention,
+                            &(*(ObjectProfile **)b)->contention);
+}
+
+
+void j2objc_sync_print_profile(FILE *out) {
+  pthread_mutex_lock(&sProfileMutex);
+  ClassProfile *classProfiles = __c11_atomic_load(&sClassProfiles, __ATOMIC_RELAXED);
+  ObjectProfile *objectProfiles = __c11_atomic_load(&sObjectProfiles, __ATOMIC_RELAXED);
+  ClassProfile **classes = NULL;
+  ObjectProfile **objects = NULL;
+  int classCount = 0;
+  int objectCount = 0;
+  if (classProfiles) {
+    classes = (ClassProfile **)malloc(PROFILE_CLASS_TABLE_SIZE * sizeof(ClassProfile *));
+    for (int i = 0; i < PROFILE_CLASS_TABLE_SIZE; i++) {
+      if (__c11_atomic_load(&classProfiles[i].acquisitions, __ATOMIC_RELAXED) != 0) {
+        classes[classCount++] = &classProfiles[i];
+      }
+    }
+    qsort(classes, classCount, sizeof(ClassProfile *), compare_class_profiles);
+    objects = (ObjectProfile **)malloc(PROFILE_OBJECT_TABLE_SIZE * sizeof(ObjectProfile *));
+    for (int i = 0; i < PROFILE_OBJECT_TABLE_SIZE; i++) {
+      ContentionStats *stats = &objectProfiles[i].contention;
+      if (__c11_atomic_load(&stats->contendedAcquisitions, __ATOMIC_RELAXED) != 0) {
+        objects[objectCount++] = &objectProfiles[i];
+      }
+    }
+    qsort(objects, objectCount, sizeof(ObjectProfile *), compare_object_profiles);
+  }
+
+  mach_timebase_info_data_t timebase;
+  mach_timebase_info(&timebase);
+  double msPerTick = (double)timebase.numer / timebase.denom / 1e6;
+#define TO_MS(field) (__c11_atomic_load(&(field), __ATOMIC_RELAXED) * msPerTick)
+
+  fprintf(out, "Monitor profile of %d classes, most time blocked first:\n", classCount);
+  fprintf(out, "%12s %10s %12s %10s %12s %8s %12s  %s\n", "acquired", "contended",
+          "blocked ms", "max ms", "held ms", "waits", "wait ms", "class");
+  for (int i = 0; i < classCount; i++) {
+    ClassProfile *profile = classes[i];
+    ContentionStats *stats = &profile->contention;
+    Class cls = (Class)__c11_atomic_load(&profile->cls, __ATOMIC_RELAXED);
+    fprintf(out, "%12" PRIu64 " %10" PRIu64 " %12.3f %10.3f %12.3f %8" PRIu64 " %12.3f  %s\n",
+            __c11_atomic_load(&profile->acquisitions, __ATOMIC_RELAXED),
+            __c11_atomic_load(&stats->contendedAcquisitions, __ATOMIC_RELAXED),
+            TO_MS(stats->blockedTime), TO_MS(stats->maxBlockedTime), TO_MS(profile->heldTime),
+            __c11_atomic_load(&stats->waits, __ATOMIC_RELAXED), TO_MS(stats->waitTime),
+            class_getName(cls));
+  }
+  uint64_t unprofiled = __c11_atomic_load(&sUnprofiledAcquisitions, __ATOMIC_RELAXED);
+  if (unprofiled != 0) {
+    fprintf(out, "%12" PRIu64 " acquisitions of classes that didn't fit in the profile\n",
+            unprofiled);
+  }
+
+  fprintf(out, "Contended objects: %d, most time blocked first:\n", objectCount);
+  fprintf(out, "%10s %12s %10s %8s %12s  %s\n", "contended", "blocked ms", "max ms", "waits",
+          "wait ms", "object");
+  for (int i = 0; i < objectCount; i++) {
+    ObjectProfile *profile = objects[i];
+    ContentionStats *stats = &profile->contention;
+    Class cls = (Class)__c11_atomic_load(&profile->cls, __ATOMIC_RELAXED);
+    fprintf(out, "%10" PRIu64 " %12.3f %10.3f %8" PRIu64 " %12.3f  %p %s\n",
+            __c11_atomic_load(&stats->contendedAcquisitions, __ATOMIC_RELAXED),
+            TO_MS(stats->blockedTime), TO_MS(stats->maxBlockedTime),
+            __c11_atomic_load(&stats->waits, __ATOMIC_RELAXED), TO_MS(stats->waitTime),
+            (void *)__c11_atomic_load(&profile->object, __ATOMIC_RELAXED),
+            cls ? class_getName(cls) : "?");
+    for (int j = 0; j < PROFILE_MAX_CALL_SITES; j++) {
+      uintptr_t pc = __c11_atomic_load(&profile->callSites[j].pc, __ATOMIC_RELAXED);
+      if (pc == 0) {
+        break;
+      }
+      uint64_t siteCount = __c11_atomic_load(&profile->callSites[j].count, __ATOMIC_RELAXED);
+      Dl_info info;
+      if (dladdr((void *)pc, &info) && info.dli_sname) {
+        fprintf(out, "    %10" PRIu64 " contended at %s+%#lx (%s)\n", siteCount, info.dli_sname,
+                (unsigned long)(pc - (uintptr_t)info.dli_saddr), info.dli_fname);
+      } else {
+        fprintf(out, "    %10" PRIu64 " contended at %p\n", siteCount, (void *)pc);
+      }
+    }
+    uint64_t others = __c11_atomic_load(&profile->otherCallSites, __ATOMIC_RELAXED);
+    if (others != 0) {
+      fprintf(out, "    %10" PRIu64 " contended at other call sites\n", others);
+    }
+  }
+#undef TO_MS
+  uint64_t unprofiledContentions = __c11_atomic_load(&sUnprofiledContentions, __ATOMIC_RELAXED);
+  if (unprofiledContentions != 0) {
+    fprintf(out, "%10" PRIu64 " contended acquisitions of objects that didn't fit in the profile\n",
+            unprofiledContentions);
+  }
+  free(classes);
+  free(objects);
+  pthread_mutex_unlock(&sProfileMutex);
+}
 #pragma clang diagnostic pop
 
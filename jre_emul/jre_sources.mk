@@ -46,6 +46,7 @@ NATIVE_JRE_SOURCES_CORE = \
   NSString+JavaString.m \
   ObjectInputStream.m \
   ObjectOutputStream.m \
+  ThreadRecordList.m \
   UnixFileSystem_md.m \
   canonicalize_md.m \
   io_util.m \
@@ -0,0 +1,126 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of concurrent FastPointerLookup() calls. It only
+// depends on pthreads, so it also runs on Linux. To build it from jre_emul:
+//
+//   clang -O2 -pthread -IClasses -o fpl_benchmark -x c misc_tests/FastPointerLookupBenchmark.c \
+//     Classes/FastPointerLookup.m Classes/ThreadRecordList.m
+//   ./fpl_benchmark [threads] [lookups per thread] [keys]
+//
+// On macOS, "make -f tests.mk run-fast-pointer-lookup-benchmark" builds and
+// runs it with the defaults. That target needs the full j2objc build setup,
+// so on Linux only the command above works.
+//
+// While the reader threads run, another thread keeps adding keys so that the
+// store is resized and retired concurrently. Each lookup result is checked.
+
+#include "FastPointerLookup.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Keys look like object pointers and map to their complement.
+#define KEY(i) ((void *)(((uintptr_t)(i) + 1) << 4))
+#define VALUE(key) ((void *)~(uintptr_t)(key))
+
+static void *CreateValue(void *key) {
+  return VALUE(key);
+}
+
+static FastPointerLookup_t lookup = FAST_POINTER_LOOKUP_INIT(&CreateValue);
+
+static long numLookups;
+static long numKeys;
+static _Atomic(int) readersRunning;
+static _Atomic(long) failures;
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *Reader(void *arg) {
+  uintptr_t seed = (uintptr_t)arg * 2654435761u + 1;
+  long localFailures = 0;
+  for (long i = 0; i < numLookups; i++) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    void *key = KEY((seed >> 33) % numKeys);
+    if (FastPointerLookup(&lookup, key) != VALUE(key)) {
+      localFailures++;
+    }
+  }
+  __c11_atomic_fetch_add(&failures, localFailures, __ATOMIC_RELAXED);
+  __c11_atomic_fetch_sub(&readersRunning, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void *Writer(void *arg) {
+  // Keys beyond the ones that the readers use, which grow the store.
+  long i = numKeys;
+  while (__c11_atomic_load(&readersRunning, __ATOMIC_ACQUIRE) > 0) {
+    FastPointerLookupAddMapping(&lookup, KEY(i), VALUE(KEY(i)));
+    i++;
+    if (i % 1024 == 0) {
+      usleep(100);
+    }
+  }
+  *(long *)arg = i - numKeys;
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  long numThreads = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  numLookups = argc > 2 ? atol(argv[2]) : 10000000;
+  numKeys = argc > 3 ? atol(argv[3]) : 1000;
+  if (numThreads < 1 || numLookups < 1 || numKeys < 1) {
+    fprintf(stderr, "usage: %s [threads] [lookups per thread] [keys]\n", argv[0]);
+    return 1;
+  }
+
+  // Populate the lookup, like the classes that are in use early on.
+  for (long i = 0; i < numKeys; i++) {
+    FastPointerLookup(&lookup, KEY(i));
+  }
+
+  pthread_t *readers = (pthread_t *)malloc(sizeof(pthread_t) * numThreads);
+  pthread_t writer;
+  long keysAdded = 0;
+  __c11_atomic_store(&readersRunning, (int)numThreads, __ATOMIC_RELAXED);
+  double start = Now();
+  for (long i = 0; i < numThreads; i++) {
+    pthread_create(&readers[i], NULL, &Reader, (void *)i);
+  }
+  pthread_create(&writer, NULL, &Writer, &keysAdded);
+  for (long i = 0; i < numThreads; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  double elapsed = Now() - start;
+  pthread_join(writer, NULL);
+  free(readers);
+
+  double total = (double)numThreads * numLookups;
+  printf("%ld threads, %ld keys, %ld keys added concurrently\n",
+         numThreads, numKeys, keysAdded);
+  printf("%.0f lookups in %.3f s: %.1f M lookups/s, %.2f ns per lookup per thread\n",
+         total, elapsed, total / elapsed * 1e-6, elapsed * numThreads / total * 1e9);
+  long failed = __c11_atomic_load(&failures, __ATOMIC_RELAXED);
+  if (failed > 0) {
+    printf("FAILED: %ld lookups returned the wrong value\n", failed);
+    return 1;
+  }
+  return 0;
+}
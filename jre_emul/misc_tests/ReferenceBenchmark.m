@@ -0,0 +1,166 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of concurrent java.lang.ref.Reference churn. Each
+// thread creates referents with weak, phantom and soft references to them,
+// gets and clears some of the references, and releases the referents, whose
+// deallocation clears and enqueues the remaining references. Each referent
+// also gets one of a shared set of long-lived referents, like a cache that is
+// based on a WeakHashMap. To build it from jre_emul:
+//
+//   ../dist/j2objcc -O2 -ObjC -ljre_emul -o reference_benchmark misc_tests/ReferenceBenchmark.m
+//   ./reference_benchmark [threads] [referents per thread]
+//
+// "make -f tests.mk run-reference-benchmark" builds and runs it with the
+// defaults.
+//
+// Every reference is checked after its referent is released, and each queue is
+// checked to have received the references that were cleared by a dealloc.
+
+#import "java/lang/ref/PhantomReference.h"
+#import "java/lang/ref/ReferenceQueue.h"
+#import "java/lang/ref/SoftReference.h"
+#import "java/lang/ref/WeakReference.h"
+
+#import <pthread.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <time.h>
+#import <unistd.h>
+
+// The number of referents that are created in each autorelease pool.
+#define BATCH_SIZE 64
+
+#define NUM_SHARED 1024
+
+static long numReferents;
+static id sharedReferents[NUM_SHARED];
+static JavaLangRefWeakReference *sharedReferences[NUM_SHARED];
+static _Atomic(long) failures;
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *Worker(void *arg) {
+  uintptr_t seed = (uintptr_t)arg * 2654435761u + 1;
+  long localFailures = 0;
+  JavaLangRefReferenceQueue *queue = new_JavaLangRefReferenceQueue_init();
+  JavaLangRefReference *references[BATCH_SIZE * 2];
+  for (long done = 0; done < numReferents; done += BATCH_SIZE) {
+    int numReferences = 0;
+    long numEnqueued = 0;
+    @autoreleasepool {
+      for (int i = 0; i < BATCH_SIZE; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        id referent = [[NSObject alloc] init];
+        JavaLangRefWeakReference *weak =
+            new_JavaLangRefWeakReference_initWithId_withJavaLangRefReferenceQueue_(referent, queue);
+        references[numReferences++] = weak;
+        numEnqueued++;
+        int kind = (seed >> 33) % 4;
+        switch (kind) {
+          case 0:
+            references[numReferences++] =
+                new_JavaLangRefPhantomReference_initWithId_withJavaLangRefReferenceQueue_(
+                    referent, queue);
+            numEnqueued++;
+            break;
+          case 1: {
+            // Soft referents aren't released on OS X, so it is cleared.
+            JavaLangRefSoftReference *soft =
+                new_JavaLangRefSoftReference_initWithId_withJavaLangRefReferenceQueue_(
+                    referent, queue);
+            if ([soft get] != referent) {
+              localFailures++;
+            }
+            [soft clear];
+            references[numReferences++] = soft;
+            break;
+          }
+          case 2:
+            [weak clear];
+            numEnqueued--;
+            break;
+        }
+        if ([weak get] != (kind == 2 ? nil : referent)) {
+          localFailures++;
+        }
+        long shared = (seed >> 40) % NUM_SHARED;
+        if ([sharedReferences[shared] get] != sharedReferents[shared]) {
+          localFailures++;
+        }
+        [referent release];
+      }
+    }
+
+    // The referents that get() returned were released by the pool.
+    @autoreleasepool {
+      for (int i = 0; i < numReferences; i++) {
+        if ([references[i] get] != nil) {
+          localFailures++;
+        }
+      }
+      long numPolled = 0;
+      while ([queue poll]) {
+        numPolled++;
+      }
+      if (numPolled != numEnqueued) {
+        localFailures++;
+      }
+    }
+    for (int i = 0; i < numReferences; i++) {
+      [references[i] release];
+    }
+  }
+  [queue release];
+  __c11_atomic_fetch_add(&failures, localFailures, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  long numThreads = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  numReferents = argc > 2 ? atol(argv[2]) : 200000;
+  if (numThreads < 1 || numReferents < 1) {
+    fprintf(stderr, "usage: %s [threads] [referents per thread]\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = 0; i < NUM_SHARED; i++) {
+    sharedReferents[i] = [[NSObject alloc] init];
+    sharedReferences[i] = new_JavaLangRefWeakReference_initWithId_(sharedReferents[i]);
+  }
+
+  pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * numThreads);
+  double start = Now();
+  for (long i = 0; i < numThreads; i++) {
+    pthread_create(&workers[i], NULL, &Worker, (void *)i);
+  }
+  for (long i = 0; i < numThreads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  double elapsed = Now() - start;
+  free(workers);
+
+  double total = (double)numThreads * numReferents;
+  printf("%ld threads, %ld referents per thread\n", numThreads, numReferents);
+  printf("%.0f referents in %.3f s: %.2f M referents/s, %.0f ns per referent per thread\n",
+         total, elapsed, total / elapsed * 1e-6, elapsed * numThreads / total * 1e9);
+  long failed = __c11_atomic_load(&failures, __ATOMIC_RELAXED);
+  if (failed > 0) {
+    printf("FAILED: %ld checks failed\n", failed);
+    return 1;
+  }
+  return 0;
+}
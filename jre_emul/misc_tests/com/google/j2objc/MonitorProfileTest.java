@@ -0,0 +1,165 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.google.j2objc;
+
+import java.util.concurrent.CountDownLatch;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
+import junit.framework.TestCase;
+
+/*-[
+#include "objc-sync.h"
+]-*/
+
+/**
+ * Tests for the monitor profiler in objc-sync.m.
+ */
+public class MonitorProfileTest extends TestCase {
+
+  private static class ShortLivedLock {}
+
+  private static class ContendedLock {}
+
+  private static native void setProfilingEnabled(boolean enabled) /*-[
+    j2objc_sync_set_profiling_enabled(enabled);
+  ]-*/;
+
+  private static native boolean isProfilingEnabled() /*-[
+    return j2objc_sync_profiling_enabled();
+  ]-*/;
+
+  private static native void resetProfile() /*-[
+    j2objc_sync_reset_profile();
+  ]-*/;
+
+  private static native String printProfile() /*-[
+    char *buffer = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buffer, &size);
+    j2objc_sync_print_profile(out);
+    fclose(out);
+    NSString *report = [NSString stringWithUTF8String:buffer];
+    free(buffer);
+    return report;
+  ]-*/;
+
+  @Override
+  protected void tearDown() throws Exception {
+    setProfilingEnabled(false);
+    resetProfile();
+    super.tearDown();
+  }
+
+  private static native String objcClassName(Class<?> cls) /*-[
+    return NSStringFromClass(cls.objcClass);
+  ]-*/;
+
+  // Returns the first line of the report that ends with the class, or null.
+  private static String classLine(String report, Class<?> cls) {
+    Pattern pattern =
+        Pattern.compile("^.* " + Pattern.quote(objcClassName(cls)) + "$", Pattern.MULTILINE);
+    Matcher matcher = pattern.matcher(report);
+    return matcher.find() ? matcher.group() : null;
+  }
+
+  private static String contendedObjects(String report) {
+    return report.substring(report.indexOf("Contended objects:"));
+  }
+
+  private static long acquisitions(String line) {
+    return Long.parseLong(line.trim().split("\\s+")[0]);
+  }
+
+  private static void lockShortLivedObjects(int count) {
+    for (int i = 0; i < count; i++) {
+      Object lock = new ShortLivedLock();
+      synchronized (lock) {
+        synchronized (lock) {}
+      }
+    }
+  }
+
+  public void testEnable() {
+    assertFalse(isProfilingEnabled());
+    setProfilingEnabled(true);
+    assertTrue(isProfilingEnabled());
+    setProfilingEnabled(false);
+    assertFalse(isProfilingEnabled());
+  }
+
+  public void testDisabledProfilingRecordsNothing() {
+    setProfilingEnabled(true);
+    setProfilingEnabled(false);
+    lockShortLivedObjects(100);
+    assertNull(classLine(printProfile(), ShortLivedLock.class));
+  }
+
+  public void testUncontendedAcquisitionsAreCountedPerClass() {
+    setProfilingEnabled(true);
+    resetProfile();
+    // Far more objects than the profile has entries for objects.
+    lockShortLivedObjects(20000);
+    String report = printProfile();
+    String line = classLine(report, ShortLivedLock.class);
+    assertNotNull(report, line);
+    assertEquals(line, 40000, acquisitions(line));
+    assertFalse(report, report.contains("didn't fit"));
+    assertNull(report, classLine(contendedObjects(report), ShortLivedLock.class));
+  }
+
+  public void testContendedObjectIsProfiled() throws Exception {
+    setProfilingEnabled(true);
+    resetProfile();
+    final Object lock = new ContendedLock();
+    final CountDownLatch locked = new CountDownLatch(1);
+    Thread holder = new Thread() {
+      @Override
+      public void run() {
+        synchronized (lock) {
+          locked.countDown();
+          try {
+            Thread.sleep(200);
+          } catch (InterruptedException e) {
+            throw new AssertionError(e);
+          }
+        }
+      }
+    };
+    holder.start();
+    locked.await();
+    synchronized (lock) {}
+    holder.join();
+
+    String report = printProfile();
+    String line = classLine(report, ContendedLock.class);
+    assertNotNull(report, line);
+    assertEquals(line, 2, acquisitions(line));
+    assertEquals(line, 1, Long.parseLong(line.trim().split("\\s+")[1]));
+    String objectSection = contendedObjects(report);
+    assertNotNull(report, classLine(objectSection, ContendedLock.class));
+    assertTrue(report, objectSection.contains("1 contended at "));
+  }
+
+  public void testReset() {
+    setProfilingEnabled(true);
+    lockShortLivedObjects(10);
+    assertNotNull(classLine(printProfile(), ShortLivedLock.class));
+    resetProfile();
+    assertNull(classLine(printProfile(), ShortLivedLock.class));
+    lockShortLivedObjects(10);
+    assertEquals(20, acquisitions(classLine(printProfile(), ShortLivedLock.class)));
+  }
+}
@@ -0,0 +1,311 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.google.j2objc;
+
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+
+import junit.framework.TestCase;
+
+/**
+ * Stress tests for the thin locks in objc-sync.m, which are used until a
+ * monitor is contended or waited on, and the SyncData mutexes they hand off to.
+ */
+public class ThinLockTest extends TestCase {
+
+  private static final int NUM_THREADS = 4;
+  private static final int NUM_ITERATIONS = 20000;
+
+  // The number of thin locks a thread holds before it uses SyncData mutexes.
+  private static final int THIN_LOCK_CACHE_SIZE = 8;
+
+  /** A counter that is only consistent if its monitor excludes other threads. */
+  private static class Counter {
+    int count;
+    Thread owner;
+
+    // Must be called with the monitor held.
+    void increment(int i) {
+      assertNull(owner);
+      owner = Thread.currentThread();
+      int value = count;
+      if (i % 64 == 0) {
+        Thread.yield();
+      }
+      count = value + 1;
+      assertSame(Thread.currentThread(), owner);
+      owner = null;
+    }
+  }
+
+  private interface Task {
+    void run(int thread) throws Exception;
+  }
+
+  private static void runConcurrently(final Task task) throws Exception {
+    final Throwable[] failures = new Throwable[NUM_THREADS];
+    Thread[] threads = new Thread[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+      final int thread = i;
+      threads[i] = new Thread() {
+        @Override
+        public void run() {
+          try {
+            task.run(thread);
+          } catch (Throwable t) {
+            failures[thread] = t;
+          }
+        }
+      };
+      threads[i].start();
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+      threads[i].join();
+      if (failures[i] != null) {
+        throw new AssertionError(failures[i]);
+      }
+    }
+  }
+
+  // The bits of the address that select an object's thin lock, for any number
+  // of thin locks up to 65536.
+  private static native int thinLockSlot(Object obj) /*-[
+    return (jint)(((uintptr_t)obj >> 5) & 0xffff);
+  ]-*/;
+
+  // Returns count groups of size counters that share a thin lock.
+  private static List<Counter[]> newCollidingCounters(int count, int size) {
+    Map<Integer, List<Counter>> bySlot = new HashMap<>();
+    List<Counter[]> groups = new ArrayList<>();
+    while (groups.size() < count) {
+      Counter counter = new Counter();
+      int slot = thinLockSlot(counter);
+      List<Counter> group = bySlot.get(slot);
+      if (group == null) {
+        group = new ArrayList<>();
+        bySlot.put(slot, group);
+      }
+      group.add(counter);
+      if (group.size() == size) {
+        groups.add(group.toArray(new Counter[size]));
+        bySlot.put(slot, new ArrayList<Counter>());
+      }
+    }
+    return groups;
+  }
+
+  public void testContendedHandoff() throws Exception {
+    final Counter counter = new Counter();
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        for (int i = 0; i < NUM_ITERATIONS; i++) {
+          synchronized (counter) {
+            counter.increment(i);
+          }
+        }
+      }
+    });
+    assertEquals(NUM_THREADS * NUM_ITERATIONS, counter.count);
+  }
+
+  public void testRecursiveContendedHandoff() throws Exception {
+    final Counter counter = new Counter();
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        for (int i = 0; i < NUM_ITERATIONS; i++) {
+          synchronized (counter) {
+            synchronized (counter) {
+              counter.increment(i);
+            }
+            assertTrue(Thread.holdsLock(counter));
+          }
+        }
+      }
+    });
+    assertEquals(NUM_THREADS * NUM_ITERATIONS, counter.count);
+    assertFalse(Thread.holdsLock(counter));
+  }
+
+  public void testMoreNestedLocksThanCacheSize() throws Exception {
+    final Counter[] counters = new Counter[THIN_LOCK_CACHE_SIZE * 3];
+    for (int i = 0; i < counters.length; i++) {
+      counters[i] = new Counter();
+    }
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        for (int i = 0; i < NUM_ITERATIONS / 10; i++) {
+          // Every thread locks the counters in the same order, starting at a
+          // different one.
+          int first = thread * 5 % counters.length;
+          lockNested(counters, first, first, i);
+        }
+      }
+    });
+    for (Counter counter : counters) {
+      assertFalse(Thread.holdsLock(counter));
+    }
+    int total = 0;
+    for (Counter counter : counters) {
+      total += counter.count;
+    }
+    int expected = 0;
+    for (int thread = 0; thread < NUM_THREADS; thread++) {
+      expected += (counters.length - thread * 5 % counters.length) * (NUM_ITERATIONS / 10);
+    }
+    assertEquals(expected, total);
+  }
+
+  // Locks counters[index] and the ones after it, which are held on top of
+  // counters[first] to counters[index - 1].
+  private static void lockNested(Counter[] counters, int first, int index, int i) {
+    if (index == counters.length) {
+      for (int j = first; j < counters.length; j++) {
+        assertTrue(Thread.holdsLock(counters[j]));
+      }
+      return;
+    }
+    synchronized (counters[index]) {
+      counters[index].increment(i);
+      lockNested(counters, first, index + 1, i);
+      assertTrue(Thread.holdsLock(counters[index]));
+      if (index + 1 < counters.length) {
+        assertFalse(Thread.holdsLock(counters[index + 1]));
+      }
+    }
+  }
+
+  public void testCollidingObjects() throws Exception {
+    final List<Counter[]> groups = newCollidingCounters(4, NUM_THREADS);
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        for (int i = 0; i < NUM_ITERATIONS; i++) {
+          Counter[] group = groups.get(i % groups.size());
+          // Threads lock different objects that share a thin lock, and one
+          // object while holding another that shares its thin lock.
+          Counter first = group[thread];
+          Counter second = group[(thread + 1) % group.length];
+          synchronized (first) {
+            first.increment(i);
+            if (i % 3 == 0 && thread == 0) {
+              synchronized (second) {
+                second.increment(i);
+              }
+            }
+          }
+        }
+      }
+    });
+    int total = 0;
+    for (Counter[] group : groups) {
+      for (Counter counter : group) {
+        assertFalse(Thread.holdsLock(counter));
+        total += counter.count;
+      }
+    }
+    assertEquals(NUM_THREADS * NUM_ITERATIONS + (NUM_ITERATIONS + 2) / 3, total);
+  }
+
+  public void testWaitOnThinLockedObject() throws Exception {
+    for (int i = 0; i < 100; i++) {
+      final Object lock = new Object();
+      final boolean[] notified = new boolean[1];
+      Thread waiter = new Thread() {
+        @Override
+        public void run() {
+          synchronized (lock) {
+            synchronized (lock) {
+              // The thin lock is moved to the mutex with both levels.
+              while (!notified[0]) {
+                try {
+                  lock.wait();
+                } catch (InterruptedException e) {
+                  throw new AssertionError(e);
+                }
+              }
+              assertTrue(Thread.holdsLock(lock));
+            }
+            assertTrue(Thread.holdsLock(lock));
+          }
+          assertFalse(Thread.holdsLock(lock));
+        }
+      };
+      waiter.start();
+      while (waiter.getState() != Thread.State.WAITING && waiter.isAlive()) {
+        Thread.yield();
+      }
+      synchronized (lock) {
+        notified[0] = true;
+        lock.notify();
+      }
+      waiter.join();
+      // The object can be locked again afterwards.
+      synchronized (lock) {
+        lock.wait(1);
+        assertTrue(Thread.holdsLock(lock));
+      }
+      assertFalse(Thread.holdsLock(lock));
+    }
+  }
+
+  public void testNotifyWhileThinLocked() throws Exception {
+    Object lock = new Object();
+    synchronized (lock) {
+      lock.notify();
+      lock.notifyAll();
+      synchronized (lock) {
+        lock.notifyAll();
+      }
+    }
+    try {
+      lock.notify();
+      fail("Expected IllegalMonitorStateException");
+    } catch (IllegalMonitorStateException e) {
+      // Expected.
+    }
+  }
+
+  public void testProducerConsumer() throws Exception {
+    // Threads hand a token around with wait() and notifyAll(), while the
+    // monitor is also locked without waiting.
+    final Object lock = new Object();
+    final int[] turn = new int[1];
+    final Counter counter = new Counter();
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) throws Exception {
+        for (int i = 0; i < NUM_ITERATIONS / 20; i++) {
+          synchronized (lock) {
+            while (turn[0] % NUM_THREADS != thread) {
+              lock.wait();
+            }
+            turn[0]++;
+            lock.notifyAll();
+          }
+          synchronized (counter) {
+            counter.increment(i);
+          }
+        }
+      }
+    });
+    assertEquals(NUM_THREADS * (NUM_ITERATIONS / 20), turn[0]);
+    assertEquals(NUM_THREADS * (NUM_ITERATIONS / 20), counter.count);
+  }
+}
@@ -0,0 +1,178 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.google.j2objc;
+
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicReference;
+
+import junit.framework.TestCase;
+
+/**
+ * Stress tests for volatile object fields, whose loads retain their values while
+ * other threads replace and release them.
+ */
+public class VolatileObjectTest extends TestCase {
+
+  private static final int NUM_THREADS = 4;
+  private static final int NUM_ITERATIONS = 20000;
+
+  private static class Box {
+    final int value;
+    final String text;
+
+    Box(int value) {
+      this.value = value;
+      this.text = Integer.toString(value);
+    }
+
+    void check() {
+      assertEquals(Integer.toString(value), text);
+    }
+  }
+
+  private static final AtomicInteger liveCountedBoxes = new AtomicInteger();
+
+  private static class CountedBox extends Box {
+    CountedBox(int value) {
+      super(value);
+      liveCountedBoxes.incrementAndGet();
+    }
+
+    @Override
+    protected void finalize() {
+      liveCountedBoxes.decrementAndGet();
+    }
+  }
+
+  private volatile Box box = new Box(0);
+
+  private interface Task {
+    void run(int thread) throws Exception;
+  }
+
+  private static void runConcurrently(final Task task) throws Exception {
+    final Throwable[] failures = new Throwable[NUM_THREADS];
+    Thread[] threads = new Thread[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+      final int thread = i;
+      threads[i] = new Thread() {
+        @Override
+        public void run() {
+          try {
+            task.run(thread);
+          } catch (Throwable t) {
+            failures[thread] = t;
+          }
+        }
+      };
+      threads[i].start();
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+      threads[i].join();
+      if (failures[i] != null) {
+        throw new AssertionError(failures[i]);
+      }
+    }
+  }
+
+  public void testConcurrentLoadAndStore() throws Exception {
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        for (int i = 0; i < NUM_ITERATIONS; i++) {
+          if (thread % 2 == 0) {
+            box = new Box(i);
+          } else {
+            box.check();
+          }
+        }
+      }
+    });
+    box.check();
+  }
+
+  public void testConcurrentCompareAndSet() throws Exception {
+    final AtomicReference<Box> counter = new AtomicReference<>(new Box(0));
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        for (int i = 0; i < NUM_ITERATIONS; i++) {
+          Box current;
+          do {
+            current = counter.get();
+            current.check();
+          } while (!counter.compareAndSet(current, new Box(current.value + 1)));
+        }
+      }
+    });
+    assertEquals(NUM_THREADS * NUM_ITERATIONS, counter.get().value);
+  }
+
+  public void testConcurrentGetAndSet() throws Exception {
+    final AtomicReference<Box> ref = new AtomicReference<>(new Box(0));
+    final long[] sums = new long[NUM_THREADS];
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) {
+        long sum = 0;
+        for (int i = 1; i <= NUM_ITERATIONS; i++) {
+          Box previous = ref.getAndSet(new Box(i));
+          previous.check();
+          sum += previous.value;
+        }
+        sums[thread] = sum;
+      }
+    });
+    // Every value that was set is either returned by exactly one getAndSet() or
+    // is the final value.
+    long total = ref.get().value;
+    for (long sum : sums) {
+      total += sum;
+    }
+    long perThread = (long) NUM_ITERATIONS * (NUM_ITERATIONS + 1) / 2;
+    assertEquals(NUM_THREADS * perThread, total);
+  }
+
+  public void testReplacedValuesAreReleased() throws Exception {
+    // A replaced value is released right away unless a load is retaining it,
+    // in which case the next store on the same thread releases it. Once the
+    // readers are done, each writer stores once more, after which only the
+    // last value can be alive. The threads drain their autorelease pools
+    // before join() returns.
+    final CountDownLatch readersDone = new CountDownLatch(NUM_THREADS / 2);
+    runConcurrently(new Task() {
+      @Override
+      public void run(int thread) throws Exception {
+        if (thread % 2 == 0) {
+          for (int i = 0; i < NUM_ITERATIONS; i++) {
+            box = new CountedBox(i);
+          }
+          readersDone.await();
+          box = new CountedBox(-1);
+        } else {
+          try {
+            for (int i = 0; i < NUM_ITERATIONS; i++) {
+              box.check();
+            }
+          } finally {
+            readersDone.countDown();
+          }
+        }
+      }
+    });
+    assertEquals(1, liveCountedBoxes.get());
+  }
+}
@@ -0,0 +1,163 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package java.lang.ref;
+
+import com.google.j2objc.annotations.AutoreleasePool;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicInteger;
+
+import junit.framework.TestCase;
+
+import sun.misc.Cleaner;
+
+/*-[
+#import "IOSReference.h"
+]-*/
+
+/**
+ * iOS-specific test for references whose referents are released on several
+ * threads at once. Enqueuing a reference, running a Cleaner and reading a
+ * reference all take a shared lock here, so the references must be enqueued
+ * without holding IOSReference's locks.
+ */
+public class ReferenceConcurrencyTest extends TestCase {
+  private static final int THREAD_COUNT = 4;
+  private static final int ITERATIONS = 2000;
+  private static final int LOW_MEMORY_INTERVAL = 100;
+  private static final long TIMEOUT_SECONDS = 60;
+
+  private final Object lock = new Object();
+  private final ReferenceQueue<Object> queue = new ReferenceQueue<Object>();
+  private final AtomicInteger cleanCount = new AtomicInteger();
+  // The latest weak reference that a worker made.
+  private volatile Reference<?> shared;
+
+  /** Reads the shared reference under the lock when it is enqueued. */
+  class LockingWeakReference extends WeakReference<Object> {
+    LockingWeakReference(Object referent) {
+      super(referent, queue);
+    }
+
+    @Override
+    public boolean enqueue() {
+      readShared();
+      return super.enqueue();
+    }
+  }
+
+  private void readShared() {
+    synchronized (lock) {
+      Reference<?> ref = shared;
+      if (ref != null) {
+        ref.get();
+      }
+    }
+  }
+
+  /** Releases weak, soft and phantom referents, and keeps their references. */
+  class Worker extends Thread {
+    private final CountDownLatch start;
+    final List<Reference<?>> references = new ArrayList<Reference<?>>();
+
+    Worker(CountDownLatch start) {
+      this.start = start;
+    }
+
+    @Override
+    public void run() {
+      try {
+        start.await();
+      } catch (InterruptedException e) {
+        return;
+      }
+      for (int i = 0; i < ITERATIONS; i++) {
+        for (@AutoreleasePool int j = 0; j < 1; j++) {
+          Object weakReferent = new Object();
+          Object softReferent = new Object();
+          Object phantomReferent = new Object();
+          LockingWeakReference weakRef = new LockingWeakReference(weakReferent);
+          references.add(weakRef);
+          references.add(new SoftReference<Object>(softReferent, queue));
+          references.add(new PhantomReference<Object>(phantomReferent, queue));
+          Cleaner.create(phantomReferent, new Runnable() {
+            @Override
+            public void run() {
+              readShared();
+              cleanCount.incrementAndGet();
+            }
+          });
+          shared = weakRef;
+          // Takes the lock before IOSReference's, unlike enqueue().
+          readShared();
+        }
+        if (i % LOW_MEMORY_INTERVAL == 0) {
+          fakeLowMemoryNotification();
+        }
+      }
+    }
+  }
+
+  public void testConcurrentReleases() throws Exception {
+    CountDownLatch start = new CountDownLatch(1);
+    List<Worker> workers = new ArrayList<Worker>();
+    for (int i = 0; i < THREAD_COUNT; i++) {
+      Worker worker = new Worker(start);
+      worker.start();
+      workers.add(worker);
+    }
+    start.countDown();
+
+    // Polls while the workers run, so that enqueuing contends for the queue.
+    int polled = 0;
+    long deadline = System.currentTimeMillis() + TimeUnit.SECONDS.toMillis(TIMEOUT_SECONDS);
+    for (Worker worker : workers) {
+      while (worker.isAlive() && System.currentTimeMillis() < deadline) {
+        polled += poll();
+        worker.join(10);
+      }
+      assertFalse("worker deadlocked", worker.isAlive());
+    }
+
+    // Clears the soft references that are left.
+    fakeLowMemoryNotification();
+    polled += poll();
+    int expected = 3 * THREAD_COUNT * ITERATIONS;
+    assertEquals("references weren't all enqueued", expected, polled);
+    assertEquals("cleaners didn't all run", THREAD_COUNT * ITERATIONS, cleanCount.get());
+    for (Worker worker : workers) {
+      for (Reference<?> ref : worker.references) {
+        assertNull("reference wasn't cleared", ref.get());
+      }
+    }
+  }
+
+  private int poll() {
+    int count = 0;
+    Reference<?> ref;
+    while ((ref = queue.poll()) != null) {
+      assertNull("enqueued reference wasn't cleared", ref.get());
+      count++;
+    }
+    return count;
+  }
+
+  private static native void fakeLowMemoryNotification() /*-[
+    [IOSReference handleMemoryWarning:nil];
+  ]-*/;
+}
@@ -286,12 +286,15 @@ TEST_SOURCES := \
     com/google/j2objc/LinkedListTest.java \
     com/google/j2objc/MemoryTest.java \
     com/google/j2objc/MethodTest.java \
+    com/google/j2objc/MonitorProfileTest.java \
     com/google/j2objc/PackageTest.java \
     com/google/j2objc/ReflectionTest.java \
     com/google/j2objc/RetainedWithTest.java \
     com/google/j2objc/StringTest.java \
+    com/google/j2objc/ThinLockTest.java \
     com/google/j2objc/ThreadTest.java \
     com/google/j2objc/ThrowableTest.java \
+    com/google/j2objc/VolatileObjectTest.java \
     com/google/j2objc/io/AsyncPipedNSInputStreamAdapterTest.java \
     com/google/j2objc/java8/CreationReferenceTest.java \
     com/google/j2objc/java8/DefaultMethodsTest.java \
@@ -313,6 +316,7 @@ TEST_SOURCES := \
     java/io/FileTest.java \
     java/lang/SystemTest.java \
     java/lang/ref/PhantomReferenceTest.java \
+    java/lang/ref/ReferenceConcurrencyTest.java \
     java/lang/ref/SoftReferenceTest.java \
     java/lang/ref/WeakReferenceTest.java \
     java/lang/reflect/MethodTest.java \
@@ -50,7 +50,7 @@ TEST_RESOURCES = $(TEST_RESOURCES_RELATIVE:%=$(RESOURCES_DEST_DIR)/%)
 JUNIT_DIST_JAR = $(DIST_JAR_DIR)/$(JUNIT_JAR)
 JUNIT_DATAPROVIDER_DIST_JAR = $(DIST_JAR_DIR)/$(JUNIT_DATAPROVIDER_JAR)
 
-INCLUDE_DIRS = $(TESTS_DIR) $(TESTS_DIR)/arc $(CLASS_DIR) $(EMULATION_CLASS_DIR)
+INCLUDE_DIRS = $(TESTS_DIR) $(TESTS_DIR)/arc $(CLASS_DIR) $(EMULATION_CLASS_DIR) $(APPLE_ROOT)
 INCLUDE_ARGS = $(INCLUDE_DIRS:%=-I%)
 
 ifdef DEVELOPER_DIR
@@ -190,6 +190,12 @@ run-single-test: link resources $(TEST_BIN)
 run-initialization-test: resources $(TESTS_DIR)/jreinitialization
 	@$(TESTS_DIR)/jreinitialization 2>&1 | grep -v "support not implemented"
 
+run-fast-pointer-lookup-benchmark: $(TESTS_DIR)/fast_pointer_lookup_benchmark
+	@$(TESTS_DIR)/fast_pointer_lookup_benchmark
+
+run-reference-benchmark: $(TESTS_DIR)/reference_benchmark
+	@$(TESTS_DIR)/reference_benchmark
+
 run-core-size-test: $(TESTS_DIR)/core_size \
   $(TESTS_DIR)/full_jre_size \
   $(TESTS_DIR)/core_plus_android_util \
@@ -315,6 +321,21 @@ $(TESTS_DIR)/jreinitialization: $(MISC_TEST_ROOT)/JreInitialization.m $(DIST_JRE
 	@echo Verifying JRE initialization
 	@$(J2OBJCC) -o $@ -ljre_emul -ObjC $(COVERAGE_FLAGS) -Os $(MISC_TEST_ROOT)/JreInitialization.m
 
+# Plain C built with clang, so that it can be run on Linux too.
+$(TESTS_DIR)/fast_pointer_lookup_benchmark: $(MISC_TEST_ROOT)/FastPointerLookupBenchmark.c \
+  $(EMULATION_CLASS_DIR)/FastPointerLookup.h $(EMULATION_CLASS_DIR)/FastPointerLookup.m \
+  $(EMULATION_CLASS_DIR)/ThreadRecordList.h $(EMULATION_CLASS_DIR)/ThreadRecordList.m
+	@mkdir -p $(@D)
+	@echo Building $(@F)
+	@clang -O2 -pthread -I$(EMULATION_CLASS_DIR) -o $@ -x c \
+	  $(MISC_TEST_ROOT)/FastPointerLookupBenchmark.c $(EMULATION_CLASS_DIR)/FastPointerLookup.m \
+	  $(EMULATION_CLASS_DIR)/ThreadRecordList.m
+
+$(TESTS_DIR)/reference_benchmark: $(MISC_TEST_ROOT)/ReferenceBenchmark.m $(DIST_JRE_EMUL_LIB)
+	@mkdir -p $(@D)
+	@echo Building $(@F)
+	@$(J2OBJCC) -o $@ -ljre_emul -ObjC -O2 $(MISC_TEST_ROOT)/ReferenceBenchmark.m
+
 $(GEN_JAVA_DIR)/com/google/j2objc/arc/%.java: $(MISC_TEST_ROOT)/com/google/j2objc/%.java
 	@mkdir -p $(@D)
 	@echo $<
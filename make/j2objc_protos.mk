@@ -7,6 +7,7 @@
 #   J2OBJC_PROTOS_NAME
 #   J2OBJC_PROTOS_PREFIX_FILES
 #   J2OBJC_PROTOS_GENERATE_CLASS_MAPPINGS
+#   J2OBJC_PROTOS_GENERATE_FAST_PATHS
 #
 # The following variables are defined by this include:
 #   J2OBJC_PROTOS_JAVA
@@ -58,6 +59,10 @@ J2OBJC_PROTOS_CLASS_MAPPING_FILES = \
   $(J2OBJC_PROTOS_RELATIVE_INPUTS:%.proto=$(GEN_OBJC_DIR)/%.clsmap.properties)
 endif
 
+ifdef J2OBJC_PROTOS_GENERATE_FAST_PATHS
+J2OBJC_PROTOS_OPTIONS += generate_fast_paths
+endif
+
 ifdef J2OBJC_PROTOS_PREFIX_FILES
 J2OBJC_PROTOS_OPTIONS += $(J2OBJC_PROTOS_PREFIX_FILES:%=prefixes=%)
 endif
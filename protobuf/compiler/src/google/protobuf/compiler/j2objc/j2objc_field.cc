@@ -127,6 +127,7 @@ void SetCommonFieldVariables(const FieldDescriptor* descriptor,
   (*variables)["capitalized_name"] =
       UnderscoresToCapitalizedCamelCase(descriptor);
   (*variables)["field_number"] = SimpleItoa(descriptor->number());
+  (*variables)["field_index"] = SimpleItoa(descriptor->index());
   (*variables)["constant_name"] = FieldConstantName(descriptor);
   (*variables)["parameter_type"] = GetParameterType(descriptor);
   (*variables)["storage_type"] = GetStorageType(descriptor);
@@ -165,6 +166,115 @@ void CollectForwardDeclarationsForFieldType(std::set<std::string>* declarations,
     }
   }
 }
+
+// Code for parsing and serializing a singular scalar field inline in the
+// generated fast paths. "$field$" stands for the field's storage.
+struct FastPathCode {
+  uint32_t wire_type;
+  const char* read;
+  const char* size;  // NULL if the value is always fixed_size bytes.
+  int fixed_size;
+  const char* write;
+};
+
+bool GetFastPathCode(const FieldDescriptor* descriptor, FastPathCode* code) {
+  switch (descriptor->type()) {
+    case FieldDescriptor::TYPE_INT32:
+      *code = {0,
+          "if (!CGPParseVarint32(ctx, (uint32_t *)&$field$)) return NO;\n",
+          "CGPVarintSize32SignExtended($field$)", 0,
+          "target = CGPWriteVarint32SignExtendedToArray($field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_UINT32:
+      *code = {0,
+          "if (!CGPParseVarint32(ctx, (uint32_t *)&$field$)) return NO;\n",
+          "CGPVarintSize32((uint32_t)$field$)", 0,
+          "target = CGPWriteVarint32ToArray((uint32_t)$field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_SINT32:
+      *code = {0,
+          "uint32_t value;\n"
+          "if (!CGPParseVarint32(ctx, &value)) return NO;\n"
+          "$field$ = CGPZigZagDecode32(value);\n",
+          "CGPVarintSize32((uint32_t)CGPZigZagEncode32($field$))", 0,
+          "target = CGPWriteVarint32ToArray("
+              "(uint32_t)CGPZigZagEncode32($field$), target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_FIXED32:
+    case FieldDescriptor::TYPE_SFIXED32:
+      *code = {5,
+          "if (!CGPParseFixed32(ctx, (uint32_t *)&$field$)) return NO;\n",
+          NULL, 4,
+          "target = CGPWriteFixed32ToArray((uint32_t)$field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_FLOAT:
+      *code = {5,
+          "if (!CGPParseFloat(ctx, &$field$)) return NO;\n",
+          NULL, 4,
+          "target = CGPWriteFloatToArray($field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_INT64:
+    case FieldDescriptor::TYPE_UINT64:
+      *code = {0,
+          "if (!CGPParseVarint64(ctx, (uint64_t *)&$field$)) return NO;\n",
+          "CGPVarintSize64((uint64_t)$field$)", 0,
+          "target = CGPWriteVarint64ToArray((uint64_t)$field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_SINT64:
+      *code = {0,
+          "uint64_t value;\n"
+          "if (!CGPParseVarint64(ctx, &value)) return NO;\n"
+          "$field$ = CGPZigZagDecode64(value);\n",
+          "CGPVarintSize64((uint64_t)CGPZigZagEncode64($field$))", 0,
+          "target = CGPWriteVarint64ToArray("
+              "(uint64_t)CGPZigZagEncode64($field$), target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_FIXED64:
+    case FieldDescriptor::TYPE_SFIXED64:
+      *code = {1,
+          "if (!CGPParseFixed64(ctx, (uint64_t *)&$field$)) return NO;\n",
+          NULL, 8,
+          "target = CGPWriteFixed64ToArray((uint64_t)$field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_DOUBLE:
+      *code = {1,
+          "if (!CGPParseDouble(ctx, &$field$)) return NO;\n",
+          NULL, 8,
+          "target = CGPWriteDoubleToArray($field$, target);\n"};
+      return true;
+    case FieldDescriptor::TYPE_BOOL:
+      *code = {0,
+          "uint32_t value;\n"
+          "if (!CGPParseVarint32(ctx, &value)) return NO;\n"
+          "$field$ = value != 0;\n",
+          NULL, 1,
+          "target = CGPWriteVarint32ToArray($field$ ? 1 : 0, target);\n"};
+      return true;
+    default:
+      return false;
+  }
+}
+
+int VarintSize32(uint32_t value) {
+  int size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+void SetFastPathVariables(const FieldDescriptor* descriptor, int has_bit_index,
+                          const FastPathCode& code,
+                          std::map<std::string, std::string>* variables) {
+  uint32_t tag = (descriptor->number() << 3) | code.wire_type;
+  (*variables)["field"] = "storage->" + UnderscoresToCamelCase(descriptor) + "_";
+  (*variables)["tag"] = SimpleItoa(tag);
+  (*variables)["tag_size"] = SimpleItoa(VarintSize32(tag));
+  (*variables)["fixed_size"] = SimpleItoa(VarintSize32(tag) + code.fixed_size);
+  (*variables)["has_word"] = SimpleItoa(has_bit_index / 32);
+  (*variables)["has_mask"] = SimpleItoa(1u << (has_bit_index % 32)) + "u";
+}
 }  // namespace
 
 void CollectSourceImportsForField(std::set<std::string>* imports,
@@ -234,6 +344,26 @@ void FieldGenerator::GenerateFieldHeader(io::Printer *printer) const {
 void FieldGenerator::GenerateMapEntryFieldData(io::Printer *printer) const {
 }
 
+bool FieldGenerator::IsInlinedInFastPath() const {
+  return false;
+}
+
+void FieldGenerator::GenerateFastPathMergeCase(io::Printer *printer) const {
+  // Handled by the default case, which calls into the runtime.
+}
+
+void FieldGenerator::GenerateFastPathSize(io::Printer *printer) const {
+  printer->Print(variables_,
+      "size += CGPFieldSerializedSize(msg, $classname$_descriptor_, "
+      "$field_index$);\n");
+}
+
+void FieldGenerator::GenerateFastPathWrite(io::Printer *printer) const {
+  printer->Print(variables_,
+      "target = CGPWriteFieldToArray(msg, $classname$_descriptor_, "
+      "$field_index$, target);\n");
+}
+
 void FieldGenerator::GenerateFieldData(io::Printer *printer) const {
   printer->Print(variables_,
       "{\n"
@@ -281,9 +411,10 @@ void FieldGenerator::GenerateStaticRefs(io::Printer *printer) const {
 
 SingleFieldGenerator::SingleFieldGenerator(
     const FieldDescriptor *descriptor, uint32_t *numHasBits)
-  : FieldGenerator(descriptor) {
+  : FieldGenerator(descriptor), has_bit_index_(-1) {
   if (descriptor->containing_oneof() == NULL) {
-    variables_["has_bit_index"] = SimpleItoa((*numHasBits)++);
+    has_bit_index_ = (*numHasBits)++;
+    variables_["has_bit_index"] = SimpleItoa(has_bit_index_);
   }
 }
 
@@ -313,6 +444,66 @@ void SingleFieldGenerator::GenerateDeclaration(io::Printer* printer) const {
   printer->Print(variables_, "$storage_type$$decl_space$$camelcase_name$_;\n");
 }
 
+bool SingleFieldGenerator::IsInlinedInFastPath() const {
+  FastPathCode code;
+  return has_bit_index_ >= 0 && GetFastPathCode(descriptor_, &code);
+}
+
+void SingleFieldGenerator::GenerateFastPathMergeCase(io::Printer* printer)
+    const {
+  FastPathCode code;
+  if (has_bit_index_ < 0 || !GetFastPathCode(descriptor_, &code)) {
+    FieldGenerator::GenerateFastPathMergeCase(printer);
+    return;
+  }
+  std::map<std::string, std::string> vars(variables_);
+  SetFastPathVariables(descriptor_, has_bit_index_, code, &vars);
+  printer->Print(vars, "case $tag$: {\n");
+  printer->Indent();
+  printer->Print(vars, code.read);
+  printer->Print(vars,
+      "storage->hasBits[$has_word$] |= $has_mask$;\n"
+      "break;\n");
+  printer->Outdent();
+  printer->Print("}\n");
+}
+
+void SingleFieldGenerator::GenerateFastPathSize(io::Printer* printer) const {
+  FastPathCode code;
+  if (has_bit_index_ < 0 || !GetFastPathCode(descriptor_, &code)) {
+    FieldGenerator::GenerateFastPathSize(printer);
+    return;
+  }
+  std::map<std::string, std::string> vars(variables_);
+  SetFastPathVariables(descriptor_, has_bit_index_, code, &vars);
+  printer->Print(vars, "if (storage->hasBits[$has_word$] & $has_mask$) {\n");
+  if (code.size != NULL) {
+    vars["size"] = code.size;
+    printer->Print(vars, "  size += $tag_size$ + ");
+    printer->Print(vars, code.size);
+    printer->Print(";\n");
+  } else {
+    printer->Print(vars, "  size += $fixed_size$;\n");
+  }
+  printer->Print("}\n");
+}
+
+void SingleFieldGenerator::GenerateFastPathWrite(io::Printer* printer) const {
+  FastPathCode code;
+  if (has_bit_index_ < 0 || !GetFastPathCode(descriptor_, &code)) {
+    FieldGenerator::GenerateFastPathWrite(printer);
+    return;
+  }
+  std::map<std::string, std::string> vars(variables_);
+  SetFastPathVariables(descriptor_, has_bit_index_, code, &vars);
+  printer->Print(vars, "if (storage->hasBits[$has_word$] & $has_mask$) {\n");
+  printer->Indent();
+  printer->Print(vars, "target = CGPWriteVarint32ToArray($tag$, target);\n");
+  printer->Print(vars, code.write);
+  printer->Outdent();
+  printer->Print("}\n");
+}
+
 void RepeatedFieldGenerator::CollectForwardDeclarations(
     std::set<std::string>* declarations) const {
   FieldGenerator::CollectForwardDeclarations(declarations);
@@ -67,6 +67,13 @@ class FieldGenerator {
   virtual void GenerateMapEntryFieldData(io::Printer *printer) const;
   virtual void GenerateFieldData(io::Printer *printer) const;
 
+  // Fast path generation, for the "generate_fast_paths" option. Fields that
+  // aren't inlined are parsed and serialized by calling into the runtime.
+  virtual bool IsInlinedInFastPath() const;
+  virtual void GenerateFastPathMergeCase(io::Printer *printer) const;
+  virtual void GenerateFastPathSize(io::Printer *printer) const;
+  virtual void GenerateFastPathWrite(io::Printer *printer) const;
+
   virtual void CollectForwardDeclarations(
       std::set<std::string>* declarations) const;
   virtual void CollectMessageOrBuilderForwardDeclarations(
@@ -99,7 +106,15 @@ class SingleFieldGenerator : public FieldGenerator {
 
   virtual void GenerateDeclaration(io::Printer* printer) const;
 
+  virtual bool IsInlinedInFastPath() const;
+  virtual void GenerateFastPathMergeCase(io::Printer *printer) const;
+  virtual void GenerateFastPathSize(io::Printer *printer) const;
+  virtual void GenerateFastPathWrite(io::Printer *printer) const;
+
  private:
+  // -1 for fields in a oneof, which don't have a has bit.
+  int has_bit_index_;
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(SingleFieldGenerator);
 };
 
@@ -457,16 +457,32 @@ void FileGenerator::GenerateMessageOrBuilder(
 
 void FileGenerator::GenerateSiblings(GeneratorContext* context,
                                      std::vector<std::string>* file_list) {
-  if (GenerateMultipleFiles()) {
-    for (int i = 0; i < file_->enum_type_count(); i++) {
-      GenerateEnumHeader(context, file_list, file_->enum_type(i));
-      GenerateEnumSource(context, file_list, file_->enum_type(i));
-    }
-    for (int i = 0; i < file_->message_type_count(); i++) {
-      GenerateMessageHeader(context, file_list, file_->message_type(i));
-      GenerateMessageSource(context, file_list, file_->message_type(i));
-      GenerateMessageOrBuilder(context, file_list, file_->message_type(i));
-    }
+  int count = SiblingGroupCount();
+  for (int i = 0; i < count; i++) {
+    GenerateSiblingGroup(context, file_list, i);
+  }
+}
+
+int FileGenerator::SiblingGroupCount() {
+  if (!GenerateMultipleFiles()) {
+    return 0;
+  }
+  return file_->enum_type_count() + file_->message_type_count();
+}
+
+void FileGenerator::GenerateSiblingGroup(GeneratorContext* context,
+                                         std::vector<std::string>* file_list,
+                                         int index) {
+  if (index < file_->enum_type_count()) {
+    const EnumDescriptor* descriptor = file_->enum_type(index);
+    GenerateEnumHeader(context, file_list, descriptor);
+    GenerateEnumSource(context, file_list, descriptor);
+  } else {
+    const Descriptor* descriptor =
+        file_->message_type(index - file_->enum_type_count());
+    GenerateMessageHeader(context, file_list, descriptor);
+    GenerateMessageSource(context, file_list, descriptor);
+    GenerateMessageOrBuilder(context, file_list, descriptor);
   }
 }
 
@@ -64,6 +64,12 @@ class FileGenerator {
   void GenerateSiblings(GeneratorContext* generator_context,
                         std::vector<std::string>* file_list);
 
+  // The sibling files come in groups, one for each enum and message type, that
+  // can be generated independently of each other.
+  int SiblingGroupCount();
+  void GenerateSiblingGroup(GeneratorContext* generator_context,
+                            std::vector<std::string>* file_list, int index);
+
   void GenerateHeaderMappings(GeneratorContext* context);
   void GenerateClassMappings(GeneratorContext* generator_context);
 
@@ -34,66 +34,253 @@
 
 #include <google/protobuf/compiler/j2objc/j2objc_generator.h>
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <utility>
+
 #include <google/protobuf/compiler/j2objc/j2objc_file.h>
 #include <google/protobuf/compiler/j2objc/j2objc_helpers.h>
+#include <google/protobuf/compiler/j2objc/j2objc_output_cache.h>
 
 namespace google {
 namespace protobuf {
 namespace compiler {
 namespace j2objc {
 
-J2ObjCGenerator::J2ObjCGenerator() {}
-J2ObjCGenerator::~J2ObjCGenerator() {}
+namespace {
 
-bool J2ObjCGenerator::Generate(const FileDescriptor* file,
-                               const std::string& parameter,
-                               GeneratorContext* context,
-                               std::string* error) const {
-  // -----------------------------------------------------------------
-  // parse generator options
+struct GeneratorOptions {
+  GeneratorOptions() : generate_class_mappings(false), num_threads(0) {}
 
+  bool generate_class_mappings;
+  // The number of threads used by GenerateAll(), or 0 for one per CPU.
+  int num_threads;
+  // The prefix files, in the order in which they were parsed.
+  std::vector<std::string> prefix_files;
+  // The directory that protoc writes to, when files whose output hasn't
+  // changed since the last run should be skipped. See OutputCache.
+  std::string incremental_output_dir;
+};
+
+bool ParseOptions(const std::string& parameter, GeneratorOptions* result,
+                  std::string* error) {
   std::vector<std::pair<std::string, std::string> > options;
   ParseGeneratorParameter(parameter, &options);
 
-  bool generate_class_mappings = false;
-
   for (int i = 0; i < options.size(); i++) {
     if (options[i].first == "prefixes") {
       ParsePrefixFile(options[i].second);
+      result->prefix_files.push_back(options[i].second);
     } else if (options[i].first == "file_dir_mapping") {
       GenerateFileDirMapping();
     } else if (options[i].first == "generate_class_mappings") {
-      generate_class_mappings = true;
+      result->generate_class_mappings = true;
+    } else if (options[i].first == "generate_fast_paths") {
+      GenerateFastPaths();
+    } else if (options[i].first == "threads") {
+      if (!safe_strto32(options[i].second, &result->num_threads) ||
+          result->num_threads < 0) {
+        *error = "Invalid thread count: " + options[i].second;
+        return false;
+      }
+    } else if (options[i].first == "incremental_output_dir") {
+      result->incremental_output_dir = options[i].second;
     } else {
       *error = "Unknown generator option: " + options[i].first;
       return false;
     }
   }
+  return true;
+}
+
+// Identifies everything besides the .proto files that the generated code
+// depends on. Options that only affect how the code is generated, like the
+// thread count and the output cache itself, are left out, and the order of the
+// options doesn't matter.
+std::string OptionsFingerprint(const GeneratorOptions& options) {
+  std::string fingerprint;
+  if (IsGenerateFileDirMapping()) {
+    fingerprint += "file_dir_mapping\n";
+  }
+  if (options.generate_class_mappings) {
+    fingerprint += "generate_class_mappings\n";
+  }
+  if (IsGenerateFastPaths()) {
+    fingerprint += "generate_fast_paths\n";
+  }
+  // Later prefix files override earlier ones, so their order does matter.
+  for (int i = 0; i < options.prefix_files.size(); i++) {
+    std::ifstream in(options.prefix_files[i].c_str());
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    fingerprint += "prefixes " + SimpleItoa(contents.str().size()) + "\n" +
+                   contents.str();
+  }
+  return fingerprint;
+}
 
-  // -----------------------------------------------------------------
+// Keeps the files that one task generates in memory, so that tasks can run
+// concurrently and the files can be written to the real context in a fixed
+// order afterwards.
+class BufferedGeneratorContext : public GeneratorContext {
+ public:
+  BufferedGeneratorContext() {}
 
-  FileGenerator file_generator(file);
-  if (!file_generator.Validate(error)) {
-    return false;
+  io::ZeroCopyOutputStream* Open(const std::string& filename) {
+    contents_.emplace_back(new std::string());
+    filenames_.push_back(filename);
+    return new io::StringOutputStream(contents_.back().get());
   }
 
-  std::vector<std::string> all_files;
+  // Writes the files to the context in the order in which they were opened.
+  // Files that the cache reports as unchanged are skipped.
+  void WriteTo(GeneratorContext* context, OutputCache* cache) const {
+    for (int i = 0; i < filenames_.size(); i++) {
+      if (cache != NULL && cache->AddOutput(filenames_[i], *contents_[i])) {
+        continue;
+      }
+      std::unique_ptr<io::ZeroCopyOutputStream> output(
+          context->Open(filenames_[i]));
+      io::CodedOutputStream coded_output(output.get());
+      coded_output.WriteString(*contents_[i]);
+    }
+  }
 
-  // Generate main source and header files.
-  file_generator.Generate(context, &all_files);
+ private:
+  std::vector<std::string> filenames_;
+  std::vector<std::unique_ptr<std::string> > contents_;
 
-  // Generate sibling files.
-  file_generator.GenerateSiblings(context, &all_files);
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(BufferedGeneratorContext);
+};
 
-  if (IsGenerateFileDirMapping()) {
-    file_generator.GenerateHeaderMappings(context);
+// Runs the tasks on at most num_threads threads, including the calling one.
+// Each thread takes the next task that hasn't been started.
+void RunTasks(const std::vector<std::function<void()> >& tasks,
+              int num_threads) {
+  std::atomic<size_t> next_task(0);
+  auto worker = [&tasks, &next_task]() {
+    for (size_t i = next_task++; i < tasks.size(); i = next_task++) {
+      tasks[i]();
+    }
+  };
+  size_t thread_count = std::min(tasks.size(), (size_t)num_threads);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(worker);
   }
+  worker();
+  for (int i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+}  // namespace
 
-  if (generate_class_mappings) {
-    file_generator.GenerateClassMappings(context);
+J2ObjCGenerator::J2ObjCGenerator() {}
+J2ObjCGenerator::~J2ObjCGenerator() {}
+
+bool J2ObjCGenerator::Generate(const FileDescriptor* file,
+                               const std::string& parameter,
+                               GeneratorContext* context,
+                               std::string* error) const {
+  return GenerateAll(std::vector<const FileDescriptor*>(1, file), parameter,
+                     context, error);
+}
+
+bool J2ObjCGenerator::GenerateAll(
+    const std::vector<const FileDescriptor*>& files,
+    const std::string& parameter, GeneratorContext* context,
+    std::string* error) const {
+  // The options set global state, which the tasks only read.
+  GeneratorOptions options;
+  if (!ParseOptions(parameter, &options, error)) {
+    return false;
+  }
+  int num_threads = options.num_threads;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
   }
 
-  return true;
+  // Files that were generated with the same inputs before are skipped.
+  std::unique_ptr<OutputCache> cache;
+  std::vector<const FileDescriptor*> generated_files;
+  std::vector<std::string> keys;
+  std::string options_fingerprint;
+  if (!options.incremental_output_dir.empty()) {
+    cache.reset(new OutputCache(options.incremental_output_dir));
+    cache->Load();
+    options_fingerprint = OptionsFingerprint(options);
+  }
+
+  std::vector<std::unique_ptr<FileGenerator> > file_generators;
+  for (int i = 0; i < files.size(); i++) {
+    if (cache != NULL) {
+      std::string key = OutputCache::ComputeKey(files[i], options_fingerprint);
+      if (cache->IsUpToDate(files[i], key)) {
+        continue;
+      }
+      keys.push_back(key);
+    }
+    generated_files.push_back(files[i]);
+    file_generators.emplace_back(new FileGenerator(files[i]));
+    if (!file_generators.back()->Validate(error)) {
+      return false;
+    }
+  }
+
+  // The tasks generate into separate buffers, which are listed in the order in
+  // which the files are written: the main files, the siblings and the mappings
+  // of each .proto file. first_outputs holds the index of the first buffer of
+  // each .proto file.
+  std::vector<std::function<void()> > tasks;
+  std::vector<std::unique_ptr<BufferedGeneratorContext> > outputs;
+  std::vector<int> first_outputs;
+  for (int i = 0; i < file_generators.size(); i++) {
+    FileGenerator* file_generator = file_generators[i].get();
+    first_outputs.push_back(outputs.size());
+    outputs.emplace_back(new BufferedGeneratorContext());
+    BufferedGeneratorContext* main_output = outputs.back().get();
+    int sibling_count = file_generator->SiblingGroupCount();
+    for (int j = 0; j < sibling_count; j++) {
+      outputs.emplace_back(new BufferedGeneratorContext());
+      BufferedGeneratorContext* sibling_output = outputs.back().get();
+      tasks.push_back([file_generator, sibling_output, j]() {
+        std::vector<std::string> all_files;
+        file_generator->GenerateSiblingGroup(sibling_output, &all_files, j);
+      });
+    }
+    outputs.emplace_back(new BufferedGeneratorContext());
+    BufferedGeneratorContext* mapping_output = outputs.back().get();
+    bool generate_class_mappings = options.generate_class_mappings;
+    tasks.push_back([file_generator, main_output, mapping_output,
+                     generate_class_mappings]() {
+      std::vector<std::string> all_files;
+      file_generator->Generate(main_output, &all_files);
+      if (IsGenerateFileDirMapping()) {
+        file_generator->GenerateHeaderMappings(mapping_output);
+      }
+      if (generate_class_mappings) {
+        file_generator->GenerateClassMappings(mapping_output);
+      }
+    });
+  }
+  RunTasks(tasks, num_threads);
+
+  first_outputs.push_back(outputs.size());
+  for (int i = 0; i < file_generators.size(); i++) {
+    if (cache != NULL) {
+      cache->BeginFile(generated_files[i], keys[i]);
+    }
+    for (int j = first_outputs[i]; j < first_outputs[i + 1]; j++) {
+      outputs[j]->WriteTo(context, cache.get());
+    }
+  }
+  return cache == NULL || cache->Save(error);
 }
 
 }  // namespace j2objc
@@ -39,6 +39,7 @@
 #define GOOGLE_PROTOBUF_COMPILER_J2OBJC_GENERATOR_H__
 
 #include <string>
+#include <vector>
 
 #include "google/protobuf/compiler/j2objc/common.h"
 
@@ -56,6 +57,12 @@ class J2ObjCGenerator : public CodeGenerator {
   bool Generate(const FileDescriptor* file, const std::string& parameter,
                 GeneratorContext* context, std::string* error) const;
 
+  // Parses the options once and generates the files on a pool of threads. The
+  // output is written to the context in the same order as by Generate().
+  bool GenerateAll(const std::vector<const FileDescriptor*>& files,
+                   const std::string& parameter, GeneratorContext* context,
+                   std::string* error) const;
+
  private:
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(J2ObjCGenerator);
 };
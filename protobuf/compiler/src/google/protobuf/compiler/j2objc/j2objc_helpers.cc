@@ -36,6 +36,7 @@
 
 #include <fstream>
 #include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
 
@@ -58,8 +59,13 @@ const int kPackagePrefixFieldNumber = 102687446;
 
 static std::map<std::string, std::string> prefixes;
 static std::map<std::string, std::string> wildcardPrefixes;
+static std::set<std::string> parsedPrefixFiles;
+// Guards prefixes, which caches wildcard matches while files are generated
+// concurrently.
+static std::mutex prefixesMutex;
 
 static bool generateFileDirMapping = false;
+static bool generateFastPaths = false;
 
 const char* const kKeywordList[] = {
   "TYPE_BOOL",
@@ -144,6 +150,7 @@ std::string GetPackagePrefix(const FileDescriptor *file) {
 
   // Look for a matching prefix from the prefixes file.
   std::string java_package = FileJavaPackage(file);
+  std::lock_guard<std::mutex> lock(prefixesMutex);
   std::map<std::string, std::string>::iterator it = prefixes.find(java_package);
   if (it != prefixes.end()) {
     return it->second;
@@ -650,6 +657,10 @@ void ParsePrefixLine(std::string line) {
 }
 
 void ParsePrefixFile(std::string prefix_file) {
+  // Generate() is called once per .proto file with the same options.
+  if (!parsedPrefixFiles.insert(prefix_file).second) {
+    return;
+  }
   std::ifstream in(prefix_file.c_str());
   if (in.is_open()) {
     std::string line;
@@ -684,6 +695,14 @@ bool IsGenerateFileDirMapping() {
   return generateFileDirMapping;
 }
 
+void GenerateFastPaths() {
+  generateFastPaths = true;
+}
+
+bool IsGenerateFastPaths() {
+  return generateFastPaths;
+}
+
 }  // namespace j2objc
 }  // namespace compiler
 }  // namespace protobuf
@@ -136,6 +136,8 @@ std::string StaticOutputFileName(const FileDescriptor *file,
 std::string FileDirMappingOutputName(const FileDescriptor *file);
 void GenerateFileDirMapping();
 bool IsGenerateFileDirMapping();
+void GenerateFastPaths();
+bool IsGenerateFastPaths();
 
 }  // namespace j2objc
 }  // namespace compiler
@@ -60,6 +60,32 @@ std::string GetMessageFlags(const Descriptor* descriptor) {
   return JoinFlags(flags);
 }
 
+// Returns where a field goes in the storage struct. Singular integral, bool and
+// enum fields outside oneofs come first, widest first so that they pack
+// without padding, because the runtime compares and hashes them as one range
+// of bytes. All other fields follow in declaration order.
+int GetStorageRank(const FieldDescriptor* field) {
+  if (field->is_repeated() || field->containing_oneof() != NULL) {
+    return 4;
+  }
+  switch (GetJavaType(field)) {
+    case JAVATYPE_LONG:
+      return 0;
+    case JAVATYPE_ENUM:
+      return 1;
+    case JAVATYPE_INT:
+      return 2;
+    case JAVATYPE_BOOLEAN:
+      return 3;
+    default:
+      return 4;
+  }
+}
+
+bool CompareStorageRank(const FieldDescriptor* a, const FieldDescriptor* b) {
+  return GetStorageRank(a) < GetStorageRank(b);
+}
+
 } // namespace
 
 MessageGenerator::MessageGenerator(const Descriptor* descriptor)
@@ -136,6 +162,9 @@ void MessageGenerator::CollectHeaderImports(
 void MessageGenerator::CollectSourceImports(
     std::set<std::string>* imports) const {
   imports->insert("com/google/protobuf/GeneratedMessage_PackagePrivate.h");
+  if (HasFastPaths()) {
+    imports->insert("com/google/protobuf/FastPath.h");
+  }
 
   for (int i = 0; i < descriptor_->field_count(); i++) {
     field_generators_.get(descriptor_->field(i)).CollectSourceImports(imports);
@@ -179,6 +208,20 @@ void MessageGenerator::GenerateHeader(io::Printer* printer) {
       "+ ($classname$ *)parseFromWithByteArray:(IOSByteArray *)bytes "
           "withComGoogleProtobufExtensionRegistryLite:"
           "(ComGoogleProtobufExtensionRegistryLite *)registry;\n"
+      "// Bytes fields and large ASCII string fields of the result point into\n"
+      "// bytes instead of copying it. bytes must not be modified afterwards.\n"
+      "+ ($classname$ *)parseFromAliasingByteArray:(IOSByteArray *)bytes "
+          "registry:(ComGoogleProtobufExtensionRegistryLite *)registry;\n"
+      "+ ($classname$ *)parseFromByteArrayWithArena:(IOSByteArray *)bytes "
+          "registry:(ComGoogleProtobufExtensionRegistryLite *)registry;\n"
+      "// Singular message fields of the result are parsed when first accessed,\n"
+      "// which is when errors in them are thrown. Until then they hold a copy of\n"
+      "// their encoded bytes, so unlike the aliasing parse, bytes may be modified\n"
+      "// afterwards.\n"
+      "+ ($classname$ *)parseLazilyFromByteArray:(IOSByteArray *)bytes "
+          "registry:(ComGoogleProtobufExtensionRegistryLite *)registry;\n"
+      "+ ($classname$ *)parseFromByteArrayInParallel:(IOSByteArray *)bytes "
+          "registry:(ComGoogleProtobufExtensionRegistryLite *)registry;\n"
       "+ ($classname$ *)parseFromNSData:(NSData *)data;\n"
       "+ ($classname$ *)parseFromNSData:(NSData *)data registry:"
           "(ComGoogleProtobufExtensionRegistryLite *)registry;\n"
@@ -309,17 +352,29 @@ void MessageGenerator::GenerateSource(io::Printer* printer) {
     printer->Outdent();
     printer->Print("};\n");
   }
+  std::vector<const FieldDescriptor*> storage_fields;
   for (int i = 0; i < descriptor_->field_count(); i++) {
     const FieldDescriptor* field = descriptor_->field(i);
     if (field->containing_oneof() == NULL) {
-      field_generators_.get(field).GenerateDeclaration(printer);
+      storage_fields.push_back(field);
     }
   }
+  std::stable_sort(
+      storage_fields.begin(), storage_fields.end(), CompareStorageRank);
+  for (int i = 0; i < storage_fields.size(); i++) {
+    field_generators_.get(storage_fields[i]).GenerateDeclaration(printer);
+  }
   printer->Outdent();
 
   printer->Print(
-      "} $classname$_Storage;\n"
-      "\n"
+      "} $classname$_Storage;\n",
+      "classname", ClassName(descriptor_));
+
+  if (HasFastPaths()) {
+    GenerateFastPaths(printer);
+  }
+
+  printer->Print("\n"
       "+ (ComGoogleProtobufDescriptors_Descriptor *)getDescriptor {\n"
       "  return $classname$_descriptor_;\n"
       "}\n",
@@ -399,6 +454,16 @@ void MessageGenerator::GenerateSource(io::Printer* printer) {
           .GenerateSourceInitializer(printer);
     }
   }
+  if (HasFastPaths()) {
+    printer->Print(
+        "static const CGPFastPath fastPath = {\n"
+        "  .merge = $classname$_mergeFromContext,\n"
+        "  .serializedSize = $classname$_serializedSize,\n"
+        "  .write = $classname$_writeToArray,\n"
+        "};\n"
+        "CGPInitFastPath($classname$_descriptor_, &fastPath);\n",
+        "classname", ClassName(descriptor_));
+  }
   printer->Print(
       "J2OBJC_SET_INITIALIZED($classname$)\n",
       "classname", ClassName(descriptor_));
@@ -477,6 +542,89 @@ void MessageGenerator::GenerateSource(io::Printer* printer) {
   GenerateBuilderSource(printer);
 }
 
+// Extendable messages always use the descriptor-driven implementation, as do
+// messages with no fields that can be handled inline.
+bool MessageGenerator::HasFastPaths() const {
+  if (!IsGenerateFastPaths() || descriptor_->extension_range_count() > 0) {
+    return false;
+  }
+  for (int i = 0; i < descriptor_->field_count(); i++) {
+    if (field_generators_.get(descriptor_->field(i)).IsInlinedInFastPath()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MessageGenerator::GenerateFastPaths(io::Printer* printer) {
+  printer->Print("\n"
+      "static BOOL $classname$_mergeFromContext(id msg, CGPParseContext *ctx) {\n"
+      "  $classname$_Storage *storage = ($classname$_Storage *)CGPGetStorage(msg);\n"
+      "  while (ctx->ptr < ctx->end) {\n"
+      "    uint32_t tag = CGPParseTag(ctx);\n"
+      "    switch (tag) {\n",
+      "classname", ClassName(descriptor_));
+  printer->Indent();
+  printer->Indent();
+  printer->Indent();
+  for (int i = 0; i < descriptor_->field_count(); i++) {
+    field_generators_.get(descriptor_->field(i))
+        .GenerateFastPathMergeCase(printer);
+  }
+  printer->Outdent();
+  printer->Outdent();
+  printer->Outdent();
+  printer->Print(
+      "      case 0:\n"
+      "        return NO;\n"
+      "      default:\n"
+      "        if (!CGPParseField(msg, $classname$_descriptor_, tag, ctx)) {\n"
+      "          return NO;\n"
+      "        }\n"
+      "    }\n"
+      "  }\n"
+      "  return YES;\n"
+      "}\n",
+      "classname", ClassName(descriptor_));
+
+  // Fields are written in field number order, like the runtime does.
+  std::vector<const FieldDescriptor*> sorted_fields;
+  for (int i = 0; i < descriptor_->field_count(); i++) {
+    sorted_fields.push_back(descriptor_->field(i));
+  }
+  std::sort(sorted_fields.begin(), sorted_fields.end(),
+            [](const FieldDescriptor* a, const FieldDescriptor* b) {
+              return a->number() < b->number();
+            });
+
+  printer->Print("\n"
+      "static int $classname$_serializedSize(id msg) {\n"
+      "  $classname$_Storage *storage = ($classname$_Storage *)CGPGetStorage(msg);\n"
+      "  int size = 0;\n",
+      "classname", ClassName(descriptor_));
+  printer->Indent();
+  for (int i = 0; i < sorted_fields.size(); i++) {
+    field_generators_.get(sorted_fields[i]).GenerateFastPathSize(printer);
+  }
+  printer->Outdent();
+  printer->Print(
+      "  return size;\n"
+      "}\n");
+
+  printer->Print("\n"
+      "static uint8_t *$classname$_writeToArray(id msg, uint8_t *target) {\n"
+      "  $classname$_Storage *storage = ($classname$_Storage *)CGPGetStorage(msg);\n",
+      "classname", ClassName(descriptor_));
+  printer->Indent();
+  for (int i = 0; i < sorted_fields.size(); i++) {
+    field_generators_.get(sorted_fields[i]).GenerateFastPathWrite(printer);
+  }
+  printer->Outdent();
+  printer->Print(
+      "  return target;\n"
+      "}\n");
+}
+
 void MessageGenerator::GenerateBuilderHeader(io::Printer* printer) {
   std::string superclassName = "ComGoogleProtobufGeneratedMessage_Builder";
   if (descriptor_->extension_range_count() > 0) {
@@ -65,6 +65,8 @@ class MessageGenerator {
  private:
   void GenerateBuilderHeader(io::Printer* printer);
   void GenerateBuilderSource(io::Printer* printer);
+  bool HasFastPaths() const;
+  void GenerateFastPaths(io::Printer* printer);
 
   const Descriptor* descriptor_;
   FieldGeneratorMap field_generators_;
@@ -0,0 +1,293 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "google/protobuf/compiler/j2objc/j2objc_output_cache.h"
+
+// Defines J2OBJC_GENERATOR_VERSION, a fingerprint of the generator's sources
+// that the build writes.
+#include "google/protobuf/compiler/j2objc/j2objc_generator_version.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+namespace google {
+namespace protobuf {
+namespace compiler {
+namespace j2objc {
+
+namespace {
+
+const char kManifestName[] = ".j2objc_proto_manifest";
+
+// Identifies the format of the manifest. Changes to the generated code are
+// covered by J2OBJC_GENERATOR_VERSION, which is part of each key.
+const char kManifestVersion[] = "j2objc-proto-manifest 1";
+
+const uint64 kFnvOffsetBasis = GOOGLE_ULONGLONG(0xcbf29ce484222325);
+const uint64 kFnvPrime = GOOGLE_ULONGLONG(0x100000001b3);
+
+uint64 HashBytes(uint64 hash, const std::string& data) {
+  for (int i = 0; i < data.size(); i++) {
+    hash ^= (uint8)data[i];
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+std::string HashToHex(uint64 hash) {
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+  return buffer;
+}
+
+// Adds the serialized descriptors of the file and all of its transitive
+// dependencies to the hash, each once.
+uint64 HashFileAndDependencies(uint64 hash, const FileDescriptor* file,
+                               std::set<const FileDescriptor*>* visited) {
+  if (!visited->insert(file).second) {
+    return hash;
+  }
+  for (int i = 0; i < file->dependency_count(); i++) {
+    hash = HashFileAndDependencies(hash, file->dependency(i), visited);
+  }
+  FileDescriptorProto proto;
+  file->CopyTo(&proto);
+  std::string serialized;
+  proto.SerializeToString(&serialized);
+  hash = HashBytes(hash, file->name());
+  return HashBytes(hash, serialized);
+}
+
+// Returns true if the file at path holds exactly contents. The bytes are
+// compared rather than a fingerprint, so that a manifest written by a
+// concurrent run can't cause a needed write to be skipped.
+bool FileHasContents(const std::string& path, const std::string& contents) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || st.st_size != contents.size()) {
+    return false;
+  }
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  char buffer[8192];
+  size_t pos = 0;
+  while (pos < contents.size()) {
+    size_t count = std::min(sizeof(buffer), contents.size() - pos);
+    if (!in.read(buffer, count) ||
+        contents.compare(pos, count, buffer, count) != 0) {
+      return false;
+    }
+    pos += count;
+  }
+  return in.peek() == EOF;
+}
+
+// Returns the fingerprint of the contents of the file at path, or an empty
+// string if it can't be read.
+std::string FingerprintFile(const std::string& path) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) {
+    return "";
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  return OutputCache::Fingerprint(contents.str());
+}
+
+// Holds an exclusive flock() on a file for as long as it exists. Runs that
+// share an output directory take it around reading and replacing the
+// manifest, so that they don't drop each other's entries.
+class ScopedFileLock {
+ public:
+  explicit ScopedFileLock(const std::string& path)
+      : fd_(open(path.c_str(), O_RDWR | O_CREAT, 0644)) {
+    if (fd_ >= 0) {
+      while (flock(fd_, LOCK_EX) != 0 && errno == EINTR) {
+      }
+    }
+  }
+
+  ~ScopedFileLock() {
+    if (fd_ >= 0) {
+      close(fd_);  // Releases the lock.
+    }
+  }
+
+  bool locked() const { return fd_ >= 0; }
+
+ private:
+  int fd_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ScopedFileLock);
+};
+
+}  // namespace
+
+OutputCache::OutputCache(const std::string& output_dir)
+    : output_dir_(output_dir), current_(NULL) {
+  if (!output_dir_.empty() && output_dir_[output_dir_.size() - 1] != '/') {
+    output_dir_ += '/';
+  }
+}
+
+OutputCache::~OutputCache() {}
+
+void OutputCache::Load() {
+  entries_.clear();
+  updated_.clear();
+  current_ = NULL;
+  ReadManifest(&entries_);
+}
+
+void OutputCache::ReadManifest(std::map<std::string, Entry>* entries) const {
+  std::ifstream in((output_dir_ + kManifestName).c_str());
+  std::string line;
+  if (!getline(in, line) || line != kManifestVersion) {
+    return;
+  }
+  Entry* entry = NULL;
+  while (getline(in, line)) {
+    std::istringstream fields(line);
+    std::string kind, name, hash;
+    if (!(fields >> kind >> name >> hash)) {
+      continue;
+    }
+    if (kind == "file") {
+      entry = &(*entries)[name];
+      entry->key = hash;
+      entry->outputs.clear();
+    } else if (kind == "out" && entry != NULL) {
+      entry->outputs.push_back(std::make_pair(name, hash));
+    }
+  }
+}
+
+bool OutputCache::Save(std::string* error) {
+  std::string path = output_dir_ + kManifestName;
+  ScopedFileLock lock(path + ".lock");
+  if (!lock.locked()) {
+    *error = "Could not lock output manifest: " + path + ".lock";
+    return false;
+  }
+  // Another run may have replaced the manifest since it was loaded. Its
+  // entries are kept for the files that this run didn't generate.
+  std::map<std::string, Entry> saved;
+  ReadManifest(&saved);
+  for (std::map<std::string, Entry>::const_iterator it = saved.begin();
+       it != saved.end(); ++it) {
+    if (updated_.count(it->first) == 0) {
+      entries_[it->first] = it->second;
+    }
+  }
+
+  // The temporary file is private to this process, in case the lock isn't
+  // honored, as on some network file systems.
+  std::string temp_path = path + "." + SimpleItoa(getpid()) + ".tmp";
+  {
+    std::ofstream out(temp_path.c_str());
+    out << kManifestVersion << "\n";
+    for (std::map<std::string, Entry>::const_iterator it = entries_.begin();
+         it != entries_.end(); ++it) {
+      out << "file " << it->first << " " << it->second.key << "\n";
+      for (int i = 0; i < it->second.outputs.size(); i++) {
+        out << "out " << it->second.outputs[i].first << " "
+            << it->second.outputs[i].second << "\n";
+      }
+    }
+    out.close();
+    if (out.fail()) {
+      *error = "Could not write output manifest: " + temp_path;
+      remove(temp_path.c_str());
+      return false;
+    }
+  }
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    remove(temp_path.c_str());
+    *error = "Could not write output manifest: " + path;
+    return false;
+  }
+  return true;
+}
+
+std::string OutputCache::ComputeKey(const FileDescriptor* file,
+                                    const std::string& options_fingerprint) {
+  uint64 hash = HashBytes(kFnvOffsetBasis, J2OBJC_GENERATOR_VERSION);
+  hash = HashBytes(hash, SimpleItoa(GOOGLE_PROTOBUF_VERSION));
+  hash = HashBytes(hash, options_fingerprint);
+  std::set<const FileDescriptor*> visited;
+  return HashToHex(HashFileAndDependencies(hash, file, &visited));
+}
+
+bool OutputCache::IsUpToDate(const FileDescriptor* file,
+                             const std::string& key) {
+  std::map<std::string, Entry>::const_iterator it = entries_.find(file->name());
+  if (it == entries_.end() || it->second.key != key) {
+    return false;
+  }
+  // The outputs may have been written by a concurrent run for a different
+  // version of the file, so their contents are checked as well.
+  for (int i = 0; i < it->second.outputs.size(); i++) {
+    if (FingerprintFile(output_dir_ + it->second.outputs[i].first) !=
+        it->second.outputs[i].second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void OutputCache::BeginFile(const FileDescriptor* file,
+                            const std::string& key) {
+  current_ = &entries_[file->name()];
+  updated_.insert(file->name());
+  current_->key = key;
+  current_->outputs.clear();
+}
+
+bool OutputCache::AddOutput(const std::string& filename,
+                            const std::string& contents) {
+  current_->outputs.push_back(std::make_pair(filename, Fingerprint(contents)));
+  return FileHasContents(output_dir_ + filename, contents);
+}
+
+std::string OutputCache::Fingerprint(const std::string& data) {
+  return HashToHex(HashBytes(kFnvOffsetBasis, data));
+}
+
+}  // namespace j2objc
+}  // namespace compiler
+}  // namespace protobuf
+}  // namespace google
@@ -0,0 +1,114 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Remembers what previous runs of the generator wrote to an output directory,
+// so that unchanged .proto files are skipped and unchanged outputs are left
+// alone. protoc only writes the files that the generator opens, so outputs that
+// aren't opened keep their timestamps and don't trigger rebuilds.
+
+#ifndef GOOGLE_PROTOBUF_COMPILER_J2OBJC_OUTPUT_CACHE_H__
+#define GOOGLE_PROTOBUF_COMPILER_J2OBJC_OUTPUT_CACHE_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/compiler/j2objc/common.h"
+
+namespace google {
+namespace protobuf {
+namespace compiler {
+namespace j2objc {
+
+class OutputCache {
+ public:
+  // The manifest is kept in output_dir, which must be the directory that
+  // protoc writes the generated files to.
+  explicit OutputCache(const std::string& output_dir);
+  ~OutputCache();
+
+  // Reads the manifest. A missing or unreadable manifest leaves the cache
+  // empty.
+  void Load();
+
+  // Writes the manifest, keeping what concurrent runs wrote to it for the
+  // files that weren't generated since Load(). Returns false and sets error if
+  // it can't be written.
+  bool Save(std::string* error);
+
+  // Returns a key that changes whenever the output of the given file may
+  // change: with the file, its dependencies, the generator's sources or the
+  // options, which options_fingerprint identifies.
+  static std::string ComputeKey(const FileDescriptor* file,
+                                const std::string& options_fingerprint);
+
+  // Returns true if the file was generated with the same key before and all of
+  // its outputs still have the recorded contents, so that it doesn't need to be
+  // generated again.
+  bool IsUpToDate(const FileDescriptor* file, const std::string& key);
+
+  // Starts recording the outputs of a file that is being generated, replacing
+  // what was recorded for it before.
+  void BeginFile(const FileDescriptor* file, const std::string& key);
+
+  // Records an output of the file passed to the last BeginFile() call. Returns
+  // true if the output already exists with exactly the same contents, in which
+  // case it doesn't need to be written.
+  bool AddOutput(const std::string& filename, const std::string& contents);
+
+  // Returns a 64-bit FNV-1a hash of data, as hex.
+  static std::string Fingerprint(const std::string& data);
+
+ private:
+  struct Entry {
+    std::string key;
+    // The output file names and the fingerprints of their contents.
+    std::vector<std::pair<std::string, std::string> > outputs;
+  };
+
+  // Adds the entries of the manifest in output_dir_ to entries.
+  void ReadManifest(std::map<std::string, Entry>* entries) const;
+
+  std::string output_dir_;
+  std::map<std::string, Entry> entries_;  // Keyed by .proto file name.
+  // The .proto files passed to BeginFile() since Load().
+  std::set<std::string> updated_;
+  Entry* current_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(OutputCache);
+};
+
+}  // namespace j2objc
+}  // namespace compiler
+}  // namespace protobuf
+}  // namespace google
+
+#endif  // GOOGLE_PROTOBUF_COMPILER_J2OBJC_OUTPUT_CACHE_H__
@@ -0,0 +1,83 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// DO NOT INCLUDE EXTERNALLY.
+// A bump allocator for the messages and field data created by a single parse,
+// see CGPParseFromByteArrayWithArena(). Allocations are never freed one by
+// one. The arena is reference counted, and every message and field data block
+// allocated in it holds a reference, so all of its memory is freed at once
+// when the last of them is released, typically along with the root message.
+//
+// Allocation is not thread safe and only happens while parsing. Retaining and
+// releasing are thread safe.
+
+#ifndef __ComGoogleProtobufArena_H__
+#define __ComGoogleProtobufArena_H__
+
+#import "JreEmulation.h"
+
+#import "com/google/protobuf/common.h"
+
+typedef struct CGPArena {
+  uint8_t *ptr;
+  uint8_t *end;
+  struct CGPArenaBlock *blocks;
+  size_t nextBlockSize;
+  _Atomic(uint32_t) refCount;
+} CGPArena;
+
+CF_EXTERN_C_BEGIN
+
+// Returns a new arena with a reference count of one. sizeHint is the expected
+// amount of memory needed, and is used to size the first block.
+CGPArena *CGPArenaCreate(size_t sizeHint);
+
+void CGPArenaRelease(CGPArena *arena);
+
+void *CGPArenaAllocSlow(CGPArena *arena, size_t size);
+
+CGP_ALWAYS_INLINE inline void CGPArenaRetain(CGPArena *arena) {
+  __c11_atomic_fetch_add(&arena->refCount, 1, __ATOMIC_RELAXED);
+}
+
+// Returns zeroed memory that is suitably aligned for any type.
+CGP_ALWAYS_INLINE inline void *CGPArenaAlloc(CGPArena *arena, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  if (__builtin_expect((size_t)(arena->end - arena->ptr) >= size, 1)) {
+    void *result = arena->ptr;
+    arena->ptr += size;
+    return result;
+  }
+  return CGPArenaAllocSlow(arena, size);
+}
+
+CF_EXTERN_C_END
+
+#endif // __ComGoogleProtobufArena_H__
@@ -0,0 +1,92 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#import "com/google/protobuf/Arena.h"
+
+#define MIN_BLOCK_SIZE 0x1000     // 4k
+#define MAX_BLOCK_SIZE 0x100000   // 1M
+
+// Allocations larger than this fraction of the next block size get a block of
+// their own, so that they don't waste the rest of the current block.
+#define LARGE_ALLOCATION_DIVISOR 4
+
+typedef struct CGPArenaBlock {
+  struct CGPArenaBlock *next;
+  // Keeps the data that follows 16 byte aligned.
+  size_t unused;
+} CGPArenaBlock;
+
+// Blocks are zeroed so that allocations are too, like NSAllocateObject.
+static CGPArenaBlock *NewBlock(size_t dataSize) {
+  return calloc(sizeof(CGPArenaBlock) + dataSize, 1);
+}
+
+CGPArena *CGPArenaCreate(size_t sizeHint) {
+  CGPArena *arena = calloc(sizeof(CGPArena), 1);
+  __c11_atomic_store(&arena->refCount, 1, __ATOMIC_RELAXED);
+  arena->nextBlockSize = MIN(MAX(sizeHint, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+  return arena;
+}
+
+void CGPArenaRelease(CGPArena *arena) {
+  if (__c11_atomic_fetch_sub(&arena->refCount, 1, __ATOMIC_RELEASE) == 1) {
+    __c11_atomic_thread_fence(__ATOMIC_ACQUIRE);
+    CGPArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+      CGPArenaBlock *next = block->next;
+      free(block);
+      block = next;
+    }
+    free(arena);
+  }
+}
+
+void *CGPArenaAllocSlow(CGPArena *arena, size_t size) {
+  if (size > arena->nextBlockSize / LARGE_ALLOCATION_DIVISOR) {
+    CGPArenaBlock *block = NewBlock(size);
+    if (arena->blocks != NULL) {
+      // Keep allocating from the current block.
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      arena->blocks = block;
+    }
+    return block + 1;
+  }
+
+  size_t blockSize = arena->nextBlockSize;
+  arena->nextBlockSize = MIN(blockSize * 2, MAX_BLOCK_SIZE);
+  CGPArenaBlock *block = NewBlock(blockSize);
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->ptr = (uint8_t *)(block + 1) + size;
+  arena->end = (uint8_t *)(block + 1) + blockSize;
+  return block + 1;
+}
@@ -52,6 +52,10 @@
 @interface ComGoogleProtobufByteString : NSObject < JavaLangIterable, JavaIoSerializable > {
  @package
   jint size_;
+  // The contents. Points at buffer_, unless the byte string aliases memory that
+  // is kept alive by owner_.
+  int8_t *bytes_;
+  id owner_;
   int8_t buffer_[0];
 }
 
@@ -99,6 +103,11 @@ ComGoogleProtobufByteString
 
 ComGoogleProtobufByteString *CGPNewByteString(jint len);
 
+// Returns a retained byte string that points at len bytes of existing memory
+// instead of copying them. The memory must stay valid and unmodified for as
+// long as owner is alive; the byte string retains owner.
+ComGoogleProtobufByteString *CGPNewAliasingByteString(id owner, const void *bytes, jint len);
+
 CF_EXTERN_C_END
 
 J2OBJC_STATIC_INIT(ComGoogleProtobufByteString)
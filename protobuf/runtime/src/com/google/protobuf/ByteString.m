@@ -54,6 +54,15 @@ ComGoogleProtobufByteString *ComGoogleProtobufByteString_EMPTY;
 ComGoogleProtobufByteString *CGPNewByteString(jint len) {
   CGPByteString *byteString = NSAllocateObject([CGPByteString class], len, nil);
   byteString->size_ = len;
+  byteString->bytes_ = byteString->buffer_;
+  return byteString;
+}
+
+ComGoogleProtobufByteString *CGPNewAliasingByteString(id owner, const void *bytes, jint len) {
+  CGPByteString *byteString = NSAllocateObject([CGPByteString class], 0, nil);
+  byteString->size_ = len;
+  byteString->bytes_ = (int8_t *)bytes;
+  byteString->owner_ = [owner retain];
   return byteString;
 }
 
@@ -61,7 +70,7 @@ ComGoogleProtobufByteString *ComGoogleProtobufByteString_copyFromWithByteArray_(
     IOSByteArray *bytes) {
   (void)nil_chk(bytes);  // Ensure Java compatibility.
   CGPByteString *byteString = CGPNewByteString(bytes->size_);
-  memcpy(byteString->buffer_, bytes->buffer_, bytes->size_);
+  memcpy(byteString->bytes_, bytes->buffer_, bytes->size_);
   return [byteString autorelease];
 }
 
@@ -69,7 +78,7 @@ ComGoogleProtobufByteString *ComGoogleProtobufByteString_copyFromUtf8WithNSStrin
   (void)nil_chk(text);  // Ensure Java compatibility.
   NSUInteger length = [text lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
   CGPByteString *byteString = CGPNewByteString((jint)length);
-  [text getBytes:byteString->buffer_
+  [text getBytes:byteString->bytes_
        maxLength:length
       usedLength:NULL
         encoding:NSUTF8StringEncoding
@@ -116,7 +125,7 @@ static ByteStringIterator *create_ByteStringIterator_initWithComGoogleProtobufBy
         initWithNSString:[NSString stringWithFormat:@"this.length=%d; index=%d", size_, index]]
         autorelease];
   }
-  return buffer_[index];
+  return bytes_[index];
 }
 
 - (jint)size {
@@ -140,13 +149,13 @@ static ByteStringIterator *create_ByteStringIterator_initWithComGoogleProtobufBy
     return ComGoogleProtobufByteString_EMPTY;
   } else {
     CGPByteString *byteString = CGPNewByteString(substringLength);
-    memcpy(byteString->buffer_, buffer_ + beginIndex, substringLength);
+    memcpy(byteString->bytes_, bytes_ + beginIndex, substringLength);
     return [byteString autorelease];
   }
 }
 
 - (IOSByteArray *)toByteArray {
-  return [IOSByteArray arrayWithBytes:buffer_ count:size_];
+  return [IOSByteArray arrayWithBytes:bytes_ count:size_];
 }
 
 - (NSString *)toStringWithJavaNioCharsetCharset:(JavaNioCharsetCharset *)charset {
@@ -158,7 +167,7 @@ static ByteStringIterator *create_ByteStringIterator_initWithComGoogleProtobufBy
 }
 
 - (NSString *)toStringUtf8 {
-  return [[[NSString alloc] initWithBytes:buffer_
+  return [[[NSString alloc] initWithBytes:bytes_
                                    length:size_
                                  encoding:NSUTF8StringEncoding] autorelease];
 }
@@ -186,7 +195,7 @@ static ByteStringIterator *create_ByteStringIterator_initWithComGoogleProtobufBy
 
 - (void)writeToWithJavaIoOutputStream:(JavaIoOutputStream *)output {
   if (size_ > 0) {
-    IOSByteArray *bytes = [IOSByteArray newArrayWithBytes:buffer_ count:size_];
+    IOSByteArray *bytes = [IOSByteArray newArrayWithBytes:bytes_ count:size_];
     @try {
       [output writeWithByteArray:bytes];
     } @finally {
@@ -209,7 +218,7 @@ static ByteStringIterator *create_ByteStringIterator_initWithComGoogleProtobufBy
   if (size_ == 0) {
     return YES;
   }
-  return memcmp(buffer_, otherByteString->buffer_, size_) == 0;
+  return memcmp(bytes_, otherByteString->bytes_, size_) == 0;
 }
 
 - (void)forEachWithJavaUtilFunctionConsumer:(id<JavaUtilFunctionConsumer>)arg0 {
@@ -229,11 +238,16 @@ static ByteStringIterator *create_ByteStringIterator_initWithComGoogleProtobufBy
 - (NSUInteger)hash {
   jint h = size_;
   for (jint i = 0; i < size_; i++) {
-    h = h * 31 + buffer_[i];
+    h = h * 31 + bytes_[i];
   }
   return h;
 }
 
+- (void)dealloc {
+  [owner_ release];
+  [super dealloc];
+}
+
 + (void)initialize {
   if (self == [ComGoogleProtobufByteString class]) {
     ComGoogleProtobufByteString_EMPTY = CGPNewByteString(0);
@@ -277,7 +291,7 @@ static void ReleaseChunks(IOSByteArray *chunk) {
 
 ComGoogleProtobufByteString *ByteStringFromChunks(jint size, IOSByteArray *chunk) {
   CGPByteString *byteString = CGPNewByteString(size);
-  void *buffer = byteString->buffer_;
+  void *buffer = byteString->bytes_;
   while (chunk) {
     ChunkData *chunkData = (ChunkData *)chunk->buffer_;
     memcpy(buffer, (void *)chunk->buffer_ + sizeof(ChunkData), chunkData->numBytes);
@@ -212,6 +212,32 @@ class CGPCodedInputStream {
   static bool ReadVarint32(int firstByte, JavaIoInputStream *input,
                            uint32 *value);
 
+  // Lets byte strings, and large ASCII strings, that are read from now on point
+  // into the input buffer instead of copying it. The values retain owner, which
+  // must keep the buffer alive and unmodified. Only valid for streams that read
+  // from a buffer.
+  void EnableAliasing(id owner);
+  id AliasingOwner() const;
+
+  // Sub-messages and repeated and map field data created while parsing from
+  // this stream are allocated in the arena, if set. See Arena.h.
+  void SetArena(struct CGPArena *arena);
+  struct CGPArena *Arena() const;
+
+  // Singular message fields read from this stream, and from the sub-messages
+  // in them, keep their encoded bytes and are only parsed when first accessed.
+  void EnableLazyParsing();
+  bool LazyParsing() const;
+
+  // If all of the input up to the current limit is already buffered, points
+  // *data at the unread part of it, sets *size to its length and returns true.
+  // The caller may then parse directly from memory and call
+  // SkipBufferedUntilLimit() once it has consumed all of it.
+  bool GetBufferedUntilLimit(const void **data, int *size);
+  // Consumes the rest of the buffered input up to the current limit, leaving
+  // the stream in the same state as reading a tag at the limit would.
+  void SkipBufferedUntilLimit();
+
  private:
   CGPCodedInputStream(const CGPCodedInputStream&);
   void operator=(const CGPCodedInputStream&);
@@ -244,6 +270,13 @@ class CGPCodedInputStream {
   // we aren't at a limit -- the buffer may have ended exactly at the limit.
   int buffer_size_after_limit_;
 
+  // Set by EnableAliasing(). Not retained.
+  id alias_owner_;
+
+  struct CGPArena *arena_;
+
+  bool lazy_parsing_;
+
   // Private member functions.
 
   // Advance the buffer by a given number of bytes.
@@ -354,6 +387,46 @@ inline int CGPCodedInputStream::CurrentPosition() const {
   return total_bytes_read_ - (BufferSize() + buffer_size_after_limit_);
 }
 
+inline bool CGPCodedInputStream::GetBufferedUntilLimit(const void **data, int *size) {
+  if (buffer_size_after_limit_ == 0 && total_bytes_read_ != current_limit_) {
+    return false;
+  }
+  *data = buffer_;
+  *size = BufferSize();
+  return true;
+}
+
+inline void CGPCodedInputStream::SkipBufferedUntilLimit() {
+  buffer_ = buffer_end_;
+  last_tag_ = 0;
+  legitimate_message_end_ = true;
+}
+
+inline void CGPCodedInputStream::EnableAliasing(id owner) {
+  NSCAssert(input_ == nil, @"Aliasing requires a buffered stream");
+  alias_owner_ = owner;
+}
+
+inline id CGPCodedInputStream::AliasingOwner() const {
+  return alias_owner_;
+}
+
+inline void CGPCodedInputStream::SetArena(struct CGPArena *arena) {
+  arena_ = arena;
+}
+
+inline struct CGPArena *CGPCodedInputStream::Arena() const {
+  return arena_;
+}
+
+inline void CGPCodedInputStream::EnableLazyParsing() {
+  lazy_parsing_ = true;
+}
+
+inline bool CGPCodedInputStream::LazyParsing() const {
+  return lazy_parsing_;
+}
+
 inline void CGPCodedInputStream::Advance(int amount) {
   buffer_ += amount;
 }
@@ -373,7 +446,10 @@ inline CGPCodedInputStream::CGPCodedInputStream(JavaIoInputStream *input,
     last_tag_(0),
     legitimate_message_end_(false),
     current_limit_(INT_MAX),
-    buffer_size_after_limit_(0) {
+    buffer_size_after_limit_(0),
+    alias_owner_(nil),
+    arena_(NULL),
+    lazy_parsing_(false) {
   // Eagerly Refresh() so buffer space is immediately available.
   Refresh();
 }
@@ -388,7 +464,10 @@ inline CGPCodedInputStream::CGPCodedInputStream(const void *buffer, int size)
     last_tag_(0),
     legitimate_message_end_(false),
     current_limit_(size),
-    buffer_size_after_limit_(0) {
+    buffer_size_after_limit_(0),
+    alias_owner_(nil),
+    arena_(NULL),
+    lazy_parsing_(false) {
 }
 
 #endif // __ComGoogleProtobufCodedInputStream_H__
@@ -41,8 +41,82 @@ namespace {
 static const int kMaxVarintBytes = 10;
 static const int kMaxVarint32Bytes = 5;
 
+// Shorter strings are copied even when aliasing, since a CFString can store
+// them inline.
+static const uint32 kMinAliasedStringSize = 64;
+
 }  // namespace
 
+// An ASCII string whose characters are read directly from bytes that owner_
+// keeps alive, so that parsing it doesn't copy the data.
+@interface CGPAliasedAsciiString : NSString {
+  const uint8 *bytes_;
+  NSUInteger length_;
+  id owner_;
+}
+
+- (instancetype)initWithBytes:(const uint8 *)bytes length:(NSUInteger)length owner:(id)owner;
+
+@end
+
+@implementation CGPAliasedAsciiString
+
+- (instancetype)initWithBytes:(const uint8 *)bytes length:(NSUInteger)length owner:(id)owner {
+  if ((self = [super init])) {
+    bytes_ = bytes;
+    length_ = length;
+    owner_ = [owner retain];
+  }
+  return self;
+}
+
+- (NSUInteger)length {
+  return length_;
+}
+
+- (unichar)characterAtIndex:(NSUInteger)index {
+  if (index >= length_) {
+    [NSException raise:NSRangeException format:@"Index %lu out of bounds; string length %lu",
+        (unsigned long)index, (unsigned long)length_];
+  }
+  return bytes_[index];
+}
+
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range {
+  if (NSMaxRange(range) > length_) {
+    [NSException raise:NSRangeException format:@"Range %@ out of bounds; string length %lu",
+        NSStringFromRange(range), (unsigned long)length_];
+  }
+  const uint8 *src = bytes_ + range.location;
+  for (NSUInteger i = 0; i < range.length; i++) {
+    buffer[i] = src[i];
+  }
+}
+
+- (NSStringEncoding)fastestEncoding {
+  return NSASCIIStringEncoding;
+}
+
+- (void)dealloc {
+  [owner_ release];
+  [super dealloc];
+}
+
+@end
+
+static bool IsAscii(const uint8 *bytes, uint32 size) {
+  uint32 i = 0;
+  for (; i + sizeof(uint64) <= size; i += sizeof(uint64)) {
+    uint64 word;
+    memcpy(&word, bytes + i, sizeof(word));
+    if (word & 0x8080808080808080ULL) return false;
+  }
+  for (; i < size; i++) {
+    if (bytes[i] & 0x80) return false;
+  }
+  return true;
+}
+
 CGPCodedInputStream::~CGPCodedInputStream() {
   [bytes_ release];
 }
@@ -428,7 +502,13 @@ bool CGPCodedInputStream::ReadRetainedNSString(NSString **value) {
   if (!ReadVarint32(&size)) return false;
 
   if ((unsigned)BufferSize() >= size) {
-    *value = RetainedStringFromBytes(buffer_, size);
+    if (alias_owner_ != nil && size >= kMinAliasedStringSize && IsAscii(buffer_, size)) {
+      *value = [[CGPAliasedAsciiString alloc] initWithBytes:buffer_
+                                                     length:size
+                                                      owner:alias_owner_];
+    } else {
+      *value = RetainedStringFromBytes(buffer_, size);
+    }
     Advance(size);
     return true;
   }
@@ -446,8 +526,12 @@ bool CGPCodedInputStream::ReadRetainedByteString(CGPByteString **value) {
   if (!ReadVarint32(&size)) return false;
 
   if ((unsigned)BufferSize() >= size) {
-    *value = CGPNewByteString(size);
-    memcpy((*value)->buffer_, buffer_, size);
+    if (alias_owner_ != nil) {
+      *value = CGPNewAliasingByteString(alias_owner_, buffer_, size);
+    } else {
+      *value = CGPNewByteString(size);
+      memcpy((*value)->bytes_, buffer_, size);
+    }
     Advance(size);
     return true;
   }
@@ -457,7 +541,7 @@ bool CGPCodedInputStream::ReadRetainedByteString(CGPByteString **value) {
   string string;
   if (!ReadStringFallback(&string, size)) return false;
   *value = CGPNewByteString(size);
-  memcpy((*value)->buffer_, string.data(), size);
+  memcpy((*value)->bytes_, string.data(), size);
   return true;
 }
 
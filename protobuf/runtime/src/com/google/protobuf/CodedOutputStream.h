@@ -89,6 +89,8 @@
 
 #import "com/google/protobuf/common.h"
 
+#include <vector>
+
 @class JavaIoOutputStream;
 
 // Class which encodes and writes binary data which is composed of varint-
@@ -149,6 +151,12 @@ class CGPCodedOutputStream {
   // true.
   explicit CGPCodedOutputStream(void *buffer, int size);
 
+  // Create a CodedOutputStream that collects its output in a chain of buffers.
+  // Large payloads written with WriteAliasedRaw() become links of the chain
+  // instead of being copied. The chain is written out with WriteChainToFile()
+  // or CopyChainToArray().
+  CGPCodedOutputStream();
+
   ~CGPCodedOutputStream();
 
   // Skips a number of bytes, leaving the bytes unmodified in the underlying
@@ -169,6 +177,11 @@ class CGPCodedOutputStream {
   // Write raw bytes, copying them from the given buffer.
   void WriteRaw(const void* buffer, int size);
 
+  // Like WriteRaw(), except that a chained stream refers to large buffers
+  // instead of copying them. owner must keep the buffer alive and unmodified;
+  // the stream retains it until it is destructed.
+  void WriteAliasedRaw(const void* buffer, int size, id owner);
+
   // Write a 32-bit little-endian integer.
   void WriteLittleEndian32(uint32 value);
   // Like WriteLittleEndian32()  but writing directly to the target array.
@@ -212,10 +225,29 @@ class CGPCodedOutputStream {
   // the full buffer size will be available.
   bool FlushBuffer();
 
+  // Returns the number of bytes written to a chained stream.
+  int ChainSize();
+
+  // Copies the output of a chained stream to target, which must have room for
+  // ChainSize() bytes.
+  void CopyChainToArray(uint8* target);
+
+  // Writes the output of a chained stream to a file descriptor, with as few
+  // writev() calls as possible. Returns false if a write fails, with errno set.
+  bool WriteChainToFile(int fd);
+
  private:
   CGPCodedOutputStream(const CGPCodedOutputStream&);
   void operator=(const CGPCodedOutputStream&);
 
+  // A piece of the output of a chained stream. owner is nil if the data is in
+  // one of the stream's blocks.
+  struct ChainLink {
+    const uint8* data;
+    int size;
+    id owner;
+  };
+
   JavaIoOutputStream *output_;
   IOSByteArray *bytes_;
   uint8* buffer_;
@@ -223,6 +255,15 @@ class CGPCodedOutputStream {
   int total_bytes_;  // Sum of sizes of all buffers seen so far.
   bool had_error_;   // Whether an error occurred during output.
 
+  bool chained_;
+  std::vector<ChainLink> links_;
+  std::vector<uint8*> blocks_;
+  uint8* link_start_;  // Start of the bytes in the current block not yet linked.
+  uint8* block_end_;
+
+  // Links the bytes written to the current block since the last link.
+  void EndLink();
+
   // Advance the buffer by a given number of bytes.
   void Advance(int amount);
 
@@ -289,6 +330,15 @@ inline int CGPCodedOutputStream::VarintSize32SignExtended(int32 value) {
   }
 }
 
+inline void CGPCodedOutputStream::WriteAliasedRaw(const void* data, int size, id owner) {
+  if (chained_ && size >= CGP_CODED_STREAM_MIN_ALIASED_SIZE) {
+    EndLink();
+    links_.push_back({ static_cast<const uint8*>(data), size, [owner retain] });
+  } else {
+    WriteRaw(data, size);
+  }
+}
+
 inline void CGPCodedOutputStream::Advance(int amount) {
   buffer_ += amount;
   buffer_size_ -= amount;
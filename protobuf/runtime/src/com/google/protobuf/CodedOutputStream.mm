@@ -32,6 +32,10 @@
 
 #import "java/io/OutputStream.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
 namespace {
 
 static const int kMaxVarintBytes = 10;
@@ -45,7 +49,10 @@ CGPCodedOutputStream::CGPCodedOutputStream(JavaIoOutputStream *output)
     buffer_((uint8 *)bytes_->buffer_),
     buffer_size_((int)bytes_->size_),
     total_bytes_((int)bytes_->size_),
-    had_error_(false) {
+    had_error_(false),
+    chained_(false),
+    link_start_(NULL),
+    block_end_(NULL) {
 }
 
 CGPCodedOutputStream::CGPCodedOutputStream(void *buffer, int size)
@@ -54,11 +61,32 @@ CGPCodedOutputStream::CGPCodedOutputStream(void *buffer, int size)
     buffer_((uint8 *)buffer),
     buffer_size_(size),
     total_bytes_(size),
-    had_error_(false) {
+    had_error_(false),
+    chained_(false),
+    link_start_(NULL),
+    block_end_(NULL) {
+}
+
+CGPCodedOutputStream::CGPCodedOutputStream()
+  : output_(nil),
+    bytes_(nil),
+    buffer_(NULL),
+    buffer_size_(0),
+    total_bytes_(0),
+    had_error_(false),
+    chained_(true),
+    link_start_(NULL),
+    block_end_(NULL) {
 }
 
 CGPCodedOutputStream::~CGPCodedOutputStream() {
   [bytes_ release];
+  for (const ChainLink &link : links_) {
+    [link.owner release];
+  }
+  for (uint8 *block : blocks_) {
+    free(block);
+  }
 }
 
 bool CGPCodedOutputStream::Skip(int count) {
@@ -271,7 +299,19 @@ void CGPCodedOutputStream::WriteVarint64(uint64 value) {
 }
 
 bool CGPCodedOutputStream::FlushBuffer() {
-  if (output_ != NULL) {
+  if (chained_) {
+    // Link what was written to the current block and continue in a new one.
+    EndLink();
+    int size = CGP_CODED_STREAM_BUFFER_SIZE;
+    uint8 *block = (uint8 *)malloc(size);
+    blocks_.push_back(block);
+    buffer_ = block;
+    buffer_size_ = size;
+    link_start_ = block;
+    block_end_ = block + size;
+    total_bytes_ += size;
+    return true;
+  } else if (output_ != NULL) {
     // Flush remaining bytes to the output stream.
     int size = (int)bytes_->size_ - buffer_size_;
     [output_ writeWithByteArray:bytes_ withInt:0 withInt:size];
@@ -287,6 +327,63 @@ bool CGPCodedOutputStream::FlushBuffer() {
   }
 }
 
+void CGPCodedOutputStream::EndLink() {
+  // Refresh() clears buffer_size_ without advancing buffer_, so the written
+  // part of the block is measured from its end.
+  uint8 *end = block_end_ - buffer_size_;
+  if (end > link_start_) {
+    links_.push_back({ link_start_, (int)(end - link_start_), nil });
+    link_start_ = end;
+  }
+}
+
+int CGPCodedOutputStream::ChainSize() {
+  EndLink();
+  int size = 0;
+  for (const ChainLink &link : links_) {
+    size += link.size;
+  }
+  return size;
+}
+
+void CGPCodedOutputStream::CopyChainToArray(uint8 *target) {
+  EndLink();
+  for (const ChainLink &link : links_) {
+    memcpy(target, link.data, link.size);
+    target += link.size;
+  }
+}
+
+bool CGPCodedOutputStream::WriteChainToFile(int fd) {
+  EndLink();
+  std::vector<struct iovec> iov(links_.size());
+  for (size_t i = 0; i < links_.size(); i++) {
+    iov[i].iov_base = (void *)links_[i].data;
+    iov[i].iov_len = links_[i].size;
+  }
+  struct iovec *next = iov.data();
+  struct iovec *end = next + iov.size();
+  while (next < end) {
+    int count = (int)MIN(end - next, IOV_MAX);
+    ssize_t written = writev(fd, next, count);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    // Skip the links that were written completely, and the written part of the
+    // next one.
+    while (next < end && (size_t)written >= next->iov_len) {
+      written -= next->iov_len;
+      next++;
+    }
+    if (written > 0) {
+      next->iov_base = (uint8 *)next->iov_base + written;
+      next->iov_len -= written;
+    }
+  }
+  return true;
+}
+
 int CGPCodedOutputStream::VarintSize32Fallback(uint32 value) {
   if (value < (1 << 7)) {
     return 1;
@@ -0,0 +1,82 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Reads a sequence of length-delimited messages, as written by
+// writeDelimitedTo(), from an input stream.
+//
+// Unlike parseDelimitedFrom(), which reads the length one byte at a time and
+// then allocates a stream buffer for each message, a reader fills a single
+// buffer with as much input as is available and parses every message that it
+// contains before reading again. The reader may therefore consume input past
+// the last message it returns, so the input stream should not be read
+// directly while the reader is in use.
+
+#ifndef __ComGoogleProtobufDelimitedReader_H__
+#define __ComGoogleProtobufDelimitedReader_H__
+
+#include "J2ObjC_header.h"
+
+// The largest message that a reader accepts by default, in bytes.
+#define CGP_DELIMITED_READER_DEFAULT_SIZE_LIMIT (64 << 20)
+
+@class ComGoogleProtobufExtensionRegistryLite;
+@class ComGoogleProtobufGeneratedMessage;
+@class IOSByteArray;
+@class JavaIoInputStream;
+
+@interface CGPDelimitedReader : NSObject {
+ @private
+  JavaIoInputStream *input_;
+  IOSByteArray *buffer_;
+  // The unread part of the buffer.
+  jint start_;
+  jint end_;
+  jint sizeLimit_;
+}
+
+- (instancetype)initWithInputStream:(JavaIoInputStream *)input;
+
+// Sets the largest message size that the reader accepts. A message with a
+// larger length prefix is rejected before its bytes are read, so that a corrupt
+// or malicious prefix can't make the reader buffer an arbitrary amount of input.
+- (void)setSizeLimit:(jint)limit;
+
+// Returns the next message, which must be of the given generated message
+// class, or nil if the input ended after the previous message. Throws
+// InvalidProtocolBufferException if the input is malformed or truncated, or if
+// the message is larger than the size limit. Only blocks for input until the
+// message is complete, so it can be used with a socket or pipe whose sender
+// waits for a response.
+- (ComGoogleProtobufGeneratedMessage *)nextMessageOfClass:(Class)messageClass
+    registry:(ComGoogleProtobufExtensionRegistryLite *)registry;
+
+@end
+
+#endif // __ComGoogleProtobufDelimitedReader_H__
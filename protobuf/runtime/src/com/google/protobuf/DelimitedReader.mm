@@ -0,0 +1,155 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "com/google/protobuf/DelimitedReader.h"
+
+#include "IOSPrimitiveArray.h"
+#include "com/google/protobuf/GeneratedMessage_PackagePrivate.h"
+#include "com/google/protobuf/InvalidProtocolBufferException.h"
+#include "com/google/protobuf/common.h"
+#include "java/io/InputStream.h"
+#include "java/lang/IllegalArgumentException.h"
+
+#define MAX_VARINT_SIZE 10
+
+static void InvalidPB() {
+  @throw [[[ComGoogleProtobufInvalidProtocolBufferException alloc] init] autorelease];
+}
+
+@implementation CGPDelimitedReader
+
+- (instancetype)initWithInputStream:(JavaIoInputStream *)input {
+  if ((self = [super init])) {
+    input_ = [input retain];
+    buffer_ = [IOSByteArray newArrayWithLength:CGP_CODED_STREAM_BUFFER_SIZE];
+    sizeLimit_ = CGP_DELIMITED_READER_DEFAULT_SIZE_LIMIT;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [input_ release];
+  [buffer_ release];
+  [super dealloc];
+}
+
+- (void)setSizeLimit:(jint)limit {
+  if (limit < 0) {
+    @throw create_JavaLangIllegalArgumentException_initWithNSString_(
+        @"Size limit cannot be negative");
+  }
+  sizeLimit_ = limit;
+}
+
+// Makes a single read from the input after the unread bytes, which must be
+// fewer than size, and returns NO at the end of the input. A full buffer is
+// first compacted, or grown if the unread bytes fill it. The buffer only grows
+// as input arrives, and never beyond size, so that a length prefix doesn't
+// allocate more than the input that follows it.
+static BOOL ReadMore(CGPDelimitedReader *self, jint size) {
+  IOSByteArray *buffer = self->buffer_;
+  jint capacity = buffer->size_;
+  if (self->end_ == capacity) {
+    jint unread = self->end_ - self->start_;
+    if (unread == capacity) {
+      capacity = capacity > size / 2 ? size : capacity * 2;
+      IOSByteArray *newBuffer = [IOSByteArray newArrayWithLength:capacity];
+      memcpy(newBuffer->buffer_, buffer->buffer_ + self->start_, unread);
+      [buffer release];
+      self->buffer_ = buffer = newBuffer;
+    } else {
+      memmove(buffer->buffer_, buffer->buffer_ + self->start_, unread);
+    }
+    self->start_ = 0;
+    self->end_ = unread;
+  }
+  jint count = [self->input_ readWithByteArray:buffer
+                                       withInt:self->end_
+                                       withInt:capacity - self->end_];
+  if (count < 0) {
+    return NO;
+  }
+  self->end_ += count;
+  return YES;
+}
+
+// Decodes the length prefix if its last byte has been read, without waiting for
+// input past it, since the sender may not write more until it gets a response.
+static BOOL ReadLength(CGPDelimitedReader *self, uint64_t *length) {
+  const uint8_t *ptr = (const uint8_t *)self->buffer_->buffer_ + self->start_;
+  const uint8_t *end = (const uint8_t *)self->buffer_->buffer_ + self->end_;
+  uint64_t result = 0;
+  for (uint32_t shift = 0; ptr < end; shift += 7) {
+    if (shift >= 7 * MAX_VARINT_SIZE) {
+      InvalidPB();
+    }
+    uint8_t b = *ptr++;
+    result |= (uint64_t)(b & 0x7F) << shift;
+    if (b < 0x80) {
+      *length = result;
+      self->start_ = (jint)(ptr - (const uint8_t *)self->buffer_->buffer_);
+      return YES;
+    }
+  }
+  return NO;
+}
+
+- (ComGoogleProtobufGeneratedMessage *)nextMessageOfClass:(Class)messageClass
+    registry:(ComGoogleProtobufExtensionRegistryLite *)registry {
+  uint64_t length;
+  while (!ReadLength(self, &length)) {
+    if (end_ - start_ >= MAX_VARINT_SIZE) {
+      InvalidPB();
+    }
+    if (!ReadMore(self, MAX_VARINT_SIZE)) {
+      if (start_ == end_) {
+        return nil;
+      }
+      InvalidPB();
+    }
+  }
+  // Like CGPCodedInputStream::ReadVarint32(), the length is truncated to 32
+  // bits.
+  jint size = (jint)(uint32_t)length;
+  if (size < 0 || size > sizeLimit_) {
+    InvalidPB();
+  }
+  while (end_ - start_ < size) {
+    if (!ReadMore(self, size)) {
+      InvalidPB();
+    }
+  }
+  ComGoogleProtobufGeneratedMessage *msg =
+      CGPParseFromBuffer([messageClass getDescriptor], buffer_->buffer_ + start_, size, registry);
+  start_ += size;
+  return msg;
+}
+
+@end
@@ -96,6 +96,158 @@ IOSObjectArray *CreateFields(
   return fields;
 }
 
+// Field numbers up to this multiple of the field count are stored in a table
+// indexed directly by number. Sparser messages use a perfect hash instead.
+#define DENSE_LOOKUP_FACTOR 4
+#define DENSE_LOOKUP_MIN_SIZE 32
+
+// How many times larger than the smallest one a perfect hash table may grow
+// before the lookup falls back to a sorted table, as a power of 2.
+#define MAX_LOOKUP_GROWTH_BITS 4
+
+static uint32_t Log2Ceil(uint32_t n) {
+  uint32_t bits = 0;
+  while ((1u << bits) < n) {
+    bits++;
+  }
+  return bits;
+}
+
+// Attempts to place every field using the given multiplier. Buckets are placed
+// largest first, each at the smallest displacement that lands all of its fields
+// on free slots.
+static BOOL TryPerfectHash(
+    CGPFieldDescriptor **fieldsBuf, jint fieldCount, CGPFieldLookup *lookup,
+    uint32_t numBuckets, uint32_t *bucketOf, uint32_t *bucketSizes) {
+  uint32_t mask = lookup->size - 1;
+  memset(lookup->table, 0, lookup->size * sizeof(CGPFieldDescriptor *));
+  memset(bucketSizes, 0, numBuckets * sizeof(uint32_t));
+  uint32_t maxBucketSize = 0;
+  for (jint i = 0; i < fieldCount; i++) {
+    uint32_t number = (uint32_t)CGPFieldGetNumber(fieldsBuf[i]);
+    bucketOf[i] = (number * CGP_FIELD_LOOKUP_BUCKET_MULTIPLIER) >> lookup->bucketShift;
+    maxBucketSize = MAX(maxBucketSize, ++bucketSizes[bucketOf[i]]);
+  }
+  for (uint32_t bucketSize = maxBucketSize; bucketSize > 0; bucketSize--) {
+    for (uint32_t bucket = 0; bucket < numBuckets; bucket++) {
+      if (bucketSizes[bucket] != bucketSize) {
+        continue;
+      }
+      BOOL placed = NO;
+      for (uint32_t disp = 0; disp < lookup->size && !placed; disp++) {
+        placed = YES;
+        jint i = 0;
+        for (; i < fieldCount; i++) {
+          if (bucketOf[i] != bucket) continue;
+          uint32_t number = (uint32_t)CGPFieldGetNumber(fieldsBuf[i]);
+          uint32_t idx = (((number * lookup->multiplier) >> lookup->shift) + disp) & mask;
+          if (lookup->table[idx] != nil) {
+            placed = NO;
+            break;
+          }
+          lookup->table[idx] = fieldsBuf[i];
+        }
+        if (!placed) {
+          // Undo the partial placement of this bucket.
+          for (jint j = 0; j < i; j++) {
+            if (bucketOf[j] != bucket) continue;
+            uint32_t number = (uint32_t)CGPFieldGetNumber(fieldsBuf[j]);
+            lookup->table[(((number * lookup->multiplier) >> lookup->shift) + disp) & mask] = nil;
+          }
+        } else {
+          lookup->displacements[bucket] = disp;
+        }
+      }
+      if (!placed) {
+        return NO;
+      }
+    }
+  }
+  return YES;
+}
+
+static int CompareFieldNumbers(const void *a, const void *b) {
+  jint numberA = CGPFieldGetNumber(*(CGPFieldDescriptor * const *)a);
+  jint numberB = CGPFieldGetNumber(*(CGPFieldDescriptor * const *)b);
+  return numberA < numberB ? -1 : numberA > numberB;
+}
+
+// The fallback when no perfect hash is found: the fields sorted by number.
+static void BuildSortedFieldLookup(
+    CGPFieldLookup *lookup, CGPFieldDescriptor **fieldsBuf, jint fieldCount) {
+  *lookup = (CGPFieldLookup){};
+  lookup->table = (CGPFieldDescriptor **)malloc(fieldCount * sizeof(CGPFieldDescriptor *));
+  memcpy(lookup->table, fieldsBuf, fieldCount * sizeof(CGPFieldDescriptor *));
+  qsort(lookup->table, fieldCount, sizeof(CGPFieldDescriptor *), CompareFieldNumbers);
+  lookup->sortedCount = (uint32_t)fieldCount;
+}
+
+static void BuildFieldLookup(CGPDescriptor *descriptor) {
+  CGPFieldLookup *lookup = &descriptor->fieldLookup_;
+  jint fieldCount = (jint)descriptor->fields_->size_;
+  CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
+  uint32_t maxNumber = 0;
+  for (jint i = 0; i < fieldCount; i++) {
+    maxNumber = MAX(maxNumber, (uint32_t)CGPFieldGetNumber(fieldsBuf[i]));
+  }
+
+  if (maxNumber < MAX(DENSE_LOOKUP_MIN_SIZE, (uint32_t)fieldCount * DENSE_LOOKUP_FACTOR)) {
+    lookup->size = maxNumber + 1;
+    lookup->table = (CGPFieldDescriptor **)calloc(lookup->size, sizeof(CGPFieldDescriptor *));
+    for (jint i = 0; i < fieldCount; i++) {
+      lookup->table[CGPFieldGetNumber(fieldsBuf[i])] = fieldsBuf[i];
+    }
+    return;
+  }
+
+  // Roughly two fields per bucket and a table at most half full. If no
+  // multiplier works, retry with a larger table, up to a limit.
+  uint32_t bucketBits = MAX(1u, Log2Ceil((uint32_t)fieldCount / 2));
+  uint32_t numBuckets = 1u << bucketBits;
+  lookup->bucketShift = 32 - bucketBits;
+  lookup->displacements = (uint32_t *)calloc(numBuckets, sizeof(uint32_t));
+  uint32_t *bucketOf = (uint32_t *)malloc(fieldCount * sizeof(uint32_t));
+  uint32_t *bucketSizes = (uint32_t *)malloc(numBuckets * sizeof(uint32_t));
+  uint32_t minBits = Log2Ceil((uint32_t)fieldCount * 2);
+  uint32_t maxBits = MIN(minBits + MAX_LOOKUP_GROWTH_BITS, 31u);
+  for (uint32_t bits = minBits; bits <= maxBits; bits++) {
+    lookup->size = 1u << bits;
+    lookup->shift = 32 - bits;
+    lookup->table = (CGPFieldDescriptor **)malloc(lookup->size * sizeof(CGPFieldDescriptor *));
+    lookup->multiplier = 0x85EBCA6Bu;
+    for (int attempt = 0; attempt < 16; attempt++) {
+      if (TryPerfectHash(fieldsBuf, fieldCount, lookup, numBuckets, bucketOf, bucketSizes)) {
+        free(bucketOf);
+        free(bucketSizes);
+        return;
+      }
+      lookup->multiplier = (lookup->multiplier * 1664525u + 1013904223u) | 1u;
+    }
+    free(lookup->table);
+  }
+  free(bucketOf);
+  free(bucketSizes);
+  free(lookup->displacements);
+  BuildSortedFieldLookup(lookup, fieldsBuf, fieldCount);
+}
+
+CGPFieldDescriptor *CGPFindFieldInSortedLookup(const CGPFieldLookup *lookup, uint32_t number) {
+  uint32_t low = 0;
+  uint32_t high = lookup->sortedCount;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    uint32_t midNumber = (uint32_t)CGPFieldGetNumber(lookup->table[mid]);
+    if (midNumber == number) {
+      return lookup->table[mid];
+    } else if (midNumber < number) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return nil;
+}
+
 CGPDescriptor *CGPInitDescriptor(
     Class messageClass, Class builderClass, CGPMessageFlags flags,
     size_t storageSize) {
@@ -106,10 +258,110 @@ CGPDescriptor *CGPInitDescriptor(
                storageSize:storageSize];
 }
 
+// Where a field or a oneof case is stored, and whether it may be part of the
+// POD range.
+typedef struct CGPStorageSlot {
+  uint32_t start;
+  uint32_t end;
+  bool isPod;
+} CGPStorageSlot;
+
+static int CompareStorageSlots(const void *a, const void *b) {
+  uint32_t startA = ((const CGPStorageSlot *)a)->start;
+  uint32_t startB = ((const CGPStorageSlot *)b)->start;
+  return startA < startB ? -1 : startA > startB;
+}
+
+static BOOL IsPodField(CGPFieldDescriptor *field) {
+  if (CGPFieldIsRepeated(field) || field->access_.isOneof) {
+    return NO;
+  }
+  switch (CGPFieldGetJavaType(field)) {
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_INT:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_LONG:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_BOOLEAN:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_ENUM:
+      return YES;
+    default:
+      // Floating point equality differs from bitwise equality for NaN and -0.
+      return NO;
+  }
+}
+
+// Finds the longest run of adjacent singular integral, bool and enum fields
+// outside oneofs in the field storage. The plugin declares all of them first,
+// so the run normally covers every such field. Storage from older generated
+// code may interleave them with other fields, in which case the remaining ones
+// are compared one by one.
+static void ComputePodRange(CGPDescriptor *descriptor, jint oneofCount, CGPOneofData *oneofData) {
+  NSUInteger fieldCount = descriptor->fields_->size_;
+  CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
+  uint32_t hasWords = 0;
+  CGPStorageSlot *slots = malloc((fieldCount + oneofCount) * sizeof(CGPStorageSlot));
+  NSUInteger slotCount = 0;
+  for (NSUInteger i = 0; i < fieldCount; i++) {
+    CGPFieldDescriptor *field = fieldsBuf[i];
+    CGPStorageSlot *slot = &slots[slotCount++];
+    slot->start = field->access_.offset;
+    slot->isPod = IsPodField(field);
+    slot->end = slot->start;
+    if (slot->isPod) {
+      slot->end += CGPGetTypeSize(CGPFieldGetJavaType(field));
+    }
+    if (!CGPFieldIsRepeated(field) && !field->access_.isOneof) {
+      hasWords = MAX(hasWords, field->data_->hasBitIndex / 32 + 1);
+    }
+  }
+  for (jint i = 0; i < oneofCount; i++) {
+    CGPStorageSlot *slot = &slots[slotCount++];
+    slot->start = slot->end = oneofData[i].offset;
+    slot->isPod = false;
+  }
+  qsort(slots, slotCount, sizeof(CGPStorageSlot), CompareStorageSlots);
+
+  NSUInteger bestStart = 0;
+  NSUInteger bestLength = 0;
+  for (NSUInteger i = 0; i < slotCount;) {
+    if (!slots[i].isPod) {
+      i++;
+      continue;
+    }
+    NSUInteger runStart = i;
+    while (i < slotCount && slots[i].isPod) {
+      i++;
+    }
+    if (i - runStart > bestLength) {
+      bestStart = runStart;
+      bestLength = i - runStart;
+    }
+  }
+
+  descriptor->hasBitsSize_ = hasWords * sizeof(uint32_t);
+  if (bestLength > 0) {
+    descriptor->podRangeStart_ = slots[bestStart].start;
+    descriptor->podRangeEnd_ = slots[bestStart + bestLength - 1].end;
+  }
+  free(slots);
+
+  CGPFieldDescriptor **otherFields = malloc(fieldCount * sizeof(CGPFieldDescriptor *));
+  uint32_t otherCount = 0;
+  for (NSUInteger i = 0; i < fieldCount; i++) {
+    CGPFieldDescriptor *field = fieldsBuf[i];
+    uint32_t offset = field->access_.offset;
+    if (!IsPodField(field) || offset < descriptor->podRangeStart_
+        || offset >= descriptor->podRangeEnd_) {
+      otherFields[otherCount++] = field;
+    }
+  }
+  descriptor->nonPodFields_ = otherFields;
+  descriptor->nonPodFieldCount_ = otherCount;
+}
+
 void CGPInitFields(
     CGPDescriptor *descriptor, jint fieldCount, CGPFieldData *fieldData,
     jint oneofCount, CGPOneofData *oneofData) {
   descriptor->fields_ = CreateFields(fieldCount, fieldData, descriptor);
+  BuildFieldLookup(descriptor);
 
   if (oneofCount > 0) {
     IOSObjectArray *oneofs = [IOSObjectArray newArrayWithLength:oneofCount
@@ -122,16 +374,32 @@ void CGPInitFields(
       uint32_t firstFieldIdx = oneofData[i].firstFieldIdx;
       uint32_t lastFieldIdx = firstFieldIdx + oneofData[i].fieldCount;
       for (uint32_t j = firstFieldIdx; j < lastFieldIdx; j++) {
-        fieldsBuf[j]->containingOneof_ = newOneof;
+        CGPFieldDescriptor *field = fieldsBuf[j];
+        field->containingOneof_ = newOneof;
+        CGPFieldAccess *access = &field->access_;
+        access->isOneof = true;
+        access->hasOffset = oneofData[i].offset;
+        access->oneofCase = CGPFieldGetNumber(field);
+        if (CGPIsRetainedType(CGPFieldGetJavaType(field))) {
+          // The sign bit is used to indicate that the current value need to be
+          // released when a new field in the oneof is set.
+          access->oneofCase |= ONEOF_RETAINABLE_MASK;
+        }
       }
     }
     descriptor->oneofs_ = oneofs;
   }
+  ComputePodRange(descriptor, oneofCount, oneofData);
+}
+
+void CGPInitFastPath(CGPDescriptor *descriptor, const CGPFastPath *fastPath) {
+  descriptor->fastPath_ = *fastPath;
 }
 
 CGPDescriptor *NewMapEntryDescriptor(CGPFieldData *fieldData) {
   CGPDescriptor *descriptor = [[CGPDescriptor alloc] init];
   descriptor->fields_ = CreateFields(2, fieldData, descriptor);
+  BuildFieldLookup(descriptor);
   return descriptor;
 }
 
@@ -211,6 +479,8 @@ static inline ComGoogleProtobufDescriptors_FieldDescriptor_Type *GetTypeObj(CGPF
   if (self = [self init]) {
     messageClass_ = messageClass;
     builderClass_ = builderClass;
+    messageStorageOffset_ = class_getInstanceSize(messageClass);
+    builderStorageOffset_ = class_getInstanceSize(builderClass);
     flags_ = flags;
     storageSize_ = storageSize;
     defaultInstance_ = CGPNewMessage(self);
@@ -235,15 +505,7 @@ static inline ComGoogleProtobufDescriptors_FieldDescriptor_Type *GetTypeObj(CGPF
 }
 
 - (CGPFieldDescriptor *)findFieldByNumberWithInt:(jint)fieldId {
-  NSUInteger count = fields_->size_;
-  CGPFieldDescriptor **fieldsBuf = fields_->buffer_;
-  for (NSUInteger i = 0; i < count; i++) {
-    CGPFieldDescriptor *field = fieldsBuf[i];
-    if (field->data_->number == fieldId) {
-      return field;
-    }
-  }
-  return nil;
+  return fieldId > 0 ? CGPFindFieldByNumber(self, fieldId) : nil;
 }
 
 J2OBJC_ETERNAL_SINGLETON
@@ -327,7 +589,7 @@ static void CGPFieldFixDefaultValue(CGPFieldDescriptor *descriptor) {
         length = ntohl(length);
         rawBytes += sizeof(length);
         CGPByteString *byteString = CGPNewByteString(length);
-        memcpy(byteString->buffer_, rawBytes, length);
+        memcpy(byteString->bytes_, rawBytes, length);
         data->defaultValue.valueId = byteString;
       }
       break;
@@ -352,14 +614,45 @@ static void CGPFieldFixDefaultValue(CGPFieldDescriptor *descriptor) {
   }
 }
 
+// Returns the JSON name of a field, as protoc computes it: underscores are
+// removed and the letter following each one is capitalized. Group fields are
+// named after their lowercased type name.
+static char *NewJsonName(const char *name, BOOL isGroup) {
+  char *result = (char *)malloc(strlen(name) + 1);
+  char *dst = result;
+  BOOL capitalizeNext = NO;
+  for (const char *src = name; *src != '\0'; src++) {
+    char c = *src;
+    if (c == '_') {
+      capitalizeNext = YES;
+      continue;
+    }
+    if (isGroup) {
+      c = (char)tolower(c);
+    }
+    if (capitalizeNext) {
+      c = (char)toupper(c);
+      capitalizeNext = NO;
+    }
+    *dst++ = c;
+  }
+  *dst = '\0';
+  return result;
+}
+
 - (instancetype)initWithData:(CGPFieldData *)data
               containingType:(CGPDescriptor *)containingType {
   if (self = [self init]) {
     data_ = data;
+    // Oneof fields are updated by CGPInitFields().
+    access_.offset = data->offset;
+    access_.hasOffset = data->hasBitIndex / 32 * sizeof(uint32_t);
+    access_.hasMask = 1u << (data->hasBitIndex % 32);
     tag_ = TagFromData(data);
     javaType_ = [GetTypeObj(data->type)->javaType_ ordinal];
     fieldOptions_ = InitFieldOptions(data->optionsData);
     containingType_ = containingType;
+    jsonName_ = NewJsonName(data->name, CGPTypeIsGroup(data->type));
     CGPFieldFixDefaultValue(self);
   }
   return self;
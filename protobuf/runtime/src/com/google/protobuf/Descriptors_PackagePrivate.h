@@ -88,6 +88,64 @@ typedef struct CGPFieldData {
   const char *optionsData;
 } CGPFieldData;
 
+// Maps a field number to its field descriptor. When the field numbers of a
+// message are dense, the table is indexed directly by field number
+// (multiplier == 0). Otherwise the table is a hash-and-displace perfect hash:
+// the number selects a bucket, and the bucket's displacement is added to a
+// multiplicative hash of the number. Displacements and the multiplier are
+// chosen at build time so that no two fields of the message collide. If no
+// perfect hash is found, the table holds the fields sorted by number
+// (sortedCount > 0) and is binary searched.
+typedef struct CGPFieldLookup {
+  CGPFieldDescriptor **table;
+  uint32_t *displacements;
+  uint32_t size;  // A power of 2 when hashed, 0 when sorted.
+  uint32_t multiplier;
+  uint32_t shift;
+  uint32_t bucketShift;
+  uint32_t sortedCount;
+} CGPFieldLookup;
+
+#define CGP_FIELD_LOOKUP_BUCKET_MULTIPLIER 0x9E3779B1u
+
+struct CGPParseContext;
+
+// Parse and serialize functions specialized for a single message type. The
+// j2objc protoc plugin generates these when run with the "generate_fast_paths"
+// option, see FastPath.h. Messages without them use the descriptor-driven
+// implementations in GeneratedMessage.mm.
+typedef struct CGPFastPath {
+  // Merges all fields up to ctx->end into msg. Returns NO if the data is
+  // malformed.
+  BOOL (*merge)(id msg, struct CGPParseContext *ctx);
+  // Returns the serialized size of msg without consulting its memoized size.
+  int (*serializedSize)(id msg);
+  // Writes msg to target, which must have room for its serialized size, and
+  // returns the position after the last byte written.
+  uint8_t *(*write)(id msg, uint8_t *target);
+} CGPFastPath;
+
+// We use the most significant bit (sign bit) of the oneof case field number to
+// indicate that the field is retainable. This allows the value to be correctly
+// released when a new value is being set without having to look up the previous
+// value's field descriptor.
+#define ONEOF_FIELD_NUM_MASK 0x7fffffff
+#define ONEOF_RETAINABLE_MASK 0x80000000
+
+// How to access a field's value and "has" state, computed once by
+// CGPInitFields(). Offsets are relative to the start of the field storage,
+// which differs between the message and builder classes.
+typedef struct CGPFieldAccess {
+  uint32_t offset;
+  // The offset of the has bit word, or of the oneof case for oneof fields.
+  uint32_t hasOffset;
+  union {
+    uint32_t hasMask;  // For regular fields that use the has bit.
+    jint oneofCase;    // For oneof fields, including ONEOF_RETAINABLE_MASK.
+  };
+  bool isOneof;
+} CGPFieldAccess;
+
 typedef struct CGPOneofData {
   const char *name;
   const char *javaName;
@@ -102,10 +160,32 @@ typedef struct CGPOneofData {
   Class builderClass_;
   CGPMessageFlags flags_;
   size_t storageSize_;
+  // Where the field storage starts in messages and in builders.
+  size_t messageStorageOffset_;
+  size_t builderStorageOffset_;
+  // The has bits and the POD range, which holds the singular integral, bool
+  // and enum fields outside oneofs, are compared and hashed as raw bytes. Such
+  // fields are zero while unset. Offsets are relative to the field storage.
+  uint32_t hasBitsSize_;
+  uint32_t podRangeStart_;
+  uint32_t podRangeEnd_;
+  // The fields outside the POD range, in declaration order.
+  CGPFieldDescriptor **nonPodFields_;
+  uint32_t nonPodFieldCount_;
   IOSObjectArray *fields_;
   IOSObjectArray *serializationOrderFields_;
   IOSObjectArray *oneofs_;
+  CGPFieldLookup fieldLookup_;
+  CGPFastPath fastPath_;
   ComGoogleProtobufGeneratedMessage *defaultInstance_;
+  // Set once an extension of this type has been added to any registry, so that
+  // parsing other types doesn't look up unknown fields. Written with release
+  // and read with acquire ordering, since registries are filled while other
+  // threads parse.
+  _Atomic(BOOL) hasRegisteredExtensions_;
+  // Identifies the type's recycled instances in each thread's pool, zero until
+  // the type is first recycled.
+  _Atomic(uint32_t) recycleIndex_;
 }
 
 - (instancetype)initWithMessageClass:(Class)messageClass
@@ -118,6 +198,7 @@ typedef struct CGPOneofData {
 @interface ComGoogleProtobufDescriptors_FieldDescriptor () {
  @package
   CGPFieldData *data_;
+  CGPFieldAccess access_;
   uint32_t tag_;
   CGPFieldJavaType javaType_;
   // Either nil, a Descriptor or a EnumDescriptor depending on the field type.
@@ -125,6 +206,8 @@ typedef struct CGPOneofData {
   ComGoogleProtobufDescriptorProtos_FieldOptions *fieldOptions_;
   CGPDescriptor *containingType_;
   CGPOneofDescriptor *containingOneof_;
+  // The lowerCamelCase name that keys the field in JSON.
+  char *jsonName_;
 }
 
 - (instancetype)initWithData:(CGPFieldData *)data
@@ -182,6 +265,10 @@ void CGPInitFields(
     CGPDescriptor *descriptor, jint fieldCount, CGPFieldData *fieldData,
     jint oneofCount, CGPOneofData *oneofData);
 
+// Installs generated fast paths for the message. Must be called after
+// CGPInitFields().
+void CGPInitFastPath(CGPDescriptor *descriptor, const CGPFastPath *fastPath);
+
 CGP_ALWAYS_INLINE inline BOOL CGPIsExtendable(const CGPDescriptor *descriptor) {
   return descriptor->flags_ & CGPMessageFlagExtendable;
 }
@@ -204,6 +291,29 @@ CGP_ALWAYS_INLINE inline jint CGPFieldGetNumber(const CGPFieldDescriptor *field)
   return field->data_->number;
 }
 
+// Returns the field with the given number from a sorted lookup table, or nil.
+CGPFieldDescriptor *CGPFindFieldInSortedLookup(const CGPFieldLookup *lookup, uint32_t number);
+
+// Returns the field with the given number, or nil if the message has no such
+// field. Built by CGPInitFields so that parsing resolves each tag in O(1).
+CGP_ALWAYS_INLINE inline CGPFieldDescriptor *CGPFindFieldByNumber(
+    const CGPDescriptor *descriptor, uint32_t number) {
+  const CGPFieldLookup *lookup = &descriptor->fieldLookup_;
+  uint32_t idx;
+  if (lookup->multiplier == 0) {
+    if (number >= lookup->size) {
+      return lookup->sortedCount > 0 ? CGPFindFieldInSortedLookup(lookup, number) : nil;
+    }
+    idx = number;
+  } else {
+    uint32_t bucket = (number * CGP_FIELD_LOOKUP_BUCKET_MULTIPLIER) >> lookup->bucketShift;
+    idx = (((number * lookup->multiplier) >> lookup->shift) + lookup->displacements[bucket])
+        & (lookup->size - 1);
+  }
+  CGPFieldDescriptor *field = lookup->table[idx];
+  return field != nil && CGPFieldGetNumber(field) == (jint)number ? field : nil;
+}
+
 CGP_ALWAYS_INLINE inline BOOL CGPFieldIsRequired(const CGPFieldDescriptor *field) {
   return field->data_->flags & CGPFieldFlagRequired;
 }
@@ -240,8 +350,20 @@ CGP_ALWAYS_INLINE inline uint32_t CGPFieldGetHasBitIndex(const CGPFieldDescripto
   return field->data_->hasBitIndex;
 }
 
+// Returns the offset of the field storage in instances of cls, which is the
+// message or builder class of the descriptor.
+CGP_ALWAYS_INLINE inline size_t CGPGetStorageOffset(const CGPDescriptor *descriptor, Class cls) {
+  if (cls == descriptor->messageClass_) {
+    return descriptor->messageStorageOffset_;
+  }
+  if (cls == descriptor->builderClass_) {
+    return descriptor->builderStorageOffset_;
+  }
+  return class_getInstanceSize(cls);
+}
+
 CGP_ALWAYS_INLINE inline uint32_t CGPFieldGetOffset(const CGPFieldDescriptor *field, Class cls) {
-  return (uint32_t)class_getInstanceSize(cls) + field->data_->offset;
+  return (uint32_t)CGPGetStorageOffset(field->containingType_, cls) + field->access_.offset;
 }
 
 CGP_ALWAYS_INLINE inline BOOL CGPTypeIsGroup(CGPFieldType type) {
@@ -269,7 +391,7 @@ id CGPFieldGetDefaultValue(CGPFieldDescriptor *field);
 Class<ComGoogleProtobufInternal_EnumLite> CGPOneofGetCaseClass(CGPOneofDescriptor *oneof);
 
 CGP_ALWAYS_INLINE inline uint32_t CGPOneofGetOffset(const CGPOneofDescriptor *oneof, Class cls) {
-  return (uint32_t)class_getInstanceSize(cls) + oneof->data_->offset;
+  return (uint32_t)CGPGetStorageOffset(oneof->containingType_, cls) + oneof->data_->offset;
 }
 
 BOOL CGPIsRetainedType(CGPFieldJavaType type);
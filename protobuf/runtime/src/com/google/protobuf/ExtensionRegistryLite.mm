@@ -30,28 +30,94 @@
 
 #import "com/google/protobuf/ExtensionRegistryLite.h"
 
-#include <map>
-
 #import "com/google/protobuf/Descriptors_PackagePrivate.h"
 #import "com/google/protobuf/Extension.h"
 
 #include "J2ObjC_source.h"
 
-typedef std::pair<const CGPDescriptor *, jint> ExtensionRegistryKey;
-typedef std::map<ExtensionRegistryKey, CGPFieldDescriptor *> ExtensionRegistryMap;
+// Extensions are kept in an open-addressing hash table keyed on the containing
+// type and field number, with linear probing. Lookups don't lock: an entry is
+// published by storing its containing type last, entries are never removed, and
+// a table that is replaced by a larger one stays allocated until the registry
+// is deallocated. Adding is serialized on the registry.
+typedef struct ExtensionRegistryEntry {
+  CGPDescriptor *containingType;  // NULL if the entry is empty.
+  jint number;
+  CGPFieldDescriptor *field;
+} ExtensionRegistryEntry;
+
+typedef struct ExtensionRegistryTable {
+  // Replaced tables, freed with this one.
+  struct ExtensionRegistryTable *previous;
+  uint32_t count;
+  uint32_t shift;  // 64 - log2 of the capacity.
+  ExtensionRegistryEntry entries[];
+} ExtensionRegistryTable;
+
+#define EXTENSION_REGISTRY_MIN_BITS 4
 
 @interface ComGoogleProtobufExtensionRegistryLite () {
  @package
-  ExtensionRegistryMap map_;
+  ExtensionRegistryTable *table_;
 }
 @end
 
+static inline uint32_t TableCapacity(ExtensionRegistryTable *table) {
+  return 1u << (64 - table->shift);
+}
+
+static inline uint32_t TableIndex(
+    ExtensionRegistryTable *table, const CGPDescriptor *containingType, jint number) {
+  uint64_t key = (uint64_t)(uintptr_t)containingType ^ ((uint64_t)(uint32_t)number << 32);
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> table->shift);
+}
+
+static ExtensionRegistryTable *NewTable(uint32_t bits) {
+  size_t entriesSize = ((size_t)1 << bits) * sizeof(ExtensionRegistryEntry);
+  ExtensionRegistryTable *table =
+      (ExtensionRegistryTable *)calloc(sizeof(ExtensionRegistryTable) + entriesSize, 1);
+  table->shift = 64 - bits;
+  return table;
+}
+
+// Stores the field in a table that has room for it, replacing the field of an
+// existing entry with the same key.
+static void TableInsert(ExtensionRegistryTable *table, CGPFieldDescriptor *field) {
+  CGPDescriptor *containingType = field->containingType_;
+  jint number = CGPFieldGetNumber(field);
+  uint32_t mask = TableCapacity(table) - 1;
+  for (uint32_t i = TableIndex(table, containingType, number); ; i = (i + 1) & mask) {
+    ExtensionRegistryEntry *entry = &table->entries[i];
+    if (entry->containingType == NULL) {
+      entry->number = number;
+      entry->field = field;
+      __atomic_store_n(&entry->containingType, containingType, __ATOMIC_RELEASE);
+      table->count++;
+      return;
+    }
+    if (entry->containingType == containingType && entry->number == number) {
+      __atomic_store_n(&entry->field, field, __ATOMIC_RELEASE);
+      return;
+    }
+  }
+}
+
 J2OBJC_INITIALIZED_DEFN(ComGoogleProtobufExtensionRegistryLite)
 
 static CGPExtensionRegistryLite *CGPExtensionRegistryLite_EMPTY_;
 
 @implementation ComGoogleProtobufExtensionRegistryLite
 
+- (void)dealloc {
+  ExtensionRegistryTable *table = table_;
+  while (table != NULL) {
+    ExtensionRegistryTable *previous = table->previous;
+    free(table);
+    table = previous;
+  }
+  [super dealloc];
+}
+
 + (CGPExtensionRegistryLite *)getEmptyRegistry {
   return CGPExtensionRegistryLite_EMPTY_;
 }
@@ -90,8 +156,27 @@ CGPExtensionRegistryLite *ComGoogleProtobufExtensionRegistryLite_getEmptyRegistr
 
 void CGPExtensionRegistryAdd(CGPExtensionRegistryLite *registry, CGPExtensionLite *extension) {
   CGPFieldDescriptor *field = extension->fieldDescriptor_;
-  CGPDescriptor *containingType = field->containingType_;
-  registry->map_[ExtensionRegistryKey(containingType, CGPFieldGetNumber(field))] = field;
+  @synchronized(registry) {
+    ExtensionRegistryTable *table = registry->table_;
+    // Keep the load factor at most 1/2.
+    if (table == NULL || (table->count + 1) * 2 > TableCapacity(table)) {
+      uint32_t bits = table == NULL ? EXTENSION_REGISTRY_MIN_BITS : 64 - table->shift + 1;
+      ExtensionRegistryTable *newTable = NewTable(bits);
+      if (table != NULL) {
+        uint32_t capacity = TableCapacity(table);
+        for (uint32_t i = 0; i < capacity; i++) {
+          if (table->entries[i].containingType != NULL) {
+            TableInsert(newTable, table->entries[i].field);
+          }
+        }
+      }
+      newTable->previous = table;
+      __atomic_store_n(&registry->table_, newTable, __ATOMIC_RELEASE);
+      table = newTable;
+    }
+    TableInsert(table, field);
+  }
+  __c11_atomic_store(&field->containingType_->hasRegisteredExtensions_, YES, __ATOMIC_RELEASE);
 }
 
 void ComGoogleProtobufExtensionRegistryLite_initWithBoolean_(
@@ -108,12 +193,21 @@ new_ComGoogleProtobufExtensionRegistryLite_initWithBoolean_(jboolean empty) {
 
 CGPFieldDescriptor *CGPExtensionRegistryFind(
     CGPExtensionRegistryLite *registry, CGPDescriptor *descriptor, jint fieldNumber) {
-  ExtensionRegistryMap *map = &registry->map_;
-  ExtensionRegistryMap::iterator it = map->find(ExtensionRegistryKey(descriptor, fieldNumber));
-  if (it != map->end()) {
-    return it->second;
+  ExtensionRegistryTable *table = __atomic_load_n(&registry->table_, __ATOMIC_ACQUIRE);
+  if (table == NULL) {
+    return nil;
+  }
+  uint32_t mask = TableCapacity(table) - 1;
+  for (uint32_t i = TableIndex(table, descriptor, fieldNumber); ; i = (i + 1) & mask) {
+    ExtensionRegistryEntry *entry = &table->entries[i];
+    CGPDescriptor *containingType = __atomic_load_n(&entry->containingType, __ATOMIC_ACQUIRE);
+    if (containingType == NULL) {
+      return nil;
+    }
+    if (containingType == descriptor && entry->number == fieldNumber) {
+      return __atomic_load_n(&entry->field, __ATOMIC_ACQUIRE);
+    }
   }
-  return nil;
 }
 
 J2OBJC_CLASS_TYPE_LITERAL_SOURCE(ComGoogleProtobufExtensionRegistryLite)
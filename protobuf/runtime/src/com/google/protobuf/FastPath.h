@@ -0,0 +1,216 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// DO NOT INCLUDE EXTERNALLY.
+// Contains the declarations used by the per-message parse and serialize
+// functions that the j2objc protoc plugin generates with the
+// "generate_fast_paths" option. Generated sources are compiled as Objective-C,
+// so everything here is plain C.
+//
+// Generated functions handle singular scalar fields inline and call back into
+// the runtime for every other field, so they only need to stay consistent with
+// the runtime's storage layout, which the generated _Storage struct defines.
+
+#ifndef __ComGoogleProtobufFastPath_H__
+#define __ComGoogleProtobufFastPath_H__
+
+#import "com/google/protobuf/Descriptors_PackagePrivate.h"
+#import "com/google/protobuf/ExtensionRegistryLite.h"
+#import "com/google/protobuf/WireFormat.h"
+
+#import <libkern/OSByteOrder.h>
+
+CF_EXTERN_C_BEGIN
+
+// Input that is entirely in memory, up to the end of the message being parsed.
+typedef struct CGPParseContext {
+  const uint8_t *ptr;
+  const uint8_t *end;
+  CGPExtensionRegistryLite *registry;
+  // Non-nil when parsing with aliasing enabled, see
+  // CGPCodedInputStream::EnableAliasing().
+  id aliasOwner;
+  // Non-NULL when parsing with an arena, see Arena.h.
+  struct CGPArena *arena;
+  // See CGPCodedInputStream::EnableLazyParsing().
+  BOOL lazy;
+} CGPParseContext;
+
+// Returns the start of the field storage of a message or builder.
+CGP_ALWAYS_INLINE inline void *CGPGetStorage(id msg) {
+  return (uint8_t *)msg + class_getInstanceSize(object_getClass(msg));
+}
+
+// Parses the field with the given tag, which has already been read, using the
+// descriptor-driven parser. Unknown fields are skipped. Returns NO if the data
+// is malformed.
+BOOL CGPParseField(id msg, CGPDescriptor *descriptor, uint32_t tag, CGPParseContext *ctx);
+
+// Returns the serialized size of the field at fieldIndex in the descriptor's
+// field list, as computed by the descriptor-driven implementation.
+int CGPFieldSerializedSize(id msg, CGPDescriptor *descriptor, uint32_t fieldIndex);
+
+// Writes the field at fieldIndex in the descriptor's field list with the
+// descriptor-driven serializer and returns the position after the last byte
+// written. The target must have room for the field.
+uint8_t *CGPWriteFieldToArray(
+    id msg, CGPDescriptor *descriptor, uint32_t fieldIndex, uint8_t *target);
+
+// ***** Reading *****
+
+CGP_ALWAYS_INLINE inline BOOL CGPParseVarint64(CGPParseContext *ctx, uint64_t *value) {
+  const uint8_t *ptr = ctx->ptr;
+  uint64_t result = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    if (ptr == ctx->end) {
+      return NO;
+    }
+    uint8_t b = *ptr++;
+    result |= (uint64_t)(b & 0x7F) << shift;
+    if (b < 0x80) {
+      *value = result;
+      ctx->ptr = ptr;
+      return YES;
+    }
+  }
+  return NO;  // More than 10 bytes.
+}
+
+// Like CGPCodedInputStream::ReadVarint32(), reads a varint of up to 10 bytes
+// and truncates it to 32 bits.
+CGP_ALWAYS_INLINE inline BOOL CGPParseVarint32(CGPParseContext *ctx, uint32_t *value) {
+  if (__builtin_expect(ctx->ptr < ctx->end && *ctx->ptr < 0x80, 1)) {
+    *value = *ctx->ptr++;
+    return YES;
+  }
+  uint64_t result;
+  if (!CGPParseVarint64(ctx, &result)) return NO;
+  *value = (uint32_t)result;
+  return YES;
+}
+
+// Returns the next tag, or 0 if the data is malformed.
+CGP_ALWAYS_INLINE inline uint32_t CGPParseTag(CGPParseContext *ctx) {
+  uint32_t tag;
+  return CGPParseVarint32(ctx, &tag) ? tag : 0;
+}
+
+CGP_ALWAYS_INLINE inline BOOL CGPParseFixed32(CGPParseContext *ctx, uint32_t *value) {
+  if (ctx->end - ctx->ptr < (ptrdiff_t)sizeof(uint32_t)) return NO;
+  *value = OSReadLittleInt32(ctx->ptr, 0);
+  ctx->ptr += sizeof(uint32_t);
+  return YES;
+}
+
+CGP_ALWAYS_INLINE inline BOOL CGPParseFixed64(CGPParseContext *ctx, uint64_t *value) {
+  if (ctx->end - ctx->ptr < (ptrdiff_t)sizeof(uint64_t)) return NO;
+  *value = OSReadLittleInt64(ctx->ptr, 0);
+  ctx->ptr += sizeof(uint64_t);
+  return YES;
+}
+
+// Floating point values are bit cast with memcpy, which doesn't violate strict
+// aliasing the way that a pointer cast would.
+CGP_ALWAYS_INLINE inline BOOL CGPParseFloat(CGPParseContext *ctx, jfloat *value) {
+  uint32_t bits;
+  if (!CGPParseFixed32(ctx, &bits)) return NO;
+  memcpy(value, &bits, sizeof(bits));
+  return YES;
+}
+
+CGP_ALWAYS_INLINE inline BOOL CGPParseDouble(CGPParseContext *ctx, jdouble *value) {
+  uint64_t bits;
+  if (!CGPParseFixed64(ctx, &bits)) return NO;
+  memcpy(value, &bits, sizeof(bits));
+  return YES;
+}
+
+// ***** Sizes *****
+
+CGP_ALWAYS_INLINE inline int CGPVarintSize64(uint64_t value) {
+  // (bits * 9 + 64) / 64 is ceil(bits / 7) for 1 <= bits <= 64.
+  int bits = 64 - __builtin_clzll(value | 1);
+  return (bits * 9 + 64) / 64;
+}
+
+CGP_ALWAYS_INLINE inline int CGPVarintSize32(uint32_t value) {
+  return CGPVarintSize64(value);
+}
+
+// Negative values are sign extended to 10 bytes.
+CGP_ALWAYS_INLINE inline int CGPVarintSize32SignExtended(int32_t value) {
+  return CGPVarintSize64((uint64_t)(int64_t)value);
+}
+
+// ***** Writing *****
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteVarint64ToArray(uint64_t value, uint8_t *target) {
+  while (value >= 0x80) {
+    *target++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *target++ = (uint8_t)value;
+  return target;
+}
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteVarint32ToArray(uint32_t value, uint8_t *target) {
+  return CGPWriteVarint64ToArray(value, target);
+}
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteVarint32SignExtendedToArray(
+    int32_t value, uint8_t *target) {
+  return CGPWriteVarint64ToArray((uint64_t)(int64_t)value, target);
+}
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteFixed32ToArray(uint32_t value, uint8_t *target) {
+  OSWriteLittleInt32(target, 0, value);
+  return target + sizeof(uint32_t);
+}
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteFixed64ToArray(uint64_t value, uint8_t *target) {
+  OSWriteLittleInt64(target, 0, value);
+  return target + sizeof(uint64_t);
+}
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteFloatToArray(jfloat value, uint8_t *target) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return CGPWriteFixed32ToArray(bits, target);
+}
+
+CGP_ALWAYS_INLINE inline uint8_t *CGPWriteDoubleToArray(jdouble value, uint8_t *target) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return CGPWriteFixed64ToArray(bits, target);
+}
+
+CF_EXTERN_C_END
+
+#endif // __ComGoogleProtobufFastPath_H__
@@ -55,6 +55,19 @@ typedef ComGoogleProtobufGeneratedMessage_GeneratedExtension CGPGeneratedExtensi
 
 + (id)getDescriptor;
 
+// Recycling lets a loop that builds many messages of the same type reuse the
+// instances and their repeated and map field buffers instead of allocating new
+// ones. Each thread keeps a few recycled messages and builders of each type.
+// Only references obtained from +newRecycledBuilder and -buildRecycled may be
+// passed to -recycle, which takes ownership of them.
+
+// Returns a retained, empty builder, reusing a recycled one if there is one.
++ (id)newRecycledBuilder;
+
+// Releases the message, or keeps it for reuse by -buildRecycled if the caller
+// held the only reference.
+- (void)recycle;
+
 @end
 
 J2OBJC_EMPTY_STATIC_INIT(ComGoogleProtobufGeneratedMessage)
@@ -76,6 +89,17 @@ J2OBJC_TYPE_LITERAL_HEADER(ComGoogleProtobufGeneratedMessage)
     withComGoogleProtobufExtensionRegistryLite:
         (ComGoogleProtobufExtensionRegistryLite *)extensionRegistry;
 
+// Like -clear, except that repeated and map fields keep their buffers.
+- (id)clearKeepingCapacity;
+
+// Like -build, except that the result is retained and reuses a recycled
+// message if there is one.
+- (id)buildRecycled NS_RETURNS_RETAINED;
+
+// Releases the builder, or keeps it for reuse by +newRecycledBuilder if the
+// caller held the only reference.
+- (void)recycle;
+
 @end
 
 J2OBJC_EMPTY_STATIC_INIT(ComGoogleProtobufGeneratedMessage_Builder)
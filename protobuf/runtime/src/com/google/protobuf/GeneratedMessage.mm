@@ -35,25 +35,37 @@
 
 #include "com/google/protobuf/GeneratedMessage_PackagePrivate.h"
 
-#include <map>
+#include <atomic>
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <float.h>
+#include <new>
+#include <alloca.h>
+#include <objc/runtime.h>
+#include <pthread.h>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
+#include "com/google/protobuf/Arena.h"
 #include "com/google/protobuf/ByteString.h"
 #include "com/google/protobuf/CodedInputStream.h"
 #include "com/google/protobuf/Descriptors_PackagePrivate.h"
 #include "com/google/protobuf/ExtensionRegistry.h"
 #include "com/google/protobuf/ExtensionRegistryLite.h"
+#include "com/google/protobuf/FastPath.h"
 #include "com/google/protobuf/Internal.h"
 #include "com/google/protobuf/InvalidProtocolBufferException.h"
+#include "com/google/protobuf/JsonFormat.h"
 #include "com/google/protobuf/MapField.h"
 #include "com/google/protobuf/ProtocolMessageEnum.h"
 #include "com/google/protobuf/RepeatedField.h"
+#include "com/google/protobuf/TextFormat.h"
 #include "com/google/protobuf/WireFormat.h"
 #include "java/io/InputStream.h"
+#include "java/io/OutputStream.h"
 #include "java/lang/IllegalArgumentException.h"
 #include "java/lang/IndexOutOfBoundsException.h"
-#include "java/lang/StringBuilder.h"
 #include "java/lang/UnsupportedOperationException.h"
 #include "java/util/ArrayList.h"
 #include "java/util/HashMap.h"
@@ -74,10 +86,7 @@
 #define NIL_CHECK_Retainable(value) (void)nil_chk(value);
 
 // Forward declarations.
-class CGPExtensionValue;
-class CGPExtensionMapComparator;
-typedef std::map<CGPFieldDescriptor *, CGPExtensionValue, CGPExtensionMapComparator>
-    CGPExtensionMap;
+class CGPExtensionMap;
 
 static void MergeFromMessage(
     id msg, CGPExtensionMap *msgExtensionMap, id other, CGPExtensionMap *otherExtensionMap,
@@ -85,11 +94,12 @@ static void MergeFromMessage(
 static BOOL MergeFromStream(
     id msg, CGPDescriptor *descriptor, CGPCodedInputStream *stream,
     CGPExtensionRegistryLite *registry, CGPExtensionMap *extensionMap);
+static BOOL MergeFieldsFromStream(
+    id msg, CGPDescriptor *descriptor, CGPCodedInputStream *stream,
+    CGPExtensionRegistryLite *registry, CGPExtensionMap *extensionMap);
 static inline int SerializedSizeForMessage(
     ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *descriptor);
 static void WriteMessage(id msg, CGPDescriptor *descriptor, CGPCodedOutputStream *output);
-static void MessageToString(
-    id msg, CGPDescriptor *descriptor, NSMutableString *builder, int indent);
 
 // Declares a value type for the C++ extensions map to implement correct
 // equality and handle memory management
@@ -111,7 +121,7 @@ class CGPExtensionValue {
     [value_ autorelease];
   }
 
-  id get() { return value_; }
+  id get() const { return value_; }
 
   void set(id value) {
     [value_ autorelease];
@@ -135,11 +145,190 @@ class CGPExtensionValue {
   id value_;
 };
 
-class CGPExtensionMapComparator {
+struct CGPExtensionMapEntry {
+  CGPFieldDescriptor *first;
+  CGPExtensionValue second;
+};
+
+// The extension values of a message or builder, sorted by field number. Most
+// messages have only a handful of extensions, so the entries are kept in a
+// single contiguous block instead of a tree. The block is reference counted and
+// shared by copies of the map, notably between a builder and the messages it
+// builds, and is only copied when a shared map is modified. Copying the block
+// copies each CGPExtensionValue, so repeated values are never shared between a
+// map that is modified and the other maps. Iteration and lookup never copy, so
+// the iterators are read only.
+class CGPExtensionMap {
  public:
-  bool operator()(const CGPFieldDescriptor *left, const CGPFieldDescriptor *right) const {
-    return CGPFieldGetNumber(left) < CGPFieldGetNumber(right);
+  typedef const CGPExtensionMapEntry *iterator;
+
+  CGPExtensionMap() : rep_(NULL) {}
+
+  CGPExtensionMap(const CGPExtensionMap &other) : rep_(Retain(other.rep_)) {}
+
+  ~CGPExtensionMap() {
+    Release(rep_);
+  }
+
+  CGPExtensionMap &operator=(const CGPExtensionMap &other) {
+    if (rep_ != other.rep_) {
+      Rep *old = rep_;
+      rep_ = Retain(other.rep_);
+      Release(old);
+    }
+    return *this;
+  }
+
+  bool empty() const { return rep_ == NULL || rep_->size == 0; }
+
+  iterator begin() const { return rep_ != NULL ? Entries(rep_) : NULL; }
+
+  iterator end() const { return rep_ != NULL ? Entries(rep_) + rep_->size : NULL; }
+
+  iterator find(const CGPFieldDescriptor *field) const {
+    if (rep_ == NULL) return NULL;
+    uint32_t idx = LowerBound(rep_, CGPFieldGetNumber(field));
+    CGPExtensionMapEntry *entries = Entries(rep_);
+    if (idx < rep_->size && entries[idx].first == field) {
+      return &entries[idx];
+    }
+    return end();
+  }
+
+  // Returns the value for the field, inserting an empty value if the map has
+  // none.
+  CGPExtensionValue &operator[](CGPFieldDescriptor *field) {
+    MakeUnique(1);
+    uint32_t idx = LowerBound(rep_, CGPFieldGetNumber(field));
+    CGPExtensionMapEntry *entries = Entries(rep_);
+    if (idx < rep_->size && entries[idx].first == field) {
+      return entries[idx].second;
+    }
+    // CGPExtensionValue holds a single object pointer, so entries can be moved
+    // bitwise.
+    memmove(&entries[idx + 1], &entries[idx], (rep_->size - idx) * sizeof(CGPExtensionMapEntry));
+    new (&entries[idx]) CGPExtensionMapEntry();
+    entries[idx].first = field;
+    rep_->size++;
+    return entries[idx].second;
+  }
+
+  void erase(const CGPFieldDescriptor *field) {
+    if (find(field) == end()) return;
+    MakeUnique(0);
+    uint32_t idx = LowerBound(rep_, CGPFieldGetNumber(field));
+    CGPExtensionMapEntry *entries = Entries(rep_);
+    entries[idx].~CGPExtensionMapEntry();
+    rep_->size--;
+    memmove(&entries[idx], &entries[idx + 1], (rep_->size - idx) * sizeof(CGPExtensionMapEntry));
+  }
+
+  bool operator==(const CGPExtensionMap &other) const {
+    if (rep_ == other.rep_) return true;
+    iterator a = begin(), aEnd = end(), b = other.begin(), bEnd = other.end();
+    if (aEnd - a != bEnd - b) return false;
+    for (; a != aEnd; a++, b++) {
+      if (a->first != b->first || a->second != b->second) return false;
+    }
+    return true;
+  }
+
+  bool operator!=(const CGPExtensionMap &other) const {
+    return !(*this == other);
+  }
+
+ private:
+  struct Rep {
+    _Atomic(uint32_t) refCount;
+    uint32_t size;
+    uint32_t capacity;
+    // Followed by capacity entries, at kEntriesOffset.
+  };
+
+  static const uint32_t kMinCapacity = 4;
+  static const size_t kEntriesOffset =
+      (sizeof(Rep) + __alignof__(CGPExtensionMapEntry) - 1)
+      & ~(__alignof__(CGPExtensionMapEntry) - 1);
+
+  static CGPExtensionMapEntry *Entries(Rep *rep) {
+    return (CGPExtensionMapEntry *)((uint8_t *)rep + kEntriesOffset);
+  }
+
+  static Rep *NewRep(uint32_t capacity) {
+    Rep *rep = (Rep *)malloc(kEntriesOffset + capacity * sizeof(CGPExtensionMapEntry));
+    __c11_atomic_store(&rep->refCount, 1, __ATOMIC_RELAXED);
+    rep->size = 0;
+    rep->capacity = capacity;
+    return rep;
   }
+
+  static Rep *Retain(Rep *rep) {
+    if (rep != NULL) {
+      __c11_atomic_fetch_add(&rep->refCount, 1, __ATOMIC_RELAXED);
+    }
+    return rep;
+  }
+
+  static void Release(Rep *rep) {
+    if (rep == NULL) return;
+    if (__c11_atomic_fetch_sub(&rep->refCount, 1, __ATOMIC_RELEASE) == 1) {
+      __c11_atomic_thread_fence(__ATOMIC_ACQUIRE);
+      CGPExtensionMapEntry *entries = Entries(rep);
+      for (uint32_t i = 0; i < rep->size; i++) {
+        entries[i].~CGPExtensionMapEntry();
+      }
+      free(rep);
+    }
+  }
+
+  // Returns the index of the first entry whose field number is not less than
+  // number.
+  static uint32_t LowerBound(Rep *rep, jint number) {
+    CGPExtensionMapEntry *entries = Entries(rep);
+    uint32_t lo = 0;
+    uint32_t hi = rep->size;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      if (CGPFieldGetNumber(entries[mid].first) < number) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // Makes rep_ owned only by this map, with room for the given number of
+  // additional entries.
+  void MakeUnique(uint32_t additional) {
+    if (rep_ == NULL) {
+      rep_ = NewRep(kMinCapacity);
+      return;
+    }
+    uint32_t size = rep_->size;
+    uint32_t capacity = rep_->capacity;
+    if (size + additional > capacity) {
+      capacity = capacity * 2;
+    }
+    if (__c11_atomic_load(&rep_->refCount, __ATOMIC_ACQUIRE) == 1) {
+      if (capacity != rep_->capacity) {
+        rep_ = (Rep *)realloc(rep_, kEntriesOffset + capacity * sizeof(CGPExtensionMapEntry));
+        rep_->capacity = capacity;
+      }
+      return;
+    }
+    Rep *copy = NewRep(capacity);
+    CGPExtensionMapEntry *src = Entries(rep_);
+    CGPExtensionMapEntry *dst = Entries(copy);
+    for (uint32_t i = 0; i < size; i++) {
+      new (&dst[i]) CGPExtensionMapEntry(src[i]);
+    }
+    copy->size = size;
+    Release(rep_);
+    rep_ = copy;
+  }
+
+  Rep *rep_;
 };
 
 @interface ComGoogleProtobufGeneratedMessage_ExtendableMessage () {
@@ -177,31 +366,12 @@ typedef struct {
   bool isOneof;
 } CGPHasLocator;
 
-// We use the most significant bit (sign bit) of the oneof case field number to
-// indicate that the field is retainable. This allows the value to be correctly
-// released when a new value is being set without having to look up the previous
-// value's field descriptor.
-#define ONEOF_FIELD_NUM_MASK 0x7fffffff
-#define ONEOF_RETAINABLE_MASK 0x80000000
-
-static CGPHasLocator GetHasLocator(Class cls, const CGPFieldDescriptor *field) {
-  CGPOneofDescriptor *oneof = field->containingOneof_;
+static inline CGPHasLocator GetHasLocator(Class cls, const CGPFieldDescriptor *field) {
+  const CGPFieldAccess *access = &field->access_;
   CGPHasLocator result;
-  result.isOneof = oneof != nil;
-  if (oneof) {
-    result.offset = CGPOneofGetOffset(oneof, cls);
-    result.fieldNum = CGPFieldGetNumber(field);
-    if (CGPIsRetainedType(CGPFieldGetJavaType(field))) {
-      // The sign bit is used to indicate that the current value need to be
-      // released when a new field in the oneof is set.
-      result.fieldNum |= ONEOF_RETAINABLE_MASK;
-    }
-  } else {
-    uint32_t idx = CGPFieldGetHasBitIndex(field);
-    uint32_t byteIndex = idx / 32;
-    result.mask = (1 << (idx % 32));
-    result.offset = class_getInstanceSize(cls) + byteIndex * sizeof(uint32_t);
-  }
+  result.offset = CGPGetStorageOffset(field->containingType_, cls) + access->hasOffset;
+  result.mask = access->hasMask;
+  result.isOneof = access->isOneof;
   return result;
 }
 
@@ -265,6 +435,93 @@ static inline void ClearPreviousOneof(id msg, CGPHasLocator loc, uintptr_t ptr)
 #define MAP_FIELD_PTR(msg, offset) ((CGPMapField *)((uint8_t *)msg + offset))
 #define FIELD_PTR(TYPE, msg, offset) ((TYPE *)((uint8_t *)msg + offset))
 
+
+// *****************************************************************************
+// ********** Lazily parsed message fields *************************************
+// *****************************************************************************
+
+// Stored in place of a singular message field that was read with lazy parsing
+// enabled. The encoded bytes are parsed the first time the field's value is
+// needed. Since messages are immutable the bytes never go stale, so they are
+// also used to serialize the field, whether or not it has been parsed.
+@interface CGPLazyMessage : NSObject {
+ @public
+  CGPDescriptor *descriptor_;
+  CGPExtensionRegistryLite *registry_;
+  CGPByteString *bytes_;
+  // Set at most once, by LazyMessageGetValue().
+  id value_;
+}
+@end
+
+@implementation CGPLazyMessage
+
+- (void)dealloc {
+  [registry_ release];
+  [bytes_ release];
+  [value_ release];
+  [super dealloc];
+}
+
+@end
+
+static Class lazyMessageClass;
+
+// Consumes the reference to bytes.
+static CGPLazyMessage *NewLazyMessage(
+    CGPDescriptor *descriptor, CGPExtensionRegistryLite *registry, CGPByteString *bytes) {
+  if (lazyMessageClass == Nil) {
+    lazyMessageClass = [CGPLazyMessage class];
+  }
+  CGPLazyMessage *lazy = [[CGPLazyMessage alloc] init];
+  lazy->descriptor_ = descriptor;
+  lazy->registry_ = [registry retain];
+  lazy->bytes_ = bytes;
+  return lazy;
+}
+
+static id LazyMessageGetValue(CGPLazyMessage *lazy) {
+  id value = __atomic_load_n(&lazy->value_, __ATOMIC_ACQUIRE);
+  if (value != nil) {
+    return value;
+  }
+  CGPDescriptor *descriptor = lazy->descriptor_;
+  CGPByteString *bytes = lazy->bytes_;
+  ComGoogleProtobufGeneratedMessage *newValue = CGPNewMessage(descriptor);
+  CGPCodedInputStream stream(bytes->bytes_, bytes->size_);
+  // The bytes are immutable, so nested lazy fields don't need their own copy.
+  stream.EnableAliasing(bytes);
+  stream.EnableLazyParsing();
+  if (!MergeFromStream(newValue, descriptor, &stream, lazy->registry_,
+                       MessageExtensionMap(newValue, descriptor))
+      || !stream.ConsumedEntireMessage()) {
+    [newValue release];
+    @throw [[[ComGoogleProtobufInvalidProtocolBufferException alloc] init] autorelease];
+  }
+  // Another thread may have parsed the same bytes in the meantime.
+  if (!__atomic_compare_exchange_n(
+          &lazy->value_, &value, newValue, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    [newValue release];
+    return value;
+  }
+  return newValue;
+}
+
+// Returns the value of a singular message field that has been set, parsing it
+// first if it was read lazily.
+static inline id GetMessageField(id msg, size_t offset) {
+  id value = *FIELD_PTR(id, msg, offset);
+  if (__builtin_expect(object_getClass(value) == lazyMessageClass, 0)) {
+    return LazyMessageGetValue(value);
+  }
+  return value;
+}
+
+static inline CGPLazyMessage *GetLazyMessageField(id msg, size_t offset) {
+  id value = *FIELD_PTR(id, msg, offset);
+  return object_getClass(value) == lazyMessageClass ? value : nil;
+}
+
 #define SINGULAR_SETTER_IMP(NAME) \
   static void SingularSet##NAME(id msg, TYPE_##NAME value, size_t offset, CGPHasLocator hasLoc) { \
     TYPE_##NAME *ptr = FIELD_PTR(TYPE_##NAME, msg, offset); \
@@ -297,6 +554,15 @@ FOR_EACH_TYPE_NO_ENUM(SINGULAR_GETTER_IMP)
 
 #undef SINGULAR_GETTER_IMP
 
+static IMP GetSingularMessageGetterImp(size_t offset, CGPHasLocator hasLoc, id defaultValue) {
+  return imp_implementationWithBlock(^id(id msg) {
+    if (GetHas(msg, hasLoc)) {
+      return GetMessageField(msg, offset);
+    }
+    return defaultValue;
+  });
+}
+
 #define REPEATED_GETTER_IMP(NAME) \
   static IMP GetRepeatedGetterImp##NAME(size_t offset) { \
     return imp_implementationWithBlock(^TYPE_##NAME(id msg, jint idx) { \
@@ -315,6 +581,11 @@ static BOOL AddGetterMethod(Class cls, SEL sel, CGPFieldDescriptor *field) {
   size_t offset = CGPFieldGetOffset(field, cls);
   CGPHasLocator hasLoc = GetHasLocator(cls, field);
 
+  if (!repeated && CGPFieldTypeIsMessage(field)) {
+    imp = GetSingularMessageGetterImp(offset, hasLoc, field->data_->defaultValue.valueId);
+    return class_addMethod(cls, sel, imp, "@@:");
+  }
+
 #define ADD_GETTER_METHOD_CASE(NAME) \
   imp = repeated ? GetRepeatedGetterImp##NAME(offset) : \
       GetSingularGetterImp##NAME(offset, hasLoc, field->data_->defaultValue.value##NAME); \
@@ -410,8 +681,12 @@ static BOOL AddClearMethod(Class cls, SEL sel, CGPFieldDescriptor *field) {
         return msg;
       });
     } else {
+      size_t size = CGPGetTypeSize(type);
       imp = imp_implementationWithBlock(^id(id msg) {
-        UnsetHas(msg, hasLoc);
+        if (UnsetHas(msg, hasLoc)) {
+          // Unset fields hold zero, see MessageIsEqual().
+          memset(FIELD_PTR(uint8_t, msg, offset), 0, size);
+        }
         return msg;
       });
     }
@@ -1109,6 +1384,9 @@ static id GetSingularField(id msg, CGPFieldDescriptor *field) {
   Class msgCls = object_getClass(msg);
   bool isSet = GetHas(msg, GetHasLocator(msgCls, field));
   size_t offset = CGPFieldGetOffset(field, msgCls);
+  if (isSet && CGPFieldTypeIsMessage(field)) {
+    return GetMessageField(msg, offset);
+  }
 
 #define GET_FIELD_CASE(NAME) \
   { \
@@ -1223,10 +1501,41 @@ static void ReleaseAllFields(id self, Class cls, CGPDescriptor *descriptor) {
   }
 }
 
+// Like ReleaseAllFields() followed by zeroing the field storage, except that
+// repeated and map fields keep their buffers for reuse.
+static void ClearAllFieldsKeepingCapacity(id self, Class cls, CGPDescriptor *descriptor) {
+  CGPFieldDescriptor **fields = descriptor->fields_->buffer_;
+  NSUInteger count = descriptor->fields_->size_;
+  void **kept = (void **)alloca(count * sizeof(void *));
+  for (NSUInteger i = 0; i < count; i++) {
+    CGPFieldDescriptor *field = fields[i];
+    uintptr_t ptr = ((uintptr_t)self + CGPFieldGetOffset(field, cls));
+    CGPFieldJavaType javaType = CGPFieldGetJavaType(field);
+    if (CGPFieldIsMap(field)) {
+      CGPMapFieldClearKeepingCapacity(
+          (CGPMapField *)ptr, CGPFieldGetJavaType(CGPFieldMapKey(field)),
+          CGPFieldGetJavaType(CGPFieldMapValue(field)));
+      kept[i] = *(void **)ptr;
+    } else if (CGPFieldIsRepeated(field)) {
+      CGPRepeatedFieldClearKeepingCapacity((CGPRepeatedField *)ptr, javaType);
+      kept[i] = *(void **)ptr;
+    } else if (CGPIsRetainedType(javaType) && GetHas(self, GetHasLocator(cls, field))) {
+      [*(id *)ptr autorelease];
+    }
+  }
+  memset((uint8_t *)self + CGPGetStorageOffset(descriptor, cls), 0, descriptor->storageSize_);
+  for (NSUInteger i = 0; i < count; i++) {
+    CGPFieldDescriptor *field = fields[i];
+    if (CGPFieldIsRepeated(field)) {
+      *(void **)((uintptr_t)self + CGPFieldGetOffset(field, cls)) = kept[i];
+    }
+  }
+}
+
 static void CopyAllFields(
     id orig, Class origCls, id copy, Class copyCls, CGPDescriptor *descriptor) {
-  memcpy((uint8_t *)copy + class_getInstanceSize(copyCls),
-      (uint8_t *)orig + class_getInstanceSize(origCls), descriptor->storageSize_);
+  memcpy((uint8_t *)copy + CGPGetStorageOffset(descriptor, copyCls),
+      (uint8_t *)orig + CGPGetStorageOffset(descriptor, origCls), descriptor->storageSize_);
   // Retain object types.
   CGPFieldDescriptor **fields = descriptor->fields_->buffer_;
   NSUInteger count = descriptor->fields_->size_;
@@ -1246,6 +1555,41 @@ static void CopyAllFields(
   }
 }
 
+// Like CopyAllFields(), for a copy that was cleared by
+// ClearAllFieldsKeepingCapacity(). The repeated and map fields are copied into
+// the buffers that the copy kept instead of new ones.
+static void CopyAllFieldsReusingCapacity(
+    id orig, Class origCls, id copy, Class copyCls, CGPDescriptor *descriptor) {
+  CGPFieldDescriptor **fields = descriptor->fields_->buffer_;
+  NSUInteger count = descriptor->fields_->size_;
+  void **kept = (void **)alloca(count * sizeof(void *));
+  for (NSUInteger i = 0; i < count; i++) {
+    CGPFieldDescriptor *field = fields[i];
+    if (CGPFieldIsRepeated(field)) {
+      kept[i] = *(void **)((uintptr_t)copy + CGPFieldGetOffset(field, copyCls));
+    }
+  }
+  memcpy((uint8_t *)copy + CGPGetStorageOffset(descriptor, copyCls),
+      (uint8_t *)orig + CGPGetStorageOffset(descriptor, origCls), descriptor->storageSize_);
+  for (NSUInteger i = 0; i < count; i++) {
+    CGPFieldDescriptor *field = fields[i];
+    uintptr_t ptr = ((uintptr_t)copy + CGPFieldGetOffset(field, copyCls));
+    uintptr_t origPtr = ((uintptr_t)orig + CGPFieldGetOffset(field, origCls));
+    CGPFieldJavaType javaType = CGPFieldGetJavaType(field);
+    if (CGPFieldIsMap(field)) {
+      *(void **)ptr = kept[i];
+      CGPMapFieldAppendOther(
+          (CGPMapField *)ptr, (CGPMapField *)origPtr, CGPFieldGetJavaType(CGPFieldMapKey(field)),
+          CGPFieldGetJavaType(CGPFieldMapValue(field)));
+    } else if (CGPFieldIsRepeated(field)) {
+      *(void **)ptr = kept[i];
+      CGPRepeatedFieldAppendOther((CGPRepeatedField *)ptr, (CGPRepeatedField *)origPtr, javaType);
+    } else if (CGPIsRetainedType(javaType) && GetHas(copy, GetHasLocator(copyCls, field))) {
+      [*(id *)ptr retain];
+    }
+  }
+}
+
 static void CopyMessage(
     id copy, CGPExtensionMap *copyExtensionMap, id orig, CGPExtensionMap *origExtensionMap,
     CGPDescriptor *descriptor) {
@@ -1299,9 +1643,12 @@ static void MergeFieldsFromMessage(id msg, id other, CGPDescriptor *descriptor)
       uintptr_t fieldPtr = (uintptr_t)msg + msgOffset;
       uintptr_t otherFieldPtr = (uintptr_t)other + otherOffset;
       if (CGPJavaTypeIsMessage(type) && GetHas(msg, hasLoc)) {
+        id merged = NewMergedMessageField(
+            GetMessageField(msg, msgOffset), GetMessageField(other, otherOffset),
+            field->valueType_);
         id *msgPtr = (id *)fieldPtr;
         [*msgPtr autorelease];
-        *msgPtr = NewMergedMessageField(*msgPtr, *(id *)otherFieldPtr, field->valueType_);
+        *msgPtr = merged;
         continue;
       }
       ClearPreviousOneof(msg, hasLoc, fieldPtr);
@@ -1379,6 +1726,25 @@ ComGoogleProtobufGeneratedMessage_Builder *CGPBuilderFromPrototype(
 // ********** Deserializing ****************************************************
 // *****************************************************************************
 
+static ComGoogleProtobufGeneratedMessage *NewMessageInArena(
+    CGPDescriptor *descriptor, CGPArena *arena) {
+  Class cls = descriptor->messageClass_;
+  void *bytes = CGPArenaAlloc(arena, descriptor->messageStorageOffset_ + descriptor->storageSize_);
+  ComGoogleProtobufGeneratedMessage *msg = objc_constructInstance(cls, bytes);
+  msg->memoizedSize_ = -1;
+  msg->arena_ = arena;
+  CGPArenaRetain(arena);
+  return msg;
+}
+
+// Returns a new message for a field that is being parsed, allocated in the
+// stream's arena if it has one.
+static inline ComGoogleProtobufGeneratedMessage *NewParsedMessage(
+    CGPDescriptor *descriptor, CGPCodedInputStream *stream) {
+  CGPArena *arena = stream->Arena();
+  return arena != NULL ? NewMessageInArena(descriptor, arena) : CGPNewMessage(descriptor);
+}
+
 static inline BOOL ReadEnumValueDescriptor(
     CGPCodedInputStream *input, CGPEnumDescriptor *enumType, id *valueDescriptor) {
   jint value;
@@ -1399,7 +1765,9 @@ static inline BOOL MergeGroupFieldFromStream(
     id msg, CGPFieldDescriptor *field, CGPCodedInputStream *input,
     CGPExtensionRegistryLite *registry) {
   CGPDescriptor *type = field->valueType_;
-  if (!MergeFromStream(msg, type, input, registry, MessageExtensionMap(msg, type))) return NO;
+  if (!MergeFieldsFromStream(msg, type, input, registry, MessageExtensionMap(msg, type))) {
+    return NO;
+  }
   if (!input->LastTagWas(CGPWireFormatMakeTag(CGPFieldGetNumber(field), CGPWireFormatEndGroup)))
     return NO;
   return YES;
@@ -1462,7 +1830,7 @@ static BOOL ReadMapEntryField(
       isGroup = YES;
       FALLTHROUGH_INTENDED;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE: {
-      ComGoogleProtobufGeneratedMessage *newMsg = CGPNewMessage(field->valueType_);
+      ComGoogleProtobufGeneratedMessage *newMsg = NewParsedMessage(field->valueType_, stream);
       if (!(isGroup ?
           MergeGroupFieldFromStream(newMsg, field, stream, registry) :
           MergeMessageFieldFromStream(newMsg, field, stream, registry))) {
@@ -1575,7 +1943,7 @@ static BOOL MergeExtensionValueFromStream(
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE:
       {
         CGPDescriptor *fieldType = field->valueType_;
-        ComGoogleProtobufGeneratedMessage *msgField = CGPNewMessage(fieldType);
+        ComGoogleProtobufGeneratedMessage *msgField = NewParsedMessage(fieldType, stream);
         if (existingValue != nil) {
           CopyMessage(msgField, MessageExtensionMap(msgField, fieldType),
                       existingValue, MessageExtensionMap(existingValue, fieldType), fieldType);
@@ -1658,7 +2026,7 @@ static BOOL MergeMessageSetExtensionFromStream(
         if (!stream->ReadVarint32(&typeId)) return NO;
         extension = CGPExtensionRegistryFind(registry, descriptor, typeId);
         if (rawBytes != nil && extension != nil) {
-          CGPCodedInputStream newInput(rawBytes->buffer_, rawBytes->size_);
+          CGPCodedInputStream newInput(rawBytes->bytes_, rawBytes->size_);
           if (!MergeExtensionFromStream(&newInput, extension, registry, extensionMap)) return NO;
         }
         rawBytes = nil;
@@ -1670,7 +2038,7 @@ static BOOL MergeMessageSetExtensionFromStream(
           CGPByteString *tempBytes;
           if (!stream->ReadRetainedByteString(&tempBytes)) return NO;
           rawBytes = [CGPNewByteString(CGPGetBytesSize(tempBytes)) autorelease];
-          CGPCodedOutputStream tempOutput(rawBytes->buffer_, rawBytes->size_);
+          CGPCodedOutputStream tempOutput(rawBytes->bytes_, rawBytes->size_);
           CGPWriteBytes(tempBytes, &tempOutput);
           [tempBytes release];
         } else {
@@ -1696,18 +2064,10 @@ static BOOL MergeMessageSetExtensionFromStream(
 static BOOL ParseUnknownField(
     CGPCodedInputStream *stream, CGPDescriptor *descriptor, CGPExtensionRegistryLite *registry,
     CGPExtensionMap *extensionMap, uint32_t tag) {
-  if (registry != nil && extensionMap != NULL) {
+  if (registry != nil && extensionMap != NULL
+      && __c11_atomic_load(&descriptor->hasRegisteredExtensions_, __ATOMIC_ACQUIRE)) {
     uint32_t fieldNumber = CGPWireFormatGetTagFieldNumber(tag);
     CGPFieldDescriptor *field = CGPExtensionRegistryFind(registry, descriptor, fieldNumber);
-    if (!field && [registry isKindOfClass:[ComGoogleProtobufExtensionRegistry class]]) {
-      ComGoogleProtobufExtensionRegistry_ExtensionInfo *extension =
-          [(ComGoogleProtobufExtensionRegistry *)registry
-              findExtensionByNumberWithComGoogleProtobufDescriptors_Descriptor:descriptor
-                                                                       withInt:fieldNumber];
-      if (extension) {
-        field = extension->descriptor_;
-      }
-    }
     if (field != nil && field->tag_ == tag) {
       return MergeExtensionFromStream(stream, field, registry, extensionMap);
     }
@@ -1730,6 +2090,10 @@ static BOOL MergeFieldFromStream(
   if (!repeated) {
     hasLoc = GetHasLocator(msgCls, field);
     ClearPreviousOneof(msg, hasLoc, fieldPtr);
+  } else if (stream->Arena() != NULL && !CGPFieldIsMap(field) && *(void **)fieldPtr == NULL) {
+    // The field is still empty, so its data can come from the arena. Map entries
+    // are stored contiguously and don't need it.
+    CGPRepeatedFieldInitArenaData((CGPRepeatedField *)fieldPtr, stream->Arena());
   }
   switch (CGPFieldGetType(field)) {
 #define MERGE_FIELD_CASE(NAME, ENUM_NAME, JAVA_NAME) \
@@ -1740,13 +2104,8 @@ static BOOL MergeFieldFromStream(
         if (CGPFieldIsPacked(field)) { \
           int length; \
           if (!CGPReadInt32(stream, &length)) return NO; \
-          CGPRepeatedFieldReserveAdditionalCapacity( \
-              repeatedField, length, sizeof(TYPE_##JAVA_NAME)); \
           CGPCodedInputStream::Limit limit = stream->PushLimit(length); \
-          while (stream->BytesUntilLimit() > 0) { \
-            if (!CGPRead##NAME(stream, &value)) return NO; \
-            CGPRepeatedFieldAdd##JAVA_NAME(repeatedField, value); \
-          } \
+          if (!CGPReadPacked##NAME(stream, repeatedField)) return NO; \
           stream->PopLimit(limit); \
         } else { \
           if (!CGPRead##NAME(stream, &value)) return NO; \
@@ -1839,14 +2198,22 @@ static BOOL MergeFieldFromStream(
         if (CGPFieldIsMap(field)) {
           return MergeMapEntryFromStream((CGPMapField *)fieldPtr, stream, fieldType, registry);
         }
-        ComGoogleProtobufGeneratedMessage *msgField = CGPNewMessage(fieldType);
+        if (stream->LazyParsing() && !repeated && !isGroup && !GetHas(msg, hasLoc)) {
+          CGPByteString *bytes;
+          if (!stream->ReadRetainedByteString(&bytes)) return NO;
+          *(id *)fieldPtr = NewLazyMessage(fieldType, registry, bytes);
+          SetHas(msg, hasLoc);
+          return YES;
+        }
+        ComGoogleProtobufGeneratedMessage *msgField = NewParsedMessage(fieldType, stream);
         if (repeated) {
           CGPRepeatedFieldAddRetainedId((CGPRepeatedField *)fieldPtr, msgField);
         } else {
           id *ptr = (id *)fieldPtr;
           if (GetHas(msg, hasLoc)) {
+            id existing = GetMessageField(msg, CGPFieldGetOffset(field, msgCls));
             CopyMessage(msgField, MessageExtensionMap(msgField, fieldType),
-                        *ptr, MessageExtensionMap(*ptr, fieldType), fieldType);
+                        existing, MessageExtensionMap(existing, fieldType), fieldType);
           }
           [*ptr autorelease];
           *ptr = msgField;
@@ -1864,30 +2231,18 @@ static BOOL MergeFieldFromStream(
   __builtin_unreachable();
 }
 
-static BOOL MergeFromStream(
+// Parses fields until the end of the input or an end-group tag.
+static BOOL MergeFieldsFromStream(
     id msg, CGPDescriptor *descriptor, CGPCodedInputStream *stream,
     CGPExtensionRegistryLite *registry, CGPExtensionMap *extensionMap) {
-  NSUInteger index = 0;
-  NSUInteger fieldsCount = descriptor->fields_->size_;
-  CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
   while (YES) {
-    BOOL merged = NO;
     uint32_t tag = stream->ReadTag();
     if (tag == 0) break;
-    for (NSUInteger i = 0; i < fieldsCount; i++) {
-      if (index >= fieldsCount) {
-        index = 0;
-      }
-      CGPFieldDescriptor *field = fieldsBuf[index];
-      if (tag == field->tag_) {
-        if (!MergeFieldFromStream(msg, field, stream, registry)) return NO;
-        merged = YES;
-        break;
-      } else {
-        index++;
-      }
-    }
-    if (!merged) {
+    CGPFieldDescriptor *field =
+        CGPFindFieldByNumber(descriptor, CGPWireFormatGetTagFieldNumber(tag));
+    if (field != nil && tag == field->tag_) {
+      if (!MergeFieldFromStream(msg, field, stream, registry)) return NO;
+    } else {
       CGPWireFormat wireType = CGPWireFormatGetTagWireType(tag);
       if (wireType == CGPWireFormatEndGroup) {
         return YES;
@@ -1898,6 +2253,52 @@ static BOOL MergeFromStream(
   return YES;
 }
 
+// Parses a message that extends to the current limit of the stream. Must not
+// be used for groups, which are terminated by a tag instead.
+static BOOL MergeFromStream(
+    id msg, CGPDescriptor *descriptor, CGPCodedInputStream *stream,
+    CGPExtensionRegistryLite *registry, CGPExtensionMap *extensionMap) {
+  BOOL (*fastMerge)(id, CGPParseContext *) = descriptor->fastPath_.merge;
+  const void *data;
+  int size;
+  if (fastMerge != NULL && stream->GetBufferedUntilLimit(&data, &size)) {
+    CGPParseContext ctx;
+    ctx.ptr = (const uint8_t *)data;
+    ctx.end = ctx.ptr + size;
+    ctx.registry = registry;
+    ctx.aliasOwner = stream->AliasingOwner();
+    ctx.arena = stream->Arena();
+    ctx.lazy = stream->LazyParsing();
+    if (!fastMerge(msg, &ctx)) return NO;
+    stream->SkipBufferedUntilLimit();
+    return YES;
+  }
+  return MergeFieldsFromStream(msg, descriptor, stream, registry, extensionMap);
+}
+
+BOOL CGPParseField(id msg, CGPDescriptor *descriptor, uint32_t tag, CGPParseContext *ctx) {
+  CGPCodedInputStream stream(ctx->ptr, (int)(ctx->end - ctx->ptr));
+  if (ctx->aliasOwner != nil) {
+    stream.EnableAliasing(ctx->aliasOwner);
+  }
+  stream.SetArena(ctx->arena);
+  if (ctx->lazy) {
+    stream.EnableLazyParsing();
+  }
+  CGPFieldDescriptor *field =
+      CGPFindFieldByNumber(descriptor, CGPWireFormatGetTagFieldNumber(tag));
+  if (field != nil && tag == field->tag_) {
+    if (!MergeFieldFromStream(msg, field, &stream, ctx->registry)) return NO;
+  } else {
+    // A message parsed up to a limit can't legitimately end with an end-group
+    // tag.
+    if (CGPWireFormatGetTagWireType(tag) == CGPWireFormatEndGroup) return NO;
+    if (!ParseUnknownField(&stream, descriptor, ctx->registry, NULL, tag)) return NO;
+  }
+  ctx->ptr += stream.CurrentPosition();
+  return YES;
+}
+
 static void InvalidPB() {
   @throw [[[ComGoogleProtobufInvalidProtocolBufferException alloc] init] autorelease];
 }
@@ -1913,8 +2314,58 @@ void CGPMergeFromRawData(id msg, CGPDescriptor *descriptor, const char *data, ui
 
 ComGoogleProtobufGeneratedMessage *CGPParseFromByteArray(
     CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry) {
+  return CGPParseFromBuffer(descriptor, bytes->buffer_, (int)bytes->size_, registry);
+}
+
+ComGoogleProtobufGeneratedMessage *CGPParseFromBuffer(
+    CGPDescriptor *descriptor, const void *data, int length, CGPExtensionRegistryLite *registry) {
+  ComGoogleProtobufGeneratedMessage *msg = [CGPNewMessage(descriptor) autorelease];
+  CGPCodedInputStream codedStream(data, length);
+  BOOL success =
+      MergeFromStream(msg, descriptor, &codedStream, registry, MessageExtensionMap(msg, descriptor))
+      && codedStream.ConsumedEntireMessage();
+  if (!success) {
+    InvalidPB();
+  }
+  return msg;
+}
+
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayAliasing(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry) {
+  ComGoogleProtobufGeneratedMessage *msg = [CGPNewMessage(descriptor) autorelease];
+  CGPCodedInputStream codedStream(bytes->buffer_, (int)bytes->size_);
+  codedStream.EnableAliasing(bytes);
+  BOOL success =
+      MergeFromStream(msg, descriptor, &codedStream, registry, MessageExtensionMap(msg, descriptor))
+      && codedStream.ConsumedEntireMessage();
+  if (!success) {
+    InvalidPB();
+  }
+  return msg;
+}
+
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayLazily(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry) {
   ComGoogleProtobufGeneratedMessage *msg = [CGPNewMessage(descriptor) autorelease];
   CGPCodedInputStream codedStream(bytes->buffer_, (int)bytes->size_);
+  codedStream.EnableLazyParsing();
+  BOOL success =
+      MergeFromStream(msg, descriptor, &codedStream, registry, MessageExtensionMap(msg, descriptor))
+      && codedStream.ConsumedEntireMessage();
+  if (!success) {
+    InvalidPB();
+  }
+  return msg;
+}
+
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayWithArena(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry) {
+  // Parsed messages usually take up a few times the size of their encoding.
+  CGPArena *arena = CGPArenaCreate(bytes->size_ * 4);
+  ComGoogleProtobufGeneratedMessage *msg = [NewMessageInArena(descriptor, arena) autorelease];
+  CGPArenaRelease(arena);  // Now owned by the message.
+  CGPCodedInputStream codedStream(bytes->buffer_, (int)bytes->size_);
+  codedStream.SetArena(arena);
   BOOL success =
       MergeFromStream(msg, descriptor, &codedStream, registry, MessageExtensionMap(msg, descriptor))
       && codedStream.ConsumedEntireMessage();
@@ -1924,6 +2375,204 @@ ComGoogleProtobufGeneratedMessage *CGPParseFromByteArray(
   return msg;
 }
 
+// Inputs smaller than this are always parsed sequentially.
+#define PARALLEL_PARSE_MIN_SIZE (256 * 1024)
+// The encoded size of the elements that are parsed together by one task.
+#define PARALLEL_PARSE_CHUNK_SIZE (64 * 1024)
+
+// The position of one top-level element of a repeated message field.
+typedef struct ElementSpan {
+  CGPFieldDescriptor *field;
+  int start;       // Offset of the element's tag.
+  int dataStart;   // Offset of the element's encoded message.
+  int end;
+} ElementSpan;
+
+// Finds the top-level elements of the repeated message field that has the most
+// encoded data. Returns NO if there is no such field or if the input contains
+// anything the scan doesn't handle, in which case the input is left to the
+// sequential parser.
+static BOOL ScanLargestRepeatedField(
+    CGPDescriptor *descriptor, const uint8_t *data, int length, std::vector<ElementSpan> *spans) {
+  CGPParseContext ctx;
+  ctx.ptr = data;
+  ctx.end = data + length;
+  std::vector<ElementSpan> all;
+  while (ctx.ptr < ctx.end) {
+    int start = (int)(ctx.ptr - data);
+    uint32_t tag = CGPParseTag(&ctx);
+    if (tag == 0) return NO;
+    uint64_t value;
+    uint32_t size;
+    switch (CGPWireFormatGetTagWireType(tag)) {
+      case CGPWireFormatVarint:
+        if (!CGPParseVarint64(&ctx, &value)) return NO;
+        break;
+      case CGPWireFormatFixed64:
+        if (ctx.end - ctx.ptr < 8) return NO;
+        ctx.ptr += 8;
+        break;
+      case CGPWireFormatFixed32:
+        if (ctx.end - ctx.ptr < 4) return NO;
+        ctx.ptr += 4;
+        break;
+      case CGPWireFormatLengthDelimited:
+        {
+          if (!CGPParseVarint32(&ctx, &size) || size > (uint64_t)(ctx.end - ctx.ptr)) return NO;
+          CGPFieldDescriptor *field =
+              CGPFindFieldByNumber(descriptor, CGPWireFormatGetTagFieldNumber(tag));
+          int dataStart = (int)(ctx.ptr - data);
+          ctx.ptr += size;
+          if (field != nil && tag == field->tag_ && CGPFieldIsRepeated(field)
+              && !CGPFieldIsMap(field) && CGPFieldGetType(field)
+                  == ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE) {
+            all.push_back({ field, start, dataStart, (int)(ctx.ptr - data) });
+          }
+        }
+        break;
+      default:
+        // Groups would need a nested scan, they aren't worth it.
+        return NO;
+    }
+  }
+
+  // Messages rarely have more than a few repeated message fields, so the totals
+  // are kept in a short list.
+  std::vector<std::pair<CGPFieldDescriptor *, size_t>> totals;
+  for (const ElementSpan &span : all) {
+    size_t i = 0;
+    while (i < totals.size() && totals[i].first != span.field) i++;
+    if (i == totals.size()) totals.push_back({ span.field, 0 });
+    totals[i].second += span.end - span.start;
+  }
+  CGPFieldDescriptor *best = nil;
+  size_t bestSize = 0;
+  for (const auto &total : totals) {
+    if (total.second > bestSize) {
+      best = total.first;
+      bestSize = total.second;
+    }
+  }
+  if (best == nil || bestSize < PARALLEL_PARSE_MIN_SIZE / 2) return NO;
+  for (const ElementSpan &span : all) {
+    if (span.field == best) spans->push_back(span);
+  }
+  return YES;
+}
+
+// Parses the elements in [begin, end) into a buffer of retained messages.
+static BOOL ParseElements(
+    CGPDescriptor *type, const uint8_t *data, const ElementSpan *begin, const ElementSpan *end,
+    CGPExtensionRegistryLite *registry, id *result) {
+  for (const ElementSpan *span = begin; span < end; span++) {
+    ComGoogleProtobufGeneratedMessage *element = CGPNewMessage(type);
+    *result++ = element;
+    CGPCodedInputStream stream(data + span->dataStart, span->end - span->dataStart);
+    if (!MergeFromStream(element, type, &stream, registry, MessageExtensionMap(element, type))
+        || !stream.ConsumedEntireMessage()) {
+      return NO;
+    }
+  }
+  return YES;
+}
+
+// Parses all but the given elements in order into msg. The top-level fields in
+// the gaps between the elements are complete, so each gap can be parsed on its
+// own.
+static BOOL ParseBetweenElements(
+    id msg, CGPDescriptor *descriptor, const uint8_t *data, int length,
+    const std::vector<ElementSpan> &spans, CGPExtensionRegistryLite *registry) {
+  CGPExtensionMap *extensionMap = MessageExtensionMap(msg, descriptor);
+  int gapStart = 0;
+  for (size_t i = 0; i <= spans.size(); i++) {
+    int gapEnd = i < spans.size() ? spans[i].start : length;
+    if (gapEnd > gapStart) {
+      CGPCodedInputStream stream(data + gapStart, gapEnd - gapStart);
+      if (!MergeFromStream(msg, descriptor, &stream, registry, extensionMap)
+          || !stream.ConsumedEntireMessage()) {
+        return NO;
+      }
+    }
+    if (i < spans.size()) gapStart = spans[i].end;
+  }
+  return YES;
+}
+
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayInParallel(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry) {
+  const uint8_t *data = (const uint8_t *)bytes->buffer_;
+  int length = (int)bytes->size_;
+  std::vector<ElementSpan> spans;
+  if (length < PARALLEL_PARSE_MIN_SIZE
+      || !ScanLargestRepeatedField(descriptor, data, length, &spans)) {
+    return CGPParseFromBuffer(descriptor, data, length, registry);
+  }
+
+  // Cut the elements into chunks of about the same encoded size.
+  std::vector<size_t> chunkStarts;
+  size_t chunkSize = PARALLEL_PARSE_CHUNK_SIZE;
+  for (size_t i = 0; i < spans.size(); i++) {
+    if (chunkSize >= PARALLEL_PARSE_CHUNK_SIZE) {
+      chunkStarts.push_back(i);
+      chunkSize = 0;
+    }
+    chunkSize += spans[i].end - spans[i].start;
+  }
+  chunkStarts.push_back(spans.size());
+  if (chunkStarts.size() < 3) {
+    return CGPParseFromBuffer(descriptor, data, length, registry);
+  }
+
+  CGPFieldDescriptor *field = spans[0].field;
+  CGPDescriptor *type = field->valueType_;
+  id *elements = (id *)calloc(spans.size(), sizeof(id));
+  std::atomic<bool> failed(false);
+  // Blocks would copy C++ objects, so they capture pointers to them instead.
+  const ElementSpan *spanData = spans.data();
+  const size_t *chunkData = chunkStarts.data();
+  std::atomic<bool> *failedPtr = &failed;
+  // dispatch_apply() runs the chunks on the global queue's worker threads, which
+  // take the next chunk as soon as they are done with one, and on this thread.
+  dispatch_apply(chunkStarts.size() - 1, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0),
+      ^(size_t chunk) {
+    if (failedPtr->load(std::memory_order_relaxed)) return;
+    @autoreleasepool {
+      @try {
+        if (!ParseElements(type, data, spanData + chunkData[chunk], spanData + chunkData[chunk + 1],
+                           registry, elements + chunkData[chunk])) {
+          failedPtr->store(true, std::memory_order_relaxed);
+        }
+      }
+      @catch (id e) {
+        failedPtr->store(true, std::memory_order_relaxed);
+      }
+    }
+  });
+
+  ComGoogleProtobufGeneratedMessage *msg = nil;
+  if (!failed) {
+    msg = [CGPNewMessage(descriptor) autorelease];
+    if (ParseBetweenElements(msg, descriptor, data, length, spans, registry)) {
+      // The gaps don't contain any elements of the field, so it is still empty.
+      CGPRepeatedField *repeatedField =
+          REPEATED_FIELD_PTR(msg, CGPFieldGetOffset(field, object_getClass(msg)));
+      uint32_t count = (uint32_t)spans.size();
+      CGPRepeatedFieldReserveAdditionalCapacity(repeatedField, count, sizeof(id));
+      CGPRepeatedFieldData *fieldData = repeatedField->data;
+      memcpy((id *)fieldData->buffer + fieldData->size, elements, count * sizeof(id));
+      fieldData->size += count;
+      free(elements);
+      return msg;
+    }
+  }
+  for (size_t i = 0; i < spans.size(); i++) {
+    [elements[i] release];
+  }
+  free(elements);
+  // Parse again sequentially so that errors are reported the same way.
+  return CGPParseFromBuffer(descriptor, data, length, registry);
+}
+
 ComGoogleProtobufGeneratedMessage *CGPParseFromInputStream(
     CGPDescriptor *descriptor, JavaIoInputStream *input, CGPExtensionRegistryLite *registry) {
   ComGoogleProtobufGeneratedMessage *msg = [CGPNewMessage(descriptor) autorelease];
@@ -2103,13 +2752,12 @@ static int SerializedSizeForMapField(id msg, CGPFieldDescriptor *field) {
   CGPFieldDescriptor *keyField = CGPFieldMapKey(field);
   CGPFieldDescriptor *valueField = CGPFieldMapValue(field);
   CGPMapFieldEnsureValidMap(data, CGPFieldGetJavaType(keyField), CGPFieldGetJavaType(valueField));
-  CGPMapFieldEntry *entry = data->header.next;
-  while (entry != &data->header) {
+  for (uint32_t i = 0; i < data->numEntries; i++) {
+    CGPMapFieldEntry *entry = &data->entries[i];
     int entrySize = SerializedSizeForMapEntryField(keyField, entry->key) +
         SerializedSizeForMapEntryField(valueField, entry->value);
     entriesSize += CGPGetInt32Size(entrySize) + entrySize;
     numEntries++;
-    entry = entry->next;
   }
 
   return entriesSize + numEntries * tagSize;
@@ -2252,7 +2900,9 @@ static int SerializedSizeForSingularField(id msg, CGPFieldDescriptor *field) {
       }
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE:
       {
-        int msgSize = SerializedSizeForMessage(*FIELD_PTR(id, msg, offset), field->valueType_);
+        CGPLazyMessage *lazy = GetLazyMessageField(msg, offset);
+        int msgSize = lazy != nil ? lazy->bytes_->size_
+            : SerializedSizeForMessage(*FIELD_PTR(id, msg, offset), field->valueType_);
         return tagSize + CGPGetInt32Size(msgSize) + msgSize;
       }
   }
@@ -2260,20 +2910,33 @@ static int SerializedSizeForSingularField(id msg, CGPFieldDescriptor *field) {
   __builtin_unreachable();
 }
 
+static int SerializedSizeForField(id msg, CGPFieldDescriptor *field) {
+  if (CGPFieldIsMap(field)) {
+    return SerializedSizeForMapField(msg, field);
+  } else if (CGPFieldIsRepeated(field)) {
+    return SerializedSizeForRepeatedField(msg, field);
+  } else {
+    return SerializedSizeForSingularField(msg, field);
+  }
+}
+
+int CGPFieldSerializedSize(id msg, CGPDescriptor *descriptor, uint32_t fieldIndex) {
+  return SerializedSizeForField(msg, descriptor->fields_->buffer_[fieldIndex]);
+}
+
 static int ComputeSerializedSizeForMessage(
     ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *descriptor) {
+  int (*fastSize)(id) = descriptor->fastPath_.serializedSize;
+  if (fastSize != NULL) {
+    int size = fastSize(msg);
+    msg->memoizedSize_ = size;
+    return size;
+  }
   int size = 0;
   NSUInteger fieldsCount = descriptor->fields_->size_;
   CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
   for (NSUInteger i = 0; i < fieldsCount; i++) {
-    CGPFieldDescriptor *field = fieldsBuf[i];
-    if (CGPFieldIsMap(field)) {
-      size += SerializedSizeForMapField(msg, field);
-    } else if (CGPFieldIsRepeated(field)) {
-      size += SerializedSizeForRepeatedField(msg, field);
-    } else {
-      size += SerializedSizeForSingularField(msg, field);
-    }
+    size += SerializedSizeForField(msg, fieldsBuf[i]);
   }
   CGPExtensionMap *extensionMap = MessageExtensionMap(msg, descriptor);
   if (extensionMap != NULL) {
@@ -2415,6 +3078,13 @@ static void WriteSingularField(id msg, CGPFieldDescriptor *field, CGPCodedOutput
       return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE:
       {
+        CGPLazyMessage *lazy = GetLazyMessageField(msg, offset);
+        if (lazy != nil) {
+          CGPByteString *bytes = lazy->bytes_;
+          CGPWriteInt32(bytes->size_, output);
+          output->WriteAliasedRaw(bytes->bytes_, bytes->size_, bytes);
+          return;
+        }
         id msgField = *FIELD_PTR(id, msg, offset);
         CGPDescriptor *msgDescriptor = field->valueType_;
         CGPWriteInt32(SerializedSizeForMessage(msgField, msgDescriptor), output);
@@ -2492,15 +3162,14 @@ static void WriteMapField(id msg, CGPFieldDescriptor *field, CGPCodedOutputStrea
   CGPFieldDescriptor *keyField = CGPFieldMapKey(field);
   CGPFieldDescriptor *valueField = CGPFieldMapValue(field);
   CGPMapFieldEnsureValidMap(data, CGPFieldGetJavaType(keyField), CGPFieldGetJavaType(valueField));
-  CGPMapFieldEntry *entry = data->header.next;
-  while (entry != &data->header) {
+  for (uint32_t i = 0; i < data->numEntries; i++) {
+    CGPMapFieldEntry *entry = &data->entries[i];
     int entrySize = SerializedSizeForMapEntryField(keyField, entry->key) +
         SerializedSizeForMapEntryField(valueField, entry->value);
     output->WriteTag(field->tag_);
     CGPWriteInt32(entrySize, output);
     WriteMapEntryField(CGPFieldMapKey(field), entry->key, output);
     WriteMapEntryField(CGPFieldMapValue(field), entry->value, output);
-    entry = entry->next;
   }
 }
 
@@ -2526,9 +3195,7 @@ static void WriteRepeatedField(id msg, CGPFieldDescriptor *field, CGPCodedOutput
           } \
           output->WriteTag(field->tag_); \
           CGPWriteInt32(arraySize, output); \
-          for (uint32_t i = 0; i < arrayLen; i++) { \
-            CGPWrite##NAME(buffer[i], output); \
-          } \
+          CGPWritePacked##NAME(buffer, arrayLen, output); \
         } else { \
           for (uint32_t i = 0; i < arrayLen; i++) { \
             output->WriteTag(field->tag_); \
@@ -2544,9 +3211,7 @@ static void WriteRepeatedField(id msg, CGPFieldDescriptor *field, CGPCodedOutput
         if (CGPFieldIsPacked(field)) { \
           output->WriteTag(field->tag_); \
           CGPWriteInt32(arrayLen * SIZE, output); \
-          for (uint32_t i = 0; i < arrayLen; i++) { \
-            CGPWrite##NAME(buffer[i], output); \
-          } \
+          CGPWritePacked##NAME(buffer, arrayLen, output); \
         } else { \
           for (uint32_t i = 0; i < arrayLen; i++) { \
             output->WriteTag(field->tag_); \
@@ -2648,7 +3313,29 @@ static void WriteField(id msg, CGPFieldDescriptor *field, CGPCodedOutputStream *
   }
 }
 
+uint8_t *CGPWriteFieldToArray(
+    id msg, CGPDescriptor *descriptor, uint32_t fieldIndex, uint8_t *target) {
+  // The caller guarantees that the field fits, so the stream is never bounded.
+  CGPCodedOutputStream output(target, INT_MAX);
+  WriteField(msg, descriptor->fields_->buffer_[fieldIndex], &output);
+  void *end;
+  int remaining;
+  output.GetDirectBufferPointer(&end, &remaining);
+  return (uint8_t *)end;
+}
+
 static void WriteMessage(id msg, CGPDescriptor *descriptor, CGPCodedOutputStream *output) {
+  uint8_t *(*fastWrite)(id, uint8_t *) = descriptor->fastPath_.write;
+  if (fastWrite != NULL) {
+    int size = SerializedSizeForMessage(msg, descriptor);
+    void *data;
+    int available;
+    if (output->GetDirectBufferPointer(&data, &available) && available >= size) {
+      fastWrite(msg, (uint8_t *)data);
+      output->Skip(size);
+      return;
+    }
+  }
   IOSObjectArray *orderedFields = CGPGetSerializationOrderFields(descriptor);
   NSUInteger fieldsCount = orderedFields->size_;
   CGPFieldDescriptor **fieldsBuf = orderedFields->buffer_;
@@ -2705,12 +3392,11 @@ static BOOL MessageIsInitialized(id msg, CGPDescriptor *descriptor) {
           CGPDescriptor *msgType = valueField->valueType_;
           CGPMapFieldEnsureValidMap(
               data, CGPFieldGetJavaType(CGPFieldMapKey(field)), CGPFieldGetJavaType(valueField));
-          CGPMapFieldEntry *entry = data->header.next;
-          while (entry != &data->header) {
-            if (entry != NULL && !MessageIsInitialized(entry->value.valueId, msgType)) {
+          for (uint32_t i = 0; i < data->numEntries; i++) {
+            CGPMapFieldEntry *entry = &data->entries[i];
+            if (!MessageIsInitialized(entry->value.valueId, msgType)) {
               return NO;
             }
-            entry = entry->next;
           }
         }
       }
@@ -2737,7 +3423,7 @@ static BOOL MessageIsInitialized(id msg, CGPDescriptor *descriptor) {
       if (required && !hasField) return NO;
       if (isMessage && hasField) {
         size_t offset = CGPFieldGetOffset(field, msgCls);
-        id fieldValue = *FIELD_PTR(id, msg, offset);
+        id fieldValue = GetMessageField(msg, offset);
         if (!MessageIsInitialized(fieldValue, field->valueType_)) return NO;
       }
     }
@@ -2750,53 +3436,223 @@ static BOOL MessageIsInitialized(id msg, CGPDescriptor *descriptor) {
 // ********** toString *********************************************************
 // *****************************************************************************
 
-// Partially translated from com.google.protobuf.TextFormat.escapeBytes().
-static NSString *BytesToString(CGPByteString *byteString) {
-  int length = byteString->size_;
-  int8_t *buffer = byteString->buffer_;
-  JavaLangStringBuilder *builder = [[[JavaLangStringBuilder alloc] initWithInt:length] autorelease];
-  for (int i = 0; i < length; i++) {
-    int8_t b = buffer[i];
-    switch (b) {
-      case (int) 0x07:
-        [builder appendWithNSString:@"\\a"]; break;
-      case 0x0008:
-        [builder appendWithNSString:@"\\b"]; break;
-      case 0x000c:
-        [builder appendWithNSString:@"\\f"]; break;
-      case 0x000a:
-        [builder appendWithNSString:@"\\n"]; break;
-      case 0x000d:
-        [builder appendWithNSString:@"\\r"]; break;
-      case 0x0009:
-        [builder appendWithNSString:@"\\t"]; break;
-      case (int) 0x0b:
-        [builder appendWithNSString:@"\\v"]; break;
-      case '\\':
-        [builder appendWithNSString:@"\\\\"]; break;
-      case '\'':
-        [builder appendWithNSString:@"\\'"]; break;
-      case '"':
-        [builder appendWithNSString:@"\\\""]; break;
-      default:
-        if (b >= (int) 0x20) {
-          [builder appendWithChar:(unichar) b];
-        } else {
-          [builder appendWithChar:'\\'];
-          [builder appendWithChar:(unichar) ('0' + (((char) (((unsigned char) b) >> 6)) & 3))];
-          [builder appendWithChar:(unichar) ('0' + (((char) (((unsigned char) b) >> 3)) & 7))];
-          [builder appendWithChar:(unichar) ('0' + (b & 7))];
-        }
-        break;
+// Output of the text printers. Text is formatted into buffer, which either
+// grows as needed or, when flush is set, is handed to flush whenever it fills
+// up. Streaming outputs have a fixed capacity that is larger than any single
+// reservation.
+typedef struct TextOutput {
+  char *buffer;
+  size_t size;
+  size_t capacity;
+  void (*flush)(struct TextOutput *out);
+  // The sink of an output streamed by FlushToOutputStream(), whose buffer is
+  // the storage of streamBuffer.
+  JavaIoOutputStream *stream;
+  IOSByteArray *streamBuffer;
+  // The sink of an output streamed by FlushToFileDescriptor(), which sets
+  // failed and saves errno in error if a write fails. The printers stop at the
+  // next field or element once failed is set.
+  int fd;
+  BOOL failed;
+  int error;
+} TextOutput;
+
+// The buffer size of streaming outputs.
+#define TEXT_STREAM_BUFFER_SIZE 8192
+
+// The largest reservation that TextAppendNSString() makes.
+#define TEXT_MAX_CHUNK_SIZE 4096
+
+static void TextMakeRoom(TextOutput *out, size_t count) {
+  if (out->flush != NULL) {
+    out->flush(out);
+    out->size = 0;
+    return;
+  }
+  size_t capacity = MAX(out->capacity * 2, out->size + count);
+  capacity = MAX(capacity, 256);
+  out->buffer = (char *)realloc(out->buffer, capacity);
+  out->capacity = capacity;
+}
+
+// Returns the end of the output, after making room for count more bytes.
+static inline char *TextReserve(TextOutput *out, size_t count) {
+  if (out->capacity - out->size < count) {
+    TextMakeRoom(out, count);
+  }
+  return out->buffer + out->size;
+}
+
+static void TextAppend(TextOutput *out, const char *bytes, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  while (out->flush != NULL && out->capacity - out->size < count) {
+    size_t available = out->capacity - out->size;
+    memcpy(out->buffer + out->size, bytes, available);
+    out->size += available;
+    bytes += available;
+    count -= available;
+    TextMakeRoom(out, count);
+  }
+  memcpy(TextReserve(out, count), bytes, count);
+  out->size += count;
+}
+
+static inline void TextAppendChar(TextOutput *out, char c) {
+  *TextReserve(out, 1) = c;
+  out->size++;
+}
+
+static inline void TextAppendCString(TextOutput *out, const char *str) {
+  TextAppend(out, str, strlen(str));
+}
+
+static const char kTextDigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static void TextAppendUint64(TextOutput *out, uint64_t value) {
+  char buffer[20];
+  char *end = buffer + sizeof(buffer);
+  char *p = end;
+  while (value >= 100) {
+    const char *pair = &kTextDigitPairs[(value % 100) * 2];
+    value /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (value >= 10) {
+    const char *pair = &kTextDigitPairs[value * 2];
+    *--p = pair[1];
+    *--p = pair[0];
+  } else {
+    *--p = (char)('0' + value);
+  }
+  TextAppend(out, p, end - p);
+}
+
+static void TextAppendInt64(TextOutput *out, int64_t value) {
+  if (value < 0) {
+    TextAppendChar(out, '-');
+    TextAppendUint64(out, 0 - (uint64_t)value);
+  } else {
+    TextAppendUint64(out, value);
+  }
+}
+
+// Appends the UTF-8 encoding of a string, converting it in chunks that fit in
+// a streaming output's buffer.
+static void TextAppendNSString(TextOutput *out, NSString *value) {
+  NSRange range = NSMakeRange(0, [value length]);
+  while (range.length > 0 && !out->failed) {
+    // Each UTF-16 unit takes at most 3 bytes in UTF-8.
+    NSUInteger maxLength = MIN(range.length * 3, TEXT_MAX_CHUNK_SIZE);
+    NSUInteger usedLength = 0;
+    [value getBytes:TextReserve(out, maxLength)
+          maxLength:maxLength
+         usedLength:&usedLength
+           encoding:NSUTF8StringEncoding
+            options:NSStringEncodingConversionAllowLossy
+              range:range
+     remainingRange:&range];
+    if (usedLength == 0) {
+      break;
+    }
+    out->size += usedLength;
+  }
+}
+
+static void TextAppendPadding(TextOutput *out, int indent) {
+  size_t count = indent * 2;
+  while (count > 0) {
+    size_t chunk = MIN(count, 64);
+    memset(TextReserve(out, chunk), ' ', chunk);
+    out->size += chunk;
+    count -= chunk;
+  }
+}
+
+// Appends the padding and the field name, followed by ": ".
+static void TextAppendFieldName(TextOutput *out, CGPFieldDescriptor *field, int indent) {
+  TextAppendPadding(out, indent);
+  TextAppendCString(out, field->data_->name);
+  TextAppend(out, ": ", 2);
+}
+
+// Appends a float or double the way "%g" formats it.
+static void TextAppendFloatingPoint(TextOutput *out, double value) {
+  char buffer[32];
+  int length = snprintf(buffer, sizeof(buffer), "%g", value);
+  TextAppend(out, buffer, length);
+}
+
+// For each byte, the character that follows the backslash when it is escaped,
+// '0' if it is written as three octal digits or 0 if it is written as is.
+static const char kTextByteEscapes[256] = {
+  '0', '0', '0', '0', '0', '0', '0', 'a', 'b', 't', 'n', 'v', 'f', 'r', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  0, 0, '"', 0, 0, 0, 0, '\'', 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+  '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0', '0',
+};
+
+// Partially translated from com.google.protobuf.TextFormat.escapeBytes(). Runs
+// of bytes that need no escaping are copied at once.
+static void TextAppendBytes(TextOutput *out, CGPByteString *byteString) {
+  const uint8_t *bytes = (const uint8_t *)byteString->bytes_;
+  size_t length = byteString->size_;
+  size_t runStart = 0;
+  for (size_t i = 0; i < length; i++) {
+    uint8_t b = bytes[i];
+    char escape = kTextByteEscapes[b];
+    if (__builtin_expect(escape == 0, 1)) {
+      continue;
+    }
+    TextAppend(out, (const char *)bytes + runStart, i - runStart);
+    runStart = i + 1;
+    char *p = TextReserve(out, 4);
+    *p++ = '\\';
+    if (escape == '0') {
+      *p++ = (char)('0' + (b >> 6));
+      *p++ = (char)('0' + ((b >> 3) & 7));
+      *p++ = (char)('0' + (b & 7));
+    } else {
+      *p++ = escape;
     }
+    out->size = p - out->buffer;
   }
-  return [builder description];
+  TextAppend(out, (const char *)bytes + runStart, length - runStart);
+}
+
+static void MessageToString(id msg, CGPDescriptor *descriptor, TextOutput *out, int indent);
+
+static void TextAppendMessageBlock(
+    TextOutput *out, id msg, CGPFieldDescriptor *field, int indent) {
+  TextAppend(out, "{\n", 2);
+  MessageToString(msg, field->valueType_, out, indent + 1);
+  TextAppendPadding(out, indent);
+  TextAppend(out, "}\n", 2);
 }
 
 static void ExtensionFieldToString(
-    id value, CGPFieldDescriptor *field, NSMutableString *builder, const char *padding,
-    int indent) {
-  const char *fieldName = field->data_->name;
+    id value, CGPFieldDescriptor *field, TextOutput *out, int indent) {
+  TextAppendPadding(out, indent);
+  TextAppendChar(out, '[');
+  TextAppendCString(out, field->data_->name);
+  TextAppend(out, "]: ", 3);
 
   switch (CGPFieldGetType(field)) {
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT32:
@@ -2812,244 +3668,1368 @@ static void ExtensionFieldToString(
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BOOL:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FLOAT:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_DOUBLE:
-      [builder appendFormat:@"%s[%s]: %@\n", padding, fieldName, value];
-      return;
+      TextAppendNSString(out, [value description]);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_ENUM:
-      [builder appendFormat:@"%s[%s]: %@\n",
-          padding, fieldName, ((CGPEnumValueDescriptor *)value)->enum_];
-      return;
+      TextAppendNSString(out, [((CGPEnumValueDescriptor *)value)->enum_ description]);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BYTES:
-      [builder appendFormat:@"%s[%s]: \"%@\"\n", padding, fieldName, BytesToString(value)];
-      return;
+      TextAppendChar(out, '"');
+      TextAppendBytes(out, value);
+      TextAppendChar(out, '"');
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_STRING:
-      [builder appendFormat:@"%s[%s]: \"%@\"\n", padding, fieldName, value];
-      return;
+      TextAppendChar(out, '"');
+      TextAppendNSString(out, value);
+      TextAppendChar(out, '"');
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_GROUP:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE:
-      [builder appendFormat:@"%s[%s]: {\n", padding, fieldName];
-      MessageToString(value, field->valueType_, builder, indent + 1);
-      [builder appendFormat:@"%s}\n", padding];
+      TextAppendMessageBlock(out, value, field, indent);
       return;
   }
+  TextAppendChar(out, '\n');
 }
 
-void ValueToString(
-    CGPValue value, CGPFieldDescriptor *field, NSMutableString *builder, const char *padding,
-    int indent) {
-  const char *fieldName = field->data_->name;
+// Appends the value stored at ptr, which is either in a message's field
+// storage, in a repeated field's buffer or in a map entry, followed by a
+// newline.
+static void ValueToString(
+    const void *ptr, CGPFieldDescriptor *field, TextOutput *out, int indent) {
   switch (CGPFieldGetType(field)) {
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT32:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT32:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED32:
-      [builder appendFormat:@"%s%s: %d\n", padding, fieldName, value.valueInt];
-      return;
+      TextAppendInt64(out, *(const int32_t *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT32:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED32:
-      [builder appendFormat:@"%s%s: %u\n", padding, fieldName, (uint32_t)value.valueInt];
-      return;
+      TextAppendUint64(out, *(const uint32_t *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT64:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT64:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED64:
-      [builder appendFormat:@"%s%s: %qd\n", padding, fieldName, value.valueLong];
-      return;
+      TextAppendInt64(out, *(const int64_t *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT64:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED64:
-      [builder appendFormat:@"%s%s: %qu\n", padding, fieldName, (uint64_t)value.valueLong];
-      return;
+      TextAppendUint64(out, *(const uint64_t *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BOOL:
-      [builder appendFormat:@"%s%s: %s\n", padding, fieldName, value.valueBool ? "true" : "false"];
-      return;
+      if (*(const jboolean *)ptr) {
+        TextAppend(out, "true", 4);
+      } else {
+        TextAppend(out, "false", 5);
+      }
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FLOAT:
-      [builder appendFormat:@"%s%s: %g\n", padding, fieldName, value.valueFloat];
-      return;
+      TextAppendFloatingPoint(out, *(const float *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_DOUBLE:
-      [builder appendFormat:@"%s%s: %g\n", padding, fieldName, value.valueDouble];
-      return;
+      TextAppendFloatingPoint(out, *(const double *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_ENUM:
-      [builder appendFormat:@"%s%s: %@\n", padding, fieldName, value.valueId];
-      return;
+      TextAppendNSString(out, [*(const id *)ptr description]);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BYTES:
-      [builder appendFormat:@"%s%s: %@\n", padding, fieldName, BytesToString(value.valueId)];
-      return;
+      TextAppendBytes(out, *(CGPByteString * const *)ptr);
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_STRING:
-      [builder appendFormat:@"%s%s: \"%@\"\n", padding, fieldName, value.valueId];
-      return;
+      TextAppendChar(out, '"');
+      TextAppendNSString(out, *(NSString * const *)ptr);
+      TextAppendChar(out, '"');
+      break;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_GROUP:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE:
-      [builder appendFormat:@"%s%s: {\n", padding, fieldName];
-      MessageToString(value.valueId, field->valueType_, builder, indent + 1);
-      [builder appendFormat:@"%s}\n", padding];
+      TextAppendMessageBlock(out, *(const id *)ptr, field, indent);
       return;
   }
+  TextAppendChar(out, '\n');
 }
 
-static void MapFieldToString(
-    id msg, CGPFieldDescriptor *field, NSMutableString *builder, const char *padding, int indent) {
+static void MapFieldToString(id msg, CGPFieldDescriptor *field, TextOutput *out, int indent) {
   size_t offset = CGPFieldGetOffset(field, object_getClass(msg));
   CGPMapFieldData *data = MAP_FIELD_PTR(msg, offset)->data;
   if (data == NULL) {
     return;
   }
 
-  int paddingSize = (indent + 1) * 2;
-  std::string innerPadding(paddingSize, ' ');
-
-  const char *fieldName = field->data_->name;
   CGPFieldDescriptor *keyField = CGPFieldMapKey(field);
   CGPFieldDescriptor *valueField = CGPFieldMapValue(field);
   CGPMapFieldEnsureValidMap(data, CGPFieldGetJavaType(keyField), CGPFieldGetJavaType(valueField));
-  CGPMapFieldEntry *entry = data->header.next;
-  while (entry != &data->header) {
-    [builder appendFormat:@"%s%s: {\n", padding, fieldName];
-    ValueToString(entry->key, keyField, builder, innerPadding.c_str(), indent + 1);
-    ValueToString(entry->value, valueField, builder, innerPadding.c_str(), indent + 1);
-    [builder appendFormat:@"%s}\n", padding];
-    entry = entry->next;
+  for (uint32_t i = 0; i < data->numEntries && !out->failed; i++) {
+    CGPMapFieldEntry *entry = &data->entries[i];
+    TextAppendFieldName(out, field, indent);
+    TextAppend(out, "{\n", 2);
+    TextAppendFieldName(out, keyField, indent + 1);
+    ValueToString(&entry->key, keyField, out, indent + 1);
+    TextAppendFieldName(out, valueField, indent + 1);
+    ValueToString(&entry->value, valueField, out, indent + 1);
+    TextAppendPadding(out, indent);
+    TextAppend(out, "}\n", 2);
   }
 }
 
-static void FieldToString(
-    id msg, CGPFieldDescriptor *field, NSMutableString *builder, const char *padding, int indent) {
+static void FieldToString(id msg, CGPFieldDescriptor *field, TextOutput *out, int indent) {
   Class msgCls = object_getClass(msg);
   size_t offset = CGPFieldGetOffset(field, msgCls);
-  BOOL repeated = CGPFieldIsRepeated(field);
-  CGPRepeatedFieldData *data = NULL;
-  if (repeated) {
-    data = REPEATED_FIELD_PTR(msg, offset)->data;
+  if (CGPFieldIsRepeated(field)) {
+    CGPRepeatedFieldData *data = REPEATED_FIELD_PTR(msg, offset)->data;
     if (data == NULL) {
       return;
     }
+    size_t elemSize = CGPGetTypeSize(CGPFieldGetJavaType(field));
+    const uint8_t *buffer = (const uint8_t *)data->buffer;
+    for (uint32_t i = 0; i < data->size && !out->failed; i++) {
+      TextAppendFieldName(out, field, indent);
+      ValueToString(buffer + i * elemSize, field, out, indent);
+    }
   } else {
     if (!GetHas(msg, GetHasLocator(msgCls, field))) {
       return;
     }
+    TextAppendFieldName(out, field, indent);
+    if (CGPFieldTypeIsMessage(field)) {
+      TextAppendMessageBlock(out, GetMessageField(msg, offset), field, indent);
+    } else {
+      ValueToString((uint8_t *)msg + offset, field, out, indent);
+    }
+  }
+}
+
+static void MessageToString(id msg, CGPDescriptor *descriptor, TextOutput *out, int indent) {
+  NSUInteger fieldsCount = descriptor->fields_->size_;
+  CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
+  for (NSUInteger i = 0; i < fieldsCount && !out->failed; i++) {
+    CGPFieldDescriptor *field = fieldsBuf[i];
+    if (CGPFieldIsMap(field)) {
+      MapFieldToString(msg, field, out, indent);
+    } else {
+      FieldToString(msg, field, out, indent);
+    }
+  }
+  CGPExtensionMap *extensionMap = MessageExtensionMap(msg, descriptor);
+  if (extensionMap != NULL) {
+    for (CGPExtensionMap::iterator it = extensionMap->begin();
+         it != extensionMap->end() && !out->failed; it++) {
+      CGPFieldDescriptor *field = it->first;
+      if (CGPFieldIsRepeated(field)) {
+        id<JavaUtilList> list = it->second.get();
+        for (id elem in list) {
+          if (out->failed) break;
+          ExtensionFieldToString(elem, field, out, indent);
+        }
+      } else {
+        ExtensionFieldToString(it->second.get(), field, out, indent);
+      }
+    }
+  }
+}
+
+// Prints a message into a streaming output, writing what remains in the buffer
+// at the end.
+static void TextPrintToSink(id<ComGoogleProtobufMessageOrBuilder> message, TextOutput *out) {
+  MessageToString(message, [message getDescriptorForType], out, 0);
+  if (out->size > 0 && !out->failed) {
+    out->flush(out);
+    out->size = 0;
+  }
+}
+
+static void FlushToOutputStream(TextOutput *out) {
+  [out->stream writeWithByteArray:out->streamBuffer withInt:0 withInt:(jint)out->size];
+}
+
+void CGPTextFormatPrintToStream(
+    id<ComGoogleProtobufMessageOrBuilder> message, JavaIoOutputStream *output) {
+  TextOutput out = {};
+  out.streamBuffer = [IOSByteArray newArrayWithLength:TEXT_STREAM_BUFFER_SIZE];
+  out.buffer = (char *)out.streamBuffer->buffer_;
+  out.capacity = TEXT_STREAM_BUFFER_SIZE;
+  out.flush = FlushToOutputStream;
+  out.stream = output;
+  @try {
+    TextPrintToSink(message, &out);
+  } @finally {
+    [out.streamBuffer release];
+  }
+}
+
+static void FlushToFileDescriptor(TextOutput *out) {
+  const char *p = out->buffer;
+  size_t remaining = out->size;
+  while (remaining > 0 && !out->failed) {
+    ssize_t written = write(out->fd, p, remaining);
+    if (written >= 0) {
+      p += written;
+      remaining -= written;
+    } else if (errno != EINTR) {
+      // The printers stop at the next field, and the buffered text is dropped.
+      // Returning from them may still change errno, so it is restored later.
+      out->failed = YES;
+      out->error = errno;
+    }
+  }
+}
+
+BOOL CGPTextFormatPrintToFileDescriptor(id<ComGoogleProtobufMessageOrBuilder> message, int fd) {
+  char buffer[TEXT_STREAM_BUFFER_SIZE];
+  TextOutput out = {};
+  out.buffer = buffer;
+  out.capacity = sizeof(buffer);
+  out.flush = FlushToFileDescriptor;
+  out.fd = fd;
+  TextPrintToSink(message, &out);
+  if (out.failed) {
+    errno = out.error;
+    return NO;
+  }
+  return YES;
+}
+
+NSString *CGPTextFormatPrint(id<ComGoogleProtobufMessageOrBuilder> message) {
+  TextOutput out = {};
+  @try {
+    MessageToString(message, [message getDescriptorForType], &out, 0);
+  } @catch (id e) {
+    // A lazily parsed field may turn out to be malformed.
+    free(out.buffer);
+    @throw;
+  }
+  if (out.size == 0) {
+    free(out.buffer);
+    return @"";
+  }
+  return [[[NSString alloc] initWithBytesNoCopy:out.buffer
+                                         length:out.size
+                                       encoding:NSUTF8StringEncoding
+                                   freeWhenDone:YES] autorelease];
+}
+
+
+// *****************************************************************************
+// ********** JSON *************************************************************
+// *****************************************************************************
+
+// Nesting deeper than this is rejected by the parser.
+#define JSON_MAX_DEPTH 100
+
+// Writes the shortest of the "%g" representations with FLT_DIG or DBL_DIG
+// digits, and with enough digits to always round trip, that parses back to the
+// same value.
+static void JsonAppendFloatingPoint(TextOutput *out, double value, BOOL isFloat) {
+  if (isnan(value)) {
+    TextAppend(out, "\"NaN\"", 5);
+    return;
+  }
+  if (isinf(value)) {
+    if (value > 0) {
+      TextAppend(out, "\"Infinity\"", 10);
+    } else {
+      TextAppend(out, "\"-Infinity\"", 11);
+    }
+    return;
+  }
+  // Integral values are common and don't need snprintf().
+  if (fabs(value) < 1e15 && value == (double)(int64_t)value && (value != 0 || !signbit(value))) {
+    TextAppendInt64(out, (int64_t)value);
+    return;
+  }
+  char buffer[32];
+  int length;
+  if (isFloat) {
+    length = snprintf(buffer, sizeof(buffer), "%.*g", FLT_DIG, value);
+    if (strtof(buffer, NULL) != (float)value) {
+      length = snprintf(buffer, sizeof(buffer), "%.*g", FLT_DIG + 3, value);
+    }
+  } else {
+    length = snprintf(buffer, sizeof(buffer), "%.*g", DBL_DIG, value);
+    if (strtod(buffer, NULL) != value) {
+      length = snprintf(buffer, sizeof(buffer), "%.*g", DBL_DIG + 2, value);
+    }
+  }
+  TextAppend(out, buffer, length);
+}
+
+static const char kJsonHexDigits[] = "0123456789abcdef";
+
+// For each byte, the character that follows the backslash when it is escaped
+// in a JSON string, or 0 if it is written as is.
+static const char kJsonEscapes[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+// Writes UTF-8 bytes as a quoted JSON string. Runs of bytes that need no
+// escaping are copied at once.
+static void JsonAppendQuoted(TextOutput *out, const char *bytes, size_t length) {
+  TextAppendChar(out, '"');
+  size_t runStart = 0;
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = (uint8_t)bytes[i];
+    char escape = kJsonEscapes[c];
+    if (__builtin_expect(escape == 0, 1)) {
+      continue;
+    }
+    TextAppend(out, bytes + runStart, i - runStart);
+    runStart = i + 1;
+    char *p = TextReserve(out, 6);
+    *p++ = '\\';
+    *p++ = escape;
+    if (escape == 'u') {
+      *p++ = '0';
+      *p++ = '0';
+      *p++ = kJsonHexDigits[c >> 4];
+      *p++ = kJsonHexDigits[c & 0xf];
+    }
+    out->size = p - out->buffer;
+  }
+  TextAppend(out, bytes + runStart, length - runStart);
+  TextAppendChar(out, '"');
+}
+
+static void JsonAppendString(TextOutput *out, NSString *value) {
+  NSUInteger length = [value length];
+  // Each UTF-16 unit takes at most 3 bytes in UTF-8.
+  NSUInteger maxLength = length * 3;
+  char stackBuffer[256];
+  char *buffer = maxLength <= sizeof(stackBuffer) ? stackBuffer : (char *)malloc(maxLength);
+  NSUInteger usedLength = 0;
+  [value getBytes:buffer
+        maxLength:maxLength
+       usedLength:&usedLength
+         encoding:NSUTF8StringEncoding
+          options:NSStringEncodingConversionAllowLossy
+            range:NSMakeRange(0, length)
+   remainingRange:NULL];
+  JsonAppendQuoted(out, buffer, usedLength);
+  if (buffer != stackBuffer) {
+    free(buffer);
+  }
+}
+
+static const char kJsonBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void JsonAppendBase64(TextOutput *out, CGPByteString *value) {
+  const uint8_t *src = (const uint8_t *)value->bytes_;
+  size_t length = value->size_;
+  char *p = TextReserve(out, (length + 2) / 3 * 4 + 2);
+  *p++ = '"';
+  size_t i = 0;
+  for (; i + 3 <= length; i += 3) {
+    uint32_t bits = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+    *p++ = kJsonBase64Chars[bits >> 18];
+    *p++ = kJsonBase64Chars[(bits >> 12) & 0x3f];
+    *p++ = kJsonBase64Chars[(bits >> 6) & 0x3f];
+    *p++ = kJsonBase64Chars[bits & 0x3f];
+  }
+  if (i < length) {
+    uint32_t bits = src[i] << 16;
+    if (i + 1 < length) {
+      bits |= src[i + 1] << 8;
+    }
+    *p++ = kJsonBase64Chars[bits >> 18];
+    *p++ = kJsonBase64Chars[(bits >> 12) & 0x3f];
+    *p++ = i + 1 < length ? kJsonBase64Chars[(bits >> 6) & 0x3f] : '=';
+    *p++ = '=';
   }
-  const char *fieldName = field->data_->name;
+  *p++ = '"';
+  out->size = p - out->buffer;
+}
 
+static void JsonAppendMessage(TextOutput *out, id msg, CGPDescriptor *descriptor);
+
+// Writes the value stored at ptr, which is either in a message's field storage,
+// in a repeated field's buffer or in a map entry.
+static void JsonAppendValue(TextOutput *out, CGPFieldDescriptor *field, const void *ptr) {
   switch (CGPFieldGetType(field)) {
-#define FIELD_TO_STRING_CASE(TYPE, FORMAT, VALUE) \
-      if (repeated) { \
-        TYPE *buffer = (TYPE *)data->buffer; \
-        for (uint32_t i = 0; i < data->size; i++) { \
-          TYPE value = buffer[i]; \
-          [builder appendFormat:@"%s%s: " FORMAT "\n", padding, fieldName, VALUE]; \
-        } \
-      } else { \
-        TYPE value = *FIELD_PTR(TYPE, msg, offset); \
-        [builder appendFormat:@"%s%s: " FORMAT "\n", padding, fieldName, VALUE]; \
-      } \
-      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT32:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT32:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED32:
-      FIELD_TO_STRING_CASE(int32_t, "%d", value)
+      TextAppendInt64(out, *(const int32_t *)ptr);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT32:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED32:
-      FIELD_TO_STRING_CASE(uint32_t, "%u", value)
+      TextAppendUint64(out, *(const uint32_t *)ptr);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT64:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT64:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED64:
-      FIELD_TO_STRING_CASE(int64_t, "%qd", value)
+      TextAppendChar(out, '"');
+      TextAppendInt64(out, *(const int64_t *)ptr);
+      TextAppendChar(out, '"');
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT64:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED64:
-      FIELD_TO_STRING_CASE(uint64_t, "%qu", value)
+      TextAppendChar(out, '"');
+      TextAppendUint64(out, *(const uint64_t *)ptr);
+      TextAppendChar(out, '"');
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BOOL:
-      FIELD_TO_STRING_CASE(BOOL, "%s", value ? "true" : "false")
+      if (*(const jboolean *)ptr) {
+        TextAppend(out, "true", 4);
+      } else {
+        TextAppend(out, "false", 5);
+      }
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FLOAT:
-      FIELD_TO_STRING_CASE(float, "%g", value)
+      JsonAppendFloatingPoint(out, *(const float *)ptr, YES);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_DOUBLE:
-      FIELD_TO_STRING_CASE(double, "%g", value)
+      JsonAppendFloatingPoint(out, *(const double *)ptr, NO);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_ENUM:
-      FIELD_TO_STRING_CASE(id, "%@", value)
+      JsonAppendString(out, [*(JavaLangEnum * const *)ptr name]);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BYTES:
-      FIELD_TO_STRING_CASE(id, "%@", BytesToString(value))
+      JsonAppendBase64(out, *(CGPByteString * const *)ptr);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_STRING:
-      FIELD_TO_STRING_CASE(id, "\"%@\"", value)
+      JsonAppendString(out, *(NSString * const *)ptr);
+      return;
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_GROUP:
     case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE:
-      if (repeated) {
-        id *buffer = (id *)data->buffer;
-        for (uint32_t i = 0; i < data->size; i++) {
-          [builder appendFormat:@"%s%s: {\n", padding, fieldName];
-          MessageToString(buffer[i], field->valueType_, builder, indent + 1);
-          [builder appendFormat:@"%s}\n", padding];
-        }
-      } else {
-        [builder appendFormat:@"%s%s: {\n", padding, fieldName];
-        MessageToString(*FIELD_PTR(id, msg, offset), field->valueType_, builder, indent + 1);
-        [builder appendFormat:@"%s}\n", padding];
-      }
+      JsonAppendMessage(out, *(const id *)ptr, field->valueType_);
+      return;
+  }
+}
+
+// Map keys are always JSON strings.
+static void JsonAppendMapKey(TextOutput *out, CGPFieldDescriptor *keyField, const void *ptr) {
+  switch (CGPFieldGetType(keyField)) {
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_STRING:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED64:
+      JsonAppendValue(out, keyField, ptr);
+      return;
+    default:
+      TextAppendChar(out, '"');
+      JsonAppendValue(out, keyField, ptr);
+      TextAppendChar(out, '"');
       return;
   }
 }
 
-static void MessageToString(
-    id msg, CGPDescriptor *descriptor, NSMutableString *builder, int indent) {
-  int paddingSize = indent * 2;
-  std::string padding(paddingSize, ' ');
+static inline void JsonAppendFieldName(TextOutput *out, CGPFieldDescriptor *field, BOOL *first) {
+  const char *name = field->jsonName_;
+  size_t length = strlen(name);
+  char *p = TextReserve(out, length + 4);
+  if (*first) {
+    *first = NO;
+  } else {
+    *p++ = ',';
+  }
+  *p++ = '"';
+  memcpy(p, name, length);
+  p += length;
+  *p++ = '"';
+  *p++ = ':';
+  out->size = p - out->buffer;
+}
 
+static void JsonAppendMessage(TextOutput *out, id msg, CGPDescriptor *descriptor) {
+  TextAppendChar(out, '{');
+  BOOL first = YES;
+  Class msgCls = object_getClass(msg);
   NSUInteger fieldsCount = descriptor->fields_->size_;
   CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
   for (NSUInteger i = 0; i < fieldsCount; i++) {
     CGPFieldDescriptor *field = fieldsBuf[i];
+    size_t offset = CGPFieldGetOffset(field, msgCls);
     if (CGPFieldIsMap(field)) {
-      MapFieldToString(msg, field, builder, padding.c_str(), indent);
-    } else {
-      FieldToString(msg, field, builder, padding.c_str(), indent);
-    }
-  }
-  CGPExtensionMap *extensionMap = MessageExtensionMap(msg, descriptor);
-  if (extensionMap != NULL) {
-    for (CGPExtensionMap::iterator it = extensionMap->begin(); it != extensionMap->end(); it++) {
-      CGPFieldDescriptor *field = it->first;
-      if (CGPFieldIsRepeated(field)) {
-        id<JavaUtilList> list = it->second.get();
-        for (id elem in list) {
-          ExtensionFieldToString(elem, field, builder, padding.c_str(), indent);
+      CGPMapFieldData *data = MAP_FIELD_PTR(msg, offset)->data;
+      if (data == NULL) continue;
+      CGPFieldDescriptor *keyField = CGPFieldMapKey(field);
+      CGPFieldDescriptor *valueField = CGPFieldMapValue(field);
+      CGPMapFieldEnsureValidMap(
+          data, CGPFieldGetJavaType(keyField), CGPFieldGetJavaType(valueField));
+      if (data->numEntries == 0) continue;
+      JsonAppendFieldName(out, field, &first);
+      TextAppendChar(out, '{');
+      for (uint32_t j = 0; j < data->numEntries; j++) {
+        CGPMapFieldEntry *entry = &data->entries[j];
+        if (j > 0) {
+          TextAppendChar(out, ',');
+        }
+        JsonAppendMapKey(out, keyField, &entry->key);
+        TextAppendChar(out, ':');
+        JsonAppendValue(out, valueField, &entry->value);
+      }
+      TextAppendChar(out, '}');
+    } else if (CGPFieldIsRepeated(field)) {
+      CGPRepeatedFieldData *data = REPEATED_FIELD_PTR(msg, offset)->data;
+      if (data == NULL || data->size == 0) continue;
+      size_t elemSize = CGPGetTypeSize(CGPFieldGetJavaType(field));
+      const uint8_t *buffer = (const uint8_t *)data->buffer;
+      JsonAppendFieldName(out, field, &first);
+      TextAppendChar(out, '[');
+      for (uint32_t j = 0; j < data->size; j++) {
+        if (j > 0) {
+          TextAppendChar(out, ',');
         }
+        JsonAppendValue(out, field, buffer + j * elemSize);
+      }
+      TextAppendChar(out, ']');
+    } else {
+      if (!GetHas(msg, GetHasLocator(msgCls, field))) continue;
+      JsonAppendFieldName(out, field, &first);
+      if (CGPFieldTypeIsMessage(field)) {
+        JsonAppendMessage(out, GetMessageField(msg, offset), field->valueType_);
       } else {
-        ExtensionFieldToString(it->second.get(), field, builder, padding.c_str(), indent);
+        JsonAppendValue(out, field, (uint8_t *)msg + offset);
       }
     }
   }
+  TextAppendChar(out, '}');
 }
 
+// Returns the JSON representation of a message in a malloc'ed buffer.
+static TextOutput JsonPrint(id<ComGoogleProtobufMessageOrBuilder> message) {
+  TextOutput out = {};
+  @try {
+    JsonAppendMessage(&out, message, [message getDescriptorForType]);
+  } @catch (id e) {
+    // A lazily parsed field may turn out to be malformed.
+    free(out.buffer);
+    @throw;
+  }
+  return out;
+}
 
-// *****************************************************************************
-// ********** isEqual and hash *************************************************
-// *****************************************************************************
-
-#define FieldIsEqualInt(a, b) a == b
-#define FieldIsEqualLong(a, b) a == b
-#define FieldIsEqualFloat(a, b) a == b
-#define FieldIsEqualDouble(a, b) a == b
-#define FieldIsEqualBool(a, b) a == b
-#define FieldIsEqualEnum(a, b) a == b
-#define FieldIsEqualRetainable(a, b) a == b || [a isEqual:b]
-
-static BOOL FieldIsEqual(id self, id other, size_t offset, CGPFieldJavaType type) {
-#define IS_FIELD_EQUAL_CASE(NAME) \
-  return FieldIsEqual##NAME( \
-      *FIELD_PTR(TYPE_##NAME, self, offset), *FIELD_PTR(TYPE_##NAME, other, offset));
+NSString *CGPJsonFormatPrint(id<ComGoogleProtobufMessageOrBuilder> message) {
+  TextOutput out = JsonPrint(message);
+  return [[[NSString alloc] initWithBytesNoCopy:out.buffer
+                                         length:out.size
+                                       encoding:NSUTF8StringEncoding
+                                   freeWhenDone:YES] autorelease];
+}
 
-  SWITCH_TYPES_WITH_ENUM(type, IS_FIELD_EQUAL_CASE)
+NSData *CGPJsonFormatPrintToData(id<ComGoogleProtobufMessageOrBuilder> message) {
+  TextOutput out = JsonPrint(message);
+  return [NSData dataWithBytesNoCopy:out.buffer length:out.size freeWhenDone:YES];
+}
 
-#undef IS_FIELD_EQUAL_CASE
+// The input of the JSON parser. Parse functions return NO if the input is
+// malformed or doesn't match the message type.
+typedef struct JsonInput {
+  const char *ptr;
+  const char *end;
+  CGPJsonParseOptions options;
+  int depth;
+} JsonInput;
 
-  __builtin_unreachable();
+static inline void JsonSkipWhitespace(JsonInput *in) {
+  while (in->ptr < in->end) {
+    char c = *in->ptr;
+    if (c != ' ' && c != '\n' && c != '\r' && c != '\t') break;
+    in->ptr++;
+  }
 }
 
-static BOOL MessageIsEqual(id msg, id other, CGPDescriptor *descriptor) {
-  if (msg == other) {
+// Consumes the next character if it is c.
+static inline BOOL JsonConsume(JsonInput *in, char c) {
+  JsonSkipWhitespace(in);
+  if (in->ptr < in->end && *in->ptr == c) {
+    in->ptr++;
     return YES;
   }
-  Class msgCls = object_getClass(msg);
+  return NO;
+}
+
+static inline BOOL JsonConsumeLiteral(JsonInput *in, const char *literal, size_t length) {
+  JsonSkipWhitespace(in);
+  if ((size_t)(in->end - in->ptr) >= length && memcmp(in->ptr, literal, length) == 0) {
+    in->ptr += length;
+    return YES;
+  }
+  return NO;
+}
+
+static inline BOOL JsonPeek(JsonInput *in, char c) {
+  JsonSkipWhitespace(in);
+  return in->ptr < in->end && *in->ptr == c;
+}
+
+static int JsonHexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static BOOL JsonReadHex4(const char **ptr, const char *end, uint32_t *value) {
+  if (end - *ptr < 4) return NO;
+  uint32_t result = 0;
+  for (int i = 0; i < 4; i++) {
+    int digit = JsonHexValue((*ptr)[i]);
+    if (digit < 0) return NO;
+    result = (result << 4) | digit;
+  }
+  *ptr += 4;
+  *value = result;
+  return YES;
+}
+
+static void JsonAppendUtf8(std::string *s, uint32_t cp) {
+  if (cp < 0x80) {
+    s->push_back((char)cp);
+  } else if (cp < 0x800) {
+    s->push_back((char)(0xc0 | (cp >> 6)));
+    s->push_back((char)(0x80 | (cp & 0x3f)));
+  } else if (cp < 0x10000) {
+    s->push_back((char)(0xe0 | (cp >> 12)));
+    s->push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+    s->push_back((char)(0x80 | (cp & 0x3f)));
+  } else {
+    s->push_back((char)(0xf0 | (cp >> 18)));
+    s->push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+    s->push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+    s->push_back((char)(0x80 | (cp & 0x3f)));
+  }
+}
+
+// Reads a string. The result points into the input, unless the string has
+// escapes and is decoded into scratch.
+static BOOL JsonParseString(
+    JsonInput *in, const char **result, size_t *length, std::string *scratch) {
+  if (!JsonConsume(in, '"')) return NO;
+  const char *start = in->ptr;
+  const char *end = in->end;
+  const char *p = start;
+  const char *runStart = start;
+  BOOL escaped = NO;
+  while (YES) {
+    if (p == end) return NO;
+    uint8_t c = (uint8_t)*p;
+    if (c == '"') break;
+    if (c < 0x20) return NO;
+    if (c != '\\') {
+      p++;
+      continue;
+    }
+    if (!escaped) {
+      scratch->clear();
+      escaped = YES;
+    }
+    scratch->append(runStart, p - runStart);
+    if (++p == end) return NO;
+    switch (*p++) {
+      case '"': scratch->push_back('"'); break;
+      case '\\': scratch->push_back('\\'); break;
+      case '/': scratch->push_back('/'); break;
+      case 'b': scratch->push_back('\b'); break;
+      case 'f': scratch->push_back('\f'); break;
+      case 'n': scratch->push_back('\n'); break;
+      case 'r': scratch->push_back('\r'); break;
+      case 't': scratch->push_back('\t'); break;
+      case 'u': {
+        uint32_t cp;
+        if (!JsonReadHex4(&p, end, &cp)) return NO;
+        if (cp >= 0xd800 && cp < 0xdc00) {
+          uint32_t low;
+          if (end - p < 2 || p[0] != '\\' || p[1] != 'u') return NO;
+          p += 2;
+          if (!JsonReadHex4(&p, end, &low) || low < 0xdc00 || low >= 0xe000) return NO;
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        } else if (cp >= 0xdc00 && cp < 0xe000) {
+          return NO;
+        }
+        JsonAppendUtf8(scratch, cp);
+        break;
+      }
+      default:
+        return NO;
+    }
+    runStart = p;
+  }
+  if (escaped) {
+    scratch->append(runStart, p - runStart);
+    *result = scratch->data();
+    *length = scratch->size();
+  } else {
+    *result = start;
+    *length = p - start;
+  }
+  in->ptr = p + 1;
+  return YES;
+}
+
+// Reads the characters of a number, without validating them.
+static BOOL JsonParseNumberText(JsonInput *in, const char **result, size_t *length) {
+  JsonSkipWhitespace(in);
+  const char *start = in->ptr;
+  const char *p = start;
+  while (p < in->end) {
+    char c = *p;
+    if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+      break;
+    }
+    p++;
+  }
+  if (p == start) return NO;
+  in->ptr = p;
+  *result = start;
+  *length = p - start;
+  return YES;
+}
+
+// Converts the text of a number with strtod(), which needs a terminated copy.
+static BOOL JsonTextToDouble(const char *text, size_t length, double *value) {
+  if (length == 0 || length > 1024) return NO;
+  for (size_t i = 0; i < length; i++) {
+    char c = text[i];
+    // Exclude the hexadecimal, infinite and NaN forms that strtod() accepts.
+    if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) {
+      return NO;
+    }
+  }
+  char stackBuffer[64];
+  char *buffer = length < sizeof(stackBuffer) ? stackBuffer : (char *)malloc(length + 1);
+  memcpy(buffer, text, length);
+  buffer[length] = '\0';
+  char *end;
+  *value = strtod(buffer, &end);
+  BOOL success = end == buffer + length;
+  if (buffer != stackBuffer) {
+    free(buffer);
+  }
+  return success;
+}
+
+// Converts the text of an integer into its sign and magnitude. Fractions and
+// exponents are accepted as long as the value is integral. They are applied to
+// the decimal digits, since going through a double would round values above
+// 2^53.
+static BOOL JsonTextToInteger(
+    const char *text, size_t length, BOOL *negative, uint64_t *magnitude) {
+  const char *p = text;
+  const char *end = text + length;
+  *negative = p < end && *p == '-';
+  if (*negative) {
+    p++;
+  }
+  const char *intDigits = p;
+  while (p < end && *p >= '0' && *p <= '9') p++;
+  size_t intCount = p - intDigits;
+  const char *fracDigits = p;
+  size_t fracCount = 0;
+  if (p < end && *p == '.') {
+    fracDigits = ++p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    fracCount = p - fracDigits;
+  }
+  if (intCount + fracCount == 0) return NO;
+  int64_t exponent = 0;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    BOOL negativeExponent = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    const char *expDigits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+      // Larger exponents make any nonzero value overflow, or have a fraction.
+      if (exponent < 1000000) {
+        exponent = exponent * 10 + (*p - '0');
+      }
+      p++;
+    }
+    if (p == expDigits) return NO;
+    if (negativeExponent) {
+      exponent = -exponent;
+    }
+  }
+  if (p != end) return NO;
+  // The digits after the first pointIndex ones are the fraction, which must be
+  // zero. A pointIndex past the digits appends zeros.
+  int64_t digitCount = intCount + fracCount;
+  int64_t pointIndex = (int64_t)intCount + exponent;
+  uint64_t value = 0;
+  for (int64_t i = 0; i < digitCount; i++) {
+    uint64_t digit = (i < (int64_t)intCount ? intDigits[i] : fracDigits[i - intCount]) - '0';
+    if (i >= pointIndex) {
+      if (digit != 0) return NO;
+    } else {
+      if (value > (UINT64_MAX - digit) / 10) return NO;
+      value = value * 10 + digit;
+    }
+  }
+  for (int64_t i = digitCount; i < pointIndex && value != 0; i++) {
+    if (value > UINT64_MAX / 10) return NO;
+    value *= 10;
+  }
+  *magnitude = value;
+  return YES;
+}
+
+// Reads an integer, which may also be written as a string.
+static BOOL JsonParseInteger(JsonInput *in, BOOL *negative, uint64_t *magnitude) {
+  const char *text;
+  size_t length;
+  if (JsonPeek(in, '"')) {
+    std::string scratch;
+    if (!JsonParseString(in, &text, &length, &scratch)) return NO;
+    return JsonTextToInteger(text, length, negative, magnitude);
+  }
+  return JsonParseNumberText(in, &text, &length)
+      && JsonTextToInteger(text, length, negative, magnitude);
+}
+
+// Checks the range of an integer for the field type and stores it in value.
+static BOOL JsonIntegerToValue(
+    CGPFieldType type, BOOL negative, uint64_t magnitude, CGPValue *value) {
+  switch (type) {
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_ENUM:
+      if (magnitude > (negative ? (uint64_t)INT32_MAX + 1 : (uint64_t)INT32_MAX)) return NO;
+      value->valueInt = (jint)(negative ? 0 - magnitude : magnitude);
+      return YES;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED32:
+      if ((negative && magnitude != 0) || magnitude > UINT32_MAX) return NO;
+      value->valueInt = (jint)(uint32_t)magnitude;
+      return YES;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED64:
+      if (magnitude > (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX)) return NO;
+      value->valueLong = (jlong)(negative ? 0 - magnitude : magnitude);
+      return YES;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED64:
+      if (negative && magnitude != 0) return NO;
+      value->valueLong = (jlong)magnitude;
+      return YES;
+    default:
+      return NO;
+  }
+}
+
+// Reads a number, which may also be written as a string, including the
+// strings "NaN", "Infinity" and "-Infinity".
+static BOOL JsonParseFloatingPoint(JsonInput *in, double *value) {
+  const char *text;
+  size_t length;
+  if (JsonPeek(in, '"')) {
+    std::string scratch;
+    if (!JsonParseString(in, &text, &length, &scratch)) return NO;
+    if (length == 3 && memcmp(text, "NaN", 3) == 0) {
+      *value = NAN;
+      return YES;
+    }
+    if (length == 8 && memcmp(text, "Infinity", 8) == 0) {
+      *value = INFINITY;
+      return YES;
+    }
+    if (length == 9 && memcmp(text, "-Infinity", 9) == 0) {
+      *value = -INFINITY;
+      return YES;
+    }
+    return JsonTextToDouble(text, length, value);
+  }
+  return JsonParseNumberText(in, &text, &length) && JsonTextToDouble(text, length, value);
+}
+
+static int JsonBase64Value(uint8_t c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+' || c == '-') return 62;
+  if (c == '/' || c == '_') return 63;
+  return -1;
+}
+
+// Returns a retained byte string decoded from standard or URL-safe base64,
+// with or without padding, or nil if the text is not valid base64.
+static CGPByteString *JsonNewByteStringFromBase64(const char *text, size_t length) {
+  if (length % 4 == 0 && length > 0 && text[length - 1] == '=') {
+    length -= text[length - 2] == '=' ? 2 : 1;
+  }
+  if (length % 4 == 1) return nil;
+  size_t size = length / 4 * 3 + (length % 4 != 0 ? length % 4 - 1 : 0);
+  CGPByteString *result = CGPNewByteString((jint)size);
+  uint8_t *dst = (uint8_t *)result->bytes_;
+  uint32_t bits = 0;
+  for (size_t i = 0; i < length; i++) {
+    int digit = JsonBase64Value((uint8_t)text[i]);
+    if (digit < 0) {
+      [result release];
+      return nil;
+    }
+    bits = (bits << 6) | digit;
+    if (i % 4 == 3) {
+      *dst++ = (uint8_t)(bits >> 16);
+      *dst++ = (uint8_t)(bits >> 8);
+      *dst++ = (uint8_t)bits;
+      bits = 0;
+    }
+  }
+  if (length % 4 == 2) {
+    *dst++ = (uint8_t)(bits >> 4);
+  } else if (length % 4 == 3) {
+    *dst++ = (uint8_t)(bits >> 10);
+    *dst++ = (uint8_t)(bits >> 2);
+  }
+  return result;
+}
+
+// Reads an enum by name or by number. Unknown values result in nil, which is an
+// error unless unknown fields are ignored.
+static BOOL JsonParseEnum(JsonInput *in, CGPEnumDescriptor *enumType, id *value) {
+  *value = nil;
+  if (JsonPeek(in, '"')) {
+    const char *text;
+    size_t length;
+    std::string scratch;
+    if (!JsonParseString(in, &text, &length, &scratch)) return NO;
+    NSString *name = [[NSString alloc] initWithBytes:text
+                                              length:length
+                                            encoding:NSUTF8StringEncoding];
+    NSUInteger count = enumType->values_->size_;
+    CGPEnumValueDescriptor **valuesBuf = enumType->values_->buffer_;
+    for (NSUInteger i = 0; i < count; i++) {
+      JavaLangEnum *enumValue = valuesBuf[i]->enum_;
+      if ([[enumValue name] isEqualToString:name]) {
+        *value = enumValue;
+        break;
+      }
+    }
+    [name release];
+  } else {
+    BOOL negative;
+    uint64_t magnitude;
+    CGPValue number;
+    if (!JsonParseInteger(in, &negative, &magnitude)
+        || !JsonIntegerToValue(
+            ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_ENUM, negative, magnitude,
+            &number)) {
+      return NO;
+    }
+    CGPEnumValueDescriptor *valueDescriptor =
+        CGPEnumValueDescriptorFromInt(enumType, number.valueInt);
+    *value = valueDescriptor != nil ? valueDescriptor->enum_ : nil;
+  }
+  return *value != nil || (in->options & CGPJsonParseIgnoreUnknownFields);
+}
+
+static BOOL JsonMergeMessage(JsonInput *in, id msg, CGPDescriptor *descriptor);
+
+// Reads a value of the field's type. Like ReadMapEntryField(), retainable
+// values are returned retained.
+static BOOL JsonParseValue(JsonInput *in, CGPFieldDescriptor *field, CGPValue *value) {
+  CGPFieldType type = CGPFieldGetType(field);
+  switch (type) {
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED32:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_INT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SINT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_SFIXED64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_UINT64:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FIXED64: {
+      BOOL negative;
+      uint64_t magnitude;
+      return JsonParseInteger(in, &negative, &magnitude)
+          && JsonIntegerToValue(type, negative, magnitude, value);
+    }
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BOOL:
+      if (JsonConsumeLiteral(in, "true", 4)) {
+        value->valueBool = true;
+        return YES;
+      }
+      value->valueBool = false;
+      return JsonConsumeLiteral(in, "false", 5);
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_FLOAT: {
+      double d;
+      if (!JsonParseFloatingPoint(in, &d) || (isfinite(d) && fabs(d) > FLT_MAX)) return NO;
+      value->valueFloat = (float)d;
+      return YES;
+    }
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_DOUBLE:
+      return JsonParseFloatingPoint(in, &value->valueDouble);
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_ENUM:
+      return JsonParseEnum(in, field->valueType_, &value->valueId);
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BYTES: {
+      const char *text;
+      size_t length;
+      std::string scratch;
+      if (!JsonParseString(in, &text, &length, &scratch)) return NO;
+      value->valueId = JsonNewByteStringFromBase64(text, length);
+      return value->valueId != nil;
+    }
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_STRING: {
+      const char *text;
+      size_t length;
+      std::string scratch;
+      if (!JsonParseString(in, &text, &length, &scratch)) return NO;
+      value->valueId = (NSString *)CFStringCreateWithBytes(
+          NULL, (const UInt8 *)text, length, kCFStringEncodingUTF8, false);
+      return value->valueId != nil;
+    }
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_GROUP:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_MESSAGE: {
+      CGPDescriptor *fieldType = field->valueType_;
+      ComGoogleProtobufGeneratedMessage *newMsg = CGPNewMessage(fieldType);
+      if (!JsonMergeMessage(in, newMsg, fieldType)) {
+        [newMsg release];
+        return NO;
+      }
+      value->valueId = newMsg;
+      return YES;
+    }
+  }
+  __builtin_unreachable();
+}
+
+// Map keys are JSON strings that hold the key's value.
+static BOOL JsonParseMapKey(JsonInput *in, CGPFieldDescriptor *keyField, CGPValue *key) {
+  const char *text;
+  size_t length;
+  std::string scratch;
+  if (!JsonParseString(in, &text, &length, &scratch)) return NO;
+  CGPFieldType type = CGPFieldGetType(keyField);
+  switch (type) {
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_STRING:
+      key->valueId = (NSString *)CFStringCreateWithBytes(
+          NULL, (const UInt8 *)text, length, kCFStringEncodingUTF8, false);
+      return key->valueId != nil;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_Type_Enum_BOOL:
+      if (length == 4 && memcmp(text, "true", 4) == 0) {
+        key->valueBool = true;
+        return YES;
+      }
+      key->valueBool = false;
+      return length == 5 && memcmp(text, "false", 5) == 0;
+    default: {
+      BOOL negative;
+      uint64_t magnitude;
+      return JsonTextToInteger(text, length, &negative, &magnitude)
+          && JsonIntegerToValue(type, negative, magnitude, key);
+    }
+  }
+}
+
+static void JsonReleaseValue(CGPFieldDescriptor *field, CGPValue value) {
+  if (CGPIsRetainedType(CGPFieldGetJavaType(field))) {
+    [value.valueId release];
+  }
+}
+
+// Skips a value of an unknown field.
+static BOOL JsonSkipValue(JsonInput *in) {
+  JsonSkipWhitespace(in);
+  if (in->ptr == in->end) return NO;
+  switch (*in->ptr) {
+    case '"': {
+      const char *text;
+      size_t length;
+      std::string scratch;
+      return JsonParseString(in, &text, &length, &scratch);
+    }
+    case '{':
+    case '[': {
+      char close = *in->ptr == '{' ? '}' : ']';
+      in->ptr++;
+      if (++in->depth > JSON_MAX_DEPTH) return NO;
+      if (!JsonConsume(in, close)) {
+        do {
+          if (close == '}') {
+            const char *text;
+            size_t length;
+            std::string scratch;
+            if (!JsonParseString(in, &text, &length, &scratch) || !JsonConsume(in, ':')) {
+              return NO;
+            }
+          }
+          if (!JsonSkipValue(in)) return NO;
+        } while (JsonConsume(in, ','));
+        if (!JsonConsume(in, close)) return NO;
+      }
+      in->depth--;
+      return YES;
+    }
+    case 't':
+      return JsonConsumeLiteral(in, "true", 4);
+    case 'f':
+      return JsonConsumeLiteral(in, "false", 5);
+    case 'n':
+      return JsonConsumeLiteral(in, "null", 4);
+    default: {
+      const char *text;
+      size_t length;
+      double value;
+      return JsonParseNumberText(in, &text, &length) && JsonTextToDouble(text, length, &value);
+    }
+  }
+}
+
+static inline BOOL JsonNameMatches(const char *name, const char *key, size_t length) {
+  return strncmp(name, key, length) == 0 && name[length] == '\0';
+}
+
+// Returns the field with the given JSON name or proto name, or nil. JSON
+// objects usually list fields in declaration order, so the search starts after
+// the field that was found last, at *hint.
+static CGPFieldDescriptor *JsonFindField(
+    CGPDescriptor *descriptor, const char *key, size_t length, NSUInteger *hint) {
+  NSUInteger fieldsCount = descriptor->fields_->size_;
+  CGPFieldDescriptor **fieldsBuf = descriptor->fields_->buffer_;
+  NSUInteger idx = *hint;
+  for (NSUInteger i = 0; i < fieldsCount; i++, idx++) {
+    if (idx == fieldsCount) {
+      idx = 0;
+    }
+    CGPFieldDescriptor *field = fieldsBuf[idx];
+    if (JsonNameMatches(field->jsonName_, key, length)
+        || JsonNameMatches(field->data_->name, key, length)) {
+      *hint = idx + 1;
+      return field;
+    }
+  }
+  return nil;
+}
+
+static void JsonAddRepeatedValue(CGPRepeatedField *repeatedField, CGPFieldJavaType type,
+                                 CGPValue value) {
+  switch (type) {
+#define JSON_ADD_CASE(NAME) \
+      CGPRepeatedFieldAdd##NAME(repeatedField, value.CGPValueField_##NAME); \
+      return;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_INT:
+      JSON_ADD_CASE(Int)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_LONG:
+      JSON_ADD_CASE(Long)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_FLOAT:
+      JSON_ADD_CASE(Float)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_DOUBLE:
+      JSON_ADD_CASE(Double)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_BOOLEAN:
+      JSON_ADD_CASE(Bool)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_ENUM:
+      JSON_ADD_CASE(Enum)
+#undef JSON_ADD_CASE
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_STRING:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_BYTE_STRING:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_MESSAGE:
+      CGPRepeatedFieldAddRetainedId(repeatedField, value.valueId);
+      return;
+  }
+}
+
+static BOOL JsonMergeMapField(JsonInput *in, CGPMapField *mapField, CGPFieldDescriptor *field) {
+  CGPFieldDescriptor *keyField = CGPFieldMapKey(field);
+  CGPFieldDescriptor *valueField = CGPFieldMapValue(field);
+  if (!JsonConsume(in, '{')) return NO;
+  if (JsonConsume(in, '}')) return YES;
+  do {
+    CGPValue key;
+    CGPValue value;
+    if (!JsonParseMapKey(in, keyField, &key)) return NO;
+    if (!JsonConsume(in, ':') || !JsonParseValue(in, valueField, &value)) {
+      JsonReleaseValue(keyField, key);
+      return NO;
+    }
+    if (CGPJavaTypeIsEnum(CGPFieldGetJavaType(valueField)) && value.valueId == nil) {
+      // An ignored unknown enum value.
+      JsonReleaseValue(keyField, key);
+      continue;
+    }
+    CGPMapFieldPut(
+        mapField, key, CGPFieldGetJavaType(keyField), value, CGPFieldGetJavaType(valueField),
+        /* retainedKeyAndValue */ true);
+  } while (JsonConsume(in, ','));
+  return JsonConsume(in, '}');
+}
+
+static BOOL JsonMergeField(JsonInput *in, id msg, CGPFieldDescriptor *field) {
+  // null stands for the default value, so the field is left as is.
+  if (JsonConsumeLiteral(in, "null", 4)) return YES;
+  Class msgCls = object_getClass(msg);
+  size_t offset = CGPFieldGetOffset(field, msgCls);
+  uintptr_t fieldPtr = (uintptr_t)msg + offset;
+  CGPFieldJavaType type = CGPFieldGetJavaType(field);
+  if (CGPFieldIsMap(field)) {
+    return JsonMergeMapField(in, (CGPMapField *)fieldPtr, field);
+  }
+  if (CGPFieldIsRepeated(field)) {
+    CGPRepeatedField *repeatedField = (CGPRepeatedField *)fieldPtr;
+    if (!JsonConsume(in, '[')) return NO;
+    if (JsonConsume(in, ']')) return YES;
+    do {
+      CGPValue value;
+      if (!JsonParseValue(in, field, &value)) return NO;
+      if (CGPJavaTypeIsEnum(type) && value.valueId == nil) continue;
+      JsonAddRepeatedValue(repeatedField, type, value);
+    } while (JsonConsume(in, ','));
+    return JsonConsume(in, ']');
+  }
+  CGPHasLocator hasLoc = GetHasLocator(msgCls, field);
+  if (CGPJavaTypeIsMessage(type)) {
+    ClearPreviousOneof(msg, hasLoc, fieldPtr);
+    // Like MergeFieldFromStream(), merges into a copy of an existing value.
+    CGPDescriptor *fieldType = field->valueType_;
+    ComGoogleProtobufGeneratedMessage *msgField = CGPNewMessage(fieldType);
+    if (GetHas(msg, hasLoc)) {
+      id existing = GetMessageField(msg, offset);
+      CopyMessage(msgField, MessageExtensionMap(msgField, fieldType),
+                  existing, MessageExtensionMap(existing, fieldType), fieldType);
+    }
+    id *ptr = (id *)fieldPtr;
+    [*ptr autorelease];
+    *ptr = msgField;
+    SetHas(msg, hasLoc);
+    return JsonMergeMessage(in, msgField, fieldType);
+  }
+  CGPValue value;
+  if (!JsonParseValue(in, field, &value)) return NO;
+  // An unknown enum value that is ignored leaves a set oneof as it is.
+  if (CGPJavaTypeIsEnum(type) && value.valueId == nil) return YES;
+  ClearPreviousOneof(msg, hasLoc, fieldPtr);
+  switch (type) {
+#define JSON_STORE_CASE(NAME) \
+      *(TYPE_##NAME *)fieldPtr = value.CGPValueField_##NAME; \
+      break;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_INT:
+      JSON_STORE_CASE(Int)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_LONG:
+      JSON_STORE_CASE(Long)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_FLOAT:
+      JSON_STORE_CASE(Float)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_DOUBLE:
+      JSON_STORE_CASE(Double)
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_BOOLEAN:
+      JSON_STORE_CASE(Bool)
+#undef JSON_STORE_CASE
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_ENUM:
+      *(id *)fieldPtr = value.valueId;
+      break;
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_STRING:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_BYTE_STRING:
+    case ComGoogleProtobufDescriptors_FieldDescriptor_JavaType_Enum_MESSAGE:
+      [*(id *)fieldPtr autorelease];
+      *(id *)fieldPtr = value.valueId;
+      break;
+  }
+  SetHas(msg, hasLoc);
+  return YES;
+}
+
+static BOOL JsonMergeMessage(JsonInput *in, id msg, CGPDescriptor *descriptor) {
+  if (++in->depth > JSON_MAX_DEPTH || !JsonConsume(in, '{')) return NO;
+  if (!JsonConsume(in, '}')) {
+    NSUInteger hint = 0;
+    std::string scratch;
+    do {
+      const char *key;
+      size_t length;
+      if (!JsonParseString(in, &key, &length, &scratch) || !JsonConsume(in, ':')) return NO;
+      CGPFieldDescriptor *field = JsonFindField(descriptor, key, length, &hint);
+      if (field != nil) {
+        if (!JsonMergeField(in, msg, field)) return NO;
+      } else if (!(in->options & CGPJsonParseIgnoreUnknownFields) || !JsonSkipValue(in)) {
+        return NO;
+      }
+    } while (JsonConsume(in, ','));
+    if (!JsonConsume(in, '}')) return NO;
+  }
+  in->depth--;
+  return YES;
+}
+
+static void JsonMerge(
+    id msg, CGPDescriptor *descriptor, NSData *json, CGPJsonParseOptions options) {
+  JsonInput in;
+  in.ptr = (const char *)[json bytes];
+  in.end = in.ptr + [json length];
+  in.options = options;
+  in.depth = 0;
+  if (!JsonMergeMessage(&in, msg, descriptor)) {
+    InvalidPB();
+  }
+  JsonSkipWhitespace(&in);
+  if (in.ptr != in.end) {
+    InvalidPB();
+  }
+}
+
+ComGoogleProtobufGeneratedMessage *CGPJsonFormatParse(
+    Class messageClass, NSData *json, CGPJsonParseOptions options) {
+  CGPDescriptor *descriptor = [messageClass getDescriptor];
+  ComGoogleProtobufGeneratedMessage *msg = [CGPNewMessage(descriptor) autorelease];
+  JsonMerge(msg, descriptor, json, options);
+  return msg;
+}
+
+void CGPJsonFormatMerge(
+    ComGoogleProtobufGeneratedMessage_Builder *builder, NSData *json,
+    CGPJsonParseOptions options) {
+  JsonMerge(builder, [builder getDescriptorForType], json, options);
+}
+
+
+// *****************************************************************************
+// ********** isEqual and hash *************************************************
+// *****************************************************************************
+
+#define FieldIsEqualInt(a, b) a == b
+#define FieldIsEqualLong(a, b) a == b
+#define FieldIsEqualFloat(a, b) a == b
+#define FieldIsEqualDouble(a, b) a == b
+#define FieldIsEqualBool(a, b) a == b
+#define FieldIsEqualEnum(a, b) a == b
+#define FieldIsEqualRetainable(a, b) a == b || [a isEqual:b]
+
+static BOOL FieldIsEqual(id self, id other, size_t offset, CGPFieldJavaType type) {
+  if (CGPJavaTypeIsMessage(type)) {
+    id value = GetMessageField(self, offset);
+    id otherValue = GetMessageField(other, offset);
+    return FieldIsEqualRetainable(value, otherValue);
+  }
+#define IS_FIELD_EQUAL_CASE(NAME) \
+  return FieldIsEqual##NAME( \
+      *FIELD_PTR(TYPE_##NAME, self, offset), *FIELD_PTR(TYPE_##NAME, other, offset));
+
+  SWITCH_TYPES_WITH_ENUM(type, IS_FIELD_EQUAL_CASE)
+
+#undef IS_FIELD_EQUAL_CASE
+
+  __builtin_unreachable();
+}
+
+// The has bits and the POD range are compared with memcmp(), which relies on
+// unset fields in the POD range holding zero. Clearing a field restores that.
+static BOOL MessageIsEqual(id msg, id other, CGPDescriptor *descriptor) {
+  if (msg == other) {
+    return YES;
+  }
+  Class msgCls = object_getClass(msg);
   if (msgCls != object_getClass(other)) {
     return NO;
   }
-  NSUInteger count = descriptor->fields_->size_;
-  CGPFieldDescriptor **fields = descriptor->fields_->buffer_;
-  for (NSUInteger i = 0; i < count; i++) {
+  size_t storageOffset = CGPGetStorageOffset(descriptor, msgCls);
+  const uint8_t *storage = (const uint8_t *)msg + storageOffset;
+  const uint8_t *otherStorage = (const uint8_t *)other + storageOffset;
+  if (memcmp(storage, otherStorage, descriptor->hasBitsSize_) != 0) {
+    return NO;
+  }
+  uint32_t podStart = descriptor->podRangeStart_;
+  if (memcmp(storage + podStart, otherStorage + podStart, descriptor->podRangeEnd_ - podStart)
+      != 0) {
+    return NO;
+  }
+  uint32_t count = descriptor->nonPodFieldCount_;
+  CGPFieldDescriptor **fields = descriptor->nonPodFields_;
+  for (uint32_t i = 0; i < count; i++) {
     CGPFieldDescriptor *field = fields[i];
     size_t offset = CGPFieldGetOffset(field, msgCls);
     CGPFieldJavaType type = CGPFieldGetJavaType(field);
@@ -3133,6 +5113,9 @@ static int SingularFieldHash(id msg, CGPFieldDescriptor *field, int hash) {
   }
   size_t offset = CGPFieldGetOffset(field, msgCls);
   hash = 37 * hash + CGPFieldGetNumber(field);
+  if (CGPFieldTypeIsMessage(field)) {
+    return 53 * hash + HASH_Id(GetMessageField(msg, offset));
+  }
 
 #define SINGULAR_FIELD_HASH_CASE(NAME) \
   { \
@@ -3147,6 +5130,21 @@ static int SingularFieldHash(id msg, CGPFieldDescriptor *field, int hash) {
   __builtin_unreachable();
 }
 
+// Hashes storage eight bytes at a time.
+static int StorageHash(const uint8_t *ptr, size_t size) {
+  uint64_t hash = size;
+  while (size > 0) {
+    uint64_t word = 0;
+    size_t chunk = MIN(size, sizeof(word));
+    memcpy(&word, ptr, chunk);
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 29;
+    ptr += chunk;
+    size -= chunk;
+  }
+  return (int)(hash ^ (hash >> 32));
+}
+
 static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *descriptor) {
   int hash = msg->memoizedHash_;
   if (hash != 0) {
@@ -3154,9 +5152,14 @@ static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *de
   }
   hash = 41;
   hash = 19 * hash + (int)[descriptor hash];
-  NSUInteger count = descriptor->fields_->size_;
-  CGPFieldDescriptor **fields = descriptor->fields_->buffer_;
-  for (NSUInteger i = 0; i < count; i++) {
+  const uint8_t *storage =
+      (const uint8_t *)msg + CGPGetStorageOffset(descriptor, object_getClass(msg));
+  hash = 31 * hash + StorageHash(storage, descriptor->hasBitsSize_);
+  hash = 31 * hash + StorageHash(
+      storage + descriptor->podRangeStart_, descriptor->podRangeEnd_ - descriptor->podRangeStart_);
+  uint32_t count = descriptor->nonPodFieldCount_;
+  CGPFieldDescriptor **fields = descriptor->nonPodFields_;
+  for (uint32_t i = 0; i < count; i++) {
     CGPFieldDescriptor *field = fields[i];
     if (CGPFieldIsMap(field)) {
       hash = MapFieldHash(msg, field, hash);
@@ -3177,6 +5180,144 @@ static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *de
 }
 
 
+// *****************************************************************************
+// ********** Recycling ********************************************************
+// *****************************************************************************
+
+// The number of messages and of builders of one type that a thread keeps.
+#define RECYCLE_LIST_CAPACITY 16
+
+typedef struct RecycleList {
+  uint32_t messageCount;
+  uint32_t builderCount;
+  id messages[RECYCLE_LIST_CAPACITY];
+  id builders[RECYCLE_LIST_CAPACITY];
+} RecycleList;
+
+// A thread's recycled instances, with a list for each type that has been used,
+// indexed by the descriptor's recycleIndex_ minus one.
+typedef struct RecyclePool {
+  uint32_t size;
+  RecycleList *lists;
+} RecyclePool;
+
+static pthread_key_t recyclePoolKey;
+static _Atomic(uint32_t) nextRecycleIndex;
+
+static void DestroyRecyclePool(void *value) {
+  RecyclePool *pool = (RecyclePool *)value;
+  @autoreleasepool {
+    for (uint32_t i = 0; i < pool->size; i++) {
+      RecycleList *list = &pool->lists[i];
+      for (uint32_t j = 0; j < list->messageCount; j++) {
+        [list->messages[j] release];
+      }
+      for (uint32_t j = 0; j < list->builderCount; j++) {
+        [list->builders[j] release];
+      }
+    }
+  }
+  free(pool->lists);
+  free(pool);
+}
+
+static RecycleList *GetRecycleList(CGPDescriptor *descriptor) {
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    pthread_key_create(&recyclePoolKey, DestroyRecyclePool);
+  });
+  uint32_t index = __c11_atomic_load(&descriptor->recycleIndex_, __ATOMIC_RELAXED);
+  if (index == 0) {
+    // Racing threads may both take an index, only one of them is used.
+    uint32_t newIndex = __c11_atomic_fetch_add(&nextRecycleIndex, 1, __ATOMIC_RELAXED) + 1;
+    if (__c11_atomic_compare_exchange_strong(
+            &descriptor->recycleIndex_, &index, newIndex, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      index = newIndex;
+    }
+  }
+  RecyclePool *pool = (RecyclePool *)pthread_getspecific(recyclePoolKey);
+  if (pool == NULL) {
+    pool = (RecyclePool *)calloc(1, sizeof(RecyclePool));
+    pthread_setspecific(recyclePoolKey, pool);
+  }
+  if (index > pool->size) {
+    uint32_t newSize = MAX(index, pool->size * 2);
+    pool->lists = (RecycleList *)realloc(pool->lists, newSize * sizeof(RecycleList));
+    memset(pool->lists + pool->size, 0, (newSize - pool->size) * sizeof(RecycleList));
+    pool->size = newSize;
+  }
+  return &pool->lists[index - 1];
+}
+
+ComGoogleProtobufGeneratedMessage_Builder *CGPNewRecycledBuilder(CGPDescriptor *descriptor) {
+  RecycleList *list = GetRecycleList(descriptor);
+  if (list->builderCount > 0) {
+    return list->builders[--list->builderCount];
+  }
+  return CGPNewBuilder(descriptor);
+}
+
+void CGPRecycleBuilder(ComGoogleProtobufGeneratedMessage_Builder *builder) {
+  Class cls = object_getClass(builder);
+  CGPDescriptor *descriptor = [cls getDescriptor];
+  RecycleList *list = GetRecycleList(descriptor);
+  if ([builder retainCount] != 1 || list->builderCount == RECYCLE_LIST_CAPACITY) {
+    [builder release];
+    return;
+  }
+  ClearAllFieldsKeepingCapacity(builder, cls, descriptor);
+  CGPExtensionMap *extensionMap = BuilderExtensionMap(builder, descriptor);
+  if (extensionMap != NULL) {
+    *extensionMap = CGPExtensionMap();
+  }
+  list->builders[list->builderCount++] = builder;
+}
+
+ComGoogleProtobufGeneratedMessage *CGPBuildRecycled(
+    ComGoogleProtobufGeneratedMessage_Builder *builder) {
+  Class builderCls = object_getClass(builder);
+  CGPDescriptor *descriptor = [builderCls getDescriptor];
+  if (!MessageIsInitialized(builder, descriptor)) {
+    @throw AUTORELEASE([[JavaLangRuntimeException alloc]
+        initWithNSString:@"Message was missing required fields."]);
+  }
+  RecycleList *list = GetRecycleList(descriptor);
+  ComGoogleProtobufGeneratedMessage *msg;
+  if (list->messageCount > 0) {
+    msg = list->messages[--list->messageCount];
+    CopyAllFieldsReusingCapacity(
+        builder, builderCls, msg, descriptor->messageClass_, descriptor);
+  } else {
+    msg = CGPNewMessage(descriptor);
+    CopyAllFields(builder, builderCls, msg, descriptor->messageClass_, descriptor);
+  }
+  CGPExtensionMap *extensionMap = MessageExtensionMap(msg, descriptor);
+  if (extensionMap != NULL) {
+    *extensionMap = *BuilderExtensionMap(builder, descriptor);
+  }
+  return msg;
+}
+
+void CGPRecycleMessage(ComGoogleProtobufGeneratedMessage *msg) {
+  Class cls = object_getClass(msg);
+  CGPDescriptor *descriptor = [cls getDescriptor];
+  RecycleList *list = GetRecycleList(descriptor);
+  if (msg->arena_ != NULL || [msg retainCount] != 1
+      || list->messageCount == RECYCLE_LIST_CAPACITY) {
+    [msg release];
+    return;
+  }
+  ClearAllFieldsKeepingCapacity(msg, cls, descriptor);
+  CGPExtensionMap *extensionMap = MessageExtensionMap(msg, descriptor);
+  if (extensionMap != NULL) {
+    *extensionMap = CGPExtensionMap();
+  }
+  msg->memoizedSize_ = -1;
+  msg->memoizedHash_ = 0;
+  list->messages[list->messageCount++] = msg;
+}
+
+
 // *****************************************************************************
 // ********** Objective C type implementations *********************************
 // *****************************************************************************
@@ -3225,6 +5366,26 @@ static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *de
   return CGPParseFromByteArray([self getDescriptor], bytes, registry);
 }
 
++ (id)parseFromAliasingByteArray:(IOSByteArray *)bytes
+                        registry:(CGPExtensionRegistryLite *)registry {
+  return CGPParseFromByteArrayAliasing([self getDescriptor], bytes, registry);
+}
+
++ (id)parseFromByteArrayWithArena:(IOSByteArray *)bytes
+                          registry:(CGPExtensionRegistryLite *)registry {
+  return CGPParseFromByteArrayWithArena([self getDescriptor], bytes, registry);
+}
+
++ (id)parseLazilyFromByteArray:(IOSByteArray *)bytes
+                      registry:(CGPExtensionRegistryLite *)registry {
+  return CGPParseFromByteArrayLazily([self getDescriptor], bytes, registry);
+}
+
++ (id)parseFromByteArrayInParallel:(IOSByteArray *)bytes
+                          registry:(CGPExtensionRegistryLite *)registry {
+  return CGPParseFromByteArrayInParallel([self getDescriptor], bytes, registry);
+}
+
 + (id)parseFromNSData:(NSData *)data {
   return [self parseFromNSData:data registry:nil];
 }
@@ -3279,7 +5440,7 @@ static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *de
   CGPDescriptor *descriptor = [object_getClass(self) getDescriptor];
   jint size = [self getSerializedSize];
   CGPByteString *byteString = CGPNewByteString(size);
-  CGPCodedOutputStream codedStream(byteString->buffer_, byteString->size_);
+  CGPCodedOutputStream codedStream(byteString->bytes_, byteString->size_);
   WriteMessage(self, descriptor, &codedStream);
   NSAssert(!codedStream.HadError(), @"Serialization error");
   return [byteString autorelease];
@@ -3295,6 +5456,13 @@ static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *de
   return [NSData dataWithBytesNoCopy:buffer length:size freeWhenDone:YES];
 }
 
+- (BOOL)writeToFileDescriptor:(int)fd {
+  CGPDescriptor *descriptor = [object_getClass(self) getDescriptor];
+  CGPCodedOutputStream codedStream;
+  WriteMessage(self, descriptor, &codedStream);
+  return codedStream.WriteChainToFile(fd);
+}
+
 - (void)writeToWithJavaIoOutputStream:(JavaIoOutputStream *)output {
   CGPDescriptor *descriptor = [object_getClass(self) getDescriptor];
   CGPCodedOutputStream codedStream(output);
@@ -3350,16 +5518,28 @@ static int MessageHash(ComGoogleProtobufGeneratedMessage *msg, CGPDescriptor *de
 }
 
 - (NSString *)description {
-  CGPDescriptor *descriptor = [object_getClass(self) getDescriptor];
-  NSMutableString *builder = [NSMutableString string];
-  MessageToString(self, descriptor, builder, 0);
-  return builder;
+  return CGPTextFormatPrint(self);
+}
+
++ (id)newRecycledBuilder {
+  return CGPNewRecycledBuilder([self getDescriptor]);
+}
+
+- (void)recycle {
+  CGPRecycleMessage(self);
 }
 
 - (void)dealloc {
   Class selfCls = object_getClass(self);
   CGPDescriptor *descriptor = [selfCls getDescriptor];
   ReleaseAllFields(self, selfCls, descriptor);
+  CGPArena *arena = arena_;
+  if (arena != NULL) {
+    // The memory belongs to the arena, so only run the destructors.
+    objc_destructInstance(self);
+    CGPArenaRelease(arena);
+    return;
+  }
   [super dealloc];
 }
 
@@ -3425,11 +5605,25 @@ J2OBJC_CLASS_TYPE_LITERAL_SOURCE(ComGoogleProtobufGeneratedMessage)
   Class selfCls = object_getClass(self);
   CGPDescriptor *descriptor = [selfCls getDescriptor];
   ReleaseAllFields(self, selfCls, descriptor);
-  uint8_t *fieldStorage = (uint8_t *)self + class_getInstanceSize(selfCls);
+  uint8_t *fieldStorage = (uint8_t *)self + CGPGetStorageOffset(descriptor, selfCls);
   memset(fieldStorage, 0, descriptor->storageSize_);
   return self;
 }
 
+- (ComGoogleProtobufGeneratedMessage_Builder *)clearKeepingCapacity {
+  Class selfCls = object_getClass(self);
+  ClearAllFieldsKeepingCapacity(self, selfCls, [selfCls getDescriptor]);
+  return self;
+}
+
+- (id)buildRecycled {
+  return CGPBuildRecycled(self);
+}
+
+- (void)recycle {
+  CGPRecycleBuilder(self);
+}
+
 - (CGPDescriptor *)getDescriptorForType {
   return [object_getClass(self) getDescriptor];
 }
@@ -3531,10 +5725,16 @@ J2OBJC_CLASS_TYPE_LITERAL_SOURCE(ComGoogleProtobufGeneratedMessage)
     CGPRepeatedFieldClear(REPEATED_FIELD_PTR(self, offset), CGPFieldGetJavaType(descriptor));
   } else {
     CGPHasLocator hasLoc = GetHasLocator(cls, descriptor);
-    if (UnsetHas(self, hasLoc) && CGPIsRetainedType(CGPFieldGetJavaType(descriptor))) {
-      id *ptr = FIELD_PTR(id, self, offset);
-      [*ptr autorelease];
-      *ptr = nil;
+    CGPFieldJavaType type = CGPFieldGetJavaType(descriptor);
+    if (UnsetHas(self, hasLoc)) {
+      if (CGPIsRetainedType(type)) {
+        id *ptr = FIELD_PTR(id, self, offset);
+        [*ptr autorelease];
+        *ptr = nil;
+      } else {
+        // Unset fields hold zero, see MessageIsEqual().
+        memset(FIELD_PTR(uint8_t, self, offset), 0, CGPGetTypeSize(type));
+      }
     }
   }
   return self;
@@ -3611,7 +5811,7 @@ J2OBJC_CLASS_TYPE_LITERAL_SOURCE(ComGoogleProtobufGeneratedMessage)
     mergeFromWithComGoogleProtobufByteString:(CGPByteString *)data
     withComGoogleProtobufExtensionRegistryLite:(CGPExtensionRegistryLite *)extensionRegistry {
   CGPDescriptor *descriptor = [object_getClass(self) getDescriptor];
-  CGPCodedInputStream codedStream(data->buffer_, data->size_);
+  CGPCodedInputStream codedStream(data->bytes_, data->size_);
   BOOL success = MergeFromStream(
       self, descriptor, &codedStream, extensionRegistry, BuilderExtensionMap(self, descriptor))
       && codedStream.ConsumedEntireMessage();
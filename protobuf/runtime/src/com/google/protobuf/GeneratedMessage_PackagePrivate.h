@@ -43,6 +43,8 @@
  @package
   int memoizedSize_;
   int memoizedHash_;
+  // The arena that the message was allocated in, or NULL.
+  struct CGPArena *arena_;
 }
 @end
 
@@ -69,12 +71,53 @@ void CGPMergeFromRawData(id msg, CGPDescriptor *descriptor, const char *data, ui
 ComGoogleProtobufGeneratedMessage *CGPParseFromByteArray(
     CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry);
 
+// Parses a message from the length bytes at data, which are copied as needed.
+ComGoogleProtobufGeneratedMessage *CGPParseFromBuffer(
+    CGPDescriptor *descriptor, const void *data, int length, CGPExtensionRegistryLite *registry);
+
+// Like CGPParseFromByteArray(), except that bytes fields and large ASCII string
+// fields of the result point into bytes instead of copying it. bytes must not
+// be modified afterwards.
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayAliasing(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry);
+
+// Like CGPParseFromByteArray(), except that the messages and the repeated and
+// map field data of the result are allocated in an arena, which is freed all at
+// once when they are all released.
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayWithArena(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry);
+
+// Like CGPParseFromByteArray(), except that singular message fields are only
+// parsed when first accessed. Until then they hold a copy of their encoded
+// bytes, which is also what they serialize to. Errors in a lazily parsed field
+// are reported by the first access that needs its value.
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayLazily(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry);
+
+// Like CGPParseFromByteArray(), except that the elements of a large top-level
+// repeated message field are parsed concurrently. The result is the same as
+// that of CGPParseFromByteArray(), which is also used for small inputs.
+ComGoogleProtobufGeneratedMessage *CGPParseFromByteArrayInParallel(
+    CGPDescriptor *descriptor, IOSByteArray *bytes, CGPExtensionRegistryLite *registry);
+
 ComGoogleProtobufGeneratedMessage *CGPParseFromInputStream(
     CGPDescriptor *descriptor, JavaIoInputStream *input, CGPExtensionRegistryLite *registry);
 
 ComGoogleProtobufGeneratedMessage *CGPParseDelimitedFromInputStream(
     CGPDescriptor *descriptor, JavaIoInputStream *input, CGPExtensionRegistryLite *registry);
 
+// The recycling functions behind +newRecycledBuilder, -buildRecycled and
+// -recycle. The New and Build functions return retained instances and the
+// Recycle functions take ownership of one.
+ComGoogleProtobufGeneratedMessage_Builder *CGPNewRecycledBuilder(CGPDescriptor *descriptor);
+
+void CGPRecycleBuilder(ComGoogleProtobufGeneratedMessage_Builder *builder);
+
+ComGoogleProtobufGeneratedMessage *CGPBuildRecycled(
+    ComGoogleProtobufGeneratedMessage_Builder *builder);
+
+void CGPRecycleMessage(ComGoogleProtobufGeneratedMessage *msg);
+
 CF_EXTERN_C_END
 
 #endif // __ComGoogleProtobufGeneratedMessage_PackagePrivate_H__
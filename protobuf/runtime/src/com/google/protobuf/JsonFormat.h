@@ -0,0 +1,76 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Converts generated messages to and from JSON, following the proto3 JSON
+// mapping. Fields are keyed by their lowerCamelCase JSON names, 64-bit integers
+// are written as strings, bytes fields as base64 and enums by name. Fields that
+// are not set are omitted and extensions are ignored. The printer writes no
+// whitespace. The parser also accepts the original proto field names and every
+// alternative representation that the mapping allows for a value.
+//
+// Both directions walk the field storage directly, without boxing field values
+// through the reflection API.
+
+#ifndef __ComGoogleProtobufJsonFormat_H__
+#define __ComGoogleProtobufJsonFormat_H__
+
+#include "J2ObjC_header.h"
+
+@class ComGoogleProtobufGeneratedMessage;
+@class ComGoogleProtobufGeneratedMessage_Builder;
+@protocol ComGoogleProtobufMessageOrBuilder;
+
+typedef NS_OPTIONS(uint32_t, CGPJsonParseOptions) {
+  // Skip fields and enum values that the message type doesn't define, instead
+  // of failing.
+  CGPJsonParseIgnoreUnknownFields = 1 << 0,
+};
+
+CF_EXTERN_C_BEGIN
+
+// Returns the JSON representation of a message or builder.
+NSString *CGPJsonFormatPrint(id<ComGoogleProtobufMessageOrBuilder> message);
+
+// Like CGPJsonFormatPrint(), but returns the UTF-8 encoded bytes.
+NSData *CGPJsonFormatPrintToData(id<ComGoogleProtobufMessageOrBuilder> message);
+
+// Parses a message of the given generated message class from UTF-8 encoded
+// JSON. Throws InvalidProtocolBufferException if the input is malformed or
+// doesn't match the message type.
+ComGoogleProtobufGeneratedMessage *CGPJsonFormatParse(
+    Class messageClass, NSData *json, CGPJsonParseOptions options);
+
+// Merges the fields of a JSON object into a builder, like CGPJsonFormatParse().
+void CGPJsonFormatMerge(
+    ComGoogleProtobufGeneratedMessage_Builder *builder, NSData *json, CGPJsonParseOptions options);
+
+CF_EXTERN_C_END
+
+#endif // __ComGoogleProtobufJsonFormat_H__
@@ -30,11 +30,11 @@
 
 // Defines the type used for map fields. This data structure emulates as close
 // as possible the functionality of com.google.protobuf.MapField which can be
-// viewed as either a map or a list. Like c.g.p.MapField, CGPMapField can be
-// structured as an array or a linked hash map (or both) and at least one of the
-// structures must be valid at all times. Unlike c.g.p.MapField, CGPMapField
-// shares entries between its array and its map. This avoids additional
-// allocations when converting from map to array or from array to map.
+// viewed as either a map or a list. Entries are stored by value in one array in
+// insertion order, which serves as the list, and an open-addressing index over
+// that array serves as the map. List style mutations invalidate the index, which
+// is rebuilt on the next map access, collapsing entries with the same key.
+// Removing an entry leaves a gap that is closed on the next list access.
 
 #ifndef __ComGoogleProtobufMapField_H__
 #define __ComGoogleProtobufMapField_H__
@@ -46,14 +46,11 @@
 @protocol JavaUtilList;
 @protocol JavaUtilMap;
 
-// The hash map entry.
 typedef struct CGPMapFieldEntry {
-  struct CGPMapFieldEntry *hashNext;
-  struct CGPMapFieldEntry *prev;
-  struct CGPMapFieldEntry *next;
   CGPValue key;
   CGPValue value;
   uint32_t hash;
+  bool removed;
 } CGPMapFieldEntry;
 
 // For compactness of empty map fields, the storage type of a map field
@@ -61,17 +58,16 @@ typedef struct CGPMapFieldEntry {
 // allocate CGPMapFieldData, which contains all the data necessary to manage the
 // map field.
 typedef struct CGPMapFieldData {
-  CGPMapFieldEntry header;
-  CGPMapFieldEntry **array;
-  CGPMapFieldEntry **hashArray;
-  uint32_t numEntries;
-  uint32_t arrayCapacity;
-//  uint32_t nextIndex;
-  uint32_t hashCapacity;  // Always a power of 2.
+  CGPMapFieldEntry *entries;
+  // Linear probing table of positions in entries, plus one. Zero is empty.
+  uint32_t *index;
+  uint32_t numEntries;  // Not counting removed entries.
+  uint32_t entriesSize;
+  uint32_t entriesCapacity;
+  uint32_t indexCapacity;  // Always a power of 2.
   uint32_t modCount;
   _Atomic(uint32_t) refCount;
-  bool validArray;
-  bool validHashMap;
+  bool validIndex;
 } CGPMapFieldData;
 
 typedef struct CGPMapField {
@@ -88,6 +84,8 @@ CGP_ALWAYS_INLINE inline uint32_t CGPMapFieldListSize(CGPMapField *field) {
   return field->data != NULL ? field->data->numEntries : 0;
 }
 
+// Makes the data a valid map without removed entries, so that the map can be
+// iterated as the first numEntries entries.
 void CGPMapFieldEnsureValidMap(
     CGPMapFieldData *data, CGPFieldJavaType keyType, CGPFieldJavaType valueType);
 
@@ -97,7 +95,7 @@ CGP_ALWAYS_INLINE inline uint32_t CGPMapFieldMapSize(
   if (data == NULL) {
     return 0;
   }
-  if (!data->validHashMap) {
+  if (!data->validIndex) {
     CGPMapFieldEnsureValidMap(data, keyType, valueType);
   }
   return data->numEntries;
@@ -121,6 +119,11 @@ void CGPMapFieldAppendOther(
 
 void CGPMapFieldClear(CGPMapField *field, CGPFieldJavaType keyType, CGPFieldJavaType valueType);
 
+// Like CGPMapFieldClear(), except that data shared with a map or list view is
+// released instead of being cleared for reuse.
+void CGPMapFieldClearKeepingCapacity(
+    CGPMapField *field, CGPFieldJavaType keyType, CGPFieldJavaType valueType);
+
 bool CGPMapFieldIsEqual(
     CGPMapField *fieldA, CGPMapField *fieldB, CGPFieldJavaType keyType, CGPFieldJavaType valueType);
 
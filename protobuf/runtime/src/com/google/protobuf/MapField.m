@@ -42,10 +42,12 @@
 #include "java/util/Iterator.h"
 #include "java/util/NoSuchElementException.h"
 
-#define MIN_HASH_CAPACITY 16
-#define HASH_LOAD_FACTOR 0.75f
+#define MIN_INDEX_CAPACITY 16
+#define INDEX_LOAD_FACTOR 0.75f
 
-#define HASH_IDX(hash, data) (hash & (data->hashCapacity - 1))
+// Index slots hold the position of an entry plus one.
+#define INDEX_EMPTY 0
+#define INDEX_REMOVED UINT32_MAX
 
 static uint32_t Hash0(CGPValue value, CGPFieldJavaType type) {
 #define HASH_CASE(NAME) return HASH_##NAME(value.CGPValueField_##NAME);
@@ -89,175 +91,160 @@ static bool Equals(CGPValue a, CGPValue b, CGPFieldJavaType type) {
 }
 
 static CGPMapFieldData *NewData() {
-  CGPMapFieldData *data = calloc(sizeof(CGPMapFieldData), 1 );
+  CGPMapFieldData *data = calloc(sizeof(CGPMapFieldData), 1);
   __c11_atomic_store(&data->refCount, 1, __ATOMIC_RELAXED);
-  data->validArray = true;
-  data->validHashMap = true;
-  data->header.next = &data->header;
-  data->header.prev = &data->header;
+  data->validIndex = true;
   return data;
 }
 
-// The passed in key and value must already have an incremented retain count if they have a
-// retainable type.
-static CGPMapFieldEntry *NewEntryConsuming(CGPValue key, CGPValue value, uint32_t hash) {
-  CGPMapFieldEntry *entry = malloc(sizeof(CGPMapFieldEntry));
-  entry->key = key;
-  entry->value = value;
-  entry->hash = hash;
-  return entry;
-}
-
-static CGPMapFieldEntry *NewEntry(
-    CGPValue key, CGPFieldJavaType keyType, CGPValue value, CGPFieldJavaType valueType,
-    uint32_t hash) {
+static void RetainEntry(CGPMapFieldEntry *entry, CGPFieldJavaType keyType,
+                        CGPFieldJavaType valueType) {
   if (CGPIsRetainedType(keyType)) {
-    [key.valueId retain];
+    [entry->key.valueId retain];
   }
   if (CGPIsRetainedType(valueType)) {
-    [value.valueId retain];
+    [entry->value.valueId retain];
   }
-  return NewEntryConsuming(key, value, hash);
 }
 
-static void ReleaseEntry(
-    CGPMapFieldEntry *entry, CGPFieldJavaType keyType, CGPFieldJavaType valueType) {
+static void ReleaseEntry(CGPMapFieldEntry *entry, CGPFieldJavaType keyType,
+                         CGPFieldJavaType valueType) {
   if (CGPIsRetainedType(keyType)) {
     [entry->key.valueId release];
   }
   if (CGPIsRetainedType(valueType)) {
     [entry->value.valueId release];
   }
-  free(entry);
 }
 
-static void MoveArray(CGPMapFieldEntry **from, CGPMapFieldEntry **to, uint32_t len) {
-  for (uint32_t i = 0; i < len; i++) {
-    to[i] = from[i];
+// Adds an entry to the index. The key must not be in the index already.
+static void PutInIndex(CGPMapFieldData *data, uint32_t entryIdx) {
+  uint32_t mask = data->indexCapacity - 1;
+  uint32_t slot = data->entries[entryIdx].hash & mask;
+  while (data->index[slot] != INDEX_EMPTY && data->index[slot] != INDEX_REMOVED) {
+    slot = (slot + 1) & mask;
   }
+  data->index[slot] = entryIdx + 1;
 }
 
-static void PutInHashArray(CGPMapFieldData *data, CGPMapFieldEntry *entry) {
-  uint32_t hashIdx = HASH_IDX(entry->hash, data);
-  entry->hashNext = data->hashArray[hashIdx];
-  data->hashArray[hashIdx] = entry;
+static void RebuildIndex(CGPMapFieldData *data) {
+  if (data->index == NULL) {
+    return;
+  }
+  memset(data->index, 0, sizeof(uint32_t) * data->indexCapacity);
+  for (uint32_t i = 0; i < data->entriesSize; i++) {
+    if (!data->entries[i].removed) {
+      PutInIndex(data, i);
+    }
+  }
 }
 
-static CGPMapFieldEntry *GetFromHashArray(
+// Returns the index slot of the key, or NULL. Slots of removed entries are
+// skipped, and the load factor guarantees an empty slot.
+static uint32_t *GetIndexSlot(
     CGPMapFieldData *data, CGPValue key, CGPFieldJavaType keyType, uint32_t hash) {
-  CGPMapFieldEntry *entry = data->hashArray[HASH_IDX(hash, data)];
-  while (entry) {
-    if (Equals(key, entry->key, keyType)) {
-      break;
+  if (data->index == NULL) {
+    return NULL;
+  }
+  uint32_t mask = data->indexCapacity - 1;
+  for (uint32_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+    uint32_t value = data->index[slot];
+    if (value == INDEX_EMPTY) {
+      return NULL;
+    }
+    if (value != INDEX_REMOVED) {
+      CGPMapFieldEntry *entry = &data->entries[value - 1];
+      if (entry->hash == hash && Equals(key, entry->key, keyType)) {
+        return &data->index[slot];
+      }
     }
-    entry = entry->hashNext;
   }
-  return entry;
-}
-
-static void AddToHashMap(CGPMapFieldData *data, CGPMapFieldEntry *entry) {
-  entry->next = &data->header;
-  entry->prev = data->header.prev;
-  entry->prev->next = entry;
-  data->header.prev = entry;
-  PutInHashArray(data, entry);
-  data->numEntries++;
 }
 
-static void RemoveFromHashArray(CGPMapFieldData *data, CGPMapFieldEntry *entry) {
-  CGPMapFieldEntry **current = &data->hashArray[HASH_IDX(entry->hash, data)];
-  while (*current != NULL) {
-    if (*current == entry) {
-      *current = entry->hashNext;
-      break;
-    }
-    current = &(*current)->hashNext;
-  }
+static CGPMapFieldEntry *GetFromIndex(
+    CGPMapFieldData *data, CGPValue key, CGPFieldJavaType keyType, uint32_t hash) {
+  uint32_t *slot = GetIndexSlot(data, key, keyType, hash);
+  return slot != NULL ? &data->entries[*slot - 1] : NULL;
 }
 
-static void CopyHashEntries(
-    CGPMapFieldData *fromData, CGPMapFieldData *toData, CGPFieldJavaType keyType,
-    CGPFieldJavaType valueType) {
-  CGPMapFieldEntry *current = fromData->header.next;
-  while (current != &fromData->header) {
-    AddToHashMap(toData, NewEntry(current->key, keyType, current->value, valueType, current->hash));
-    current = current->next;
+// The passed in key and value must already have an incremented retain count if
+// they have a retainable type. There must be room for the entry.
+static void AppendEntryConsuming(
+    CGPMapFieldData *data, CGPValue key, CGPValue value, uint32_t hash) {
+  uint32_t entryIdx = data->entriesSize++;
+  CGPMapFieldEntry *entry = &data->entries[entryIdx];
+  entry->key = key;
+  entry->value = value;
+  entry->hash = hash;
+  entry->removed = false;
+  if (data->validIndex) {
+    PutInIndex(data, entryIdx);
   }
-  toData->validArray = false;
+  data->numEntries++;
 }
 
-static void NewArray(CGPMapFieldData *data, uint32_t newArraySize, uint32_t newHashCapacity) {
-  uint32_t newBufferSize = newArraySize + newHashCapacity;
-  CGPMapFieldEntry **newArray = calloc(sizeof(CGPMapFieldEntry *), newBufferSize);
-  data->array = newArray;
-  data->arrayCapacity = newArraySize;
-  data->hashArray = newArray + newArraySize;
-  data->hashCapacity = newHashCapacity;
+static void AppendEntry(
+    CGPMapFieldData *data, CGPValue key, CGPFieldJavaType keyType, CGPValue value,
+    CGPFieldJavaType valueType, uint32_t hash) {
+  AppendEntryConsuming(data, key, value, hash);
+  RetainEntry(&data->entries[data->entriesSize - 1], keyType, valueType);
 }
 
-static void Grow(CGPMapFieldData *data, uint32_t minSize) {
-  uint32_t newHashCapacity = MAX(data->hashCapacity << 1, MIN_HASH_CAPACITY);
-  uint32_t newArraySize = newHashCapacity * HASH_LOAD_FACTOR;
-  while (newArraySize < minSize) {
-    newHashCapacity <<= 1;
-    newArraySize = newHashCapacity * HASH_LOAD_FACTOR;
+// Closes the gaps left by removed entries, keeping the insertion order.
+static void Compact(CGPMapFieldData *data) {
+  if (data->entriesSize == data->numEntries) {
+    return;
   }
-  NewArray(data, newArraySize, newHashCapacity);
-}
-
-static void GrowAsMap(CGPMapFieldData *data, uint32_t minSize) {
-  CGPMapFieldEntry **oldArray = data->array;
-  Grow(data, minSize);
-  free(oldArray);
-  CGPMapFieldEntry *current = data->header.next;
-  while (current != &data->header) {
-    PutInHashArray(data, current);
-    current = current->next;
+  uint32_t newSize = 0;
+  for (uint32_t i = 0; i < data->entriesSize; i++) {
+    if (!data->entries[i].removed) {
+      data->entries[newSize++] = data->entries[i];
+    }
+  }
+  data->entriesSize = newSize;
+  if (data->validIndex) {
+    RebuildIndex(data);
   }
 }
 
-static void GrowAsArray(CGPMapFieldData *data, uint32_t minSize) {
-  CGPMapFieldEntry **oldArray = data->array;
-  Grow(data, minSize);
-  MoveArray(oldArray, data->array, data->numEntries);
-  free(oldArray);
-}
-
-static void EnsureValidArray(CGPMapFieldData *data) {
-  if (data->validArray) {
+static void Reserve(CGPMapFieldData *data, uint32_t minSize) {
+  if (data->entriesCapacity >= minSize) {
     return;
   }
-
-  uint32_t i = 0;
-  CGPMapFieldEntry *current = data->header.next;
-  while (current != &data->header) {
-    data->array[i++] = current;
-    current = current->next;
+  uint32_t newIndexCapacity = MAX(data->indexCapacity << 1, MIN_INDEX_CAPACITY);
+  uint32_t newEntriesCapacity = newIndexCapacity * INDEX_LOAD_FACTOR;
+  while (newEntriesCapacity < minSize) {
+    newIndexCapacity <<= 1;
+    newEntriesCapacity = newIndexCapacity * INDEX_LOAD_FACTOR;
+  }
+  data->entries = realloc(data->entries, sizeof(CGPMapFieldEntry) * newEntriesCapacity);
+  data->entriesCapacity = newEntriesCapacity;
+  free(data->index);
+  data->index = calloc(sizeof(uint32_t), newIndexCapacity);
+  data->indexCapacity = newIndexCapacity;
+  if (data->validIndex) {
+    RebuildIndex(data);
   }
-  data->validArray = true;
 }
 
+// List style mutations don't update the index. Builds the index, collapsing
+// entries with the same key.
 static void EnsureValidMap(
     CGPMapFieldData *data, CGPFieldJavaType keyType, CGPFieldJavaType valueType) {
-  if (data->validHashMap) {
+  if (data->validIndex) {
     return;
   }
-
-  uint32_t arraySize = data->numEntries;
-  // Clear the hash array.
-  memset(data->hashArray, 0, sizeof(CGPMapFieldEntry *) * data->hashCapacity);
-  data->header.next = &data->header;
-  data->header.prev = &data->header;
-  data->numEntries = 0;
-
+  // Without a valid index there are no removed entries.
+  if (data->index != NULL) {
+    memset(data->index, 0, sizeof(uint32_t) * data->indexCapacity);
+  }
   BOOL keyTypeIsRetainable = CGPIsRetainedType(keyType);
   BOOL valueTypeIsRetainable = CGPIsRetainedType(valueType);
-  // Construct the hash map from the array.
-  for (uint32_t i = 0; i < arraySize; i++) {
-    CGPMapFieldEntry *entry = data->array[i];
-    CGPMapFieldEntry *existingEntry = GetFromHashArray(data, entry->key, keyType, entry->hash);
+  for (uint32_t i = 0; i < data->entriesSize; i++) {
+    CGPMapFieldEntry *entry = &data->entries[i];
+    CGPMapFieldEntry *existingEntry = GetFromIndex(data, entry->key, keyType, entry->hash);
     if (existingEntry != NULL) {
-      // The array had multiple entries with the same key. We keep the insertion order from the
+      // The list had multiple entries with the same key. We keep the insertion order from the
       // first key but replace the value.
       if (keyTypeIsRetainable) {
         [entry->key.valueId autorelease];
@@ -266,18 +253,19 @@ static void EnsureValidMap(
         [existingEntry->value.valueId autorelease];
       }
       existingEntry->value = entry->value;
-      free(entry);
-      data->validArray = false;  // We just freed an entry in the array.
+      entry->removed = true;
+      data->numEntries--;
     } else {
-      AddToHashMap(data, entry);
+      PutInIndex(data, i);
     }
   }
-  data->validHashMap = true;
+  data->validIndex = true;
 }
 
 void CGPMapFieldEnsureValidMap(
     CGPMapFieldData *data, CGPFieldJavaType keyType, CGPFieldJavaType valueType) {
   EnsureValidMap(data, keyType, valueType);
+  Compact(data);
 }
 
 static void EnsureAdditionalListCapacity(CGPMapField *field, uint32_t additionalEntries) {
@@ -285,13 +273,10 @@ static void EnsureAdditionalListCapacity(CGPMapField *field, uint32_t additional
   if (data == NULL) {
     data = field->data = NewData();
   } else {
-    EnsureValidArray(data);
+    Compact(data);
   }
-  uint32_t totalEntries = data->numEntries + additionalEntries;
-  if (data->arrayCapacity < totalEntries) {
-    GrowAsArray(data, totalEntries);
-  }
-  data->validHashMap = false;
+  Reserve(data, data->entriesSize + additionalEntries);
+  data->validIndex = false;
 }
 
 static void EnsureAdditionalHashMapCapacity(
@@ -303,11 +288,10 @@ static void EnsureAdditionalHashMapCapacity(
   } else {
     EnsureValidMap(data, keyType, valueType);
   }
-  uint32_t totalEntries = data->numEntries + additionalEntries;
-  if (data->arrayCapacity < totalEntries) {
-    GrowAsMap(data, totalEntries);
+  if (data->entriesSize + additionalEntries > data->entriesCapacity) {
+    Compact(data);
+    Reserve(data, data->entriesSize + additionalEntries);
   }
-  data->validArray = false;
 }
 
 CGPMapFieldEntry *CGPMapFieldGetWithKey(
@@ -317,7 +301,7 @@ CGPMapFieldEntry *CGPMapFieldGetWithKey(
     return NULL;
   }
   EnsureValidMap(data, keyType, valueType);
-  return GetFromHashArray(data, key, keyType, Hash(key, keyType));
+  return GetFromIndex(data, key, keyType, Hash(key, keyType));
 }
 
 void CGPMapFieldPut(
@@ -334,7 +318,7 @@ void CGPMapFieldPut(
   CGPMapFieldData *data = field->data;
   if (data != NULL) {
     EnsureValidMap(data, keyType, valueType);
-    entry = GetFromHashArray(data, key, keyType, hash);
+    entry = GetFromIndex(data, key, keyType, hash);
   }
   if (entry) {
     // Existing entry so the key is not added to the map and must not be retained.
@@ -353,25 +337,28 @@ void CGPMapFieldPut(
     }
     EnsureAdditionalHashMapCapacity(field, 1, keyType, valueType);
     data = field->data;
-    entry = NewEntryConsuming(key, value, hash);
-    AddToHashMap(data, entry);
+    AppendEntryConsuming(data, key, value, hash);
   }
   data->modCount++;
 }
 
 void CGPMapFieldRemove(
     CGPMapField *field, CGPValue key, CGPFieldJavaType keyType, CGPFieldJavaType valueType) {
-  CGPMapFieldEntry *entry = CGPMapFieldGetWithKey(field, key, keyType, valueType);
-  if (entry == NULL) {
+  CGPMapFieldData *data = field->data;
+  if (data == NULL) {
     return;
   }
-  CGPMapFieldData *data = field->data;
-  RemoveFromHashArray(data, entry);
-  entry->prev->next = entry->next;
-  entry->next->prev = entry->prev;
+  EnsureValidMap(data, keyType, valueType);
+  uint32_t *slot = GetIndexSlot(data, key, keyType, Hash(key, keyType));
+  if (slot == NULL) {
+    return;
+  }
+  // The entry is left in place until the next compaction.
+  CGPMapFieldEntry *entry = &data->entries[*slot - 1];
   ReleaseEntry(entry, keyType, valueType);
+  entry->removed = true;
+  *slot = INDEX_REMOVED;
   data->numEntries--;
-  data->validArray = false;
   data->modCount++;
 }
 
@@ -383,8 +370,13 @@ void CGPMapFieldCopyData(CGPMapField *field, CGPFieldJavaType keyType, CGPFieldJ
 
   EnsureValidMap(oldData, keyType, valueType);
   CGPMapFieldData *newData = field->data = NewData();
-  NewArray(newData, oldData->arrayCapacity, oldData->hashCapacity);
-  CopyHashEntries(oldData, newData, keyType, valueType);
+  Reserve(newData, oldData->numEntries);
+  for (uint32_t i = 0; i < oldData->entriesSize; i++) {
+    CGPMapFieldEntry *entry = &oldData->entries[i];
+    if (!entry->removed) {
+      AppendEntry(newData, entry->key, keyType, entry->value, valueType, entry->hash);
+    }
+  }
 }
 
 void CGPMapFieldAppendOther(
@@ -396,22 +388,32 @@ void CGPMapFieldAppendOther(
   CGPMapFieldData *otherData = other->data;
   EnsureAdditionalHashMapCapacity(field, otherSize, keyType, valueType);
   CGPMapFieldData *data = field->data;
-  CopyHashEntries(otherData, data, keyType, valueType);
+  for (uint32_t i = 0; i < otherData->entriesSize; i++) {
+    CGPMapFieldEntry *otherEntry = &otherData->entries[i];
+    if (otherEntry->removed) {
+      continue;
+    }
+    CGPMapFieldEntry *entry = GetFromIndex(data, otherEntry->key, keyType, otherEntry->hash);
+    if (entry != NULL) {
+      if (CGPIsRetainedType(valueType)) {
+        [otherEntry->value.valueId retain];
+        [entry->value.valueId autorelease];
+      }
+      entry->value = otherEntry->value;
+    } else {
+      AppendEntry(
+          data, otherEntry->key, keyType, otherEntry->value, valueType, otherEntry->hash);
+    }
+  }
   data->modCount++;
 }
 
 static void ReleaseAllEntries(
     CGPMapFieldData *data, CGPFieldJavaType keyType, CGPFieldJavaType valueType) {
-  if (data->validArray) {
-    for (uint32_t i = 0; i < data->numEntries; i++) {
-      ReleaseEntry(data->array[i], keyType, valueType);
-    }
-  } else {  // validHashMap implied
-    CGPMapFieldEntry *current = data->header.next;
-    while (current != &data->header) {
-      CGPMapFieldEntry *next = current->next;
-      ReleaseEntry(current, keyType, valueType);
-      current = next;
+  for (uint32_t i = 0; i < data->entriesSize; i++) {
+    CGPMapFieldEntry *entry = &data->entries[i];
+    if (!entry->removed) {
+      ReleaseEntry(entry, keyType, valueType);
     }
   }
 }
@@ -427,8 +429,8 @@ static void ReleaseData(
 
     ReleaseAllEntries(data, keyType, valueType);
 
-    // Don't need to free hashArray because it is on the same allocation as array.
-    free(data->array);
+    free(data->entries);
+    free(data->index);
     free(data);
   }
 }
@@ -439,11 +441,22 @@ void CGPMapFieldClear(CGPMapField *field, CGPFieldJavaType keyType, CGPFieldJava
     return;
   }
   ReleaseAllEntries(data, keyType, valueType);
+  data->entriesSize = 0;
   data->numEntries = 0;
   data->modCount++;
-  data->validArray = true;
-  // The hash array and header are now dirty.
-  data->validHashMap = false;
+  // The index is now dirty.
+  data->validIndex = false;
+}
+
+void CGPMapFieldClearKeepingCapacity(
+    CGPMapField *field, CGPFieldJavaType keyType, CGPFieldJavaType valueType) {
+  CGPMapFieldData *data = field->data;
+  if (data != NULL && __c11_atomic_load(&data->refCount, __ATOMIC_ACQUIRE) != 1) {
+    ReleaseData(data, keyType, valueType);
+    field->data = NULL;
+    return;
+  }
+  CGPMapFieldClear(field, keyType, valueType);
 }
 
 bool CGPMapFieldIsEqual(
@@ -460,14 +473,15 @@ bool CGPMapFieldIsEqual(
   CGPMapFieldData *dataA = fieldA->data;
   CGPMapFieldData *dataB = fieldB->data;
 
-  CGPMapFieldEntry *current = dataA->header.next;
-  while (current != &dataA->header) {
-    CGPValue key = current->key;
-    CGPMapFieldEntry *entryB = GetFromHashArray(dataB, key, keyType, current->hash);
+  for (uint32_t i = 0; i < dataA->entriesSize; i++) {
+    CGPMapFieldEntry *current = &dataA->entries[i];
+    if (current->removed) {
+      continue;
+    }
+    CGPMapFieldEntry *entryB = GetFromIndex(dataB, current->key, keyType, current->hash);
     if (entryB == NULL || !Equals(current->value, entryB->value, valueType)) {
       return false;
     }
-    current = current->next;
   }
   return true;
 }
@@ -480,10 +494,11 @@ int CGPMapFieldHash(CGPMapField *field, CGPFieldJavaType keyType, CGPFieldJavaTy
   }
 
   EnsureValidMap(data, keyType, valueType);
-  CGPMapFieldEntry *current = data->header.next;
-  while (current != &data->header) {
-    hash += current->hash ^ Hash(current->value, valueType);
-    current = current->next;
+  for (uint32_t i = 0; i < data->entriesSize; i++) {
+    CGPMapFieldEntry *current = &data->entries[i];
+    if (!current->removed) {
+      hash += current->hash ^ Hash(current->value, valueType);
+    }
   }
 
   return hash;
@@ -574,9 +589,9 @@ id<JavaUtilList> CGPMapFieldCopyList(
     return newList;
   }
 
-  EnsureValidArray(data);
+  Compact(data);
   for (uint32_t i = 0; i < data->numEntries; i++) {
-    [newList addWithId:CreateReflectionMapEntry(data->array[i], keyType, valueType)];
+    [newList addWithId:CreateReflectionMapEntry(&data->entries[i], keyType, valueType)];
   }
   return newList;
 }
@@ -592,10 +607,10 @@ static void CheckArrayBounds(CGPMapField *field, jint idx) {
 id CGPMapFieldGetAtIndex(CGPMapField *field, jint idx, CGPFieldDescriptor *descriptor) {
   CheckArrayBounds(field, idx);
   CGPMapFieldData *data = field->data;
-  EnsureValidArray(data);
+  Compact(data);
   CGPFieldJavaType keyType = CGPFieldGetJavaType(CGPFieldMapKey(descriptor));
   CGPFieldJavaType valueType = CGPFieldGetJavaType(CGPFieldMapValue(descriptor));
-  return CreateReflectionMapEntry(data->array[idx], keyType, valueType);
+  return CreateReflectionMapEntry(&data->entries[idx], keyType, valueType);
 }
 
 void CGPMapFieldAdd(CGPMapField *field, id object, CGPFieldDescriptor *descriptor) {
@@ -609,7 +624,7 @@ void CGPMapFieldAdd(CGPMapField *field, id object, CGPFieldDescriptor *descripto
   CGPFieldJavaType valueType = CGPFieldGetJavaType(valueField);
   CGPValue key = UnboxReflectionValue([mapEntry getKey], keyField);
   CGPValue value = UnboxReflectionValue([mapEntry getValue], valueField);
-  data->array[data->numEntries++] = NewEntry(key, keyType, value, valueType, Hash(key, keyType));
+  AppendEntry(data, key, keyType, value, valueType, Hash(key, keyType));
   data->modCount++;
 }
 
@@ -618,16 +633,20 @@ void CGPMapFieldSet(CGPMapField *field, jint idx, id object, CGPFieldDescriptor
   CGPMapFieldData *data = field->data;
   ComGoogleProtobufMapEntry *mapEntry =
       (ComGoogleProtobufMapEntry *)cast_chk(object, [ComGoogleProtobufMapEntry class]);
-  EnsureValidArray(data);
-  data->validHashMap = false;
+  Compact(data);
+  data->validIndex = false;
   CGPFieldDescriptor *keyField = CGPFieldMapKey(descriptor);
   CGPFieldDescriptor *valueField = CGPFieldMapValue(descriptor);
   CGPFieldJavaType keyType = CGPFieldGetJavaType(keyField);
   CGPFieldJavaType valueType = CGPFieldGetJavaType(valueField);
   CGPValue key = UnboxReflectionValue([mapEntry getKey], keyField);
   CGPValue value = UnboxReflectionValue([mapEntry getValue], valueField);
-  ReleaseEntry(data->array[idx], keyType, valueType);
-  data->array[idx] = NewEntry(key, keyType, value, valueType, Hash(key, keyType));
+  CGPMapFieldEntry *entry = &data->entries[idx];
+  ReleaseEntry(entry, keyType, valueType);
+  entry->key = key;
+  entry->value = value;
+  entry->hash = Hash(key, keyType);
+  RetainEntry(entry, keyType, valueType);
   data->modCount++;
 }
 
@@ -646,7 +665,7 @@ void CGPMapFieldAssignFromList(
         (ComGoogleProtobufMapEntry *)cast_chk(obj, [ComGoogleProtobufMapEntry class]);
     CGPValue key = UnboxReflectionValue([mapEntry getKey], keyField);
     CGPValue value = UnboxReflectionValue([mapEntry getValue], valueField);
-    data->array[data->numEntries++] = NewEntry(key, keyType, value, valueType, Hash(key, keyType));
+    AppendEntry(data, key, keyType, value, valueType, Hash(key, keyType));
   }
   data->modCount++;
 }
@@ -681,7 +700,7 @@ id<JavaUtilMap> CGPMapFieldAsJavaMap(
 @interface CGPMapFieldEntrySetIterator : NSObject < JavaUtilIterator > {
  @package
   CGPMapFieldMap *map_;
-  CGPMapFieldEntry *nextEntry_;
+  uint32_t nextIndex_;
   uint32_t expectedModCount_;
 }
 @end
@@ -732,8 +751,7 @@ id<JavaUtilMap> CGPMapFieldAsJavaMap(
   CGPMapFieldEntrySetIterator *iterator = [[[CGPMapFieldEntrySetIterator alloc] init] autorelease];
   iterator->map_ = [map_ retain];
   if (data != NULL) {
-    EnsureValidMap(data, map_->keyType_, map_->valueType_);
-    iterator->nextEntry_ = data->header.next;
+    CGPMapFieldEnsureValidMap(data, map_->keyType_, map_->valueType_);
     iterator->expectedModCount_ = data->modCount;
   }
   return iterator;
@@ -749,21 +767,19 @@ id<JavaUtilMap> CGPMapFieldAsJavaMap(
 @implementation CGPMapFieldEntrySetIterator
 
 - (jboolean)hasNext {
-  return nextEntry_ != NULL;
+  CGPMapFieldData *data = map_->field_.data;
+  return data != NULL && nextIndex_ < data->entriesSize;
 }
 
 - (id<JavaUtilMap_Entry>)next {
-  if (nextEntry_ == NULL) {
+  if (![self hasNext]) {
     @throw create_JavaUtilNoSuchElementException_init();
   }
-  if (map_->field_.data->modCount != expectedModCount_) {
+  CGPMapFieldData *data = map_->field_.data;
+  if (data->modCount != expectedModCount_) {
     @throw create_JavaUtilConcurrentModificationException_init();
   }
-  CGPMapFieldEntry *entry = nextEntry_;
-  nextEntry_ = entry->next;
-  if (nextEntry_ == &map_->field_.data->header) {
-    nextEntry_ = NULL;
-  }
+  CGPMapFieldEntry *entry = &data->entries[nextIndex_++];
   return create_JavaUtilAbstractMap_SimpleImmutableEntry_initWithId_withId_(
     BoxedValue(entry->key, map_->keyType_), BoxedValue(entry->value, map_->valueType_));
 }
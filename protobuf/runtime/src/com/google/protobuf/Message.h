@@ -50,6 +50,9 @@
 - (id<ComGoogleProtobufMessage_Builder>)toBuilder;
 - (id<ComGoogleProtobufMessage_Builder>)newBuilderForType NS_RETURNS_NOT_RETAINED;
 - (NSData *)toNSData;
+// Writes the message to a file or socket without copying its large bytes
+// fields. Returns NO if a write fails, with errno set.
+- (BOOL)writeToFileDescriptor:(int)fd;
 
 + (id)getDescriptor;
 
@@ -43,11 +43,14 @@
 // field (CGPRepeatedField) is a single pointer. When the repeated field becomes
 // non-empty, we allocate CGPRepeatedFieldData, which contains the size, the
 // allocated size and a buffer. This block is re-allocated as the field grows.
+// Data created while parsing with an arena is allocated in the arena, along
+// with its buffer, and holds a reference to it.
 typedef struct CGPRepeatedFieldData {
   uint32_t size;
   uint32_t total_size;
   _Atomic(uint32_t) ref_count;
   void *buffer;
+  struct CGPArena *arena;
 } CGPRepeatedFieldData;
 
 typedef struct CGPRepeatedField {
@@ -66,6 +69,9 @@ CGP_ALWAYS_INLINE inline uint32_t CGPRepeatedFieldTotalSize(CGPRepeatedField *fi
 
 void CGPRepeatedFieldReserve(CGPRepeatedField *field, uint32_t new_size, size_t elemSize);
 
+// Allocates the data of an empty field in the arena.
+void CGPRepeatedFieldInitArenaData(CGPRepeatedField *field, struct CGPArena *arena);
+
 CGP_ALWAYS_INLINE inline void CGPRepeatedFieldReserveAdditionalCapacity(
     CGPRepeatedField *field, uint32_t size_to_add, size_t elemSize) {
   uint32_t new_size = CGPRepeatedFieldSize(field) + size_to_add;
@@ -81,6 +87,10 @@ void CGPRepeatedFieldAppendOther(
 
 void CGPRepeatedFieldClear(CGPRepeatedField *field, CGPFieldJavaType type);
 
+// Like CGPRepeatedFieldClear(), except that the buffer is kept for reuse unless
+// it is shared or in an arena.
+void CGPRepeatedFieldClearKeepingCapacity(CGPRepeatedField *field, CGPFieldJavaType type);
+
 void CGPRepeatedFieldOutOfBounds(jint idx, uint32_t size);
 
 CGP_ALWAYS_INLINE inline void CGPRepeatedFieldCheckBounds(CGPRepeatedField *field, jint idx) {
@@ -30,6 +30,7 @@
 
 #import "com/google/protobuf/RepeatedField.h"
 
+#import "com/google/protobuf/Arena.h"
 #import "com/google/protobuf/ByteString.h"
 #import "com/google/protobuf/Descriptors_PackagePrivate.h"
 #import "com/google/protobuf/ProtocolStringList.h"
@@ -45,6 +46,14 @@ static CGPRepeatedFieldData *NewData() {
   return data;
 }
 
+void CGPRepeatedFieldInitArenaData(CGPRepeatedField *field, CGPArena *arena) {
+  CGPRepeatedFieldData *data = CGPArenaAlloc(arena, sizeof(CGPRepeatedFieldData));
+  __c11_atomic_store(&data->ref_count, 1, __ATOMIC_RELAXED);
+  data->arena = arena;
+  CGPArenaRetain(arena);
+  field->data = data;
+}
+
 void CGPRepeatedFieldReserve(CGPRepeatedField *field, uint32_t new_size, size_t elemSize) {
   CGPRepeatedFieldData *data = field->data;
   if (data == NULL) {
@@ -56,8 +65,15 @@ void CGPRepeatedFieldReserve(CGPRepeatedField *field, uint32_t new_size, size_t
   }
 
   uint32_t newTotalSize = MAX(MIN_REPEATED_FIELD_SIZE, MAX(data->total_size * 2, new_size));
+  if (data->arena != NULL) {
+    // The old buffer is left in the arena.
+    void *newBuffer = CGPArenaAlloc(data->arena, newTotalSize * elemSize);
+    memcpy(newBuffer, data->buffer, data->size * elemSize);
+    data->buffer = newBuffer;
+  } else {
+    data->buffer = realloc(data->buffer, newTotalSize * elemSize);
+  }
   data->total_size = newTotalSize;
-  data->buffer = realloc(data->buffer, newTotalSize * elemSize);
 }
 
 void CGPRepeatedFieldCopyData(CGPRepeatedField *field, CGPFieldJavaType type) {
@@ -114,8 +130,12 @@ static void ReleaseData(CGPRepeatedFieldData *data, CGPFieldJavaType type) {
       }
     }
 
-    free(data->buffer);
-    free(data);
+    if (data->arena != NULL) {
+      CGPArenaRelease(data->arena);
+    } else {
+      free(data->buffer);
+      free(data);
+    }
   }
 }
 
@@ -124,6 +144,23 @@ void CGPRepeatedFieldClear(CGPRepeatedField *field, CGPFieldJavaType type) {
   field->data = NULL;
 }
 
+void CGPRepeatedFieldClearKeepingCapacity(CGPRepeatedField *field, CGPFieldJavaType type) {
+  CGPRepeatedFieldData *data = field->data;
+  if (data == NULL) {
+    return;
+  }
+  if (data->arena != NULL || __c11_atomic_load(&data->ref_count, __ATOMIC_ACQUIRE) != 1) {
+    CGPRepeatedFieldClear(field, type);
+    return;
+  }
+  if (CGPIsRetainedType(type)) {
+    for (uint32_t i = 0; i < data->size; i++) {
+      [((id *)data->buffer)[i] release];
+    }
+  }
+  data->size = 0;
+}
+
 id CGPRepeatedFieldGet(CGPRepeatedField *field, jint index, CGPFieldDescriptor *descriptor) {
   CGPRepeatedFieldCheckBounds(field, index);
 
@@ -0,0 +1,60 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Prints generated messages in the text format that -description returns,
+// either into a string or streamed straight to an output stream or a file
+// descriptor in fixed-size chunks, so that large messages can be logged without
+// holding their whole text in memory.
+
+#ifndef __ComGoogleProtobufTextFormat_H__
+#define __ComGoogleProtobufTextFormat_H__
+
+#include "J2ObjC_header.h"
+
+@class JavaIoOutputStream;
+@protocol ComGoogleProtobufMessageOrBuilder;
+
+CF_EXTERN_C_BEGIN
+
+// Returns the text format of a message or builder.
+NSString *CGPTextFormatPrint(id<ComGoogleProtobufMessageOrBuilder> message);
+
+// Writes the UTF-8 encoded text format of a message or builder to a stream.
+// Exceptions thrown by the stream are propagated.
+void CGPTextFormatPrintToStream(
+    id<ComGoogleProtobufMessageOrBuilder> message, JavaIoOutputStream *output);
+
+// Writes the UTF-8 encoded text format of a message or builder to a file
+// descriptor. Returns NO, with errno set, if a write fails.
+BOOL CGPTextFormatPrintToFileDescriptor(id<ComGoogleProtobufMessageOrBuilder> message, int fd);
+
+CF_EXTERN_C_END
+
+#endif // __ComGoogleProtobufTextFormat_H__
@@ -246,11 +246,38 @@ CGP_ALWAYS_INLINE inline void CGPWriteEnum(jint value, CGPCodedOutputStream *out
 
 CGP_ALWAYS_INLINE inline void CGPWriteBytes(CGPByteString *value, CGPCodedOutputStream *output) {
   output->WriteVarint32(value->size_);
-  output->WriteRaw(value->buffer_, value->size_);
+  output->WriteAliasedRaw(value->bytes_, value->size_, value);
 }
 
 void CGPWriteString(NSString *value, CGPCodedOutputStream *output);
 
+// ***** Packed repeated fields *****
+
+// Each of these reads the elements of a packed field, up to the current limit of
+// the input, and appends them to the field. Buffered input is decoded in bulk.
+BOOL CGPReadPackedInt32(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedSint32(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedFixed32(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedInt64(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedSint64(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedFixed64(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedBool(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedFloat(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+BOOL CGPReadPackedDouble(CGPCodedInputStream *input, struct CGPRepeatedField *field);
+
+// Each of these writes the elements of a packed field, which must follow its
+// tag and length.
+void CGPWritePackedInt32(const jint *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedUint32(const jint *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedSint32(const jint *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedFixed32(const jint *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedInt64(const jlong *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedSint64(const jlong *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedFixed64(const jlong *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedBool(const jboolean *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedFloat(const jfloat *values, uint32_t count, CGPCodedOutputStream *output);
+void CGPWritePackedDouble(const jdouble *values, uint32_t count, CGPCodedOutputStream *output);
+
 #endif
 
 CF_EXTERN_C_END
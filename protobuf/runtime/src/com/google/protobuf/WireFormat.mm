@@ -31,6 +31,9 @@
 #import "com/google/protobuf/WireFormat.h"
 
 #import "com/google/protobuf/CodedInputStream.h"
+#import "com/google/protobuf/RepeatedField.h"
+
+#import <libkern/OSByteOrder.h>
 
 CGPWireFormat CGPWireFormatForType(CGPFieldType type, BOOL isPacked) {
   if (isPacked) {
@@ -170,3 +173,294 @@ void CGPWriteString(NSString *value, CGPCodedOutputStream *output) {
   NSCAssert2(usedLength == length,
              @"String length was wrong: %d vs %d", (int)length, (int)usedLength);
 }
+
+// ***** Packed repeated fields *****
+
+#define MAX_VARINT_SIZE 10
+
+// The continuation bits of eight bytes loaded as a word.
+#define CONTINUATION_BITS 0x8080808080808080ULL
+
+CGP_ALWAYS_INLINE static inline uint64_t LoadWord(const uint8_t *ptr) {
+  uint64_t word;
+  memcpy(&word, ptr, sizeof(word));
+  return word;
+}
+
+// Returns the number of varints in [ptr, end), which is the number of bytes
+// that don't have the continuation bit set.
+static uint32_t CountVarints(const uint8_t *ptr, const uint8_t *end) {
+  uint32_t count = 0;
+  for (; end - ptr >= 8; ptr += 8) {
+    count += __builtin_popcountll(~LoadWord(ptr) & CONTINUATION_BITS);
+  }
+  for (; ptr < end; ptr++) {
+    count += *ptr < 0x80;
+  }
+  return count;
+}
+
+template <typename T>
+CGP_ALWAYS_INLINE static inline void AppendValue(CGPRepeatedField *field, T value) {
+  uint32_t total_size = CGPRepeatedFieldTotalSize(field);
+  if (CGPRepeatedFieldSize(field) == total_size) {
+    CGPRepeatedFieldReserve(field, total_size + 1, sizeof(T));
+  }
+  ((T *)field->data->buffer)[field->data->size++] = value;
+}
+
+template <typename T, T (*Decode)(uint64_t)>
+static BOOL ReadPackedVarints(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  const void *data;
+  int size;
+  if (!input->GetBufferedUntilLimit(&data, &size)) {
+    while (input->BytesUntilLimit() > 0) {
+      uint64_t value;
+      if (!input->ReadVarint64(&value)) return NO;
+      AppendValue(field, Decode(value));
+    }
+    return YES;
+  }
+  if (size == 0) {
+    return YES;
+  }
+  const uint8_t *ptr = (const uint8_t *)data;
+  const uint8_t *end = ptr + size;
+  if (end[-1] >= 0x80) {
+    return NO;  // Truncated.
+  }
+  // Every varint ends within the data, so the loop below needs no bounds
+  // checks once there is room for all of them.
+  uint32_t count = CountVarints(ptr, end);
+  CGPRepeatedFieldReserveAdditionalCapacity(field, count, sizeof(T));
+  T *out = (T *)field->data->buffer + field->data->size;
+  T *outEnd = out + count;
+  while (out < outEnd) {
+    // Small values are common, so decode eight single byte varints at once.
+    if (end - ptr >= 8 && (LoadWord(ptr) & CONTINUATION_BITS) == 0) {
+      for (int i = 0; i < 8; i++) {
+        out[i] = Decode(ptr[i]);
+      }
+      out += 8;
+      ptr += 8;
+      continue;
+    }
+    uint64_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+      if (shift >= 7 * MAX_VARINT_SIZE) return NO;
+      uint8_t b = *ptr++;
+      value |= (uint64_t)(b & 0x7F) << shift;
+      if (b < 0x80) break;
+    }
+    *out++ = Decode(value);
+  }
+  field->data->size += count;
+  return input->Skip(size);
+}
+
+// Fixed size values are copied as is, and then converted in place on big
+// endian hosts.
+template <typename T>
+static BOOL ReadPackedFixed(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  int size = input->BytesUntilLimit();
+  if (size % sizeof(T) != 0) {
+    return NO;
+  }
+  uint32_t count = size / sizeof(T);
+  if (count == 0) {
+    return YES;
+  }
+  CGPRepeatedFieldReserveAdditionalCapacity(field, count, sizeof(T));
+  T *out = (T *)field->data->buffer + field->data->size;
+  if (!input->ReadRaw(out, size)) return NO;
+#ifdef __BIG_ENDIAN__
+  for (uint32_t i = 0; i < count; i++) {
+    out[i] = sizeof(T) == sizeof(uint32_t) ? OSSwapLittleToHostInt32(out[i])
+        : OSSwapLittleToHostInt64(out[i]);
+  }
+#endif
+  field->data->size += count;
+  return YES;
+}
+
+static inline jint DecodeInt32(uint64_t value) {
+  return (jint)value;
+}
+
+static inline jint DecodeSint32(uint64_t value) {
+  return CGPZigZagDecode32((uint32_t)value);
+}
+
+static inline jlong DecodeInt64(uint64_t value) {
+  return (jlong)value;
+}
+
+static inline jlong DecodeSint64(uint64_t value) {
+  return CGPZigZagDecode64(value);
+}
+
+// Like CGPReadBool(), only looks at the low 32 bits.
+static inline jboolean DecodeBool(uint64_t value) {
+  return (uint32_t)value != 0;
+}
+
+BOOL CGPReadPackedInt32(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedVarints<jint, DecodeInt32>(input, field);
+}
+
+BOOL CGPReadPackedSint32(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedVarints<jint, DecodeSint32>(input, field);
+}
+
+BOOL CGPReadPackedFixed32(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedFixed<uint32_t>(input, field);
+}
+
+BOOL CGPReadPackedInt64(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedVarints<jlong, DecodeInt64>(input, field);
+}
+
+BOOL CGPReadPackedSint64(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedVarints<jlong, DecodeSint64>(input, field);
+}
+
+BOOL CGPReadPackedFixed64(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedFixed<uint64_t>(input, field);
+}
+
+BOOL CGPReadPackedBool(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedVarints<jboolean, DecodeBool>(input, field);
+}
+
+BOOL CGPReadPackedFloat(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedFixed<uint32_t>(input, field);
+}
+
+BOOL CGPReadPackedDouble(CGPCodedInputStream *input, CGPRepeatedField *field) {
+  return ReadPackedFixed<uint64_t>(input, field);
+}
+
+CGP_ALWAYS_INLINE static inline uint8_t *WriteVarintToArray(uint64_t value, uint8_t *target) {
+  while (value >= 0x80) {
+    *target++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *target++ = (uint8_t)value;
+  return target;
+}
+
+// Encodes straight into the output's buffer, as many values at a time as fit.
+template <typename T, uint64_t (*Encode)(T)>
+static void WritePackedVarints(const T *values, uint32_t count, CGPCodedOutputStream *output) {
+  uint32_t i = 0;
+  while (i < count) {
+    void *data;
+    int available;
+    if (!output->GetDirectBufferPointer(&data, &available) || available < MAX_VARINT_SIZE) {
+      // Let the stream deal with a value that may cross the end of the buffer.
+      output->WriteVarint64(Encode(values[i++]));
+      continue;
+    }
+    uint8_t *start = (uint8_t *)data;
+    uint8_t *target = start;
+    uint8_t *end = start + available;
+    while (i < count && end - target >= MAX_VARINT_SIZE) {
+      // Small values are common, so check for eight single byte varints at once.
+      if (count - i >= 8 && end - target >= 8) {
+        uint64_t combined = 0;
+        for (int j = 0; j < 8; j++) {
+          combined |= Encode(values[i + j]);
+        }
+        if (combined < 0x80) {
+          for (int j = 0; j < 8; j++) {
+            target[j] = (uint8_t)Encode(values[i + j]);
+          }
+          target += 8;
+          i += 8;
+          continue;
+        }
+      }
+      target = WriteVarintToArray(Encode(values[i++]), target);
+    }
+    output->Skip((int)(target - start));
+  }
+}
+
+template <typename T>
+static void WritePackedFixed(const T *values, uint32_t count, CGPCodedOutputStream *output) {
+#ifdef __BIG_ENDIAN__
+  for (uint32_t i = 0; i < count; i++) {
+    if (sizeof(T) == sizeof(uint32_t)) {
+      output->WriteLittleEndian32(values[i]);
+    } else {
+      output->WriteLittleEndian64(values[i]);
+    }
+  }
+#else
+  output->WriteRaw(values, (int)(count * sizeof(T)));
+#endif
+}
+
+static inline uint64_t EncodeInt32(jint value) {
+  return (uint64_t)(int64_t)value;  // Sign extended.
+}
+
+static inline uint64_t EncodeUint32(jint value) {
+  return (uint32_t)value;
+}
+
+static inline uint64_t EncodeSint32(jint value) {
+  return (uint32_t)CGPZigZagEncode32(value);
+}
+
+static inline uint64_t EncodeInt64(jlong value) {
+  return (uint64_t)value;
+}
+
+static inline uint64_t EncodeSint64(jlong value) {
+  return (uint64_t)CGPZigZagEncode64(value);
+}
+
+static inline uint64_t EncodeBool(jboolean value) {
+  return value ? 1 : 0;
+}
+
+void CGPWritePackedInt32(const jint *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedVarints<jint, EncodeInt32>(values, count, output);
+}
+
+void CGPWritePackedUint32(const jint *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedVarints<jint, EncodeUint32>(values, count, output);
+}
+
+void CGPWritePackedSint32(const jint *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedVarints<jint, EncodeSint32>(values, count, output);
+}
+
+void CGPWritePackedFixed32(const jint *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedFixed((const uint32_t *)values, count, output);
+}
+
+void CGPWritePackedInt64(const jlong *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedVarints<jlong, EncodeInt64>(values, count, output);
+}
+
+void CGPWritePackedSint64(const jlong *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedVarints<jlong, EncodeSint64>(values, count, output);
+}
+
+void CGPWritePackedFixed64(const jlong *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedFixed((const uint64_t *)values, count, output);
+}
+
+void CGPWritePackedBool(const jboolean *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedVarints<jboolean, EncodeBool>(values, count, output);
+}
+
+void CGPWritePackedFloat(const jfloat *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedFixed((const uint32_t *)values, count, output);
+}
+
+void CGPWritePackedDouble(const jdouble *values, uint32_t count, CGPCodedOutputStream *output) {
+  WritePackedFixed((const uint64_t *)values, count, output);
+}
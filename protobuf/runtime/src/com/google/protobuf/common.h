@@ -35,6 +35,10 @@
 
 #define CGP_CODED_STREAM_BUFFER_SIZE (jint)NSPageSize()
 
+// Chained output streams refer to written payloads of at least this size
+// instead of copying them.
+#define CGP_CODED_STREAM_MIN_ALIASED_SIZE 2048
+
 // For ported c++ code.
 typedef int8_t  int8;
 typedef int16_t int16;
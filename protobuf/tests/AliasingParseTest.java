@@ -0,0 +1,164 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.ExtensionRegistry;
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.nio.charset.StandardCharsets;
+import protos.MapMsg;
+import protos.Typical;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+
+/**
+ * Tests for +parseFromAliasingByteArray:registry:, which only exists in the
+ * Objective-C runtime. Its bytes fields and large ASCII string fields point
+ * into the input, and must be indistinguishable from copied ones.
+ */
+public class AliasingParseTest extends ProtobufTest {
+
+  // ASCII strings of at least this length are aliased.
+  private static final int MIN_ALIASED_STRING_LENGTH = 64;
+
+  private static native TypicalData parseAliasing(byte[] bytes, ExtensionRegistry registry)
+      throws InvalidProtocolBufferException /*-[
+    return [ProtosTypicalData parseFromAliasingByteArray:bytes registry:registry];
+  ]-*/;
+
+  private static native MapMsg parseMapAliasing(byte[] bytes)
+      throws InvalidProtocolBufferException /*-[
+    return [ProtosMapMsg parseFromAliasingByteArray:bytes registry:nil];
+  ]-*/;
+
+  private static String asciiString(int length, char first) {
+    StringBuilder sb = new StringBuilder();
+    for (int i = 0; i < length; i++) {
+      sb.append((char) (first + i % 26));
+    }
+    return sb.toString();
+  }
+
+  private static ByteString newBytes(int size) {
+    byte[] bytes = new byte[size];
+    for (int i = 0; i < size; i++) {
+      bytes[i] = (byte) (i * 7);
+    }
+    return ByteString.copyFrom(bytes);
+  }
+
+  private static final String SHORT_ASCII = "short";
+  private static final String LONG_ASCII = asciiString(MIN_ALIASED_STRING_LENGTH, 'a');
+  private static final String LONGER_ASCII = asciiString(1000, 'A');
+  private static final String LONG_NON_ASCII = asciiString(100, 'a') + "\u00e9\u4e2d\ud83d\ude00";
+
+  private static TypicalData newMessage() {
+    return TypicalData.newBuilder()
+        .setMyInt(1)
+        .setMyBytes(newBytes(300))
+        .setMyString(LONGER_ASCII)
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(2))
+        .addRepeatedString(SHORT_ASCII)
+        .addRepeatedString(LONG_ASCII)
+        .addRepeatedString(LONG_NON_ASCII)
+        .addRepeatedString("")
+        .addRepeatedBytes(ByteString.EMPTY)
+        .addRepeatedBytes(newBytes(1))
+        .addRepeatedBytes(newBytes(5000))
+        .setExtension(Typical.myBytesExtension, newBytes(100))
+        .build();
+  }
+
+  public void testEqualsNormalParse() throws Exception {
+    byte[] bytes = newMessage().toByteArray();
+    ExtensionRegistry registry = ExtensionRegistry.newInstance();
+    Typical.registerAllExtensions(registry);
+    TypicalData expected = TypicalData.parseFrom(bytes, registry);
+    TypicalData aliased = parseAliasing(bytes, registry);
+
+    assertEquals(expected, aliased);
+    assertEquals(aliased, expected);
+    assertEquals(expected.hashCode(), aliased.hashCode());
+    assertEquals(newMessage(), aliased);
+    checkBytes(bytes, aliased.toByteArray());
+    assertEquals(expected.toString(), aliased.toString());
+
+    assertEquals(newBytes(300), aliased.getMyBytes());
+    assertEquals(newBytes(5000), aliased.getRepeatedBytes(2));
+    assertEquals(newBytes(100), aliased.getExtension(Typical.myBytesExtension));
+    assertEquals(0, aliased.getRepeatedBytes(0).size());
+    assertEquals(newBytes(300).hashCode(), aliased.getMyBytes().hashCode());
+    assertEquals(newBytes(300).substring(10, 20), aliased.getMyBytes().substring(10, 20));
+    checkBytes(newBytes(5000).toByteArray(), aliased.getRepeatedBytes(2).toByteArray());
+  }
+
+  public void testAliasedStrings() throws Exception {
+    TypicalData aliased = parseAliasing(newMessage().toByteArray(), null);
+    String[] expected = { LONGER_ASCII, SHORT_ASCII, LONG_ASCII, LONG_NON_ASCII, "" };
+    String[] actual = {
+      aliased.getMyString(), aliased.getRepeatedString(0), aliased.getRepeatedString(1),
+      aliased.getRepeatedString(2), aliased.getRepeatedString(3)
+    };
+    for (int i = 0; i < expected.length; i++) {
+      String e = expected[i];
+      String a = actual[i];
+      assertEquals(e, a);
+      assertTrue(a.equals(e));
+      assertEquals(e.hashCode(), a.hashCode());
+      assertEquals(0, a.compareTo(e));
+      assertEquals(e.length(), a.length());
+      if (e.length() > 0) {
+        assertEquals(e.charAt(e.length() - 1), a.charAt(a.length() - 1));
+        assertEquals(e.substring(1), a.substring(1));
+      }
+      assertEquals(e.toUpperCase(), a.toUpperCase());
+      assertEquals(e + "!", a + "!");
+      checkBytes(e.getBytes(StandardCharsets.UTF_8), a.getBytes(StandardCharsets.UTF_8));
+      assertEquals(ByteString.copyFromUtf8(e), ByteString.copyFromUtf8(a));
+    }
+    try {
+      aliased.getMyString().charAt(LONGER_ASCII.length());
+      fail("Expected StringIndexOutOfBoundsException");
+    } catch (StringIndexOutOfBoundsException e) {
+      // Expected.
+    }
+  }
+
+  public void testAliasedMapKeysAndValues() throws Exception {
+    MapMsg msg = MapMsg.newBuilder()
+        .putStringString(LONG_ASCII, LONGER_ASCII)
+        .putStringString(SHORT_ASCII, LONG_NON_ASCII)
+        .putStringInt(LONGER_ASCII, 3)
+        .build();
+    MapMsg aliased = parseMapAliasing(msg.toByteArray());
+    assertEquals(msg, aliased);
+    assertEquals(msg.hashCode(), aliased.hashCode());
+    // Lookups with copied strings find the aliased keys.
+    assertEquals(LONGER_ASCII, aliased.getStringStringOrThrow(LONG_ASCII));
+    assertEquals(LONG_NON_ASCII, aliased.getStringStringOrThrow(SHORT_ASCII));
+    assertEquals(3, aliased.getStringIntOrThrow(asciiString(1000, 'A')));
+    assertTrue(aliased.getStringStringMap().containsKey(new String(LONG_ASCII)));
+  }
+
+  public void testMalformedInput() throws Exception {
+    byte[] bytes = newMessage().toByteArray();
+    byte[] truncated = new byte[bytes.length - 1];
+    System.arraycopy(bytes, 0, truncated, 0, truncated.length);
+    try {
+      parseAliasing(truncated, null);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+}
@@ -0,0 +1,209 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.util.List;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+
+/*-[
+#include "com/google/protobuf/Arena.h"
+#include "com/google/protobuf/GeneratedMessage_PackagePrivate.h"
+]-*/
+
+/**
+ * Tests for +parseFromByteArrayWithArena:registry:, which only exists in the
+ * Objective-C runtime. The natives release the root message in their own
+ * autorelease pool, so that the parts of it that escape outlive it.
+ */
+public class ArenaParseTest extends ProtobufTest {
+
+  private static native TypicalData parseWithArena(byte[] bytes)
+      throws InvalidProtocolBufferException /*-[
+    return [ProtosTypicalData parseFromByteArrayWithArena:bytes registry:nil];
+  ]-*/;
+
+  private static native boolean isInArena(TypicalDataMessage msg) /*-[
+    return ((ComGoogleProtobufGeneratedMessage *)msg)->arena_ != NULL;
+  ]-*/;
+
+  // Returns the message field of a parsed message, after the root message has
+  // been released.
+  private static native TypicalDataMessage parseAndKeepMyMessage(byte[] bytes) /*-[
+    ProtosTypicalDataMessage *result;
+    @autoreleasepool {
+      ProtosTypicalData *root = [ProtosTypicalData parseFromByteArrayWithArena:bytes registry:nil];
+      result = [[root getMyMessage] retain];
+    }
+    return [result autorelease];
+  ]-*/;
+
+  // Returns the repeated message field of a parsed message, after the root
+  // message has been released.
+  private static native List<TypicalDataMessage> parseAndKeepRepeatedMessages(byte[] bytes) /*-[
+    id<JavaUtilList> result;
+    @autoreleasepool {
+      ProtosTypicalData *root = [ProtosTypicalData parseFromByteArrayWithArena:bytes registry:nil];
+      result = [[root getRepeatedMessageList] retain];
+    }
+    return [result autorelease];
+  ]-*/;
+
+  // Returns the reference count of the arena once the root message has been
+  // released while its message field is still retained, or -1 if that field
+  // isn't in an arena.
+  private static native int arenaRefCountAfterRootReleased(byte[] bytes) /*-[
+    ComGoogleProtobufGeneratedMessage *kept;
+    @autoreleasepool {
+      ProtosTypicalData *root = [ProtosTypicalData parseFromByteArrayWithArena:bytes registry:nil];
+      kept = (ComGoogleProtobufGeneratedMessage *)[[root getMyMessage] retain];
+    }
+    CGPArena *arena = kept->arena_;
+    jint refCount = arena != NULL ? (jint)__c11_atomic_load(&arena->refCount, __ATOMIC_ACQUIRE) : -1;
+    [kept release];
+    return refCount;
+  ]-*/;
+
+  private static native void mergeAndReleaseRoot(TypicalData.Builder builder, byte[] bytes) /*-[
+    @autoreleasepool {
+      ProtosTypicalData *root = [ProtosTypicalData parseFromByteArrayWithArena:bytes registry:nil];
+      [builder mergeFromWithProtosTypicalData:root];
+    }
+  ]-*/;
+
+  private static native TypicalData.Builder toBuilderAndReleaseRoot(byte[] bytes) /*-[
+    ProtosTypicalData_Builder *builder;
+    @autoreleasepool {
+      ProtosTypicalData *root = [ProtosTypicalData parseFromByteArrayWithArena:bytes registry:nil];
+      builder = [[root toBuilder] retain];
+    }
+    return [builder autorelease];
+  ]-*/;
+
+  private static TypicalData newMessage(int repeatedCount) {
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyInt(1)
+        .setMyString("string")
+        .setMyBytes(ByteString.copyFromUtf8("bytes"))
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(2));
+    for (int i = 0; i < repeatedCount; i++) {
+      builder.addRepeatedInt32(i);
+      builder.addRepeatedString("s" + i);
+      builder.addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i));
+    }
+    return builder.build();
+  }
+
+  public void testEqualsNormalParse() throws Exception {
+    byte[] bytes = newMessage(10).toByteArray();
+    TypicalData msg = parseWithArena(bytes);
+    assertEquals(TypicalData.parseFrom(bytes), msg);
+    assertEquals(newMessage(10), msg);
+    assertEquals(newMessage(10).hashCode(), msg.hashCode());
+    checkBytes(bytes, msg.toByteArray());
+    assertTrue(isInArena(msg.getMyMessage()));
+  }
+
+  public void testSubMessagesOutliveRoot() throws Exception {
+    byte[] bytes = newMessage(50).toByteArray();
+    TypicalDataMessage myMessage = parseAndKeepMyMessage(bytes);
+    assertEquals(2, myMessage.getMyMessageInt());
+    assertEquals(TypicalDataMessage.newBuilder().setMyMessageInt(2).build(), myMessage);
+
+    List<TypicalDataMessage> repeated = parseAndKeepRepeatedMessages(bytes);
+    assertEquals(50, repeated.size());
+    for (int i = 0; i < 50; i++) {
+      assertEquals(i, repeated.get(i).getMyMessageInt());
+    }
+  }
+
+  public void testReleasingRootReleasesArenaOnce() throws Exception {
+    // Only the retained message field holds the arena once the root, its
+    // repeated field data and the other messages in it are gone.
+    assertEquals(1, arenaRefCountAfterRootReleased(newMessage(0).toByteArray()));
+    assertEquals(1, arenaRefCountAfterRootReleased(newMessage(100).toByteArray()));
+  }
+
+  public void testToBuilder() throws Exception {
+    byte[] bytes = newMessage(20).toByteArray();
+    TypicalData msg = parseWithArena(bytes);
+    TypicalData modified = msg.toBuilder().setMyInt(5).addRepeatedInt32(20).build();
+    assertEquals(newMessage(20).toBuilder().setMyInt(5).addRepeatedInt32(20).build(), modified);
+    // The original is unaffected.
+    assertEquals(newMessage(20), msg);
+
+    TypicalData.Builder builder = toBuilderAndReleaseRoot(bytes);
+    for (int i = 20; i < 100; i++) {
+      builder.addRepeatedInt32(i);
+      builder.addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i));
+    }
+    TypicalData built = builder.build();
+    assertEquals(100, built.getRepeatedInt32Count());
+    assertEquals(100, built.getRepeatedMessageCount());
+    for (int i = 0; i < 100; i++) {
+      assertEquals(i, built.getRepeatedInt32(i));
+      assertEquals(i, built.getRepeatedMessage(i).getMyMessageInt());
+    }
+    assertEquals("s19", built.getRepeatedString(19));
+  }
+
+  public void testMergeFrom() throws Exception {
+    byte[] bytes = newMessage(30).toByteArray();
+    TypicalData.Builder builder = TypicalData.newBuilder().addRepeatedInt32(-1).setMyInt(7);
+    mergeAndReleaseRoot(builder, bytes);
+    TypicalData merged = builder.build();
+    assertEquals(31, merged.getRepeatedInt32Count());
+    assertEquals(-1, merged.getRepeatedInt32(0));
+    assertEquals(29, merged.getRepeatedInt32(30));
+    assertEquals(1, merged.getMyInt());
+    assertEquals(2, merged.getMyMessage().getMyMessageInt());
+    assertEquals(29, merged.getRepeatedMessage(29).getMyMessageInt());
+
+    // Merging an arena message into a builder created from another one.
+    TypicalData msg = parseWithArena(bytes);
+    TypicalData twice = msg.toBuilder().mergeFrom(parseWithArena(bytes)).build();
+    assertEquals(60, twice.getRepeatedMessageCount());
+    assertEquals(newMessage(30).toBuilder().mergeFrom(newMessage(30)).build(), twice);
+  }
+
+  public void testRepeatedFieldGrowth() throws Exception {
+    // Enough elements for the repeated fields to be reallocated several times
+    // within the arena, and for the arena to need more blocks.
+    TypicalData expected = newMessage(5000);
+    TypicalData msg = parseWithArena(expected.toByteArray());
+    assertEquals(5000, msg.getRepeatedInt32Count());
+    assertEquals(5000, msg.getRepeatedStringCount());
+    assertEquals(5000, msg.getRepeatedMessageCount());
+    for (int i = 0; i < 5000; i++) {
+      assertEquals(i, msg.getRepeatedInt32(i));
+      assertEquals("s" + i, msg.getRepeatedString(i));
+      assertEquals(i, msg.getRepeatedMessage(i).getMyMessageInt());
+    }
+    assertEquals(expected, msg);
+    checkBytes(expected.toByteArray(), msg.toByteArray());
+  }
+
+  public void testMalformedInput() throws Exception {
+    byte[] bytes = newMessage(10).toByteArray();
+    byte[] truncated = new byte[bytes.length - 1];
+    System.arraycopy(bytes, 0, truncated, 0, truncated.length);
+    try {
+      parseWithArena(truncated);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+}
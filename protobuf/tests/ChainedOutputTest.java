@@ -0,0 +1,207 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.Message;
+import java.io.ByteArrayOutputStream;
+import protos.MessageData;
+import protos.TypicalData;
+import protos.TypicalDataSet;
+
+/*-[
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+]-*/
+
+/**
+ * Tests for -writeToFileDescriptor:, which writes a message through a chained
+ * CGPCodedOutputStream that refers to large bytes fields instead of copying
+ * them. The output must be the same as that of the copying writers.
+ */
+public class ChainedOutputTest extends ProtobufTest {
+
+  // Payloads of at least this size are linked into the chain.
+  private static final int MIN_ALIASED_SIZE = 2048;
+
+  /** Reads a pipe until it is closed, at most maxRead bytes at a time. */
+  static class PipeReader extends Thread {
+    private final int fd;
+    private final int maxRead;
+    private final ByteArrayOutputStream out = new ByteArrayOutputStream();
+
+    PipeReader(int fd, int maxRead) {
+      this.fd = fd;
+      this.maxRead = maxRead;
+    }
+
+    @Override
+    public void run() {
+      byte[] buffer = new byte[maxRead];
+      int count;
+      while ((count = readFd(fd, buffer, maxRead)) > 0) {
+        out.write(buffer, 0, count);
+      }
+    }
+
+    byte[] finish() throws InterruptedException {
+      join();
+      return out.toByteArray();
+    }
+  }
+
+  private static native int[] newPipe() /*-[
+    int fds[2];
+    if (pipe(fds) != 0) {
+      return nil;
+    }
+    return [IOSIntArray arrayWithInts:fds count:2];
+  ]-*/;
+
+  private static native void setNonBlocking(int fd) /*-[
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  ]-*/;
+
+  private static native void closeFd(int fd) /*-[
+    close(fd);
+  ]-*/;
+
+  private static native int readFd(int fd, byte[] buffer, int count) /*-[
+    ssize_t result;
+    do {
+      result = read(fd, buffer->buffer_, count);
+    } while (result < 0 && errno == EINTR);
+    return (jint)result;
+  ]-*/;
+
+  // Returns 0 if the message was written, or errno.
+  private static native int writeToFd(Message msg, int fd) /*-[
+    return [msg writeToFileDescriptor:fd] ? 0 : errno;
+  ]-*/;
+
+  private static native int eagain() /*-[
+    return EAGAIN;
+  ]-*/;
+
+  private static native MessageData parseLazily(byte[] bytes) /*-[
+    return [ProtosMessageData parseLazilyFromByteArray:bytes registry:nil];
+  ]-*/;
+
+  private static byte[] newBytes(int size, int seed) {
+    byte[] bytes = new byte[size];
+    for (int i = 0; i < size; i++) {
+      bytes[i] = (byte) (seed + i * 31);
+    }
+    return bytes;
+  }
+
+  // Large bytes fields, which are linked, between small ones, which are copied.
+  private static TypicalData newLargeMessage() {
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyInt(42)
+        .setMyBytes(ByteString.copyFrom(newBytes(1 << 20, 1)))
+        .setMyString("after my_bytes");
+    for (int i = 0; i < 100; i++) {
+      int size = i % 2 == 0 ? MIN_ALIASED_SIZE - 1 + i : MIN_ALIASED_SIZE + i;
+      builder.addRepeatedBytes(ByteString.copyFrom(newBytes(size, i)));
+      builder.addRepeatedString("string " + i);
+    }
+    return builder.build();
+  }
+
+  private static byte[] writeThroughPipe(Message msg, int maxRead) throws Exception {
+    int[] fds = newPipe();
+    PipeReader reader = new PipeReader(fds[0], maxRead);
+    reader.start();
+    int error = writeToFd(msg, fds[1]);
+    closeFd(fds[1]);
+    byte[] result = reader.finish();
+    closeFd(fds[0]);
+    assertEquals(0, error);
+    return result;
+  }
+
+  private void checkWrite(Message msg) throws Exception {
+    byte[] expected = msg.toByteArray();
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    msg.writeTo(out);
+    checkBytes(expected, out.toByteArray());
+    // Large outputs don't fit in the pipe's buffer, so the reader takes them in
+    // many pieces.
+    for (int maxRead : new int[] { 997, 1 << 16 }) {
+      checkBytes(expected, writeThroughPipe(msg, maxRead));
+    }
+  }
+
+  public void testLargeBytesFields() throws Exception {
+    checkWrite(newLargeMessage());
+  }
+
+  public void testMoreLinksThanIovMax() throws Exception {
+    // Each element has a linked bytes field, so the chain has several times
+    // IOV_MAX links and is written with several writev() calls.
+    TypicalDataSet.Builder builder = TypicalDataSet.newBuilder();
+    for (int i = 0; i < 3000; i++) {
+      builder.addRepeatedTypicalData(TypicalData.newBuilder()
+          .setMyInt(i)
+          .setMyBytes(ByteString.copyFrom(newBytes(MIN_ALIASED_SIZE + i % 7, i))));
+    }
+    checkWrite(builder.build());
+  }
+
+  public void testSmallMessages() throws Exception {
+    checkWrite(TypicalData.getDefaultInstance());
+    checkWrite(TypicalData.newBuilder().setMyInt(1).setMyString("foo").build());
+  }
+
+  public void testLazilyParsedMessage() throws Exception {
+    // The saved bytes of the unparsed recursive_msg_f are linked.
+    MessageData.Builder inner = MessageData.newBuilder();
+    for (int i = 0; i < 1000; i++) {
+      inner.addMsgR(MessageData.SubMsg.newBuilder().setIntF(i).setUintF(i * 3));
+    }
+    MessageData msg = MessageData.newBuilder()
+        .setMsgF(MessageData.SubMsg.newBuilder().setIntF(7))
+        .setRecursiveMsgF(inner)
+        .build();
+    byte[] bytes = msg.toByteArray();
+    assertTrue(msg.getRecursiveMsgF().getSerializedSize() >= MIN_ALIASED_SIZE);
+    MessageData lazy = parseLazily(bytes);
+    checkBytes(bytes, writeThroughPipe(lazy, 1 << 16));
+    assertEquals(msg, lazy);
+    checkWrite(lazy);
+  }
+
+  public void testFailedWrite() throws Exception {
+    // Nothing reads the non-blocking pipe, so the first write fills it and the
+    // next one fails.
+    TypicalData msg = newLargeMessage();
+    byte[] expected = msg.toByteArray();
+    int[] fds = newPipe();
+    setNonBlocking(fds[1]);
+    PipeReader reader = new PipeReader(fds[0], 1 << 16);
+    assertEquals(eagain(), writeToFd(msg, fds[1]));
+    closeFd(fds[1]);
+    reader.start();
+    byte[] written = reader.finish();
+    closeFd(fds[0]);
+
+    // What was written is the start of the message.
+    assertTrue(written.length > 0);
+    assertTrue(written.length < expected.length);
+    byte[] start = new byte[written.length];
+    System.arraycopy(expected, 0, start, 0, written.length);
+    checkBytes(start, written);
+  }
+}
@@ -0,0 +1,192 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import protos.TypicalData;
+
+/*-[
+#include "com/google/protobuf/DelimitedReader.h"
+]-*/
+
+/**
+ * Tests for CGPDelimitedReader, which only exists in the Objective-C runtime.
+ */
+public class DelimitedReaderTest extends ProtobufTest {
+
+  /**
+   * Returns at most maxRead bytes from each read. Once the data runs out, it
+   * either ends or fails the test, like a socket whose peer is waiting for a
+   * response would block.
+   */
+  static class ShortReadInputStream extends InputStream {
+    private final byte[] data;
+    private final int maxRead;
+    private final boolean failAtEnd;
+    private int pos;
+
+    ShortReadInputStream(byte[] data, int maxRead, boolean failAtEnd) {
+      this.data = data;
+      this.maxRead = maxRead;
+      this.failAtEnd = failAtEnd;
+    }
+
+    @Override
+    public int read() {
+      throw new UnsupportedOperationException();
+    }
+
+    @Override
+    public int read(byte[] b, int off, int len) {
+      if (pos == data.length) {
+        if (failAtEnd) {
+          fail("Read past the available input, which would block");
+        }
+        return -1;
+      }
+      int count = Math.min(Math.min(len, maxRead), data.length - pos);
+      System.arraycopy(data, pos, b, off, count);
+      pos += count;
+      return count;
+    }
+  }
+
+  private static native Object newReader(InputStream in) /*-[
+    return [[[CGPDelimitedReader alloc] initWithInputStream:in] autorelease];
+  ]-*/;
+
+  private static native void setSizeLimit(Object reader, int limit) /*-[
+    [(CGPDelimitedReader *)reader setSizeLimit:limit];
+  ]-*/;
+
+  private static native TypicalData nextMessage(Object reader) throws IOException /*-[
+    return (ProtosTypicalData *)[(CGPDelimitedReader *)reader
+        nextMessageOfClass:[ProtosTypicalData class] registry:nil];
+  ]-*/;
+
+  private static TypicalData newMessage(int i) {
+    // Some of the messages are larger than the reader's initial buffer.
+    byte[] bytes = new byte[(i * 397) % 10000];
+    for (int j = 0; j < bytes.length; j++) {
+      bytes[j] = (byte) (i + j);
+    }
+    return TypicalData.newBuilder()
+        .setMyInt(i)
+        .setMyString("message " + i)
+        .setMyBytes(ByteString.copyFrom(bytes))
+        .build();
+  }
+
+  private static byte[] writeMessages(int count) throws IOException {
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    for (int i = 0; i < count; i++) {
+      newMessage(i).writeDelimitedTo(out);
+    }
+    return out.toByteArray();
+  }
+
+  private static byte[] varint(long value) {
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    while ((value & ~0x7FL) != 0) {
+      out.write((int) (value & 0x7F) | 0x80);
+      value >>>= 7;
+    }
+    out.write((int) value);
+    return out.toByteArray();
+  }
+
+  public void testShortReads() throws Exception {
+    byte[] data = writeMessages(50);
+    for (int maxRead : new int[] { 1, 7, 3000, Integer.MAX_VALUE }) {
+      Object reader = newReader(new ShortReadInputStream(data, maxRead, false));
+      for (int i = 0; i < 50; i++) {
+        assertEquals(newMessage(i), nextMessage(reader));
+      }
+      assertNull(nextMessage(reader));
+    }
+  }
+
+  public void testDoesNotReadPastCompleteMessage() throws Exception {
+    // The length prefix is a single byte, so the first read doesn't contain
+    // a whole varint's worth of bytes.
+    TypicalData msg = TypicalData.newBuilder().setMyInt(42).build();
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    msg.writeDelimitedTo(out);
+    byte[] data = out.toByteArray();
+    assertTrue(data.length < 10);
+    Object reader = newReader(new ShortReadInputStream(data, Integer.MAX_VALUE, true));
+    assertEquals(msg, nextMessage(reader));
+
+    reader = newReader(new ShortReadInputStream(writeMessages(20), 1, true));
+    for (int i = 0; i < 20; i++) {
+      assertEquals(newMessage(i), nextMessage(reader));
+    }
+  }
+
+  public void testRejectsLengthOverSizeLimit() throws Exception {
+    // The reader fails before it waits for the payload.
+    Object reader = newReader(new ShortReadInputStream(varint(1L << 30), 1, true));
+    try {
+      nextMessage(reader);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+
+    byte[] data = writeMessages(2);
+    reader = newReader(new ShortReadInputStream(data, Integer.MAX_VALUE, false));
+    setSizeLimit(reader, 100);
+    assertEquals(newMessage(0), nextMessage(reader));
+    try {
+      nextMessage(reader);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+
+  public void testHugeLengthWithTruncatedInput() throws Exception {
+    // Without a size limit, the reader must still not allocate the 2 GiB that
+    // the prefix claims before the input ends.
+    byte[] prefix = varint(Integer.MAX_VALUE);
+    byte[] data = new byte[prefix.length + 100000];
+    System.arraycopy(prefix, 0, data, 0, prefix.length);
+    Object reader = newReader(new ShortReadInputStream(data, 4096, false));
+    setSizeLimit(reader, Integer.MAX_VALUE);
+    try {
+      nextMessage(reader);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+
+  public void testTruncatedInput() throws Exception {
+    byte[] data = writeMessages(3);
+    for (int length : new int[] { data.length - 1, 1 }) {
+      byte[] truncated = new byte[length];
+      System.arraycopy(data, 0, truncated, 0, length);
+      Object reader = newReader(new ShortReadInputStream(truncated, 5, false));
+      try {
+        while (nextMessage(reader) != null) {}
+        fail("Expected InvalidProtocolBufferException");
+      } catch (InvalidProtocolBufferException e) {
+        // Expected.
+      }
+    }
+  }
+}
@@ -0,0 +1,179 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.ExtensionRegistry;
+import java.util.Arrays;
+import java.util.List;
+import protos.MsgWithNestedExtensions;
+import protos.Typical;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+
+/**
+ * Tests that the extensions of messages and builders that share their
+ * extension values are independent: modifying one never changes the others.
+ */
+public class ExtensionsTest extends ProtobufTest {
+
+  private static TypicalDataMessage newSubMessage(int value) {
+    return TypicalDataMessage.newBuilder().setMyMessageInt(value).build();
+  }
+
+  private static TypicalData.Builder newBuilder() {
+    return TypicalData.newBuilder()
+        .setMyInt(1)
+        .setExtension(Typical.myPrimitiveExtension, 11)
+        .setExtension(Typical.myExtension, newSubMessage(12))
+        .addExtension(Typical.myRepeatedPrimitiveExtension, 1)
+        .addExtension(Typical.myRepeatedPrimitiveExtension, 2)
+        .addExtension(Typical.myRepeatedExtension, newSubMessage(3));
+  }
+
+  // Checks the extensions that newBuilder() sets.
+  private static void checkOriginal(TypicalData msg) {
+    assertEquals(11, (int) msg.getExtension(Typical.myPrimitiveExtension));
+    assertEquals(12, msg.getExtension(Typical.myExtension).getMyMessageInt());
+    assertEquals(2, msg.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(1, (int) msg.getExtension(Typical.myRepeatedPrimitiveExtension, 0));
+    assertEquals(2, (int) msg.getExtension(Typical.myRepeatedPrimitiveExtension, 1));
+    assertEquals(1, msg.getExtensionCount(Typical.myRepeatedExtension));
+    assertFalse(msg.hasExtension(Typical.myBoolExtension));
+    assertFalse(msg.hasExtension(MsgWithNestedExtensions.intExt));
+    assertEquals(newBuilder().build(), msg);
+    assertEquals(newBuilder().build().hashCode(), msg.hashCode());
+  }
+
+  // Sets, adds to and clears extensions, so that the map grows, is modified in
+  // place and loses an entry.
+  private static void modify(TypicalData.Builder builder) {
+    builder
+        .setExtension(Typical.myPrimitiveExtension, 21)
+        .setExtension(Typical.myRepeatedPrimitiveExtension, Arrays.asList(-1, 2))
+        .addExtension(Typical.myRepeatedPrimitiveExtension, 3)
+        .addExtension(Typical.myRepeatedExtension, newSubMessage(4))
+        .setExtension(Typical.myBoolExtension, true)
+        .setExtension(Typical.myBytesExtension, ByteString.copyFromUtf8("bytes"))
+        .setExtension(Typical.myEnumExtension, TypicalData.EnumType.VALUE1)
+        .setExtension(MsgWithNestedExtensions.intExt, 5)
+        .clearExtension(Typical.myExtension);
+  }
+
+  private static void checkModified(TypicalData msg) {
+    assertEquals(21, (int) msg.getExtension(Typical.myPrimitiveExtension));
+    assertFalse(msg.hasExtension(Typical.myExtension));
+    assertEquals(3, msg.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(-1, (int) msg.getExtension(Typical.myRepeatedPrimitiveExtension, 0));
+    assertEquals(3, (int) msg.getExtension(Typical.myRepeatedPrimitiveExtension, 2));
+    assertEquals(2, msg.getExtensionCount(Typical.myRepeatedExtension));
+    assertTrue(msg.getExtension(Typical.myBoolExtension));
+    assertEquals(5, (int) msg.getExtension(MsgWithNestedExtensions.intExt));
+  }
+
+  public void testModifyBuilderAfterBuild() throws Exception {
+    TypicalData.Builder builder = newBuilder();
+    TypicalData first = builder.build();
+    modify(builder);
+    checkOriginal(first);
+    TypicalData second = builder.build();
+    checkModified(second);
+
+    // Modifying the builder again leaves both messages unchanged.
+    builder.clearExtension(Typical.myRepeatedPrimitiveExtension)
+        .setExtension(Typical.myPrimitiveExtension, 31);
+    checkOriginal(first);
+    checkModified(second);
+    assertFalse(builder.build().hasExtension(Typical.myRepeatedPrimitiveExtension));
+  }
+
+  public void testModifyToBuilder() throws Exception {
+    TypicalData msg = newBuilder().build();
+    TypicalData.Builder builder = msg.toBuilder();
+    modify(builder);
+    checkOriginal(msg);
+    checkModified(builder.build());
+
+    // Two builders from the same message don't see each other's changes.
+    TypicalData.Builder other = msg.toBuilder();
+    other.clearExtension(Typical.myRepeatedExtension);
+    checkModified(builder.build());
+    assertEquals(0, other.build().getExtensionCount(Typical.myRepeatedExtension));
+    checkOriginal(msg);
+  }
+
+  public void testMergeIntoSharedMap() throws Exception {
+    TypicalData.Builder builder = newBuilder();
+    TypicalData built = builder.build();
+    TypicalData source = TypicalData.newBuilder()
+        .setExtension(Typical.myPrimitiveExtension, 41)
+        .addExtension(Typical.myRepeatedPrimitiveExtension, 42)
+        .addExtension(Typical.myRepeatedExtension, newSubMessage(43))
+        .setExtension(Typical.myBoolExtension, true)
+        .build();
+    builder.mergeFrom(source);
+    checkOriginal(built);
+    TypicalData merged = builder.build();
+    assertEquals(41, (int) merged.getExtension(Typical.myPrimitiveExtension));
+    assertEquals(3, merged.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(42, (int) merged.getExtension(Typical.myRepeatedPrimitiveExtension, 2));
+    assertEquals(2, merged.getExtensionCount(Typical.myRepeatedExtension));
+    assertTrue(merged.getExtension(Typical.myBoolExtension));
+
+    // The source is unchanged, and so is a message that is merged into itself.
+    assertEquals(1, source.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    TypicalData twice = built.toBuilder().mergeFrom(built).build();
+    assertEquals(4, twice.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(2, twice.getExtensionCount(Typical.myRepeatedExtension));
+    checkOriginal(built);
+  }
+
+  public void testRepeatedExtensionsAreCopied() throws Exception {
+    TypicalData msg = newBuilder().build();
+    List<Integer> ints = msg.getExtension(Typical.myRepeatedPrimitiveExtension);
+    List<TypicalDataMessage> messages = msg.getExtension(Typical.myRepeatedExtension);
+
+    TypicalData.Builder builder = msg.toBuilder();
+    for (int i = 0; i < 100; i++) {
+      builder.addExtension(Typical.myRepeatedPrimitiveExtension, i);
+      builder.addExtension(Typical.myRepeatedExtension, newSubMessage(i));
+    }
+    TypicalData modified = builder.build();
+    assertEquals(102, modified.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(99, (int) modified.getExtension(Typical.myRepeatedPrimitiveExtension, 101));
+    assertEquals(101, modified.getExtensionCount(Typical.myRepeatedExtension));
+
+    // The lists that the original message returned are unchanged.
+    assertEquals(2, ints.size());
+    assertEquals(2, (int) ints.get(1));
+    assertEquals(1, messages.size());
+    checkOriginal(msg);
+  }
+
+  public void testSerializeAfterModifyingShared() throws Exception {
+    TypicalData.Builder builder = newBuilder();
+    TypicalData msg = builder.build();
+    byte[] bytes = msg.toByteArray();
+    modify(builder);
+    checkBytes(bytes, msg.toByteArray());
+    TypicalData modified = builder.build();
+    assertEquals(modified, TypicalData.parseFrom(modified.toByteArray(), registry()));
+    assertEquals(msg, TypicalData.parseFrom(bytes, registry()));
+  }
+
+  private static ExtensionRegistry registry() {
+    ExtensionRegistry registry = ExtensionRegistry.newInstance();
+    Typical.registerAllExtensions(registry);
+    return registry;
+  }
+}
@@ -0,0 +1,189 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.util.ArrayList;
+import java.util.List;
+import protos.FastPathMsg;
+
+/*-[
+#include "com/google/protobuf/Descriptors_PackagePrivate.h"
+]-*/
+
+/**
+ * Compares the parse and serialize functions that the plugin generates with
+ * the "generate_fast_paths" option against the descriptor-driven ones. The
+ * protos are only generated with fast paths by "make test_objc_fast_paths",
+ * which sets PROTOBUF_TESTS_FAST_PATHS. Otherwise both sides of each
+ * comparison use the descriptor-driven code.
+ */
+public class FastPathTest extends ProtobufTest {
+
+  private static native boolean hasFastPath() /*-[
+    return [ProtosFastPathMsg getDescriptor]->fastPath_.merge != NULL;
+  ]-*/;
+
+  // The *Generic methods run with the fast paths of FastPathMsg removed.
+
+  private static native byte[] toByteArrayGeneric(FastPathMsg msg) /*-[
+    CGPDescriptor *descriptor = [ProtosFastPathMsg getDescriptor];
+    CGPFastPath saved = descriptor->fastPath_;
+    descriptor->fastPath_ = (CGPFastPath){};
+    @try {
+      return [msg toByteArray];
+    } @finally {
+      descriptor->fastPath_ = saved;
+    }
+  ]-*/;
+
+  private static native int getSerializedSizeGeneric(FastPathMsg msg) /*-[
+    CGPDescriptor *descriptor = [ProtosFastPathMsg getDescriptor];
+    CGPFastPath saved = descriptor->fastPath_;
+    descriptor->fastPath_ = (CGPFastPath){};
+    @try {
+      return [msg getSerializedSize];
+    } @finally {
+      descriptor->fastPath_ = saved;
+    }
+  ]-*/;
+
+  private static native FastPathMsg parseGeneric(byte[] bytes)
+      throws InvalidProtocolBufferException /*-[
+    CGPDescriptor *descriptor = [ProtosFastPathMsg getDescriptor];
+    CGPFastPath saved = descriptor->fastPath_;
+    descriptor->fastPath_ = (CGPFastPath){};
+    @try {
+      return [ProtosFastPathMsg parseFromWithByteArray:bytes];
+    } @finally {
+      descriptor->fastPath_ = saved;
+    }
+  ]-*/;
+
+  private static FastPathMsg.Builder newScalars(int seed) {
+    return FastPathMsg.newBuilder()
+        .setInt32F(-seed)
+        .setUint32F(0x80000000 | seed)
+        .setSint32F(Integer.MIN_VALUE + seed)
+        .setFixed32F(-1)
+        .setSfixed32F(seed)
+        .setInt64F(Long.MIN_VALUE)
+        .setUint64F(-1L)
+        .setSint64F(-seed * 1000000007L)
+        .setFixed64F(Long.MAX_VALUE)
+        .setSfixed64F(-seed)
+        .setBoolF(true)
+        .setFloatF(-0.0f)
+        .setDoubleF(Double.MIN_VALUE)
+        .setEnumF(FastPathMsg.Color.BLUE)
+        .setInt32Big(seed)
+        .setDoubleBig(1.0 / (seed + 1));
+  }
+
+  private static List<FastPathMsg.Builder> newBuilders() {
+    List<FastPathMsg.Builder> builders = new ArrayList<>();
+    builders.add(FastPathMsg.newBuilder());
+    builders.add(newScalars(1));
+    // Zero values are written when set.
+    builders.add(FastPathMsg.newBuilder().setInt32F(0).setDoubleF(0).setBoolF(false)
+        .setEnumF(FastPathMsg.Color.RED).setStringF("").setBytesF(ByteString.EMPTY));
+    builders.add(newScalars(2)
+        .setStringF("caf\u00e9 \ud83d\ude00")
+        .setBytesF(ByteString.copyFrom(new byte[] { 0, -1, 2 }))
+        .setMsgF(newScalars(3).setMsgF(newScalars(4)))
+        .addInt32R(-1).addInt32R(0).addInt32R(300)
+        .addSint64R(Long.MIN_VALUE).addSint64R(5)
+        .addDoubleR(1.5).addDoubleR(-0.0)
+        .addFixed32R(7)
+        .addStringR("a").addStringR("")
+        .addMsgR(newScalars(5)).addMsgR(FastPathMsg.getDefaultInstance())
+        .addEnumR(FastPathMsg.Color.GREEN).addEnumR(FastPathMsg.Color.RED)
+        .setOneofMsg(newScalars(6).setOneofString("inner"))
+        .putStringIntMap("x", 1).putStringIntMap("", -1));
+    builders.add(newScalars(7).setOneofInt(0));
+    builders.add(newScalars(8).setOneofString("oneof"));
+    return builders;
+  }
+
+  public void testFastPathsArePresent() {
+    assertEquals("yes".equalsIgnoreCase(System.getenv("PROTOBUF_TESTS_FAST_PATHS")),
+        hasFastPath());
+  }
+
+  public void testSerializeMatchesGeneric() throws Exception {
+    for (FastPathMsg.Builder builder : newBuilders()) {
+      // Separate instances, so that neither reuses the other's memoized sizes.
+      FastPathMsg msg = builder.build();
+      FastPathMsg genericMsg = builder.build();
+      byte[] expected = toByteArrayGeneric(genericMsg);
+      assertEquals(expected.length, getSerializedSizeGeneric(builder.build()));
+      assertEquals(expected.length, msg.getSerializedSize());
+      checkBytes(expected, msg.toByteArray());
+    }
+  }
+
+  public void testParseMatchesGeneric() throws Exception {
+    for (FastPathMsg.Builder builder : newBuilders()) {
+      FastPathMsg msg = builder.build();
+      byte[] bytes = msg.toByteArray();
+      FastPathMsg parsed = FastPathMsg.parseFrom(bytes);
+      FastPathMsg genericParsed = parseGeneric(bytes);
+      assertEquals(genericParsed, parsed);
+      assertEquals(msg, parsed);
+      assertEquals(genericParsed.hashCode(), parsed.hashCode());
+      assertEquals(genericParsed.getChoiceCase(), parsed.getChoiceCase());
+      assertEquals(genericParsed.hasDoubleF(), parsed.hasDoubleF());
+      checkBytes(toByteArrayGeneric(genericParsed), parsed.toByteArray());
+    }
+  }
+
+  public void testParseWithUnknownFieldsMatchesGeneric() throws Exception {
+    byte[] known = newScalars(9).setStringF("s").build().toByteArray();
+    byte[] unknown = asBytes(new int[] {
+      0xF8, 0x01, 0x05,  // Field 31, which is the oneof int, as a varint.
+      0xA8, 0x1F, 0x01,  // Field 501, varint.
+      0xB2, 0x1F, 0x02, 0x41, 0x42,  // Field 502, length-delimited.
+      0x08, 0x07,  // Field 1 again, the last value wins.
+    });
+    byte[] bytes = new byte[known.length + unknown.length];
+    System.arraycopy(known, 0, bytes, 0, known.length);
+    System.arraycopy(unknown, 0, bytes, known.length, unknown.length);
+    FastPathMsg parsed = FastPathMsg.parseFrom(bytes);
+    FastPathMsg genericParsed = parseGeneric(bytes);
+    assertEquals(genericParsed.getAllFields(), parsed.getAllFields());
+    assertEquals(7, parsed.getInt32F());
+    assertEquals(5, parsed.getOneofInt());
+  }
+
+  public void testMalformedInputIsRejected() throws Exception {
+    byte[] bytes = newBuilders().get(3).build().toByteArray();
+    for (int length = 1; length < bytes.length; length += 7) {
+      byte[] truncated = new byte[length];
+      System.arraycopy(bytes, 0, truncated, 0, length);
+      boolean genericFailed = false;
+      try {
+        parseGeneric(truncated);
+      } catch (InvalidProtocolBufferException e) {
+        genericFailed = true;
+      }
+      boolean failed = false;
+      try {
+        FastPathMsg.parseFrom(truncated);
+      } catch (InvalidProtocolBufferException e) {
+        failed = true;
+      }
+      assertEquals("length " + length, genericFailed, failed);
+    }
+  }
+}
@@ -0,0 +1,446 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.InvalidProtocolBufferException;
+import com.google.protobuf.Message;
+import com.google.protobuf.MessageOrBuilder;
+import protos.MapMsg;
+import protos.MapValue;
+import protos.MessageData;
+import protos.OneofFoo;
+import protos.OneofMsg;
+import protos.Typical;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+
+/*-[
+#include "com/google/protobuf/JsonFormat.h"
+]-*/
+
+/**
+ * Tests for the JSON printer and parser in JsonFormat.h, which only exist in the
+ * Objective-C runtime.
+ */
+public class JsonFormatTest extends ProtobufTest {
+
+  private static native String print(MessageOrBuilder message) /*-[
+    return CGPJsonFormatPrint(message);
+  ]-*/;
+
+  private static native Object parse(Class<?> cls, String json, boolean ignoreUnknownFields)
+      throws InvalidProtocolBufferException /*-[
+    return CGPJsonFormatParse(cls.objcClass, [json dataUsingEncoding:NSUTF8StringEncoding],
+                              ignoreUnknownFields ? CGPJsonParseIgnoreUnknownFields : 0);
+  ]-*/;
+
+  private static native void merge(Message.Builder builder, String json)
+      throws InvalidProtocolBufferException /*-[
+    CGPJsonFormatMerge((ComGoogleProtobufGeneratedMessage_Builder *)builder,
+                       [json dataUsingEncoding:NSUTF8StringEncoding], 0);
+  ]-*/;
+
+  private static TypicalData parseTypical(String json) throws InvalidProtocolBufferException {
+    return (TypicalData) parse(TypicalData.class, json, false);
+  }
+
+  private static void assertInvalid(Class<?> cls, String json) {
+    try {
+      parse(cls, json, false);
+      fail("Expected InvalidProtocolBufferException for " + json);
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+
+  private static void assertRoundTrip(Message msg) throws Exception {
+    assertEquals(msg, parse(msg.getClass(), print(msg), false));
+  }
+
+  public void testEmptyMessage() throws Exception {
+    assertEquals("{}", print(TypicalData.getDefaultInstance()));
+    assertEquals(TypicalData.getDefaultInstance(), parseTypical(" { } "));
+  }
+
+  public void testScalars() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyInt(-5)
+        .setMyBool(true)
+        .setMyFloat(1.5f)
+        .setMyDouble(0.1)
+        .setMyString("abc")
+        .setMyUint(-1)
+        .build();
+    String json =
+        "{\"myInt\":-5,\"myBool\":true,\"myFloat\":1.5,\"myDouble\":0.1,\"myString\":\"abc\","
+        + "\"myUint\":4294967295}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parseTypical(json));
+    // Integral floating point values are written without a fraction.
+    assertEquals("{\"myFloat\":2}", print(TypicalData.newBuilder().setMyFloat(2).build()));
+    // The parser also accepts the proto field names.
+    assertEquals(msg, parseTypical(
+        "{\"my_int\":-5,\"my_bool\":true,\"my_float\":1.5,\"my_double\":0.1,"
+        + "\"my_string\":\"abc\",\"my_uint\":4294967295}"));
+  }
+
+  public void test64BitIntegersAreStrings() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyLong(Long.MIN_VALUE)
+        .setMyUlong(-1L)
+        .addRepeatedInt64(1)
+        .addRepeatedUint64(Long.MIN_VALUE)
+        .build();
+    String json = "{\"myLong\":\"-9223372036854775808\",\"myUlong\":\"18446744073709551615\","
+        + "\"repeatedInt64\":[\"1\"],\"repeatedUint64\":[\"9223372036854775808\"]}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parseTypical(json));
+    // Numbers are accepted too, as are strings for 32-bit integers.
+    assertEquals(TypicalData.newBuilder().setMyLong(12).setMyInt(3).build(),
+        parseTypical("{\"myLong\":12,\"myInt\":\"3\"}"));
+    assertEquals(TypicalData.newBuilder().setMyLong(100).build(),
+        parseTypical("{\"myLong\":1e2}"));
+  }
+
+  public void testIntegerRanges() throws Exception {
+    assertEquals(Integer.MIN_VALUE, parseTypical("{\"myInt\":-2147483648}").getMyInt());
+    assertInvalid(TypicalData.class, "{\"myInt\":2147483648}");
+    assertInvalid(TypicalData.class, "{\"myUint\":-1}");
+    assertInvalid(TypicalData.class, "{\"myUint\":4294967296}");
+    assertInvalid(TypicalData.class, "{\"myLong\":\"9223372036854775808\"}");
+    assertInvalid(TypicalData.class, "{\"myUlong\":\"18446744073709551616\"}");
+    assertInvalid(TypicalData.class, "{\"myInt\":1.5}");
+  }
+
+  public void testIntegersWithFractionsAndExponents() throws Exception {
+    // Values above 2^53 are exact, not rounded through a double.
+    assertEquals(9007199254740993L,
+        parseTypical("{\"myLong\":\"9007199254740993.0\"}").getMyLong());
+    assertEquals(9007199254740993L, parseTypical("{\"myLong\":9007199254740993.0}").getMyLong());
+    assertEquals(-9223372036854775807L,
+        parseTypical("{\"myLong\":\"-9.223372036854775807e18\"}").getMyLong());
+    assertEquals(-9223372036854775808L,
+        parseTypical("{\"myLong\":-92233720368547758080e-1}").getMyLong());
+    assertEquals(Long.MAX_VALUE,
+        parseTypical("{\"myLong\":9223372036854775807.000}").getMyLong());
+    assertEquals(-8446744073709551616L, parseTypical("{\"myUlong\":1e19}").getMyUlong());
+    assertEquals(-1L, parseTypical("{\"myUlong\":\"1.8446744073709551615E19\"}").getMyUlong());
+    assertEquals(15, parseTypical("{\"myInt\":1.50e1}").getMyInt());
+    assertEquals(100, parseTypical("{\"myInt\":1E+2}").getMyInt());
+    assertEquals(0, parseTypical("{\"myInt\":0e99999999999}").getMyInt());
+    assertEquals(-2147483648, parseTypical("{\"myInt\":-2.147483648e9}").getMyInt());
+
+    assertInvalid(TypicalData.class, "{\"myLong\":9223372036854775807.5}");
+    assertInvalid(TypicalData.class, "{\"myLong\":1e19}");
+    assertInvalid(TypicalData.class, "{\"myUlong\":1e20}");
+    assertInvalid(TypicalData.class, "{\"myUlong\":18446744073709551615.1}");
+    assertInvalid(TypicalData.class, "{\"myInt\":15e-1}");
+    assertInvalid(TypicalData.class, "{\"myInt\":1e-99999999999}");
+    assertInvalid(TypicalData.class, "{\"myInt\":2.147483648e9}");
+    assertInvalid(TypicalData.class, "{\"myInt\":1e}");
+    assertInvalid(TypicalData.class, "{\"myInt\":\"-\"}");
+  }
+
+  public void testNonFiniteFloatingPoint() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyFloat(Float.NEGATIVE_INFINITY)
+        .setMyDouble(Double.NaN)
+        .addRepeatedDouble(Double.POSITIVE_INFINITY)
+        .build();
+    String json = "{\"repeatedDouble\":[\"Infinity\"],\"myFloat\":\"-Infinity\","
+        + "\"myDouble\":\"NaN\"}";
+    assertEquals(json, print(msg));
+    TypicalData parsed = parseTypical(json);
+    assertEquals(Float.NEGATIVE_INFINITY, parsed.getMyFloat());
+    assertTrue(Double.isNaN(parsed.getMyDouble()));
+    assertEquals(Double.POSITIVE_INFINITY, parsed.getRepeatedDouble(0));
+    // strtod() spellings that the JSON mapping doesn't allow.
+    assertInvalid(TypicalData.class, "{\"myDouble\":\"nan\"}");
+    assertInvalid(TypicalData.class, "{\"myDouble\":\"inf\"}");
+    assertInvalid(TypicalData.class, "{\"myDouble\":\"0x10\"}");
+    assertInvalid(TypicalData.class, "{\"myFloat\":1e39}");
+  }
+
+  public void testBytesAreBase64() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyBytes(ByteString.copyFrom(new byte[] { 1, 2, 3, 4 }))
+        .addRepeatedBytes(ByteString.copyFrom(new byte[] { 1, 2, 3 }))
+        .addRepeatedBytes(ByteString.copyFrom(new byte[] { (byte) 0xfb, (byte) 0xff }))
+        .addRepeatedBytes(ByteString.EMPTY)
+        .build();
+    String json = "{\"myBytes\":\"AQIDBA==\",\"repeatedBytes\":[\"AQID\",\"+/8=\",\"\"]}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parseTypical(json));
+    // URL-safe and unpadded base64.
+    assertEquals(msg, parseTypical(
+        "{\"myBytes\":\"AQIDBA\",\"repeatedBytes\":[\"AQID\",\"-_8\",\"\"]}"));
+    assertInvalid(TypicalData.class, "{\"myBytes\":\"A\"}");
+    assertInvalid(TypicalData.class, "{\"myBytes\":\"AQ*D\"}");
+  }
+
+  public void testStringEscapes() throws Exception {
+    TypicalData msg = TypicalData.newBuilder().setMyString("a\"b\\c\n\t\u0001\u00e9").build();
+    String json = "{\"myString\":\"a\\\"b\\\\c\\n\\t\\u0001\u00e9\"}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parseTypical(json));
+    assertEquals(msg, parseTypical("{\"myString\":\"a\\\"b\\\\c\\n\\t\\u0001\\u00e9\"}"));
+  }
+
+  public void testEnums() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyEnumType(TypicalData.EnumType.VALUE2)
+        .addRepeatedEnum(TypicalData.EnumType.VALUE9)
+        .addRepeatedEnum(TypicalData.EnumType.VALUE1)
+        .build();
+    String json = "{\"myEnumType\":\"VALUE2\",\"repeatedEnum\":[\"VALUE9\",\"VALUE1\"]}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parseTypical(json));
+    // Enums can also be given by number.
+    assertEquals(msg, parseTypical("{\"myEnumType\":2,\"repeatedEnum\":[9,\"VALUE1\"]}"));
+
+    assertInvalid(TypicalData.class, "{\"myEnumType\":\"VALUE5\"}");
+    assertInvalid(TypicalData.class, "{\"myEnumType\":5}");
+    // Unknown values are dropped when unknown fields are ignored.
+    TypicalData parsed = (TypicalData) parse(
+        TypicalData.class, "{\"myEnumType\":\"VALUE5\",\"repeatedEnum\":[5,3]}", true);
+    assertFalse(parsed.hasMyEnumType());
+    assertEquals(1, parsed.getRepeatedEnumCount());
+    assertEquals(TypicalData.EnumType.VALUE3, parsed.getRepeatedEnum(0));
+  }
+
+  public void testMessageFields() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(1))
+        .addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(2))
+        .addRepeatedMessage(TypicalDataMessage.getDefaultInstance())
+        .build();
+    String json = "{\"myMessage\":{\"myMessageInt\":1},"
+        + "\"repeatedMessage\":[{\"myMessageInt\":2},{}]}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parseTypical(json));
+    // null leaves a field unset.
+    assertEquals(TypicalData.newBuilder().setMyInt(1).build(),
+        parseTypical("{\"myMessage\":null,\"myInt\":1,\"repeatedInt32\":null}"));
+  }
+
+  public void testMaps() throws Exception {
+    MapMsg msg = MapMsg.newBuilder()
+        .putStringString("b", "x")
+        .putStringString("a", "y")
+        .putIntInt(-1, 2)
+        .putIntMessage(3, MapValue.newBuilder().setFoo("z").build())
+        .putBoolEnum(true, MapMsg.Color.RED)
+        .build();
+    // Keys are always strings, and entries are written in insertion order.
+    String json = "{\"stringString\":{\"b\":\"x\",\"a\":\"y\"},\"intInt\":{\"-1\":2},"
+        + "\"intMessage\":{\"3\":{\"foo\":\"z\"}},\"boolEnum\":{\"true\":\"RED\"}}";
+    assertEquals(json, print(msg));
+    assertEquals(msg, parse(MapMsg.class, json, false));
+
+    // A repeated key replaces the earlier value.
+    MapMsg parsed = (MapMsg) parse(MapMsg.class, "{\"intString\":{\"1\":\"a\",\"1\":\"b\"}}", false);
+    assertEquals(1, parsed.getIntStringCount());
+    assertEquals("b", parsed.getIntStringOrThrow(1));
+
+    assertInvalid(MapMsg.class, "{\"intInt\":{\"a\":1}}");
+    assertInvalid(MapMsg.class, "{\"intInt\":{\"2147483648\":1}}");
+    assertInvalid(MapMsg.class, "{\"boolEnum\":{\"1\":\"RED\"}}");
+    assertInvalid(MapMsg.class, "{\"intInt\":[1]}");
+  }
+
+  public void testOneofs() throws Exception {
+    OneofMsg msg = OneofMsg.newBuilder().setOneofInt(5).build();
+    assertEquals("{\"oneofInt\":5}", print(msg));
+    assertEquals(msg, parse(OneofMsg.class, "{\"oneofInt\":5}", false));
+
+    msg = OneofMsg.newBuilder().setOneofMessage(OneofFoo.newBuilder().setFoo("f")).build();
+    assertEquals("{\"oneofMessage\":{\"foo\":\"f\"}}", print(msg));
+    assertRoundTrip(msg);
+
+    // The last member of the oneof that is given is the one that is set.
+    OneofMsg parsed = (OneofMsg) parse(
+        OneofMsg.class, "{\"oneofString\":\"s\",\"oneofMessage\":{},\"oneofInt\":7}", false);
+    assertEquals(OneofMsg.OneofGroupCase.ONEOF_INT, parsed.getOneofGroupCase());
+    assertEquals(7, parsed.getOneofInt());
+    assertFalse(parsed.hasOneofString());
+    assertFalse(parsed.hasOneofMessage());
+  }
+
+  public void testIgnoredEnumKeepsOneof() throws Exception {
+    // An unknown enum value that is dropped doesn't clear another member of
+    // its oneof.
+    OneofMsg parsed = (OneofMsg) parse(
+        OneofMsg.class, "{\"oneofString\":\"s\",\"oneofColor\":\"BLUE\"}", true);
+    assertEquals(OneofMsg.OneofGroupCase.ONEOF_STRING, parsed.getOneofGroupCase());
+    assertEquals("s", parsed.getOneofString());
+    parsed = (OneofMsg) parse(OneofMsg.class, "{\"oneofInt\":3,\"oneofColor\":9}", true);
+    assertEquals(OneofMsg.OneofGroupCase.ONEOF_INT, parsed.getOneofGroupCase());
+    assertEquals(3, parsed.getOneofInt());
+    parsed = (OneofMsg) parse(
+        OneofMsg.class, "{\"oneofMessage\":{\"foo\":\"f\"},\"oneofColor\":\"BLUE\"}", true);
+    assertEquals("f", parsed.getOneofMessage().getFoo());
+
+    // A known value replaces the other member.
+    parsed = (OneofMsg) parse(
+        OneofMsg.class, "{\"oneofString\":\"s\",\"oneofColor\":\"GREEN\"}", false);
+    assertEquals(OneofMsg.OneofGroupCase.ONEOF_COLOR, parsed.getOneofGroupCase());
+    assertEquals(OneofMsg.Color.GREEN, parsed.getOneofColor());
+    assertFalse(parsed.hasOneofString());
+
+    // A value that fails to parse leaves the builder's oneof as it was.
+    OneofMsg.Builder builder = OneofMsg.newBuilder().setOneofString("kept");
+    try {
+      merge(builder, "{\"oneofInt\":\"x\"}");
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+    assertEquals("kept", builder.getOneofString());
+  }
+
+  public void testExtensionsAreIgnored() throws Exception {
+    TypicalData msg = TypicalData.newBuilder()
+        .setMyInt(1)
+        .setExtension(Typical.myPrimitiveExtension, 2)
+        .setExtension(Typical.myExtension, TypicalDataMessage.getDefaultInstance())
+        .build();
+    assertEquals("{\"myInt\":1}", print(msg));
+    // Extensions aren't fields of the message, so they are unknown to the parser.
+    assertInvalid(TypicalData.class, "{\"myPrimitiveExtension\":2}");
+    assertInvalid(TypicalData.class, "{\"[protos.my_primitive_extension]\":2}");
+  }
+
+  public void testUnknownFields() throws Exception {
+    String json = "{\"noSuchField\":{\"a\":[1,\"x\",{\"b\":null}],\"c\":true},\"myInt\":3,"
+        + "\"other\":-1.5e3}";
+    assertInvalid(TypicalData.class, json);
+    assertInvalid(TypicalData.class, "{\"myint\":3}");
+    assertEquals(TypicalData.newBuilder().setMyInt(3).build(),
+        parse(TypicalData.class, json, true));
+    // Skipped values must still be well formed.
+    try {
+      parse(TypicalData.class, "{\"noSuchField\":[1,}", true);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+
+  public void testMalformedInput() throws Exception {
+    for (String json : new String[] {
+        "", "[]", "{", "{\"myInt\":1", "{\"myInt\":1,}", "{\"myInt\" 1}", "{myInt:1}",
+        "{\"myInt\":1} x", "{\"myBool\":1}", "{\"myString\":1}", "{\"repeatedInt32\":1}",
+        "{\"myMessage\":1}", "{\"myString\":\"\\x\"}" }) {
+      assertInvalid(TypicalData.class, json);
+    }
+  }
+
+  // Returns a MessageData object nested depth levels deep.
+  private static String nestedJson(int depth) {
+    StringBuilder json = new StringBuilder("{");
+    for (int i = 1; i < depth; i++) {
+      json.append("\"recursiveMsgF\":{");
+    }
+    for (int i = 0; i < depth; i++) {
+      json.append('}');
+    }
+    return json.toString();
+  }
+
+  // Returns an unknown field whose value is nested depth levels deep, in a
+  // message.
+  private static String nestedUnknownJson(int depth) {
+    StringBuilder json = new StringBuilder("{\"unknown\":");
+    for (int i = 1; i < depth; i++) {
+      json.append(i % 2 == 0 ? "[" : "{\"a\":");
+    }
+    json.append("1");
+    for (int i = depth - 1; i >= 1; i--) {
+      json.append(i % 2 == 0 ? "]" : "}");
+    }
+    json.append('}');
+    return json.toString();
+  }
+
+  public void testMaxDepth() throws Exception {
+    // JSON_MAX_DEPTH is 100.
+    MessageData parsed = (MessageData) parse(MessageData.class, nestedJson(100), false);
+    int depth = 1;
+    for (MessageData msg = parsed; msg.hasRecursiveMsgF(); msg = msg.getRecursiveMsgF()) {
+      depth++;
+    }
+    assertEquals(100, depth);
+    assertEquals(parsed, parse(MessageData.class, print(parsed), false));
+    assertInvalid(MessageData.class, nestedJson(101));
+
+    parse(MessageData.class, nestedUnknownJson(100), true);
+    try {
+      parse(MessageData.class, nestedUnknownJson(101), true);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+
+  public void testMergeIntoBuilder() throws Exception {
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyInt(1)
+        .addRepeatedInt32(1)
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(2));
+    merge(builder, "{\"myString\":\"s\",\"repeatedInt32\":[2],\"myMessage\":{}}");
+    assertEquals(TypicalData.newBuilder()
+        .setMyInt(1)
+        .setMyString("s")
+        .addRepeatedInt32(1)
+        .addRepeatedInt32(2)
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(2))
+        .build(), builder.build());
+    assertEquals(print(builder.build()), print(builder));
+  }
+
+  public void testRoundTripAllFields() throws Exception {
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyInt(Integer.MIN_VALUE)
+        .setMyBytes(ByteString.copyFromUtf8("bytes \u0000 \u00ff"))
+        .setMyEnumType(TypicalData.EnumType.VALUE4)
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(Integer.MAX_VALUE))
+        .setMyBool(false)
+        .setMyFloat(Float.MIN_VALUE)
+        .setMyDouble(-Double.MAX_VALUE)
+        .setMyString("\u4e2d\u6587 \ud83d\ude00")
+        .setMyUint(Integer.MIN_VALUE)
+        .setMyLong(Long.MAX_VALUE)
+        .setMyUlong(Long.MIN_VALUE);
+    for (int i = 0; i < 3; i++) {
+      builder.addRepeatedInt32(-i)
+          .addRepeatedBool(i == 1)
+          .addRepeatedFloat(i / 3f)
+          .addRepeatedDouble(i / 3.0)
+          .addRepeatedString("s" + i)
+          .addRepeatedBytes(ByteString.copyFrom(new byte[i]))
+          .addRepeatedEnum(TypicalData.EnumType.VALUE3)
+          .addRepeatedInt64(Long.MIN_VALUE + i)
+          .addRepeatedUint32(-i)
+          .addRepeatedUint64(-i)
+          .addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i));
+    }
+    assertRoundTrip(builder.build());
+    assertRoundTrip(MapMsg.newBuilder()
+        .putStringInt("", 0)
+        .putStringMessage("m", MapValue.newBuilder().setFoo("").build())
+        .putIntString(Integer.MIN_VALUE, "min")
+        .putBoolEnum(false, MapMsg.Color.GREEN)
+        .build());
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.io.ByteArrayOutputStream;
+import protos.MessageData;
+
+/**
+ * Tests for +parseLazilyFromByteArray:registry:, which only exists in the
+ * Objective-C runtime. Singular message fields are parsed on first access.
+ */
+public class LazyParseTest extends ProtobufTest {
+
+  private static native MessageData parseLazily(byte[] bytes)
+      throws InvalidProtocolBufferException /*-[
+    return [ProtosMessageData parseLazilyFromByteArray:bytes registry:nil];
+  ]-*/;
+
+  private static MessageData newMessage(int depth) {
+    MessageData.Builder builder = MessageData.newBuilder()
+        .setMsgF(MessageData.SubMsg.newBuilder().setIntF(depth).setUintF(depth * 2))
+        .setInnerMsgF(MessageData.SubMsg.InnerMsg.newBuilder().setIntF(-depth))
+        .addMsgR(MessageData.SubMsg.newBuilder().setIntF(100 + depth));
+    if (depth > 0) {
+      builder.setRecursiveMsgF(newMessage(depth - 1));
+    }
+    return builder.build();
+  }
+
+  public void testEqualsNormalParse() throws Exception {
+    MessageData msg = newMessage(3);
+    byte[] bytes = msg.toByteArray();
+    MessageData lazy = parseLazily(bytes);
+    // Unparsed fields serialize to their saved bytes.
+    checkBytes(bytes, lazy.toByteArray());
+    assertEquals(bytes.length, lazy.getSerializedSize());
+
+    MessageData expected = MessageData.parseFrom(bytes);
+    assertEquals(expected, lazy);
+    assertEquals(expected.hashCode(), lazy.hashCode());
+    assertEquals(3, lazy.getMsgF().getIntF());
+    assertEquals(-2, lazy.getRecursiveMsgF().getInnerMsgF().getIntF());
+    assertEquals(0, lazy.getRecursiveMsgF().getRecursiveMsgF().getRecursiveMsgF().getMsgF()
+        .getIntF());
+    assertFalse(lazy.getRecursiveMsgF().getRecursiveMsgF().getRecursiveMsgF()
+        .hasRecursiveMsgF());
+    assertEquals(msg, lazy);
+    checkBytes(bytes, lazy.toByteArray());
+    assertEquals(expected.toString(), lazy.toString());
+    assertEquals(msg, lazy.toBuilder().build());
+  }
+
+  public void testInputMayBeModified() throws Exception {
+    MessageData msg = newMessage(2);
+    byte[] bytes = msg.toByteArray();
+    MessageData lazy = parseLazily(bytes);
+    for (int i = 0; i < bytes.length; i++) {
+      bytes[i] = 0;
+    }
+    assertEquals(msg, lazy);
+    checkBytes(msg.toByteArray(), lazy.toByteArray());
+  }
+
+  public void testMalformedFieldThrowsWhenAccessed() throws Exception {
+    // A valid msg_f, then a recursive_msg_f whose int_f is a truncated varint.
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    MessageData.newBuilder()
+        .setMsgF(MessageData.SubMsg.newBuilder().setIntF(5))
+        .build().writeTo(out);
+    byte[] malformedField = asBytes(new int[] { 0x1A, 0x03, 0x08, 0x80, 0x80 });
+    out.write(malformedField);
+    byte[] bytes = out.toByteArray();
+
+    try {
+      MessageData.parseFrom(bytes);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+
+    // The lazy parse only fails when the field's value is needed.
+    MessageData lazy = parseLazily(bytes);
+    assertTrue(lazy.hasRecursiveMsgF());
+    assertEquals(5, lazy.getMsgF().getIntF());
+    checkBytes(bytes, lazy.toByteArray());
+    // The failure isn't remembered, every access throws.
+    for (int i = 0; i < 2; i++) {
+      try {
+        lazy.getRecursiveMsgF();
+        fail("Expected InvalidProtocolBufferException");
+      } catch (Exception e) {
+        assertTrue(e.toString(), e instanceof InvalidProtocolBufferException);
+      }
+    }
+    // So does anything else that needs the value.
+    try {
+      lazy.hashCode();
+      fail("Expected InvalidProtocolBufferException");
+    } catch (Exception e) {
+      assertTrue(e.toString(), e instanceof InvalidProtocolBufferException);
+    }
+  }
+}
@@ -21,6 +21,7 @@ import com.google.protobuf.MapEntry;
 import java.io.ByteArrayInputStream;
 import java.io.ByteArrayOutputStream;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.List;
 import java.util.Map;
 import protos.MapMsg;
@@ -262,6 +263,128 @@ public class MapsTest extends ProtobufTest {
     assertEquals("meow", builder.getStringStringOrThrow("cat"));
   }
 
+  public void testDuplicateKeysInParsedInput() throws Exception {
+    // Concatenated messages are merged, so the input has two entries with the
+    // key "duck" and two with the key 7.
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    MapMsg.newBuilder()
+        .putStringString("duck", "quack")
+        .putStringString("cat", "meow")
+        .putIntInt(7, 49)
+        .putIntInt(8, 64)
+        .build().writeTo(out);
+    MapMsg.newBuilder()
+        .putStringString("owl", "hoot")
+        .putStringString("duck", "QUACK")
+        .putIntInt(7, 50)
+        .build().writeTo(out);
+    MapMsg msg = MapMsg.parseFrom(out.toByteArray());
+
+    // The last value wins, in the position of the first entry with the key.
+    assertEquals(3, msg.getStringStringCount());
+    assertEquals("QUACK", msg.getStringStringOrThrow("duck"));
+    assertEquals(Arrays.asList("duck", "cat", "owl"), mapKeys(msg.getStringStringMap()));
+    assertEquals(Arrays.asList("duck", "cat", "owl"), entryKeys(msg, 1));
+    assertEquals(2, msg.getIntIntCount());
+    assertEquals(50, msg.getIntIntOrThrow(7));
+    assertEquals(Arrays.asList(7, 8), mapKeys(msg.getIntIntMap()));
+    assertEquals(Arrays.asList(7, 8), entryKeys(msg, 5));
+
+    MapMsg expected = MapMsg.newBuilder()
+        .putStringString("duck", "QUACK")
+        .putStringString("cat", "meow")
+        .putStringString("owl", "hoot")
+        .putIntInt(7, 50)
+        .putIntInt(8, 64)
+        .build();
+    assertEquals(expected, msg);
+    checkBytes(expected.toByteArray(), msg.toByteArray());
+  }
+
+  public void testRemoveThenIterate() throws Exception {
+    MapMsg.Builder builder = MapMsg.newBuilder();
+    for (int i = 0; i < 20; i++) {
+      builder.putIntString(i, Integer.toString(i));
+    }
+    List<Integer> expectedKeys = new ArrayList<>();
+    for (int i = 0; i < 20; i++) {
+      if (i % 3 == 0) {
+        builder.removeIntString(i);
+      } else {
+        expectedKeys.add(i);
+      }
+    }
+    // Removing a key that isn't in the map does nothing.
+    builder.removeIntString(100);
+    assertEquals(expectedKeys.size(), builder.getIntStringCount());
+    assertEquals(expectedKeys, mapKeys(builder.getIntStringMap()));
+    assertEquals(expectedKeys, entryKeys(builder, 4));
+    for (Map.Entry<Integer, String> entry : builder.getIntStringMap().entrySet()) {
+      assertEquals(Integer.toString(entry.getKey()), entry.getValue());
+    }
+
+    // A key that is put again after it was removed goes at the end.
+    builder.putIntString(3, "three");
+    expectedKeys.add(3);
+    assertEquals(expectedKeys, mapKeys(builder.getIntStringMap()));
+    assertEquals(expectedKeys, entryKeys(builder, 4));
+    MapMsg msg = builder.build();
+    assertEquals(expectedKeys, mapKeys(msg.getIntStringMap()));
+    assertEquals(expectedKeys, mapKeys(MapMsg.parseFrom(msg.toByteArray()).getIntStringMap()));
+
+    builder = msg.toBuilder();
+    for (int key : expectedKeys) {
+      builder.removeIntString(key);
+    }
+    assertEquals(0, builder.getIntStringCount());
+    assertFalse(builder.getIntStringMap().entrySet().iterator().hasNext());
+    assertEquals(0, entryKeys(builder, 4).size());
+    // The message that the builder was made from is unchanged.
+    assertEquals(expectedKeys, mapKeys(msg.getIntStringMap()));
+  }
+
+  public void testMergeFromMessageWithSameKeys() throws Exception {
+    MapMsg other = MapMsg.newBuilder()
+        .putStringString("cat", "purr")
+        .putStringString("owl", "hoot")
+        .putStringMessage("abc", MapValue.newBuilder().setFoo("XYZ").build())
+        .putIntInt(9, 81)
+        .putIntInt(7, 0)
+        .build();
+    MapMsg.Builder builder = getFilledMessage().toBuilder();
+    builder.mergeFrom(other);
+    MapMsg msg = builder.build();
+
+    // Values of existing keys are replaced in place, and new keys are appended.
+    assertEquals(3, msg.getStringStringCount());
+    assertEquals("quack", msg.getStringStringOrThrow("duck"));
+    assertEquals("purr", msg.getStringStringOrThrow("cat"));
+    assertEquals("hoot", msg.getStringStringOrThrow("owl"));
+    assertEquals(Arrays.asList("duck", "cat", "owl"), mapKeys(msg.getStringStringMap()));
+    assertEquals(Arrays.asList("duck", "cat", "owl"), entryKeys(msg, 1));
+    // Message values are replaced, not merged.
+    assertEquals(2, msg.getStringMessageCount());
+    assertEquals("XYZ", msg.getStringMessageOrThrow("abc").getFoo());
+    assertEquals(Arrays.asList("abc", "def"), mapKeys(msg.getStringMessageMap()));
+    assertEquals(3, msg.getIntIntCount());
+    assertEquals(0, msg.getIntIntOrThrow(7));
+    assertEquals(Arrays.asList(7, 8, 9), mapKeys(msg.getIntIntMap()));
+    assertEquals(Arrays.asList(7, 8, 9), entryKeys(msg, 5));
+    // Fields that only the builder's message has are kept.
+    assertEquals(2, msg.getIntMessageCount());
+    assertEquals(2, msg.getBoolEnumCount());
+
+    // Neither of the merged messages is changed.
+    checkFields(getFilledMessage());
+    assertEquals(2, other.getStringStringCount());
+    assertEquals(Arrays.asList("cat", "owl"), mapKeys(other.getStringStringMap()));
+
+    // Merging a message into itself changes nothing.
+    MapMsg merged = msg.toBuilder().mergeFrom(msg).build();
+    assertEquals(msg, merged);
+    assertEquals(Arrays.asList("duck", "cat", "owl"), mapKeys(merged.getStringStringMap()));
+  }
+
   public void testEquals() throws Exception {
     MapMsg msg1 = getFilledMessage();
     MapMsg msg2 = getFilledMessage();
@@ -315,6 +438,20 @@ public class MapsTest extends ProtobufTest {
     assertEquals(MapMsg.Color.RED, msg.getBoolEnumOrThrow(false));
   }
 
+  private static List<Object> mapKeys(Map<?, ?> map) {
+    return new ArrayList<Object>(map.keySet());
+  }
+
+  // Returns the keys of the entries from the reflection API's list view.
+  private static List<Object> entryKeys(MapMsgOrBuilder msg, int fieldNumber) {
+    FieldDescriptor field = MapMsg.Builder.getDescriptor().findFieldByNumber(fieldNumber);
+    List<Object> keys = new ArrayList<>();
+    for (int i = 0; i < msg.getRepeatedFieldCount(field); i++) {
+      keys.add(((MapEntry<?, ?>) msg.getRepeatedField(field, i)).getKey());
+    }
+    return keys;
+  }
+
   private MapMsg getFilledMessage() {
     return MapMsg.newBuilder()
         .putStringString("duck", "quack")
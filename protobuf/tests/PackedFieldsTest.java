@@ -0,0 +1,287 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.Descriptors.FieldDescriptor;
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.io.ByteArrayOutputStream;
+import java.io.InputStream;
+import java.util.ArrayList;
+import java.util.List;
+import protos.PrimitiveFields;
+
+/**
+ * Tests for packed repeated fields of every type, with enough elements and
+ * varied enough values to go through the bulk encoding and decoding paths.
+ * The expected encodings are computed independently of the runtime.
+ */
+public class PackedFieldsTest extends ProtobufTest {
+
+  // The numbers of PrimitiveFields' packed fields.
+  private static final int FIRST_PACKED_FIELD = 41;
+  private static final int LAST_PACKED_FIELD = 53;
+
+  private static final long[] EDGE_VALUES = {
+    127, 128, 255, 16383, 16384, -1, -2, -64, -65, Integer.MIN_VALUE, Integer.MAX_VALUE,
+    Long.MIN_VALUE, Long.MAX_VALUE, 1L << 35, (1L << 56) - 1, 1L << 63 >>> 1, 0x80000000L
+  };
+
+  /** Returns at most chunkSize bytes per read, so that every read refills. */
+  private static class ChunkedInputStream extends InputStream {
+    private final byte[] bytes;
+    private final int chunkSize;
+    private int pos;
+
+    ChunkedInputStream(byte[] bytes, int chunkSize) {
+      this.bytes = bytes;
+      this.chunkSize = chunkSize;
+    }
+
+    @Override
+    public int read() {
+      return pos < bytes.length ? bytes[pos++] & 0xFF : -1;
+    }
+
+    @Override
+    public int read(byte[] b, int off, int len) {
+      if (pos == bytes.length) {
+        return -1;
+      }
+      int n = Math.min(Math.min(len, chunkSize), bytes.length - pos);
+      System.arraycopy(bytes, pos, b, off, n);
+      pos += n;
+      return n;
+    }
+  }
+
+  // Runs of small values, which take a byte each as int32, separated by edge
+  // values of every varint length.
+  private static long rawValue(int i) {
+    return i % 23 < 12 ? i % 100 : EDGE_VALUES[i % EDGE_VALUES.length];
+  }
+
+  private static Object value(FieldDescriptor field, int i) {
+    long raw = rawValue(i);
+    switch (field.getJavaType()) {
+      case INT:
+        return (int) raw;
+      case LONG:
+        return raw;
+      case BOOLEAN:
+        return raw % 3 != 0;
+      case FLOAT:
+        return (float) raw / 3;
+      case DOUBLE:
+        return (double) raw / 7;
+      default:
+        throw new AssertionError(field.getType());
+    }
+  }
+
+  private static void writeVarint(ByteArrayOutputStream out, long value) {
+    while ((value & ~0x7FL) != 0) {
+      out.write((int) (value & 0x7F) | 0x80);
+      value >>>= 7;
+    }
+    out.write((int) value);
+  }
+
+  private static void writeLittleEndian(ByteArrayOutputStream out, long value, int size) {
+    for (int i = 0; i < size; i++) {
+      out.write((int) (value >>> (8 * i)) & 0xFF);
+    }
+  }
+
+  private static void writeValue(ByteArrayOutputStream out, FieldDescriptor field, Object value) {
+    switch (field.getType()) {
+      case INT32:
+      case INT64:
+        writeVarint(out, ((Number) value).longValue());
+        break;
+      case UINT32:
+        writeVarint(out, ((Integer) value) & 0xFFFFFFFFL);
+        break;
+      case UINT64:
+        writeVarint(out, (Long) value);
+        break;
+      case SINT32: {
+        int v = (Integer) value;
+        writeVarint(out, ((v << 1) ^ (v >> 31)) & 0xFFFFFFFFL);
+        break;
+      }
+      case SINT64: {
+        long v = (Long) value;
+        writeVarint(out, (v << 1) ^ (v >> 63));
+        break;
+      }
+      case FIXED32:
+      case SFIXED32:
+        writeLittleEndian(out, (Integer) value, 4);
+        break;
+      case FIXED64:
+      case SFIXED64:
+        writeLittleEndian(out, (Long) value, 8);
+        break;
+      case BOOL:
+        out.write((Boolean) value ? 1 : 0);
+        break;
+      case FLOAT:
+        writeLittleEndian(out, Float.floatToRawIntBits((Float) value), 4);
+        break;
+      case DOUBLE:
+        writeLittleEndian(out, Double.doubleToRawLongBits((Double) value), 8);
+        break;
+      default:
+        throw new AssertionError(field.getType());
+    }
+  }
+
+  private static List<FieldDescriptor> packedFields() {
+    List<FieldDescriptor> fields = new ArrayList<>();
+    for (int number = FIRST_PACKED_FIELD; number <= LAST_PACKED_FIELD; number++) {
+      FieldDescriptor field = PrimitiveFields.getDescriptor().findFieldByNumber(number);
+      if (field != null) {
+        fields.add(field);
+      }
+    }
+    assertEquals(13, fields.size());
+    return fields;
+  }
+
+  // Returns a message in which only the given field is set, with count values.
+  private static PrimitiveFields newMessage(FieldDescriptor field, int count, int first) {
+    PrimitiveFields.Builder builder = PrimitiveFields.newBuilder();
+    for (int i = 0; i < count; i++) {
+      builder.addRepeatedField(field, value(field, first + i));
+    }
+    return builder.build();
+  }
+
+  private static byte[] expectedBytes(FieldDescriptor field, int count, int first) {
+    if (count == 0) {
+      return new byte[0];
+    }
+    ByteArrayOutputStream payload = new ByteArrayOutputStream();
+    for (int i = 0; i < count; i++) {
+      writeValue(payload, field, value(field, first + i));
+    }
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    writeVarint(out, (field.getNumber() << 3) | 2);
+    writeVarint(out, payload.size());
+    byte[] payloadBytes = payload.toByteArray();
+    out.write(payloadBytes, 0, payloadBytes.length);
+    return out.toByteArray();
+  }
+
+  private static void checkValues(PrimitiveFields msg, FieldDescriptor field, int count,
+      int first) {
+    assertEquals(field.getName(), count, msg.getRepeatedFieldCount(field));
+    for (int i = 0; i < count; i++) {
+      assertEquals(field.getName() + "[" + i + "]", value(field, first + i),
+          msg.getRepeatedField(field, i));
+    }
+  }
+
+  public void testRoundTripEveryType() throws Exception {
+    int[] counts = { 0, 1, 7, 8, 9, 16, 23, 64, 1000 };
+    for (FieldDescriptor field : packedFields()) {
+      for (int count : counts) {
+        // Different starting points shift the runs of single byte values
+        // relative to eight byte words.
+        for (int first = 0; first < 9; first += 4) {
+          PrimitiveFields msg = newMessage(field, count, first);
+          byte[] expected = expectedBytes(field, count, first);
+          assertEquals(expected.length, msg.getSerializedSize());
+          checkBytes(expected, msg.toByteArray());
+          PrimitiveFields parsed = PrimitiveFields.parseFrom(expected);
+          checkValues(parsed, field, count, first);
+          assertEquals(msg, parsed);
+        }
+      }
+    }
+  }
+
+  public void testAppendToExistingElements() throws Exception {
+    // A field that appears twice in the input is concatenated.
+    for (FieldDescriptor field : packedFields()) {
+      byte[] first = expectedBytes(field, 10, 0);
+      byte[] second = expectedBytes(field, 30, 10);
+      byte[] both = new byte[first.length + second.length];
+      System.arraycopy(first, 0, both, 0, first.length);
+      System.arraycopy(second, 0, both, first.length, second.length);
+      checkValues(PrimitiveFields.parseFrom(both), field, 40, 0);
+    }
+  }
+
+  public void testPackedRunAcrossRefills() throws Exception {
+    // Larger than the input buffer, read in chunks that end in the middle of
+    // values.
+    int[] chunkSizes = { 1, 3, 7, 1000, 4093 };
+    for (FieldDescriptor field : packedFields()) {
+      byte[] bytes = expectedBytes(field, 5000, 0);
+      for (int chunkSize : chunkSizes) {
+        PrimitiveFields parsed =
+            PrimitiveFields.parseFrom(new ChunkedInputStream(bytes, chunkSize));
+        checkValues(parsed, field, 5000, 0);
+      }
+      // A short run that starts just before a refill.
+      for (int prefix = 4080; prefix < 4100; prefix += 3) {
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        // Padding in an unknown field, which is skipped.
+        writeVarint(out, (1000 << 3) | 2);
+        writeVarint(out, prefix);
+        out.write(new byte[prefix], 0, prefix);
+        byte[] run = expectedBytes(field, 20, 0);
+        out.write(run, 0, run.length);
+        PrimitiveFields parsed =
+            PrimitiveFields.parseFrom(new ChunkedInputStream(out.toByteArray(), 4096));
+        checkValues(parsed, field, 20, 0);
+      }
+    }
+  }
+
+  private void checkMalformed(byte[] bytes) throws Exception {
+    try {
+      PrimitiveFields.parseFrom(bytes);
+      fail("Expected InvalidProtocolBufferException: " + byteArrayAsString(bytes));
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+    try {
+      PrimitiveFields.parseFrom(new ChunkedInputStream(bytes, 3));
+      fail("Expected InvalidProtocolBufferException: " + byteArrayAsString(bytes));
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+
+  public void testMalformedPackedFields() throws Exception {
+    // int32_p whose last varint has its continuation bit set.
+    checkMalformed(asBytes(new int[] { 0xCA, 0x02, 0x03, 0x01, 0x02, 0x83 }));
+    // int32_p whose last varint continues past the field's length.
+    checkMalformed(asBytes(new int[] { 0xCA, 0x02, 0x02, 0x01, 0x83, 0x01 }));
+    // int64_p with a varint of eleven bytes.
+    checkMalformed(asBytes(new int[] {
+      0xF2, 0x02, 0x0B, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 }));
+    // int32_p whose length is longer than the input.
+    checkMalformed(asBytes(new int[] { 0xCA, 0x02, 0x10, 0x01, 0x02, 0x03 }));
+    // fixed32_p whose length isn't a multiple of four.
+    checkMalformed(asBytes(new int[] { 0xE2, 0x02, 0x05, 0x01, 0x00, 0x00, 0x00, 0x02 }));
+    // double_p whose length isn't a multiple of eight.
+    checkMalformed(asBytes(new int[] {
+      0xAA, 0x03, 0x04, 0x00, 0x00, 0xF0, 0x3F }));
+    // fixed64_p whose length is longer than the input.
+    checkMalformed(asBytes(new int[] {
+      0x8A, 0x03, 0x10, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }));
+  }
+}
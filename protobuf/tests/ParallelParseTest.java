@@ -0,0 +1,153 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import com.google.protobuf.ExtensionRegistry;
+import com.google.protobuf.InvalidProtocolBufferException;
+import java.io.ByteArrayOutputStream;
+import protos.Typical;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+import protos.TypicalDataSet;
+
+/**
+ * Tests for +parseFromByteArrayInParallel:registry:, which only exists in the
+ * Objective-C runtime. Its result must equal that of a sequential parse.
+ */
+public class ParallelParseTest extends ProtobufTest {
+
+  // Inputs smaller than this are always parsed sequentially.
+  private static final int MIN_PARALLEL_SIZE = 256 * 1024;
+
+  private static native TypicalDataSet parseSetInParallel(byte[] bytes)
+      throws InvalidProtocolBufferException /*-[
+    return [ProtosTypicalDataSet parseFromByteArrayInParallel:bytes registry:nil];
+  ]-*/;
+
+  private static native TypicalData parseTypicalInParallel(
+      byte[] bytes, ExtensionRegistry registry) throws InvalidProtocolBufferException /*-[
+    return [ProtosTypicalData parseFromByteArrayInParallel:bytes registry:registry];
+  ]-*/;
+
+  private static TypicalData newElement(int i) {
+    byte[] bytes = new byte[i % 200];
+    for (int j = 0; j < bytes.length; j++) {
+      bytes[j] = (byte) (i + j);
+    }
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyInt(i)
+        .setMyString("element " + i)
+        .setMyBytes(ByteString.copyFrom(bytes));
+    for (int j = 0; j < i % 4; j++) {
+      builder.addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i * j));
+    }
+    return builder.build();
+  }
+
+  private static TypicalDataSet newSet(int first, int count) {
+    TypicalDataSet.Builder builder = TypicalDataSet.newBuilder();
+    for (int i = first; i < first + count; i++) {
+      builder.addRepeatedTypicalData(newElement(i));
+    }
+    return builder.build();
+  }
+
+  public void testLargeRepeatedField() throws Exception {
+    byte[] bytes = newSet(0, 5000).toByteArray();
+    assertTrue(bytes.length > MIN_PARALLEL_SIZE);
+    TypicalDataSet sequential = TypicalDataSet.parseFrom(bytes);
+    TypicalDataSet parallel = parseSetInParallel(bytes);
+    assertEquals(sequential, parallel);
+    assertEquals(5000, parallel.getRepeatedTypicalDataCount());
+    for (int i = 0; i < 5000; i++) {
+      assertEquals(newElement(i), parallel.getRepeatedTypicalData(i));
+    }
+    checkBytes(bytes, parallel.toByteArray());
+  }
+
+  public void testSmallInput() throws Exception {
+    byte[] bytes = newSet(0, 10).toByteArray();
+    assertTrue(bytes.length < MIN_PARALLEL_SIZE);
+    assertEquals(TypicalDataSet.parseFrom(bytes), parseSetInParallel(bytes));
+    assertEquals(TypicalDataSet.getDefaultInstance(), parseSetInParallel(new byte[0]));
+  }
+
+  public void testOtherFieldsBetweenElements() throws Exception {
+    // Concatenated messages are merged, so the elements of repeated_message are
+    // interleaved with other fields and extensions.
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    for (int i = 0; i < 3000; i++) {
+      TypicalData.Builder builder = TypicalData.newBuilder()
+          .setMyInt(i)
+          .addRepeatedString("string " + i)
+          .addExtension(Typical.myRepeatedExtension,
+              TypicalDataMessage.newBuilder().setMyMessageInt(-i).build());
+      for (int j = 0; j < 20; j++) {
+        builder.addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i * 20 + j));
+      }
+      builder.build().writeTo(out);
+    }
+    byte[] bytes = out.toByteArray();
+    assertTrue(bytes.length > MIN_PARALLEL_SIZE);
+    ExtensionRegistry registry = ExtensionRegistry.newInstance();
+    Typical.registerAllExtensions(registry);
+
+    TypicalData sequential = TypicalData.parseFrom(bytes, registry);
+    TypicalData parallel = parseTypicalInParallel(bytes, registry);
+    assertEquals(sequential, parallel);
+    assertEquals(2999, parallel.getMyInt());
+    assertEquals(3000, parallel.getRepeatedStringCount());
+    assertEquals(3000, parallel.getExtensionCount(Typical.myRepeatedExtension));
+    assertEquals(60000, parallel.getRepeatedMessageCount());
+    for (int i = 0; i < 60000; i++) {
+      assertEquals(i, parallel.getRepeatedMessage(i).getMyMessageInt());
+    }
+
+    // Without the registry the extensions are unknown fields.
+    assertEquals(TypicalData.parseFrom(bytes), parseTypicalInParallel(bytes, null));
+  }
+
+  public void testMalformedElement() throws Exception {
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    newSet(0, 3000).writeTo(out);
+    // A repeated_typical_data element whose my_int is a truncated varint. The
+    // top-level structure of the input is still valid.
+    out.write(asBytes(new int[] { 0x0A, 0x02, 0x08, 0x80 }));
+    newSet(3000, 3000).writeTo(out);
+    byte[] bytes = out.toByteArray();
+    assertTrue(bytes.length > MIN_PARALLEL_SIZE);
+    assertInvalid(bytes);
+
+    // The input ends inside of an element.
+    bytes = newSet(0, 5000).toByteArray();
+    byte[] truncated = new byte[bytes.length - 1];
+    System.arraycopy(bytes, 0, truncated, 0, truncated.length);
+    assertInvalid(truncated);
+  }
+
+  private static void assertInvalid(byte[] bytes) throws Exception {
+    try {
+      TypicalDataSet.parseFrom(bytes);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+    try {
+      parseSetInParallel(bytes);
+      fail("Expected InvalidProtocolBufferException");
+    } catch (InvalidProtocolBufferException e) {
+      // Expected.
+    }
+  }
+}
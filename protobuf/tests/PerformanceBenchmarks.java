@@ -225,6 +225,16 @@ class PerformanceBenchmarks {
     }
   }
 
+  private static void testBuildAndWriteOnce() throws Exception {
+    for (int i = 0; i < 10000; i++) {
+      TypicalData.Builder builder = TypicalData.newBuilder();
+      setAllPrimitiveFields(builder);
+      setAllRepeatedFields(builder, 5);
+      setMessageField(builder);
+      builder.build().toByteArray();
+    }
+  }
+
   private static void testMergeFrom() throws Exception {
     ByteArrayInputStream in = new ByteArrayInputStream(PROTO_DATA);
     ExtensionRegistry registry =  ExtensionRegistry.getEmptyRegistry();
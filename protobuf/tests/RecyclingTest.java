@@ -0,0 +1,178 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.ByteString;
+import protos.Typical;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+
+/*-[
+#include "com/google/protobuf/GeneratedMessage_PackagePrivate.h"
+]-*/
+
+/**
+ * Tests for +newRecycledBuilder, -buildRecycled and -recycle, which only exist
+ * in the Objective-C runtime. The instances that are passed to -recycle must
+ * not be autoreleased, so they are only handled by the native methods.
+ */
+public class RecyclingTest extends ProtobufTest {
+
+  private static native long addressOf(Object obj) /*-[
+    return (jlong)(uintptr_t)obj;
+  ]-*/;
+
+  // Builds a message with -buildRecycled, writes it so that its size is
+  // memoized, and recycles it. Returns the address of the message.
+  private static native long buildWriteAndRecycle(TypicalData.Builder builder) /*-[
+    ProtosTypicalData *msg = [builder buildRecycled];
+    @autoreleasepool {
+      [msg hash];
+      [msg toByteArray];
+    }
+    [msg recycle];
+    return (jlong)(uintptr_t)msg;
+  ]-*/;
+
+  private static native TypicalData buildRecycled(TypicalData.Builder builder) /*-[
+    return [[builder buildRecycled] autorelease];
+  ]-*/;
+
+  // Whether the memoized size and hash of a message are unset.
+  private static native boolean hasNoMemoizedValues(TypicalData msg) /*-[
+    return msg->memoizedSize_ == -1 && msg->memoizedHash_ == 0;
+  ]-*/;
+
+  // Recycles a message that has a second reference, which is returned.
+  private static native TypicalData recycleShared(TypicalData.Builder builder) /*-[
+    ProtosTypicalData *msg = [builder buildRecycled];
+    [msg retain];
+    [msg recycle];
+    return [msg autorelease];
+  ]-*/;
+
+  // Fills a builder from +newRecycledBuilder with the fields of msg, and
+  // recycles it. Returns the address of the builder.
+  private static native long fillAndRecycleBuilder(TypicalData msg) /*-[
+    ProtosTypicalData_Builder *builder = [ProtosTypicalData newRecycledBuilder];
+    [builder mergeFromWithComGoogleProtobufMessage:msg];
+    [builder recycle];
+    return (jlong)(uintptr_t)builder;
+  ]-*/;
+
+  private static native TypicalData.Builder newRecycledBuilder() /*-[
+    return [[ProtosTypicalData newRecycledBuilder] autorelease];
+  ]-*/;
+
+  // Recycles a builder that has a second reference, which is returned.
+  private static native TypicalData.Builder recycleSharedBuilder(TypicalData msg) /*-[
+    ProtosTypicalData_Builder *builder = [ProtosTypicalData newRecycledBuilder];
+    [builder mergeFromWithComGoogleProtobufMessage:msg];
+    [builder retain];
+    [builder recycle];
+    return [builder autorelease];
+  ]-*/;
+
+  // Sets every kind of field, including extensions.
+  private static TypicalData.Builder newFullBuilder() {
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyInt(42)
+        .setMyString("a string that is memoized")
+        .setMyBytes(ByteString.copyFromUtf8("bytes"))
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(7))
+        .setExtension(Typical.myPrimitiveExtension, 11)
+        .addExtension(Typical.myRepeatedPrimitiveExtension, 12);
+    for (int i = 0; i < 50; i++) {
+      builder.addRepeatedInt32(i);
+      builder.addRepeatedString("string " + i);
+      builder.addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i));
+    }
+    return builder;
+  }
+
+  public void testRecycledMessageIsCleared() throws Exception {
+    long address = buildWriteAndRecycle(newFullBuilder());
+    // Fewer and shorter fields than the recycled message had, so that stale
+    // sizes would corrupt the output.
+    TypicalData.Builder builder = TypicalData.newBuilder()
+        .setMyString("short")
+        .setMyMessage(TypicalDataMessage.newBuilder().setMyMessageInt(1))
+        .addRepeatedInt32(3)
+        .addRepeatedMessage(TypicalDataMessage.getDefaultInstance());
+    TypicalData msg = buildRecycled(builder);
+    assertEquals(address, addressOf(msg));
+    assertTrue(hasNoMemoizedValues(msg));
+
+    TypicalData expected = builder.build();
+    assertEquals(expected, msg);
+    assertFalse(msg.hasMyInt());
+    assertFalse(msg.hasMyBytes());
+    assertEquals(1, msg.getRepeatedInt32Count());
+    assertEquals(0, msg.getRepeatedStringCount());
+    assertEquals(1, msg.getRepeatedMessageCount());
+    assertFalse(msg.hasExtension(Typical.myPrimitiveExtension));
+    assertEquals(0, msg.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(expected.getSerializedSize(), msg.getSerializedSize());
+    assertEquals(expected.hashCode(), msg.hashCode());
+    checkBytes(expected.toByteArray(), msg.toByteArray());
+  }
+
+  public void testRecycledMessageKeepsNoExtensions() throws Exception {
+    long address = buildWriteAndRecycle(newFullBuilder());
+    TypicalData msg = buildRecycled(TypicalData.newBuilder().setMyInt(1));
+    assertEquals(address, addressOf(msg));
+    assertEquals(TypicalData.newBuilder().setMyInt(1).build(), msg);
+    assertFalse(msg.hasExtension(Typical.myPrimitiveExtension));
+    assertEquals(0, msg.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(1, msg.getAllFields().size());
+  }
+
+  public void testSharedMessageIsNotReused() throws Exception {
+    TypicalData.Builder builder = newFullBuilder();
+    TypicalData shared = recycleShared(builder);
+    // The other reference still sees all of the fields.
+    assertEquals(builder.build(), shared);
+    assertEquals(11, (int) shared.getExtension(Typical.myPrimitiveExtension));
+    TypicalData msg = buildRecycled(TypicalData.newBuilder().setMyInt(1));
+    assertTrue(addressOf(shared) != addressOf(msg));
+    assertEquals(builder.build(), shared);
+  }
+
+  public void testRecycledBuilderIsCleared() throws Exception {
+    long address = fillAndRecycleBuilder(newFullBuilder().build());
+    TypicalData.Builder builder = newRecycledBuilder();
+    assertEquals(address, addressOf(builder));
+    assertFalse(builder.hasMyInt());
+    assertFalse(builder.hasMyMessage());
+    assertEquals(0, builder.getRepeatedInt32Count());
+    assertEquals(0, builder.getRepeatedMessageCount());
+    assertFalse(builder.hasExtension(Typical.myPrimitiveExtension));
+    assertEquals(0, builder.getExtensionCount(Typical.myRepeatedPrimitiveExtension));
+    assertEquals(TypicalData.getDefaultInstance(), builder.build());
+
+    // The repeated fields that kept their buffers work as before.
+    builder.addRepeatedInt32(5).addRepeatedString("five");
+    TypicalData msg = builder.build();
+    assertEquals(TypicalData.newBuilder().addRepeatedInt32(5).addRepeatedString("five").build(),
+        msg);
+  }
+
+  public void testSharedBuilderIsNotReused() throws Exception {
+    TypicalData full = newFullBuilder().build();
+    TypicalData.Builder shared = recycleSharedBuilder(full);
+    assertEquals(full, shared.build());
+    TypicalData.Builder builder = newRecycledBuilder();
+    assertTrue(addressOf(shared) != addressOf(builder));
+    assertEquals(full, shared.build());
+  }
+}
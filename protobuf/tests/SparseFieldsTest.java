@@ -0,0 +1,124 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.Descriptors.Descriptor;
+import com.google.protobuf.Descriptors.FieldDescriptor;
+import java.io.ByteArrayOutputStream;
+import protos.ManySparseMsg;
+import protos.SparseMsg;
+
+/**
+ * Tests for messages whose field numbers are too sparse for a table indexed
+ * directly by number, so that tags are resolved by a hashed lookup.
+ */
+public class SparseFieldsTest extends ProtobufTest {
+
+  private static final int MAX_FIELD_NUMBER = 536870911;
+
+  private static SparseMsg newSparseMsg() {
+    return SparseMsg.newBuilder()
+        .setF1(1)
+        .setF33(33)
+        .setF100(100)
+        .setF1000(1000)
+        .setF18999(18999)
+        .setF20000(20000)
+        .setF65535(65535)
+        .setF1000000(1000000)
+        .setF268435455(268435455)
+        .setF536870911(-1)
+        .addR500("a")
+        .addR500("b")
+        .setM70000(SparseMsg.newBuilder().setF536870911(7).setF1(8))
+        .build();
+  }
+
+  private static ManySparseMsg newManySparseMsg() {
+    ManySparseMsg.Builder builder = ManySparseMsg.newBuilder();
+    for (FieldDescriptor field : ManySparseMsg.getDescriptor().getFields()) {
+      builder.setField(field, (long) field.getNumber() * 3);
+    }
+    return builder.build();
+  }
+
+  private static void writeVarint(ByteArrayOutputStream out, int value) {
+    while ((value & ~0x7F) != 0) {
+      out.write((value & 0x7F) | 0x80);
+      value >>>= 7;
+    }
+    out.write(value);
+  }
+
+  public void testFindFieldByNumber() throws Exception {
+    checkFindFieldByNumber(SparseMsg.getDescriptor());
+    checkFindFieldByNumber(ManySparseMsg.getDescriptor());
+  }
+
+  private void checkFindFieldByNumber(Descriptor descriptor) {
+    for (FieldDescriptor field : descriptor.getFields()) {
+      int number = field.getNumber();
+      assertSame(field, descriptor.findFieldByNumber(number));
+      // Numbers near a field's number must not find it.
+      for (int other : new int[] { number - 1, number + 1, number ^ 0x100, number << 1 }) {
+        FieldDescriptor found = descriptor.findFieldByNumber(other);
+        assertTrue(found == null || found.getNumber() == other);
+      }
+    }
+    assertNull(descriptor.findFieldByNumber(MAX_FIELD_NUMBER - 1));
+    assertNull(descriptor.findFieldByNumber(2));
+  }
+
+  public void testRoundTrip() throws Exception {
+    SparseMsg msg = newSparseMsg();
+    byte[] bytes = msg.toByteArray();
+    SparseMsg parsed = SparseMsg.parseFrom(bytes);
+    assertEquals(msg, parsed);
+    assertEquals(-1, parsed.getF536870911());
+    assertEquals(268435455, parsed.getF268435455());
+    assertEquals(7, parsed.getM70000().getF536870911());
+    assertEquals(2, parsed.getR500Count());
+    checkBytes(bytes, parsed.toByteArray());
+
+    ManySparseMsg many = newManySparseMsg();
+    ManySparseMsg manyParsed = ManySparseMsg.parseFrom(many.toByteArray());
+    assertEquals(many, manyParsed);
+    for (FieldDescriptor field : ManySparseMsg.getDescriptor().getFields()) {
+      assertEquals((long) field.getNumber() * 3, manyParsed.getField(field));
+    }
+  }
+
+  public void testUnknownNumbersBetweenFields() throws Exception {
+    // Known fields surrounded by unknown ones whose numbers are close to
+    // theirs, or equal to them modulo a power of 2.
+    int[] unknownNumbers = {
+      2, 34, 99, 101, 1001, 20001, 65536, 65535 + 65536, 999999,
+      MAX_FIELD_NUMBER - 1, 1 + (1 << 20), 100 + (1 << 16)
+    };
+    ByteArrayOutputStream out = new ByteArrayOutputStream();
+    for (int number : unknownNumbers) {
+      writeVarint(out, number << 3);
+      writeVarint(out, 12345);
+    }
+    newSparseMsg().writeTo(out);
+    for (int number : unknownNumbers) {
+      // Length-delimited.
+      writeVarint(out, (number << 3) | 2);
+      writeVarint(out, 3);
+      out.write(new byte[] { 'a', 'b', 'c' });
+    }
+
+    SparseMsg parsed = SparseMsg.parseFrom(out.toByteArray());
+    assertEquals(newSparseMsg().getAllFields(), parsed.getAllFields());
+  }
+}
@@ -0,0 +1,259 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.Descriptors.FieldDescriptor;
+import java.util.ArrayList;
+import java.util.List;
+import protos.FastPathMsg;
+import protos.MsgWithDefaults;
+import protos.TypicalData;
+
+/*-[
+#include "com/google/protobuf/Descriptors_PackagePrivate.h"
+#include "com/google/protobuf/GeneratedMessage.h"
+]-*/
+
+/**
+ * Tests that equals() and hashCode() only depend on the fields that are set,
+ * however the unset ones were reached. The singular integral, bool and enum
+ * fields are compared and hashed as one block of storage, so unset fields must
+ * always hold zero.
+ */
+public class StorageEqualityTest extends ProtobufTest {
+
+  // Recycles a message built from full, so that the message built from partial
+  // can reuse its storage, and returns that message.
+  private static native FastPathMsg buildAfterRecycling(
+      FastPathMsg.Builder full, FastPathMsg.Builder partial) /*-[
+    ProtosFastPathMsg *msg = [full buildRecycled];
+    @autoreleasepool {
+      [msg hash];
+    }
+    [msg recycle];
+    return [[partial buildRecycled] autorelease];
+  ]-*/;
+
+  // Fills a builder from +newRecycledBuilder with the fields of full and
+  // recycles it, then returns a recycled builder with the fields of partial.
+  private static native FastPathMsg.Builder newBuilderAfterRecycling(
+      FastPathMsg full, FastPathMsg partial) /*-[
+    ProtosFastPathMsg_Builder *builder = [ProtosFastPathMsg newRecycledBuilder];
+    [builder mergeFromWithComGoogleProtobufMessage:full];
+    [builder recycle];
+    builder = [ProtosFastPathMsg newRecycledBuilder];
+    [builder mergeFromWithComGoogleProtobufMessage:partial];
+    return [builder autorelease];
+  ]-*/;
+
+  // Runs r with the descriptor of FastPathMsg set up as for generated code
+  // from before the plugin declared the singular integral, bool and enum
+  // fields first: only the first of them is compared as storage, and the
+  // others one by one. Returns the number of fields compared one by one that
+  // would otherwise have been in the block. Hashes differ between the layouts,
+  // so r must only compare messages that it creates.
+  private static native int runWithLegacyLayout(Runnable r) /*-[
+    CGPDescriptor *descriptor = [ProtosFastPathMsg getDescriptor];
+    uint32_t savedEnd = descriptor->podRangeEnd_;
+    CGPFieldDescriptor **savedFields = descriptor->nonPodFields_;
+    uint32_t savedCount = descriptor->nonPodFieldCount_;
+
+    NSUInteger fieldCount = descriptor->fields_->size_;
+    CGPFieldDescriptor **fieldsBuf = (CGPFieldDescriptor **)descriptor->fields_->buffer_;
+    CGPFieldDescriptor **otherFields = malloc(fieldCount * sizeof(CGPFieldDescriptor *));
+    uint32_t otherCount = 0;
+    uint32_t newEnd = descriptor->podRangeStart_;
+    for (NSUInteger i = 0; i < fieldCount; i++) {
+      CGPFieldDescriptor *field = fieldsBuf[i];
+      if (!CGPFieldIsRepeated(field) && !field->access_.isOneof
+          && field->access_.offset == descriptor->podRangeStart_) {
+        newEnd = field->access_.offset + (uint32_t)CGPGetTypeSize(CGPFieldGetJavaType(field));
+      } else {
+        otherFields[otherCount++] = field;
+      }
+    }
+    descriptor->podRangeEnd_ = newEnd;
+    descriptor->nonPodFields_ = otherFields;
+    descriptor->nonPodFieldCount_ = otherCount;
+    @try {
+      [r run];
+    } @finally {
+      descriptor->podRangeEnd_ = savedEnd;
+      descriptor->nonPodFields_ = savedFields;
+      descriptor->nonPodFieldCount_ = savedCount;
+      free(otherFields);
+    }
+    return (jint)(otherCount - savedCount);
+  ]-*/;
+
+  private static FastPathMsg.Builder newScalars(int seed) {
+    return FastPathMsg.newBuilder()
+        .setInt32F(-seed)
+        .setUint32F(0x80000000 | seed)
+        .setSint32F(Integer.MIN_VALUE + seed)
+        .setFixed32F(-1)
+        .setSfixed32F(seed)
+        .setInt64F(Long.MIN_VALUE)
+        .setUint64F(-1L)
+        .setSint64F(-seed * 1000000007L)
+        .setFixed64F(Long.MAX_VALUE)
+        .setSfixed64F(-seed)
+        .setBoolF(true)
+        .setFloatF(-0.0f)
+        .setDoubleF(Double.MIN_VALUE)
+        .setEnumF(FastPathMsg.Color.BLUE)
+        .setInt32Big(seed);
+  }
+
+  // Builders that set one scalar field and clear it again.
+  private static List<FastPathMsg.Builder> newSetAndCleared() {
+    List<FastPathMsg.Builder> builders = new ArrayList<>();
+    builders.add(FastPathMsg.newBuilder().setInt32F(-1).clearInt32F());
+    builders.add(FastPathMsg.newBuilder().setUint32F(-1).clearUint32F());
+    builders.add(FastPathMsg.newBuilder().setSint32F(7).clearSint32F());
+    builders.add(FastPathMsg.newBuilder().setFixed32F(8).clearFixed32F());
+    builders.add(FastPathMsg.newBuilder().setSfixed32F(9).clearSfixed32F());
+    builders.add(FastPathMsg.newBuilder().setInt64F(-1L).clearInt64F());
+    builders.add(FastPathMsg.newBuilder().setUint64F(1L << 40).clearUint64F());
+    builders.add(FastPathMsg.newBuilder().setSint64F(10).clearSint64F());
+    builders.add(FastPathMsg.newBuilder().setFixed64F(11).clearFixed64F());
+    builders.add(FastPathMsg.newBuilder().setSfixed64F(12).clearSfixed64F());
+    builders.add(FastPathMsg.newBuilder().setBoolF(true).clearBoolF());
+    builders.add(FastPathMsg.newBuilder().setFloatF(1.5f).clearFloatF());
+    builders.add(FastPathMsg.newBuilder().setDoubleF(2.5).clearDoubleF());
+    builders.add(FastPathMsg.newBuilder().setEnumF(FastPathMsg.Color.GREEN).clearEnumF());
+    builders.add(FastPathMsg.newBuilder().setInt32Big(13).clearInt32Big());
+    builders.add(newScalars(1).clear());
+    // The reflective clearField().
+    FastPathMsg.Builder builder = newScalars(2);
+    for (FieldDescriptor field : FastPathMsg.getDescriptor().getFields()) {
+      builder.clearField(field);
+    }
+    builders.add(builder);
+    return builders;
+  }
+
+  private static void checkEqual(FastPathMsg expected, FastPathMsg actual) {
+    assertEquals(expected, actual);
+    assertEquals(actual, expected);
+    assertEquals(expected.hashCode(), actual.hashCode());
+  }
+
+  private static void checkSetThenCleared() {
+    FastPathMsg fresh = FastPathMsg.newBuilder().build();
+    for (FastPathMsg.Builder builder : newSetAndCleared()) {
+      FastPathMsg msg = builder.build();
+      checkEqual(fresh, msg);
+      // Setting a field again after it was cleared.
+      checkEqual(FastPathMsg.newBuilder().setBoolF(true).setInt64F(3).build(),
+          builder.setBoolF(true).setInt64F(3).build());
+    }
+    // A field that is set to zero is different from one that isn't set.
+    assertFalse(fresh.equals(FastPathMsg.newBuilder().setInt32F(0).build()));
+    assertFalse(fresh.equals(FastPathMsg.newBuilder().setBoolF(false).build()));
+    assertFalse(fresh.equals(FastPathMsg.newBuilder().setEnumF(FastPathMsg.Color.RED).build()));
+  }
+
+  private static void checkToBuilderClear() {
+    FastPathMsg msg = newScalars(3).setStringF("s").addInt32R(4).build();
+    FastPathMsg cleared = msg.toBuilder()
+        .clearInt32F()
+        .clearSint64F()
+        .clearBoolF()
+        .clearEnumF()
+        .clearInt32Big()
+        .build();
+    FastPathMsg expected = FastPathMsg.newBuilder()
+        .setUint32F(0x80000000 | 3)
+        .setSint32F(Integer.MIN_VALUE + 3)
+        .setFixed32F(-1)
+        .setSfixed32F(3)
+        .setInt64F(Long.MIN_VALUE)
+        .setUint64F(-1L)
+        .setFixed64F(Long.MAX_VALUE)
+        .setSfixed64F(-3)
+        .setFloatF(-0.0f)
+        .setDoubleF(Double.MIN_VALUE)
+        .setStringF("s")
+        .addInt32R(4)
+        .build();
+    checkEqual(expected, cleared);
+    // The original is unchanged.
+    checkEqual(newScalars(3).setStringF("s").addInt32R(4).build(), msg);
+
+    // Clearing every field of a copy of a full message.
+    FastPathMsg.Builder builder = msg.toBuilder();
+    for (FieldDescriptor field : FastPathMsg.getDescriptor().getFields()) {
+      builder.clearField(field);
+    }
+    checkEqual(FastPathMsg.newBuilder().build(), builder.build());
+  }
+
+  private static void checkRecycled() {
+    FastPathMsg.Builder partial = FastPathMsg.newBuilder().setSint32F(5).setStringF("p");
+    FastPathMsg expected = partial.build();
+    checkEqual(expected, buildAfterRecycling(newScalars(4), partial));
+    checkEqual(FastPathMsg.newBuilder().build(),
+        buildAfterRecycling(newScalars(5), FastPathMsg.newBuilder()));
+
+    FastPathMsg.Builder builder = newBuilderAfterRecycling(newScalars(6).build(), expected);
+    checkEqual(expected, builder.build());
+    checkEqual(expected.toBuilder().setBoolF(false).build(), builder.setBoolF(false).build());
+  }
+
+  public void testSetThenClearScalars() throws Exception {
+    checkSetThenCleared();
+    for (FastPathMsg.Builder builder : newSetAndCleared()) {
+      checkEqual(FastPathMsg.getDefaultInstance(), builder.build());
+    }
+
+    // Fields with defaults, which their getters return while they are unset.
+    MsgWithDefaults fresh = MsgWithDefaults.newBuilder().build();
+    MsgWithDefaults cleared = MsgWithDefaults.newBuilder()
+        .setMyInt32(1)
+        .setMyBool(false)
+        .setMyEnum(TypicalData.EnumType.VALUE1)
+        .clearMyInt32()
+        .clearMyBool()
+        .clearMyEnum()
+        .build();
+    assertEquals(fresh, cleared);
+    assertEquals(fresh.hashCode(), cleared.hashCode());
+    assertEquals(13, cleared.getMyInt32());
+    assertTrue(cleared.getMyBool());
+  }
+
+  public void testToBuilderClear() throws Exception {
+    checkToBuilderClear();
+  }
+
+  public void testRecycledMessages() throws Exception {
+    checkRecycled();
+  }
+
+  public void testLegacyLayout() throws Exception {
+    int movedFields = runWithLegacyLayout(new Runnable() {
+      @Override
+      public void run() {
+        checkSetThenCleared();
+        checkToBuilderClear();
+        checkRecycled();
+        // Messages that differ in a field outside the block.
+        assertFalse(newScalars(7).build().equals(newScalars(7).setEnumF(
+            FastPathMsg.Color.GREEN).build()));
+        assertFalse(newScalars(7).build().equals(newScalars(7).clearFixed64F().build()));
+      }
+    });
+    assertTrue(movedFields > 0);
+  }
+}
@@ -0,0 +1,273 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import com.google.protobuf.MessageOrBuilder;
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import protos.TypicalData;
+import protos.TypicalDataMessage;
+
+/*-[
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "com/google/protobuf/TextFormat.h"
+]-*/
+
+/**
+ * Tests for the streaming printers in TextFormat.h, which only exist in the
+ * Objective-C runtime. They must write the same text as CGPTextFormatPrint(),
+ * however it is split into chunks.
+ */
+public class TextFormatTest extends ProtobufTest {
+
+  // The size of the printers' buffer, and the largest piece of a string that
+  // they convert at once.
+  private static final int BUFFER_SIZE = 8192;
+  private static final int MAX_CHUNK_SIZE = 4096;
+
+  /** Records the size of each write, and throws once failAfter writes are made. */
+  static class RecordingOutputStream extends OutputStream {
+    final ByteArrayOutputStream out = new ByteArrayOutputStream();
+    int writes;
+    int maxWriteSize;
+    private final int failAfter;
+
+    RecordingOutputStream(int failAfter) {
+      this.failAfter = failAfter;
+    }
+
+    @Override
+    public void write(int b) throws IOException {
+      write(new byte[] { (byte) b }, 0, 1);
+    }
+
+    @Override
+    public void write(byte[] b, int off, int len) throws IOException {
+      if (writes == failAfter) {
+        throw new IOException("write " + writes);
+      }
+      writes++;
+      maxWriteSize = Math.max(maxWriteSize, len);
+      out.write(b, off, len);
+    }
+  }
+
+  private static native String print(MessageOrBuilder message) /*-[
+    return CGPTextFormatPrint(message);
+  ]-*/;
+
+  private static native void printToStream(MessageOrBuilder message, OutputStream output)
+      throws IOException /*-[
+    CGPTextFormatPrintToStream(message, output);
+  ]-*/;
+
+  // Returns 0 if the message was printed, or errno.
+  private static native int printToFd(MessageOrBuilder message, int fd) /*-[
+    return CGPTextFormatPrintToFileDescriptor(message, fd) ? 0 : errno;
+  ]-*/;
+
+  private static native int openReadOnly(String path) /*-[
+    return open([path fileSystemRepresentation], O_RDONLY);
+  ]-*/;
+
+  private static native int[] newPipe() /*-[
+    int fds[2];
+    if (pipe(fds) != 0) {
+      return nil;
+    }
+    return [IOSIntArray arrayWithInts:fds count:2];
+  ]-*/;
+
+  private static native void setNonBlocking(int fd) /*-[
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  ]-*/;
+
+  private static native void closeFd(int fd) /*-[
+    close(fd);
+  ]-*/;
+
+  private static native int readFd(int fd, byte[] buffer, int count) /*-[
+    ssize_t result;
+    do {
+      result = read(fd, buffer->buffer_, count);
+    } while (result < 0 && errno == EINTR);
+    return (jint)result;
+  ]-*/;
+
+  private static native int eagain() /*-[
+    return EAGAIN;
+  ]-*/;
+
+  private static native int ebadf() /*-[
+    return EBADF;
+  ]-*/;
+
+  /** Reads a pipe until it is closed. */
+  static class PipeReader extends Thread {
+    private final int fd;
+    private final ByteArrayOutputStream out = new ByteArrayOutputStream();
+
+    PipeReader(int fd) {
+      this.fd = fd;
+    }
+
+    @Override
+    public void run() {
+      byte[] buffer = new byte[1 << 16];
+      int count;
+      while ((count = readFd(fd, buffer, buffer.length)) > 0) {
+        out.write(buffer, 0, count);
+      }
+    }
+
+    byte[] finish() throws InterruptedException {
+      join();
+      return out.toByteArray();
+    }
+  }
+
+  private static String repeat(String s, int count) {
+    StringBuilder sb = new StringBuilder(s.length() * count);
+    for (int i = 0; i < count; i++) {
+      sb.append(s);
+    }
+    return sb.toString();
+  }
+
+  // A message whose text is several times the size of the buffer.
+  private static TypicalData newLargeMessage() {
+    TypicalData.Builder builder = TypicalData.newBuilder().setMyInt(1);
+    for (int i = 0; i < 2000; i++) {
+      builder.addRepeatedString("string " + i);
+      builder.addRepeatedMessage(TypicalDataMessage.newBuilder().setMyMessageInt(i));
+    }
+    return builder.build();
+  }
+
+  private static byte[] printThroughPipe(MessageOrBuilder message) throws Exception {
+    int[] fds = newPipe();
+    PipeReader reader = new PipeReader(fds[0]);
+    reader.start();
+    int error = printToFd(message, fds[1]);
+    closeFd(fds[1]);
+    byte[] result = reader.finish();
+    closeFd(fds[0]);
+    assertEquals(0, error);
+    return result;
+  }
+
+  private void checkPrint(MessageOrBuilder message) throws Exception {
+    byte[] expected = print(message).getBytes("UTF-8");
+    RecordingOutputStream out = new RecordingOutputStream(-1);
+    printToStream(message, out);
+    checkBytes(expected, out.out.toByteArray());
+    assertTrue(out.maxWriteSize <= BUFFER_SIZE);
+    checkBytes(expected, printThroughPipe(message));
+  }
+
+  public void testSmallMessages() throws Exception {
+    checkPrint(TypicalData.getDefaultInstance());
+    checkPrint(TypicalData.newBuilder().setMyInt(1).setMyString("foo"));
+  }
+
+  public void testOutputCrossesBufferBoundary() throws Exception {
+    checkPrint(newLargeMessage());
+    // The end of the string falls at every position around the end of the
+    // buffer.
+    int prefixSize = print(TypicalData.newBuilder().setMyString("")).length();
+    for (int size = BUFFER_SIZE - prefixSize - 8; size < BUFFER_SIZE - prefixSize + 8; size++) {
+      checkPrint(TypicalData.newBuilder().setMyString(repeat("a", size)));
+    }
+  }
+
+  public void testLongStrings() throws Exception {
+    // Longer than a chunk of the string conversion and than the buffer, with
+    // multibyte characters on either side of every chunk boundary.
+    checkPrint(TypicalData.newBuilder().setMyString(repeat("a", 3 * MAX_CHUNK_SIZE + 1)));
+    checkPrint(TypicalData.newBuilder().setMyString(repeat("\u00e9", 5000)));
+    checkPrint(TypicalData.newBuilder().setMyString(repeat("ab\u20ac\ud83d\ude00", 3000)));
+    checkPrint(TypicalData.newBuilder()
+        .setMyInt(7)
+        .setMyString(repeat("x\u00e9", BUFFER_SIZE))
+        .addRepeatedString(repeat("\ud83d\ude00", MAX_CHUNK_SIZE))
+        .addRepeatedString(""));
+  }
+
+  public void testStreamException() throws Exception {
+    TypicalData msg = newLargeMessage();
+    byte[] expected = print(msg).getBytes("UTF-8");
+    assertTrue(expected.length > 3 * BUFFER_SIZE);
+    RecordingOutputStream out = new RecordingOutputStream(2);
+    try {
+      printToStream(msg, out);
+      fail("Expected IOException");
+    } catch (IOException e) {
+      assertEquals("write 2", e.getMessage());
+    }
+    // Printing stopped at the exception.
+    assertEquals(2, out.writes);
+    byte[] written = out.out.toByteArray();
+    assertTrue(written.length <= 2 * BUFFER_SIZE);
+    byte[] start = new byte[written.length];
+    System.arraycopy(expected, 0, start, 0, written.length);
+    checkBytes(start, written);
+
+    // An exception from the first write, before anything is written.
+    out = new RecordingOutputStream(0);
+    try {
+      printToStream(TypicalData.newBuilder().setMyInt(1).build(), out);
+      fail("Expected IOException");
+    } catch (IOException e) {
+      // Expected.
+    }
+    assertEquals(0, out.writes);
+  }
+
+  public void testFileDescriptorErrors() throws Exception {
+    TypicalData msg = TypicalData.newBuilder().setMyInt(1).build();
+    assertEquals(ebadf(), printToFd(msg, -1));
+    // A descriptor that is only open for reading.
+    int fd = openReadOnly("/dev/null");
+    assertTrue(fd >= 0);
+    assertEquals(ebadf(), printToFd(msg, fd));
+    closeFd(fd);
+  }
+
+  public void testFailedWrite() throws Exception {
+    // Nothing reads the non-blocking pipe, so a write fails once it is full.
+    TypicalData.Builder builder = TypicalData.newBuilder();
+    for (int i = 0; i < 100; i++) {
+      builder.addRepeatedString(repeat("s", 10000));
+    }
+    TypicalData msg = builder.build();
+    byte[] expected = print(msg).getBytes("UTF-8");
+    int[] fds = newPipe();
+    setNonBlocking(fds[1]);
+    assertEquals(eagain(), printToFd(msg, fds[1]));
+    closeFd(fds[1]);
+    PipeReader reader = new PipeReader(fds[0]);
+    reader.start();
+    byte[] written = reader.finish();
+    closeFd(fds[0]);
+
+    // What was written is the start of the text.
+    assertTrue(written.length > 0);
+    assertTrue(written.length < expected.length);
+    byte[] start = new byte[written.length];
+    System.arraycopy(expected, 0, start, 0, written.length);
+    checkBytes(start, written);
+  }
+}
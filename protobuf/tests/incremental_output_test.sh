@@ -0,0 +1,156 @@
+#!/bin/sh
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Tests the plugin's incremental_output_dir option: .proto files that were
+# generated with the same inputs before are skipped, and outputs whose contents
+# didn't change aren't written again.
+#
+# Usage: incremental_output_test.sh <protoc> <j2objc protoc plugin>
+
+set -e
+
+PROTOC=$1
+PLUGIN=$2
+TEST_DIR=$(mktemp -d)
+trap 'rm -rf "$TEST_DIR"' EXIT
+IN=$TEST_DIR/in
+OUT=$TEST_DIR/out
+mkdir -p "$IN" "$OUT"
+
+fail() {
+  echo "FAIL: $1" >&2
+  exit 1
+}
+
+# Writes a .proto file with one message, with the given fields.
+write_proto() {
+  cat > "$IN/$1.proto" <<EOF
+syntax = "proto2";
+package incremental;
+option java_package = "incremental";
+message $2 {
+  $3
+}
+EOF
+}
+
+generate() {
+  "$PROTOC" --plugin=protoc-gen-j2objc="$PLUGIN" --proto_path="$IN" \
+    --j2objc_out="$1:$OUT" "$IN/first.proto" "$IN/second.proto"
+}
+
+# Outputs written after this are listed by written_files.
+start_run() {
+  # File times may only have a resolution of one second.
+  sleep 1
+  touch "$TEST_DIR/start"
+}
+
+written_files() {
+  (cd "$OUT" && find . -type f ! -name '.j2objc_proto_manifest*' \
+    -newer "$TEST_DIR/start" | sed 's|^\./||' | sort | tr '\n' ' ')
+}
+
+expect_written() {
+  actual=$(written_files)
+  if [ "$actual" != "$2" ]; then
+    fail "$1: expected \"$2\" to be written, was \"$actual\""
+  fi
+}
+
+FIRST_OUTPUTS="first.clsmap.properties incremental/FirstOuterClass.h \
+incremental/FirstOuterClass.m "
+SECOND_OUTPUTS="incremental/SecondOuterClass.h incremental/SecondOuterClass.m \
+second.clsmap.properties "
+OPTIONS="generate_class_mappings,incremental_output_dir=$OUT"
+
+write_proto first First "optional int32 a = 1;"
+write_proto second Second "optional string b = 1;"
+start_run
+generate "$OPTIONS"
+expect_written "first run" "$FIRST_OUTPUTS$SECOND_OUTPUTS"
+[ -f "$OUT/.j2objc_proto_manifest" ] || fail "first run: no manifest"
+
+# The thread count and the order of the options don't affect the output.
+start_run
+generate "threads=1,incremental_output_dir=$OUT,generate_class_mappings"
+expect_written "unchanged inputs" ""
+
+# The class mappings don't change when a field is added.
+write_proto first First "optional int32 a = 1; optional int32 c = 2;"
+start_run
+generate "$OPTIONS"
+expect_written "added field" \
+  "incremental/FirstOuterClass.h incremental/FirstOuterClass.m "
+
+# Options that change the generated code regenerate every file, but only the
+# outputs that changed are written. Second has no fields that the fast paths
+# handle.
+start_run
+generate "$OPTIONS,generate_fast_paths"
+expect_written "added option" "incremental/FirstOuterClass.m "
+
+# A deleted output is generated again.
+rm "$OUT/incremental/SecondOuterClass.h"
+start_run
+generate "$OPTIONS,generate_fast_paths"
+expect_written "deleted output" "incremental/SecondOuterClass.h "
+
+# So is an output that was changed without changing its size, whatever the
+# manifest records.
+sed 's/SecondOuterClass/SecondOuterClasz/' "$OUT/incremental/SecondOuterClass.m" \
+  > "$TEST_DIR/changed.m"
+mv "$TEST_DIR/changed.m" "$OUT/incremental/SecondOuterClass.m"
+start_run
+generate "$OPTIONS,generate_fast_paths"
+expect_written "changed output" "incremental/SecondOuterClass.m "
+
+# If the manifest is lost, every file is generated again, but the outputs on
+# disk are compared with the new ones and are only written if they differ.
+rm "$OUT/.j2objc_proto_manifest"
+start_run
+generate "$OPTIONS,generate_fast_paths"
+expect_written "deleted manifest" ""
+[ -f "$OUT/.j2objc_proto_manifest" ] || fail "deleted manifest: no manifest"
+
+# Concurrent runs for different files keep each other's manifest entries.
+rm "$OUT/.j2objc_proto_manifest"
+for i in 1 2 3 4; do
+  "$PROTOC" --plugin=protoc-gen-j2objc="$PLUGIN" --proto_path="$IN" \
+    --j2objc_out="$OPTIONS,generate_fast_paths:$OUT" "$IN/first.proto" &
+  "$PROTOC" --plugin=protoc-gen-j2objc="$PLUGIN" --proto_path="$IN" \
+    --j2objc_out="$OPTIONS,generate_fast_paths:$OUT" "$IN/second.proto" &
+done
+wait
+[ "$(grep -c '^file ' "$OUT/.j2objc_proto_manifest")" = 2 ] || \
+  fail "concurrent runs: lost a manifest entry"
+if ls -a "$OUT" | grep -q '\.tmp$'; then
+  fail "concurrent runs: left a temporary manifest"
+fi
+start_run
+generate "$OPTIONS,generate_fast_paths"
+expect_written "after concurrent runs" ""
+
+# The contents of a prefixes file are part of the options.
+PREFIXES=$TEST_DIR/prefixes
+echo "incremental=Inc" > "$PREFIXES"
+start_run
+generate "$OPTIONS,generate_fast_paths,prefixes=$PREFIXES"
+expect_written "added prefixes" "$FIRST_OUTPUTS$SECOND_OUTPUTS"
+echo "incremental=Ink" > "$PREFIXES"
+start_run
+generate "$OPTIONS,generate_fast_paths,prefixes=$PREFIXES"
+expect_written "changed prefixes" "$FIRST_OUTPUTS$SECOND_OUTPUTS"
+
+echo "PASSED incremental_output_test"